@@ -1,28 +1,185 @@
+// Generate PNG thumbnails for every page of a document.
+//
+// usage: genthumb-test [-T threads] [-w width] pdf_file
+//
+// Without -T the pages are handled one after another by fz_gen_thumbs.
+// With -T the main thread loads each page into a display list and hands
+// it to one of a pool of rendering threads, the same division of labour
+// as docs/multi-threaded.c: the document is only ever touched from the
+// main thread, while the workers render from display lists using cloned
+// contexts that share the store and glyph cache.
+
 #include <mupdf/fitz.h>
+#include <pthread.h>
+
+struct worker {
+	fz_context *ctx;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	fz_display_list *list;	// job to render, NULL when idle
+	char out[256];
+	int width;
+	int quit;
+};
+
+static void
+fail(char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	abort();
+}
+
+static void
+lock_mutex(void *user, int lock)
+{
+	pthread_mutex_t *mutex = (pthread_mutex_t *) user;
+
+	if (pthread_mutex_lock(&mutex[lock]) != 0)
+		fail("pthread_mutex_lock()");
+}
+
+static void
+unlock_mutex(void *user, int lock)
+{
+	pthread_mutex_t *mutex = (pthread_mutex_t *) user;
+
+	if (pthread_mutex_unlock(&mutex[lock]) != 0)
+		fail("pthread_mutex_unlock()");
+}
 
+static void *
+renderer(void *data)
+{
+	struct worker *w = data;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;)
+	{
+		while (!w->list && !w->quit)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		if (!w->list)
+			break;
+		pthread_mutex_unlock(&w->mutex);
+
+		fz_try(w->ctx)
+			fz_gen_thumb_image_from_display_list(w->ctx, w->list, w->width, w->out);
+		fz_catch(w->ctx)
+			fprintf(stderr, "cannot generate %s: %s\n", w->out, fz_caught_message(w->ctx));
+		fz_drop_display_list(w->ctx, w->list);
+
+		pthread_mutex_lock(&w->mutex);
+		w->list = NULL;
+		pthread_cond_signal(&w->cond);
+	}
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+static void
+gen_thumbs_threaded(fz_context *ctx, fz_document *doc, char *inputfile, int width, int threads)
+{
+	struct worker *workers;
+	int page_count = fz_count_pages(ctx, doc);
+	int i;
+
+	workers = fz_calloc(ctx, threads, sizeof *workers);
+	for (i = 0; i < threads; i++)
+	{
+		workers[i].ctx = fz_clone_context(ctx);
+		workers[i].width = width;
+		if (!workers[i].ctx)
+			fail("fz_clone_context()");
+		if (pthread_mutex_init(&workers[i].mutex, NULL) != 0)
+			fail("pthread_mutex_init()");
+		if (pthread_cond_init(&workers[i].cond, NULL) != 0)
+			fail("pthread_cond_init()");
+		if (pthread_create(&workers[i].thread, NULL, renderer, &workers[i]) != 0)
+			fail("pthread_create()");
+	}
+
+	for (i = 1; i <= page_count; i++)
+	{
+		struct worker *w = &workers[(i - 1) % threads];
+		fz_display_list *list;
+
+		fz_try(ctx)
+			list = fz_new_display_list_from_page_number(ctx, doc, i - 1);
+		fz_catch(ctx)
+		{
+			fprintf(stderr, "cannot load page %d: %s\n", i, fz_caught_message(ctx));
+			continue;
+		}
+
+		pthread_mutex_lock(&w->mutex);
+		while (w->list)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		sprintf(w->out, "%s-%d.png", inputfile, i);
+		w->list = list;
+		pthread_cond_signal(&w->cond);
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	for (i = 0; i < threads; i++)
+	{
+		pthread_mutex_lock(&workers[i].mutex);
+		workers[i].quit = 1;
+		pthread_cond_signal(&workers[i].cond);
+		pthread_mutex_unlock(&workers[i].mutex);
+		pthread_join(workers[i].thread, NULL);
+		pthread_cond_destroy(&workers[i].cond);
+		pthread_mutex_destroy(&workers[i].mutex);
+		fz_drop_context(workers[i].ctx);
+	}
+	fz_free(ctx, workers);
+}
 
 int main(int argc, char **argv)
 {
 	char *inputfile;
+	char pattern[256];
 	fz_context *ctx;
 	fz_document *doc;
+	pthread_mutex_t mutex[FZ_LOCK_MAX];
+	fz_locks_context locks;
+	int threads = 0;
+	int width = 400;
+	int c, i;
 
-	if (argc < 2)
+	while ((c = fz_getopt(argc, argv, "T:w:")) != -1)
 	{
-		fprintf(stderr, "usage: ./genthumb-test pdf_file\n");
+		switch (c)
+		{
+		case 'T': threads = atoi(fz_optarg); break;
+		case 'w': width = atoi(fz_optarg); break;
+		default: fz_optind = argc; break;
+		}
+	}
+
+	if (fz_optind != argc - 1)
+	{
+		fprintf(stderr, "usage: ./genthumb-test [-T threads] [-w width] pdf_file\n");
 		return EXIT_FAILURE;
 	}
-	inputfile = argv[1];
-    
+	inputfile = argv[fz_optind];
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		if (pthread_mutex_init(&mutex[i], NULL) != 0)
+			fail("pthread_mutex_init()");
+	locks.user = mutex;
+	locks.lock = lock_mutex;
+	locks.unlock = unlock_mutex;
+
 	/* Create a context to hold the exception stack and various caches. */
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	ctx = fz_new_context(NULL, threads > 0 ? &locks : NULL, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot create mupdf context\n");
 		return EXIT_FAILURE;
 	}
-    
-    //fz_set_aa_level(ctx, 8);
+
+	fz_set_aa_level(ctx, 8);
 
 	/* Register the default file types to handle. */
 	fz_try(ctx)
@@ -43,16 +200,20 @@ int main(int argc, char **argv)
 		fz_drop_context(ctx);
 		return EXIT_FAILURE;
 	}
-    
-    int page_count = fz_count_pages(ctx, doc);
-    int i;
-    for(i=1; i<=page_count; i++)
-    {
-        char out[256] = {0};
-        sprintf(out, "%s-%d.png", inputfile, i);
-        fz_gen_thumb_image(ctx, doc, i, 400, out);
-    }
+
+	if (threads > 0)
+		gen_thumbs_threaded(ctx, doc, inputfile, width, threads);
+	else
+	{
+		snprintf(pattern, sizeof pattern, "%s-%%d.png", inputfile);
+		fz_gen_thumbs(ctx, doc, 1, fz_count_pages(ctx, doc), width, pattern);
+	}
+
 	fz_drop_document(ctx, doc);
 	fz_drop_context(ctx);
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		pthread_mutex_destroy(&mutex[i]);
+
 	return 0;
-}
\ No newline at end of file
+}
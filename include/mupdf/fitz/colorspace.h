@@ -28,6 +28,13 @@ fz_colorspace *fz_lookup_device_colorspace(fz_context *ctx, char *name);
 */
 int fz_colorspace_is_indexed(fz_context *ctx, fz_colorspace *cs);
 
+/*
+	fz_indexed_colorspace_data: Return the base colorspace of an
+	indexed colorspace, along with its highest index and the lookup
+	table of (high + 1) * base->n bytes. Nothing is kept.
+*/
+fz_colorspace *fz_indexed_colorspace_data(fz_context *ctx, fz_colorspace *cs, int *high, unsigned char **lookup);
+
 /*
 	fz_device_gray: Get colorspace representing device specific gray.
 */
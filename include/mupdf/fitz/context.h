@@ -17,6 +17,7 @@ typedef struct fz_colorspace_context_s fz_colorspace_context;
 typedef struct fz_aa_context_s fz_aa_context;
 typedef struct fz_style_context_s fz_style_context;
 typedef struct fz_locks_context_s fz_locks_context;
+typedef struct fz_parallel_context_s fz_parallel_context;
 typedef struct fz_store_s fz_store;
 typedef struct fz_glyph_cache_s fz_glyph_cache;
 typedef struct fz_document_handler_context_s fz_document_handler_context;
@@ -99,6 +100,9 @@ enum
 */
 void fz_flush_warnings(fz_context *ctx);
 
+/* Number of FZ_LOCK_DOCUMENT locks; see below */
+#define FZ_DOCUMENT_LOCK_STRIPES 8
+
 struct fz_context_s
 {
 	fz_alloc_context *alloc;
@@ -113,6 +117,9 @@ struct fz_context_s
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
 	fz_document_handler_context *handler;
+	fz_parallel_context *parallel;
+	/* How many times this context (thread) holds each document lock */
+	int document_lock_depth[FZ_DOCUMENT_LOCK_STRIPES];
 };
 
 /*
@@ -241,14 +248,84 @@ struct fz_locks_context_s
 	void (*unlock)(void *user, int lock);
 };
 
+/*
+	The resource store is split into FZ_STORE_SHARDS shards, each with
+	its own lock (FZ_LOCK_STORE + shard), so that threads finding and
+	storing different items do not contend.
+*/
+#define FZ_STORE_SHARDS 8
+
+/*
+	Likewise the glyph cache is split into FZ_GLYPH_CACHE_STRIPES
+	stripes, locked by FZ_LOCK_GLYPHCACHE + stripe.
+*/
+#define FZ_GLYPH_CACHE_STRIPES 4
+
+/*
+	Threads making an expensive item for the store (such as a decoded
+	image) first claim it (see fz_claim_item), under one of
+	FZ_STORE_CLAIM_STRIPES locks from FZ_LOCK_CLAIM, which are held for
+	as long as the item takes to make.
+*/
+#define FZ_STORE_CLAIM_STRIPES 8
+
+/*
+	FZ_LOCK_DOCUMENT guards the object cache and resource loading of
+	documents that are shared between threads (see
+	pdf_share_document). Each shared document is given one of
+	FZ_DOCUMENT_LOCK_STRIPES locks from FZ_LOCK_DOCUMENT, so that
+	unrelated documents rarely wait for each other. They are the
+	highest numbered locks, as loading a resource may need any of
+	the others.
+*/
+
 enum {
 	FZ_LOCK_ALLOC = 0,
-	FZ_LOCK_FILE, /* Unused now */
+	FZ_LOCK_STORE,
+	FZ_LOCK_FILE = FZ_LOCK_STORE + FZ_STORE_SHARDS, /* Unused now */
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
-	FZ_LOCK_MAX
+	FZ_LOCK_CLAIM = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_STRIPES,
+	FZ_LOCK_DOCUMENT = FZ_LOCK_CLAIM + FZ_STORE_CLAIM_STRIPES,
+	FZ_LOCK_MAX = FZ_LOCK_DOCUMENT + FZ_DOCUMENT_LOCK_STRIPES
+};
+
+/*
+	Parallel jobs:
+
+	MuPDF never creates threads itself, but a few long running and
+	purely computational operations (such as scaling a large image)
+	can split their work into independent jobs. A client with threads
+	to spare can supply a fz_parallel_context to have these jobs run
+	concurrently.
+
+	run: Call fn(arg, i) once for each i in 0 <= i < count, on any
+	threads and in any order, and return only once all the calls have
+	completed. The jobs neither throw nor use a fz_context, so may run
+	on threads that have none.
+
+	threads: The number of jobs worth running at once. Operations
+	split their work into no more than this many jobs.
+*/
+
+typedef void (fz_parallel_fn)(void *arg, int i);
+
+struct fz_parallel_context_s
+{
+	void *user;
+	int threads;
+	void (*run)(void *user, fz_parallel_fn *fn, void *arg, int count);
 };
 
+/*
+	fz_set_parallel_context: Set (or with NULL, clear) the means by
+	which this context runs parallel jobs. Contexts cloned from this
+	one afterwards share it. The context keeps the pointer, so the
+	data it points to must remain valid until the context (and any
+	clones) are destroyed.
+*/
+void fz_set_parallel_context(fz_context *ctx, fz_parallel_context *parallel);
+
 /*
 	Memory Allocation and Scavenging:
 
@@ -496,6 +573,23 @@ fz_keep_imp8(fz_context *ctx, void *p, int8_t *refs)
 	return p;
 }
 
+/*
+	A 16 bit count that reaches INT16_MAX sticks there, and the
+	object is never freed, rather than wrapping around.
+*/
+static inline void *
+fz_keep_imp16(fz_context *ctx, void *p, int16_t *refs)
+{
+	if (p)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		if (*refs > 0 && *refs < INT16_MAX)
+			++*refs;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+	return p;
+}
+
 static inline int
 fz_drop_imp(fz_context *ctx, void *p, int *refs)
 {
@@ -530,4 +624,21 @@ fz_drop_imp8(fz_context *ctx, void *p, int8_t *refs)
 	return 0;
 }
 
+static inline int
+fz_drop_imp16(fz_context *ctx, void *p, int16_t *refs)
+{
+	if (p)
+	{
+		int drop;
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		if (*refs > 0 && *refs < INT16_MAX)
+			drop = --*refs == 0;
+		else
+			drop = 0;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return drop;
+	}
+	return 0;
+}
+
 #endif
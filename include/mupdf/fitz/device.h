@@ -288,6 +288,17 @@ fz_device *fz_new_trace_device(fz_context *ctx);
 */
 fz_device *fz_new_bbox_device(fz_context *ctx, fz_rect *rectp);
 
+/*
+	fz_new_ink_device: Create a device to compute the bounding
+	box of the ink on a page.
+
+	Like the bbox device, but fills and strokes that are fully
+	transparent, or that would paint white onto a white page,
+	are left out. Content clipped away entirely does not count.
+	Images and shadings always count, whatever their contents.
+*/
+fz_device *fz_new_ink_device(fz_context *ctx, fz_rect *rectp);
+
 /*
 	fz_new_test_device: Create a device to test for features.
 
@@ -5,6 +5,8 @@
 #include "mupdf/fitz/context.h"
 #include "mupdf/fitz/math.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/stream.h"
+#include "mupdf/fitz/output.h"
 
 /*
 	Display list device -- record and play back device commands.
@@ -63,6 +65,10 @@ fz_device *fz_new_list_device(fz_context *ctx, fz_display_list *list);
 	visible within this area will be considered when the list is
 	run through the device. This does not imply for tile objects
 	contained in the display list.
+	Once the list device has been dropped the list carries an
+	index of the bounds of runs of commands, so replaying a small
+	area (such as a band or a tile) skips most of a large list
+	without decoding it.
 
 	cookie: Communication mechanism between caller and library
 	running the page. Intended for multi-threaded applications,
@@ -93,4 +99,58 @@ void fz_drop_display_list(fz_context *ctx, fz_display_list *list);
 */
 fz_rect *fz_bound_display_list(fz_context *ctx, fz_display_list *list, fz_rect *bounds);
 
+/*
+	fz_display_list_resources: Where the fonts and images used by a
+	serialized display list are kept. Each is stored as a blob of
+	data (a font file, compressed image data or image samples) under
+	the MD5 digest of that data, so lists of many pages share one
+	copy of each.
+
+	put: Store buf under digest. May be called again for a digest
+	that is already stored.
+
+	get: Return a new reference to the data stored under digest, or
+	throw if there is none.
+*/
+typedef struct fz_display_list_resources_s fz_display_list_resources;
+
+struct fz_display_list_resources_s
+{
+	void *user;
+	void (*put)(fz_context *ctx, void *user, const unsigned char digest[16], fz_buffer *buf);
+	fz_buffer *(*get)(fz_context *ctx, void *user, const unsigned char digest[16]);
+};
+
+/*
+	fz_init_display_list_resource_directory: Set up res to keep
+	resources as files in the directory dir, which must exist and
+	must outlive res.
+*/
+void fz_init_display_list_resource_directory(fz_context *ctx, fz_display_list_resources *res, const char *dir);
+
+/*
+	fz_write_display_list: Write a display list to out in a stable
+	binary form, so that it can be read back (in this or a later
+	process) by fz_read_display_list without interpreting the page
+	again. Fonts and images are passed to res->put rather than
+	being written to out.
+
+	Throws if the list uses something that cannot be written, such
+	as a type3 font or a separation colorspace, in which case the
+	contents of out are incomplete.
+*/
+void fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list, fz_display_list_resources *res);
+
+/*
+	fz_read_display_list: Read a display list written by
+	fz_write_display_list, fetching its fonts and images from
+	res->get.
+
+	Every count in the file is checked against what is left of it
+	before anything is allocated for it, so a corrupt file throws
+	rather than asking for more memory than its own size. A stream
+	that cannot seek is read into memory first to learn its length.
+*/
+fz_display_list *fz_read_display_list(fz_context *ctx, fz_stream *stm, fz_display_list_resources *res);
+
 #endif
@@ -88,6 +88,7 @@ struct fz_document_s
 	fz_document_lookup_metadata_fn *lookup_metadata;
 	fz_document_write_fn *write;
 	int did_layout;
+	int id; /* keys cached per-page data; 0 until needed, reset by layout and edits */
 };
 
 typedef fz_document *(fz_document_open_fn)(fz_context *ctx, const char *filename);
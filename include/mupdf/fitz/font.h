@@ -83,6 +83,14 @@ fz_font *fz_new_font_from_memory(fz_context *ctx, const char *name, unsigned cha
 fz_font *fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox);
 fz_font *fz_new_font_from_file(fz_context *ctx, const char *name, const char *path, int index, int use_glyph_bbox);
 
+/*
+	fz_font_file_data: Return the font file that a font was loaded
+	from, and the index of the font within it.
+
+	Throws for fonts (such as type3 fonts) that have no font file.
+*/
+fz_buffer *fz_font_file_data(fz_context *ctx, fz_font *font, int *index);
+
 fz_font *fz_keep_font(fz_context *ctx, fz_font *font);
 void fz_drop_font(fz_context *ctx, fz_font *font);
 
@@ -18,6 +18,12 @@ fz_glyph_cache *fz_keep_glyph_cache(fz_context *ctx);
 void fz_drop_glyph_cache_context(fz_context *ctx);
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/*
+	fz_purge_glyph_cache_font: Drop any cached renderings of glyphs
+	from the given font, leaving those of other fonts in place.
+*/
+void fz_purge_glyph_cache_font(fz_context *ctx, fz_font *font);
+
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *trm);
 fz_path *fz_outline_glyph(fz_context *ctx, fz_font *font, int gid, const fz_matrix *ctm);
 fz_glyph *fz_render_ft_glyph(fz_context *ctx, fz_font *font, int cid, const fz_matrix *trm, int aa);
@@ -57,8 +57,39 @@ fz_image *fz_new_image_from_pixmap(fz_context *ctx, fz_pixmap *pixmap, fz_image
 fz_image *fz_new_image_from_data(fz_context *ctx, unsigned char *data, int len);
 fz_image *fz_new_image_from_buffer(fz_context *ctx, fz_buffer *buffer);
 fz_pixmap *fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h);
+
+/*
+	fz_image_get_sub_pixmap: Like fz_image_get_pixmap, but may only
+	decode the part of the image that will be used.
+
+	subarea: The wanted area in image pixels (0,0 to image->w,image->h),
+	or NULL for the whole image. The area decoded may be larger (it is
+	rounded out to a grid so that parts can be reused), and is the
+	whole image when the format cannot be decoded in part or when the
+	part is most of the image anyway.
+
+	w, h: The size the whole image will be drawn at, as for
+	fz_image_get_pixmap.
+
+	whole_w, whole_h: Filled in with the size of the whole image at
+	the scale it was decoded. The pixmap returned may be all or part
+	of this; its x and y give its position within it.
+*/
+fz_pixmap *fz_image_get_sub_pixmap(fz_context *ctx, fz_image *image, const fz_irect *subarea, int w, int h, int *whole_w, int *whole_h);
+
 void fz_drop_image_imp(fz_context *ctx, fz_storable *image);
 fz_pixmap *fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor);
+
+/*
+	fz_decomp_sub_image_from_stream: Like fz_decomp_image_from_stream,
+	but only decode part of the image.
+
+	subarea: NULL to decode the whole image, or the area to decode
+	in image pixels. Rows above the area are read and discarded,
+	and reading stops after its last row. On exit it holds the area
+	decoded, after rounding to the subsampling factor.
+*/
+fz_pixmap *fz_decomp_sub_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, fz_irect *subarea, int indexed, int l2factor);
 fz_pixmap *fz_expand_indexed_pixmap(fz_context *ctx, fz_pixmap *src);
 
 struct fz_image_s
@@ -68,6 +99,7 @@ struct fz_image_s
 	fz_image *mask;
 	fz_colorspace *colorspace;
 	fz_pixmap *(*get_pixmap)(fz_context *, fz_image *, int w, int h, int *l2factor);
+	fz_pixmap *(*get_sub_pixmap)(fz_context *, fz_image *, fz_irect *subarea, int w, int h, int *l2factor); /* NULL if only decoded whole */
 	int colorkey[FZ_MAX_COLORS * 2];
 	float decode[FZ_MAX_COLORS * 2];
 	int imagemask;
@@ -98,6 +130,15 @@ void fz_load_gif_info(fz_context *ctx, unsigned char *data, int size, int *w, in
 int fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, int len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage);
 
+/*
+	fz_load_tiff_subarea: Load part of a TIFF image, decoding only the
+	strips it lies in.
+
+	subarea: On entry, the area of the image wanted. On exit, the area
+	returned; this is the rows wanted, across the width of the image.
+*/
+fz_pixmap *fz_load_tiff_subarea(fz_context *ctx, unsigned char *buf, int len, fz_irect *subarea);
+
 void fz_image_get_sanitised_res(fz_image *image, int *xres, int *yres);
 
 #endif
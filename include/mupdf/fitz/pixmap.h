@@ -295,6 +295,14 @@ fz_scale_cache *fz_new_scale_cache(fz_context *ctx);
 void fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *cache);
 fz_pixmap *fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y);
 
+/*
+	fz_scale_sub_pixmap_cached: Like fz_scale_pixmap_cached, but src is
+	only part of an image of whole_w x whole_h pixels, with src->x and
+	src->y giving its position within it. x, y, w and h place the whole
+	image; src must cover all of it that falls within clip.
+*/
+fz_pixmap *fz_scale_sub_pixmap_cached(fz_context *ctx, fz_pixmap *src, int whole_w, int whole_h, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y);
+
 void fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor);
 
 fz_irect *fz_pixmap_bbox_no_ctx(fz_pixmap *src, fz_irect *bbox);
@@ -3,6 +3,7 @@
 
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/context.h"
+#include "mupdf/fitz/math.h"
 
 /*
 	Resource store
@@ -77,6 +78,12 @@ struct fz_store_hash_s
 			int i;
 		} pi;
 		struct
+		{
+			void *ptr;
+			int i;
+			fz_irect r;
+		} pir;
+		struct
 		{
 			int id;
 			float m[4];
@@ -150,6 +157,44 @@ void *fz_store_item(fz_context *ctx, void *key, void *val, unsigned int itemsize
 */
 void *fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type *type);
 
+/*
+	fz_claim_item: Claim the right to make an item that is not in the
+	store, so that threads wanting the same item make it only once.
+
+	Call this after fz_find_item has failed. It waits for any other
+	thread holding a claim on the key, so once it returns, look in the
+	store again: the item may have been made in the meantime. If it
+	has not, make it and store it. Either way, finish with
+	fz_release_claim.
+
+	Claims are striped over FZ_STORE_CLAIM_STRIPES locks, so an
+	unrelated key can occasionally make a thread wait too. Only keys
+	of types with a make_hash_key function can be claimed, and a
+	thread cannot hold two claims at once.
+
+	Returns a claim to pass to fz_release_claim, or 0 if no claim was
+	taken (in which case the item should just be made as usual).
+*/
+int fz_claim_item(fz_context *ctx, void *key, fz_store_type *type);
+
+/*
+	fz_release_claim: Give up a claim taken by fz_claim_item.
+
+	made: Non zero if the claimant made the item, zero if it found it
+	in the store after all (because another thread made it).
+
+	Does not throw exceptions.
+*/
+void fz_release_claim(fz_context *ctx, int claim, int made);
+
+/*
+	fz_store_claim_stats: Report how claims have ended: how many items
+	were made by their claimant, and how many were found already made
+	by another thread (each of those is a duplicate piece of work
+	saved).
+*/
+void fz_store_claim_stats(fz_context *ctx, int *made, int *found);
+
 /*
 	fz_remove_item: Remove an item from the store.
 
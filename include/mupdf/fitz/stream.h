@@ -31,6 +31,70 @@ fz_stream *fz_open_file(fz_context *ctx, const char *filename);
 fz_stream *fz_open_file_ptr_progressive(fz_context *ctx, FILE *file, int bps);
 fz_stream *fz_open_file_progressive(fz_context *ctx, const char *filename, int bps);
 
+/*
+	fz_range: A span of bytes within a stream.
+*/
+typedef struct fz_range_s fz_range;
+
+struct fz_range_s
+{
+	fz_off_t offset;
+	fz_off_t length;
+};
+
+/*
+	fz_range_request_fn: Called by a range stream to ask for the bytes
+	in [offset, offset+length) to be fetched.
+
+	The callback should only note (or send) the request and return;
+	the data is handed over later with fz_range_stream_supply. It may
+	be called with the document lock held, so it must not call back
+	into the document.
+*/
+typedef void (fz_range_request_fn)(fz_context *ctx, void *opaque, fz_off_t offset, fz_off_t length);
+
+/*
+	fz_open_range_stream: Open a progressive stream over a file whose
+	data arrives out of order, for instance in answer to http byte
+	range requests.
+
+	length: The final length of the file (from Content-Length or
+	Content-Range).
+
+	block_size: The granularity of requests in bytes, or 0 for the
+	default (32K).
+
+	request: Called with each range the reader needs and does not
+	have, once per block. Readers that reach such a block get an
+	FZ_ERROR_TRYLATER error, and should retry once the data has been
+	supplied.
+
+	Documents opened over the stream may also announce ranges they
+	will need soon (linearized PDFs do, from their hint tables), so
+	that they can be fetched before anything blocks on them.
+
+	Returns pointer to newly created stream. May throw exceptions on
+	failure to allocate.
+*/
+fz_stream *fz_open_range_stream(fz_context *ctx, fz_off_t length, int block_size, fz_range_request_fn *request, void *opaque);
+
+/*
+	fz_range_stream_supply: Hand data that has arrived to a range
+	stream.
+
+	offset must lie on a block boundary, and offset+len must either
+	lie on one too or be the end of the file. Blocks already present
+	are left alone. Must not be called while another thread is using
+	a document that reads from the stream.
+*/
+void fz_range_stream_supply(fz_context *ctx, fz_stream *stm, fz_off_t offset, const unsigned char *data, int len);
+
+/*
+	fz_range_stream_complete: Returns 1 once every byte of the file
+	has been supplied, 0 otherwise.
+*/
+int fz_range_stream_complete(fz_context *ctx, fz_stream *stm);
+
 /*
 	fz_open_file_w: Open the named file and wrap it in a stream.
 
@@ -49,6 +113,12 @@ fz_stream *fz_open_file_w(fz_context *ctx, const wchar_t *filename);
 	descriptor, so it may not be modified or closed after the call
 	to fz_open_file_ptr. When the stream is closed it will also close
 	the file descriptor.
+
+	On systems with mmap, a regular file positioned at its start is
+	mapped into memory and read from there without copying; anything
+	else (pipes, devices) is read through stdio. Define FZ_NO_MMAP to
+	always use stdio. A mapped file must not be truncated while the
+	stream is open.
 */
 fz_stream *fz_open_file_ptr(fz_context *ctx, FILE *file);
 
@@ -90,6 +160,34 @@ fz_stream *fz_open_buffer(fz_context *ctx, fz_buffer *buf);
 */
 fz_stream *fz_open_leecher(fz_context *ctx, fz_stream *chain, fz_buffer *buf);
 
+/*
+	fz_open_cached: Attach a block cache to a seekable stream.
+
+	Reads are served from an in-memory cache of the most recently
+	used fixed size blocks of the underlying stream, and sequential
+	reads fetch a growing run of blocks ahead at a time. Use this
+	under documents kept on storage with a high cost per request,
+	where seeking back and forth would otherwise refetch the same
+	data over and over. The data of the underlying stream must not
+	change while the cache is open.
+
+	chain: The underlying stream. It must support seeking. The cache
+	takes its own reference.
+
+	block_size: Size of each cached block in bytes, or 0 for the
+	default (64K).
+
+	max_blocks: Number of blocks to keep, or 0 for the default (64).
+
+	Hit, miss and byte counters can be read back by passing
+	FZ_STREAM_META_CACHE_STATS to fz_stream_meta with a
+	fz_stream_cache_stats.
+
+	Returns pointer to newly created stream. May throw exceptions on
+	failure to allocate.
+*/
+fz_stream *fz_open_cached(fz_context *ctx, fz_stream *chain, int block_size, int max_blocks);
+
 /*
 	fz_drop_stream: Close an open stream.
 
@@ -183,10 +281,38 @@ void fz_read_string(fz_context *ctx, fz_stream *stm, char *buffer, int len);
 
 
 
+/*
+	FZ_STREAM_META_MEMORY: If all of the stream's data is held in
+	memory (a buffer or a mapped file), fill in the fz_stream_memory
+	that ptr points to and return 1. Readers can then take any part
+	of the data without moving the stream's read position, so that
+	any number of them can share the stream.
+*/
 enum
 {
 	FZ_STREAM_META_PROGRESSIVE = 1,
-	FZ_STREAM_META_LENGTH = 2
+	FZ_STREAM_META_LENGTH = 2,
+	FZ_STREAM_META_MEMORY = 3,
+	FZ_STREAM_META_CACHE_STATS = 4,
+	FZ_STREAM_META_WANT = 5 /* ptr is an fz_range the reader will need soon */
+};
+
+typedef struct fz_stream_memory_s fz_stream_memory;
+
+struct fz_stream_memory_s
+{
+	unsigned char *data;
+	fz_off_t len;
+};
+
+typedef struct fz_stream_cache_stats_s fz_stream_cache_stats;
+
+struct fz_stream_cache_stats_s
+{
+	int hits; /* reads served from a cached block */
+	int misses; /* reads that had to fetch a block */
+	int readahead; /* blocks fetched ahead of a sequential reader */
+	fz_off_t bytes_read; /* total read from the underlying stream */
 };
 
 int fz_stream_meta(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr);
@@ -9,6 +9,7 @@
 #include "mupdf/fitz/image.h"
 #include "mupdf/fitz/output.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/store.h"
 
 /*
 	Text extraction device: Used for searching, format conversion etc.
@@ -26,6 +27,7 @@ typedef struct fz_page_block_s fz_page_block;
 
 typedef struct fz_text_sheet_s fz_text_sheet;
 typedef struct fz_text_page_s fz_text_page;
+typedef struct fz_text_index_s fz_text_index;
 
 /*
 	fz_text_sheet: A text sheet contains a list of distinct text styles
@@ -60,6 +62,9 @@ struct fz_text_style_s
 /*
 	fz_text_page: A text page is a list of page blocks, together with
 	an overall bounding box.
+
+	index: Flat character index, built on demand by
+	fz_index_text_page. NULL until then.
 */
 struct fz_text_page_s
 {
@@ -67,6 +72,7 @@ struct fz_text_page_s
 	int len, cap;
 	fz_page_block *blocks;
 	fz_text_page *next;
+	fz_text_index *index;
 };
 
 /*
@@ -184,6 +190,45 @@ struct fz_char_and_box_s
 
 fz_char_and_box *fz_text_char_at(fz_context *ctx, fz_char_and_box *cab, fz_text_page *page, int idx);
 
+/*
+	fz_text_index: Every char of a text page in a contiguous array,
+	in the order used by fz_text_char_at: the chars of each span of
+	each line of the text blocks, followed by a ' ' with an empty
+	bbox (and a NULL span) standing for the end of the line.
+
+	line_start: For each line, the index of its first char. There
+	is one extra entry at the end, equal to len.
+*/
+typedef struct fz_text_index_char_s fz_text_index_char;
+
+struct fz_text_index_char_s
+{
+	int c;
+	fz_rect bbox;
+	fz_text_span *span;
+};
+
+struct fz_text_index_s
+{
+	int len;
+	fz_text_index_char *chars;
+	int line_count;
+	fz_text_line **lines;
+	int *line_start;
+};
+
+/*
+	fz_index_text_page: Return the character index of a text page,
+	building it if needed. The index belongs to the page and is freed
+	with it.
+
+	Changes made to the page by the text device or fz_analyze_text
+	discard the index; code that edits a text page in any other way
+	must call fz_invalidate_text_page_index.
+*/
+fz_text_index *fz_index_text_page(fz_context *ctx, fz_text_page *page);
+void fz_invalidate_text_page_index(fz_context *ctx, fz_text_page *page);
+
 /*
 	fz_text_char_bbox: Return the bbox of a text char. Calculated from
 	the supplied enclosing span.
@@ -250,6 +295,60 @@ void fz_print_text_page(fz_context *ctx, fz_output *out, fz_text_page *page);
 */
 int fz_search_text_page(fz_context *ctx, fz_text_page *text, const char *needle, fz_rect *hit_bbox, int hit_max);
 
+/*
+	fz_page_text: The characters of a text page flattened into arrays.
+
+	The numbering is the same as for fz_text_char_at: every char of
+	every span of every line of the text blocks in order, with a ' '
+	(and an empty bbox) after each line to stand for the line break.
+
+	Page texts are reference counted storables, so they can be kept
+	in the store; see fz_load_page_text.
+*/
+typedef struct fz_page_text_s fz_page_text;
+
+struct fz_page_text_s
+{
+	fz_storable storable;
+	int len;
+	int *text;
+	fz_rect *bbox;
+};
+
+fz_page_text *fz_new_page_text_from_text_page(fz_context *ctx, fz_text_page *page);
+fz_page_text *fz_keep_page_text(fz_context *ctx, fz_page_text *text);
+void fz_drop_page_text(fz_context *ctx, fz_page_text *text);
+
+/*
+	fz_search_page_text: As fz_search_text_page, on a flattened page.
+*/
+int fz_search_page_text(fz_context *ctx, fz_page_text *text, const char *needle, fz_rect *hit_bbox, int hit_max);
+
+/*
+	fz_text_matcher: Finds any number of needles in a single pass
+	over a page (Aho-Corasick).
+
+	Matching follows fz_search_text_page: ASCII letters are matched
+	case insensitively, and a run of whitespace in a needle matches a
+	run of whitespace in the text. Empty needles never match.
+*/
+typedef struct fz_text_matcher_s fz_text_matcher;
+
+fz_text_matcher *fz_new_text_matcher(fz_context *ctx, int count, const char **needles);
+void fz_drop_text_matcher(fz_context *ctx, fz_text_matcher *matcher);
+
+/*
+	fz_match_page_text: Count the occurrences of every needle.
+
+	counts: Array of one count per needle, filled in.
+
+	first: Array of one index per needle, filled in with the position
+	in the page text of its first occurrence, or -1. May be NULL.
+
+	Returns the total number of occurrences found.
+*/
+int fz_match_page_text(fz_context *ctx, fz_text_matcher *matcher, fz_page_text *text, int *counts, int *first);
+
 /*
 	fz_highlight_selection: Return a list of rectangles to highlight given a selection rectangle.
 
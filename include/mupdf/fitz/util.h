@@ -59,9 +59,62 @@ int fz_search_page(fz_context *ctx, fz_page *page, const char *needle, fz_rect *
 int fz_search_page_number(fz_context *ctx, fz_document *doc, int number, const char *needle, fz_rect *hit_bbox, int hit_max);
 int fz_search_display_list(fz_context *ctx, fz_display_list *list, const char *needle, fz_rect *hit_bbox, int hit_max);
 
+/*
+	fz_load_page_text: Get the flattened text of a page.
+
+	The result is kept in the store, keyed by document and page number,
+	so repeated calls for the same page (including those made by
+	fz_search_page_number) only extract the text once, as long as the
+	store has room for it. Laying the document out again, or editing
+	a PDF, invalidates what was cached for it.
+*/
+fz_page_text *fz_load_page_text(fz_context *ctx, fz_document *doc, int number);
+
+/*
+	fz_bound_page_ink: Determine the area of a page that is actually
+	inked, in the same coordinate space as fz_bound_page.
+
+	The page is run through an ink device, which is cheap but only
+	knows the bounds of the objects drawn. If resolution is non-zero,
+	that area alone is then rendered at the given resolution and any
+	white border trimmed off, giving an answer accurate to one pixel
+	at that resolution. The result is empty for a blank page.
+*/
+fz_rect *fz_bound_page_ink(fz_context *ctx, fz_page *page, fz_rect *bounds, float resolution);
+
+/*
+	fz_bound_page_fix: Determine the page bounds cropped down to the
+	inked area plus a 5% margin. A blank page keeps its full bounds.
+*/
+fz_rect *fz_bound_page_fix(fz_context *ctx, fz_page *page, fz_rect *bounds);
+
 /*
 	fz_gen_thumb_image: generate pagen thumbnail image save as outfile
  */
 int fz_gen_thumb_image(fz_context *ctx, fz_document *doc, int pagenum, int width, char *outfile);
 
+/*
+	fz_gen_thumb_image_from_display_list: render a display list as a
+	thumbnail 'width' pixels wide and save it as a PNG in outfile.
+
+	Only the display list is touched, not the document it came from,
+	so this may be called from other threads with a cloned context
+	while the document stays on the thread that owns it. Thumbnails
+	rendered this way share the store and glyph cache of the context
+	they were cloned from.
+*/
+void fz_gen_thumb_image_from_display_list(fz_context *ctx, fz_display_list *list, int width, const char *outfile);
+
+/*
+	fz_gen_thumbs: generate thumbnails 'width' pixels wide for pages
+	first to last (1-based, inclusive) of a document.
+
+	pattern: File name in which the first %d (or %03d and the like)
+	is replaced by the page number. Any other '%' is taken literally.
+
+	Pages that fail to render are warned about and skipped. Returns
+	the number of thumbnails written.
+*/
+int fz_gen_thumbs(fz_context *ctx, fz_document *doc, int first, int last, int width, const char *pattern);
+
 #endif
@@ -26,6 +26,12 @@ struct fz_write_options_s
 	int continue_on_error; /* If non-zero, errors are (optionally)
 					counted and writing continues. */
 	int *errors; /* Pointer to a place to store a count of errors */
+	int compression_level; /* zlib level (1 to 9) to compress streams
+				with, or 0 for the zlib default. */
+	int do_keep_flate; /* If non-zero then streams that are only Flate
+				compressed are copied as they are rather
+				than expanded (and, with do_deflate,
+				compressed again). */
 };
 
 /*	An enumeration of bitflags to use in the above 'do_expand' field of
@@ -52,6 +58,10 @@ enum
 
 	opts: NULL, or a pointer to an options structure.
 
+	If the context has a fz_parallel_context, streams being
+	compressed are loaded a few at a time ahead of the writer and
+	compressed concurrently; the output is identical either way.
+
 	May throw exceptions.
 */
 void fz_write_document(fz_context *ctx, fz_document *doc, char *filename, fz_write_options *opts);
@@ -6,8 +6,10 @@
 typedef struct fz_html_font_set_s fz_html_font_set;
 typedef struct fz_html_s fz_html;
 typedef struct fz_html_flow_s fz_html_flow;
+typedef struct fz_html_pages_s fz_html_pages;
 
 typedef struct fz_css_rule_s fz_css_rule;
+typedef struct fz_css_index_s fz_css_index;
 typedef struct fz_css_match_s fz_css_match;
 typedef struct fz_css_style_s fz_css_style;
 
@@ -173,6 +175,7 @@ struct fz_html_s
 	fz_css_style style;
 	int list_item;
 	int is_first_flow; /* for text-indent */
+	fz_html_pages *pages; /* root only: where each page starts, from fz_layout_html */
 };
 
 enum
@@ -198,7 +201,22 @@ fz_css_rule *fz_parse_css(fz_context *ctx, fz_css_rule *chain, const char *sourc
 fz_css_property *fz_parse_css_properties(fz_context *ctx, const char *source);
 void fz_drop_css(fz_context *ctx, fz_css_rule *rule);
 
-void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *rule, fz_xml *node);
+/*
+	fz_new_css_index: Index the rules of a stylesheet by the id, class
+	and tag of their selectors, for fz_match_css. The rules must
+	outlive the index.
+*/
+fz_css_index *fz_new_css_index(fz_context *ctx, fz_css_rule *css);
+void fz_drop_css_index(fz_context *ctx, fz_css_index *index);
+
+void fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_index *index, fz_xml *node);
+
+/*
+	fz_can_share_css_match: Whether node is sure to match the same
+	rules as prev, a preceding sibling with the same tag, id, class
+	and style attribute, so that its match can be reused.
+*/
+int fz_can_share_css_match(fz_context *ctx, fz_css_index *index, fz_xml *prev, fz_xml *node);
 void fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css_rule *css);
 
 int fz_get_css_match_display(fz_css_match *node);
@@ -109,6 +109,35 @@ int pdf_lookup_metadata(fz_context *ctx, pdf_document *doc, const char *key, cha
 
 fz_outline *pdf_load_outline(fz_context *ctx, pdf_document *doc);
 
+/*
+	pdf_share_document: Allow several threads to load and run pages
+	of the document at the same time, each with its own context
+	cloned from the one the document was opened with.
+
+	The object cache and the loading of pages and their resources
+	(fonts, images, colorspaces and so on) are then serialized by
+	the document's lock, while the interpretation of content streams,
+	the slow part, runs in parallel. A file that is not already in
+	memory (a mapped file or a buffer) is read into memory, so that
+	streams can be read without sharing a file position.
+
+	A shared document is for reading. Editing it, saving it, or
+	running it with the FZ_NO_CACHE hint while other threads use it
+	is not supported.
+*/
+void pdf_share_document(fz_context *ctx, pdf_document *doc);
+
+/*
+	pdf_lock_document, pdf_unlock_document: Take and release the
+	document lock, one of the FZ_LOCK_DOCUMENT stripes. A thread
+	may take the lock again while it holds it, even on behalf of
+	another document with the same stripe; it is released after
+	the matching number of unlocks. Documents that have not been
+	shared are only used by one thread, and are not locked.
+*/
+void pdf_lock_document(fz_context *ctx, pdf_document *doc);
+void pdf_unlock_document(fz_context *ctx, pdf_document *doc);
+
 typedef struct pdf_ocg_entry_s pdf_ocg_entry;
 
 struct pdf_ocg_entry_s
@@ -255,6 +284,11 @@ struct pdf_document_s
 	int num_type3_fonts;
 	int max_type3_fonts;
 	fz_font **type3_fonts;
+
+	int shared;
+	int lock; /* FZ_LOCK_DOCUMENT stripe, once shared */
+
+	pdf_obj_arena *arena;
 };
 
 /*
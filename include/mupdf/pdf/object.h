@@ -11,6 +11,18 @@ typedef struct pdf_document_s pdf_document;
 
 typedef struct pdf_obj_s pdf_obj;
 
+/*
+	pdf_new_obj_arena: Create the allocator that a document's arrays,
+	dicts and indirect references are carved from, and that interns
+	its names. Called by pdf_new_document.
+
+	pdf_drop_obj_arena: Called as the document is closed. Objects that
+	are still alive keep the arena's memory until they are dropped.
+*/
+typedef struct pdf_obj_arena_s pdf_obj_arena;
+pdf_obj_arena *pdf_new_obj_arena(fz_context *ctx, pdf_document *doc);
+void pdf_drop_obj_arena(fz_context *ctx, pdf_obj_arena *arena);
+
 pdf_obj *pdf_new_null(fz_context *ctx, pdf_document *doc);
 pdf_obj *pdf_new_bool(fz_context *ctx, pdf_document *doc, int b);
 pdf_obj *pdf_new_int(fz_context *ctx, pdf_document *doc, int i);
@@ -150,6 +162,13 @@ fz_matrix *pdf_to_matrix(fz_context *ctx, pdf_obj *array, fz_matrix *mat);
 
 pdf_document *pdf_get_indirect_document(fz_context *ctx, pdf_obj *obj);
 void pdf_set_str_len(fz_context *ctx, pdf_obj *obj, int newlen);
+
+/*
+	pdf_set_int: Change the value of an integer object in place. Small
+	integers are stored inline rather than allocated and cannot be
+	changed; only objects made with a value outside +/- 2^28 (such as
+	INT_MIN placeholders) can be updated this way.
+*/
 void pdf_set_int(fz_context *ctx, pdf_obj *obj, int i);
 void pdf_set_int_offset(fz_context *ctx, pdf_obj *obj, fz_off_t i);
 
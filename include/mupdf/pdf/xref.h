@@ -49,12 +49,23 @@ enum
 
 typedef struct pdf_xref_subsec_s pdf_xref_subsec;
 
+/*
+	Large subsections are read lazily: table is left NULL and the
+	entries are decoded in blocks on first use, either from the
+	20 byte records of a classic table still on disk (at disk_ofs)
+	or from the packed records of an xref stream (packed, with
+	field widths w). Solidifying a subsection decodes it fully.
+*/
 struct pdf_xref_subsec_s
 {
 	pdf_xref_subsec *next;
 	int len;
 	fz_off_t start;
 	pdf_xref_entry *table;
+	pdf_xref_entry **blocks;
+	fz_off_t disk_ofs;
+	unsigned char *packed;
+	unsigned char w[3];
 };
 
 struct pdf_xref_s
@@ -112,6 +123,22 @@ int pdf_repair_obj(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf, fz_off_t
 
 pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum);
 
+/*
+	pdf_hinted_page_ranges: Find where in a linearized file the data
+	for a page lives, as given by its hint tables.
+
+	For the first page this is the first page section. For others it
+	is the page's own section followed by each shared object group it
+	uses, or while the hint tables have not been read yet, the hint
+	stream itself. Documents that are not being read linearly give
+	no ranges.
+
+	ranges: Array to fill in, may be NULL if max is 0.
+
+	Returns the number of ranges, which may be more than max.
+*/
+int pdf_hinted_page_ranges(fz_context *ctx, pdf_document *doc, int pagenum, fz_range *ranges, int max);
+
 void pdf_print_xref(fz_context *ctx, pdf_document *);
 
 #endif
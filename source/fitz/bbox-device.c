@@ -11,8 +11,28 @@ typedef struct fz_bbox_device_s
 	fz_rect stack[STACK_SIZE];
 	/* mask content and tiles are ignored */
 	int ignore;
+	/* skip marks that leave no ink on a white page */
+	int ink;
 } fz_bbox_device;
 
+static int
+fz_bbox_is_blank(fz_context *ctx, fz_device *dev, fz_colorspace *colorspace, float *color, float alpha)
+{
+	fz_bbox_device *bdev = (fz_bbox_device*)dev;
+	float gray;
+
+	if (!bdev->ink)
+		return 0;
+	if (alpha == 0)
+		return 1;
+	if (!colorspace)
+		return 0;
+
+	/* Anything that would draw as 255 in a gray pixmap is white. */
+	fz_convert_color(ctx, fz_device_gray(ctx), &gray, colorspace, color);
+	return gray * 255 >= 254.5f;
+}
+
 static void
 fz_bbox_add_rect(fz_context *ctx, fz_device *dev, const fz_rect *rect, int clip)
 {
@@ -38,6 +58,8 @@ fz_bbox_fill_path(fz_context *ctx, fz_device *dev, fz_path *path, int even_odd,
 	fz_colorspace *colorspace, float *color, float alpha)
 {
 	fz_rect r;
+	if (fz_bbox_is_blank(ctx, dev, colorspace, color, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_bound_path(ctx, path, NULL, ctm, &r), 0);
 }
 
@@ -46,6 +68,8 @@ fz_bbox_stroke_path(fz_context *ctx, fz_device *dev, fz_path *path, fz_stroke_st
 	const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
 {
 	fz_rect r;
+	if (fz_bbox_is_blank(ctx, dev, colorspace, color, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_bound_path(ctx, path, stroke, ctm, &r), 0);
 }
 
@@ -54,6 +78,8 @@ fz_bbox_fill_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matri
 	fz_colorspace *colorspace, float *color, float alpha)
 {
 	fz_rect r;
+	if (fz_bbox_is_blank(ctx, dev, colorspace, color, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_bound_text(ctx, text, NULL, ctm, &r), 0);
 }
 
@@ -62,6 +88,8 @@ fz_bbox_stroke_text(fz_context *ctx, fz_device *dev, fz_text *text, fz_stroke_st
 	const fz_matrix *ctm, fz_colorspace *colorspace, float *color, float alpha)
 {
 	fz_rect r;
+	if (fz_bbox_is_blank(ctx, dev, colorspace, color, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_bound_text(ctx, text, stroke, ctm, &r), 0);
 }
 
@@ -69,6 +97,8 @@ static void
 fz_bbox_fill_shade(fz_context *ctx, fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha)
 {
 	fz_rect r;
+	if (fz_bbox_is_blank(ctx, dev, NULL, NULL, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_bound_shade(ctx, shade, ctm, &r), 0);
 }
 
@@ -76,6 +106,8 @@ static void
 fz_bbox_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
 {
 	fz_rect r = fz_unit_rect;
+	if (fz_bbox_is_blank(ctx, dev, NULL, NULL, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_transform_rect(&r, ctm), 0);
 }
 
@@ -84,6 +116,8 @@ fz_bbox_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const
 	fz_colorspace *colorspace, float *color, float alpha)
 {
 	fz_rect r = fz_unit_rect;
+	if (fz_bbox_is_blank(ctx, dev, colorspace, color, alpha))
+		return;
 	fz_bbox_add_rect(ctx, dev, fz_transform_rect(&r, ctm), 0);
 }
 
@@ -224,8 +258,17 @@ fz_new_bbox_device(fz_context *ctx, fz_rect *result)
 	dev->result = result;
 	dev->top = 0;
 	dev->ignore = 0;
+	dev->ink = 0;
 
 	*result = fz_empty_rect;
 
 	return (fz_device*)dev;
 }
+
+fz_device *
+fz_new_ink_device(fz_context *ctx, fz_rect *result)
+{
+	fz_bbox_device *dev = (fz_bbox_device*)fz_new_bbox_device(ctx, result);
+	dev->ink = 1;
+	return (fz_device*)dev;
+}
@@ -43,17 +43,13 @@ fz_new_buffer_from_data(fz_context *ctx, unsigned char *data, int size)
 fz_buffer *
 fz_keep_buffer(fz_context *ctx, fz_buffer *buf)
 {
-	if (buf)
-		buf->refs ++;
-	return buf;
+	return fz_keep_imp(ctx, buf, &buf->refs);
 }
 
 void
 fz_drop_buffer(fz_context *ctx, fz_buffer *buf)
 {
-	if (!buf)
-		return;
-	if (--buf->refs == 0)
+	if (fz_drop_imp(ctx, buf, &buf->refs))
 	{
 		fz_free(ctx, buf->data);
 		fz_free(ctx, buf);
@@ -1244,6 +1244,19 @@ fz_new_indexed_colorspace(fz_context *ctx, fz_colorspace *base, int high, unsign
 	return cs;
 }
 
+fz_colorspace *
+fz_indexed_colorspace_data(fz_context *ctx, fz_colorspace *cs, int *high, unsigned char **lookup)
+{
+	struct indexed *idx;
+
+	if (!fz_colorspace_is_indexed(ctx, cs))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "colorspace is not indexed");
+	idx = cs->data;
+	*high = idx->high;
+	*lookup = idx->lookup;
+	return idx->base;
+}
+
 fz_pixmap *
 fz_expand_indexed_pixmap(fz_context *ctx, fz_pixmap *src)
 {
@@ -237,10 +237,17 @@ fz_clone_context_internal(fz_context *ctx)
 	new_ctx->id = fz_keep_id_context(new_ctx);
 	new_ctx->handler = ctx->handler;
 	new_ctx->handler = fz_keep_document_handler_context(new_ctx);
+	new_ctx->parallel = ctx->parallel;
 
 	return new_ctx;
 }
 
+void
+fz_set_parallel_context(fz_context *ctx, fz_parallel_context *parallel)
+{
+	ctx->parallel = parallel;
+}
+
 int
 fz_gen_id(fz_context *ctx)
 {
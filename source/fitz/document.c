@@ -157,14 +157,13 @@ fz_new_document(fz_context *ctx, int size)
 fz_document *
 fz_keep_document(fz_context *ctx, fz_document *doc)
 {
-	++doc->refs;
-	return doc;
+	return fz_keep_imp(ctx, doc, &doc->refs);
 }
 
 void
 fz_drop_document(fz_context *ctx, fz_document *doc)
 {
-	if (doc && --doc->refs == 0 && doc->close)
+	if (fz_drop_imp(ctx, doc, &doc->refs) && doc->close)
 		doc->close(ctx, doc);
 }
 
@@ -217,6 +216,7 @@ fz_layout_document(fz_context *ctx, fz_document *doc, float w, float h, float em
 	{
 		doc->layout(ctx, doc, w, h, em);
 		doc->did_layout = 1;
+		doc->id = 0;
 	}
 }
 
@@ -985,7 +985,7 @@ fz_gridfit_matrix(int as_tiled, fz_matrix *m)
 /* Draw an image with an affine transform on destination */
 
 static void
-fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, byte *color, int alpha, int lerp_allowed, int as_tiled)
+fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, int img_x, int img_y, int whole_w, int whole_h, const fz_matrix *ctm, byte *color, int alpha, int lerp_allowed, int as_tiled)
 {
 	byte *dp, *sp, *hp;
 	int u, v, fa, fb, fc, fd;
@@ -1006,17 +1006,17 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 	is_rectilinear = fz_is_rectilinear(&local_ctm);
 	if (!is_rectilinear)
 		dolerp = lerp_allowed;
-	if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > img->w)
+	if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > whole_w)
 		dolerp = lerp_allowed;
-	if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > img->h)
+	if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > whole_h)
 		dolerp = lerp_allowed;
 
 	/* except when we shouldn't, at large magnifications */
 	if (!img->interpolate)
 	{
-		if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > img->w * 2)
+		if (sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b) > whole_w * 2)
 			dolerp = 0;
-		if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > img->h * 2)
+		if (sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d) > whole_h * 2)
 			dolerp = 0;
 	}
 
@@ -1042,7 +1042,7 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 		return;
 
 	/* map from screen space (x,y) to image space (u,v) */
-	fz_pre_scale(&local_ctm, 1.0f / img->w, 1.0f / img->h);
+	fz_pre_scale(&local_ctm, 1.0f / whole_w, 1.0f / whole_h);
 	fz_invert_matrix(&local_ctm, &local_ctm);
 
 	fa = (int)(local_ctm.a *= 65536.0f);
@@ -1073,6 +1073,10 @@ fz_paint_image_imp(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz
 		}
 	}
 
+	/* Move from the whole image to the part of it we have */
+	u -= img_x << 16;
+	v -= img_y << 16;
+
 	dp = dst->samples + (unsigned int)(((y - dst->y) * dst->w + (x - dst->x)) * dst->n);
 	n = dst->n;
 	sp = img->samples;
@@ -1131,12 +1135,26 @@ void
 fz_paint_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, byte *color, int lerp_allowed, int as_tiled)
 {
 	assert(img->n == 1);
-	fz_paint_image_imp(dst, scissor, shape, img, ctm, color, 255, lerp_allowed, as_tiled);
+	fz_paint_image_imp(dst, scissor, shape, img, 0, 0, img->w, img->h, ctm, color, 255, lerp_allowed, as_tiled);
 }
 
 void
 fz_paint_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, int alpha, int lerp_allowed, int as_tiled)
 {
 	assert(dst->n == img->n || (dst->n == 4 && img->n == 2));
-	fz_paint_image_imp(dst, scissor, shape, img, ctm, NULL, alpha, lerp_allowed, as_tiled);
+	fz_paint_image_imp(dst, scissor, shape, img, 0, 0, img->w, img->h, ctm, NULL, alpha, lerp_allowed, as_tiled);
+}
+
+void
+fz_paint_sub_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, int whole_w, int whole_h, const fz_matrix *ctm, byte *color, int lerp_allowed, int as_tiled)
+{
+	assert(img->n == 1);
+	fz_paint_image_imp(dst, scissor, shape, img, img->x, img->y, whole_w, whole_h, ctm, color, 255, lerp_allowed, as_tiled);
+}
+
+void
+fz_paint_sub_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, int whole_w, int whole_h, const fz_matrix *ctm, int alpha, int lerp_allowed, int as_tiled)
+{
+	assert(dst->n == img->n || (dst->n == 4 && img->n == 2));
+	fz_paint_image_imp(dst, scissor, shape, img, img->x, img->y, whole_w, whole_h, ctm, NULL, alpha, lerp_allowed, as_tiled);
 }
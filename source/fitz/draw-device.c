@@ -1030,8 +1030,17 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 		fz_knockout_end(ctx, dev);
 }
 
+/* Scale image, which is whole_w x whole_h or a part of an image that size */
 static fz_pixmap *
-fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, fz_matrix *ctm, int x, int y, int dx, int dy, int gridfit, const fz_irect *clip)
+scale_image_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, int whole_w, int whole_h, float x, float y, float w, float h, const fz_irect *clip)
+{
+	if (image->w == whole_w && image->h == whole_h)
+		return fz_scale_pixmap_cached(ctx, image, x, y, w, h, clip, dev->cache_x, dev->cache_y);
+	return fz_scale_sub_pixmap_cached(ctx, image, whole_w, whole_h, x, y, w, h, clip, dev->cache_x, dev->cache_y);
+}
+
+static fz_pixmap *
+fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, int whole_w, int whole_h, fz_matrix *ctm, int x, int y, int dx, int dy, int gridfit, const fz_irect *clip)
 {
 	fz_pixmap *scaled;
 
@@ -1043,7 +1052,7 @@ fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, fz_m
 		{
 			fz_gridfit_matrix(dev->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED, &m);
 		}
-		scaled = fz_scale_pixmap_cached(ctx, image, m.e, m.f, m.a, m.d, clip, dev->cache_x, dev->cache_y);
+		scaled = scale_image_pixmap(ctx, dev, image, whole_w, whole_h, m.e, m.f, m.a, m.d, clip);
 		if (!scaled)
 			return NULL;
 		ctm->a = scaled->w;
@@ -1067,7 +1076,7 @@ fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, fz_m
 			rclip.x1 = clip->y1;
 			rclip.y1 = clip->x1;
 		}
-		scaled = fz_scale_pixmap_cached(ctx, image, m.f, m.e, m.b, m.c, (clip ? &rclip : NULL), dev->cache_x, dev->cache_y);
+		scaled = scale_image_pixmap(ctx, dev, image, whole_w, whole_h, m.f, m.e, m.b, m.c, (clip ? &rclip : NULL));
 		if (!scaled)
 			return NULL;
 		ctm->b = scaled->w;
@@ -1087,6 +1096,40 @@ fz_transform_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *image, fz_m
 	return NULL;
 }
 
+/* Get the pixmap for an image, decoding only the part of it that can be
+ * seen through the clip when the image layer thinks that worthwhile. The
+ * part is a window onto the whole image as decoded, so the scaler and
+ * painter can place it exactly where the whole image's pixels would go.
+ * Only done for rectilinear transforms, where the scaler handles it. */
+static fz_pixmap *
+get_visible_image_pixmap(fz_context *ctx, fz_image *image, const fz_matrix *ctm, const fz_irect *clip, int dx, int dy, int *whole_w, int *whole_h)
+{
+	fz_irect subarea;
+	fz_matrix inv;
+	fz_rect r;
+	int margin;
+
+	if (!fz_is_rectilinear(ctm) || fz_is_empty_irect(clip) || fz_try_invert_matrix(&inv, ctm))
+		return fz_image_get_sub_pixmap(ctx, image, NULL, dx, dy, whole_w, whole_h);
+
+	fz_rect_from_irect(&r, clip);
+	fz_transform_rect(&r, &inv);
+	fz_intersect_rect(&r, &fz_unit_rect);
+	if (fz_is_empty_rect(&r))
+		return fz_image_get_sub_pixmap(ctx, image, NULL, dx, dy, whole_w, whole_h);
+
+	/* Leave room around the visible area for the scaler's filter and
+	 * grid fitting, which each reach a device pixel or so beyond it,
+	 * and for the neighbours used when interpolating. */
+	margin = 2 + 4 * (int)ceilf(fz_max((float)image->w / fz_maxi(dx, 1), (float)image->h / fz_maxi(dy, 1)));
+	subarea.x0 = (int)floorf(r.x0 * image->w) - margin;
+	subarea.y0 = (int)floorf(r.y0 * image->h) - margin;
+	subarea.x1 = (int)ceilf(r.x1 * image->w) + margin;
+	subarea.y1 = (int)ceilf(r.y1 * image->h) + margin;
+
+	return fz_image_get_sub_pixmap(ctx, image, &subarea, dx, dy, whole_w, whole_h);
+}
+
 static void
 fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_matrix *ctm, float alpha)
 {
@@ -1096,7 +1139,7 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 	fz_pixmap *pixmap;
 	fz_pixmap *orig_pixmap;
 	int after;
-	int dx, dy;
+	int dx, dy, whole_w, whole_h, part;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
 	fz_irect clip;
@@ -1118,8 +1161,9 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
 
-	pixmap = fz_image_get_pixmap(ctx, image, dx, dy);
+	pixmap = get_visible_image_pixmap(ctx, image, &local_ctm, &clip, dx, dy, &whole_w, &whole_h);
 	orig_pixmap = pixmap;
+	part = (pixmap->w != whole_w || pixmap->h != whole_h);
 
 	/* convert images with more components (cmyk->rgb) before scaling */
 	/* convert images with fewer components (gray->rgb after scaling */
@@ -1143,11 +1187,11 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 			pixmap = converted;
 		}
 
-		if (dx < pixmap->w && dy < pixmap->h && !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES))
+		if (dx < whole_w && dy < whole_h && !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES))
 		{
 			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(ctx, dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
-			if (!scaled)
+			scaled = fz_transform_pixmap(ctx, dev, pixmap, whole_w, whole_h, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			if (!scaled && !part)
 			{
 				if (dx < 1)
 					dx = 1;
@@ -1156,7 +1200,10 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 				scaled = fz_scale_pixmap_cached(ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL, dev->cache_x, dev->cache_y);
 			}
 			if (scaled)
+			{
 				pixmap = scaled;
+				part = 0;
+			}
 		}
 
 		if (pixmap->colorspace != model)
@@ -1176,7 +1223,10 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 			}
 		}
 
-		fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
+		if (!part)
+			fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
+		else
+			fz_paint_sub_image(state->dest, &state->scissor, state->shape, pixmap, whole_w, whole_h, &local_ctm, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
 
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
 			fz_knockout_end(ctx, dev);
@@ -1203,7 +1253,7 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 	fz_pixmap *scaled = NULL;
 	fz_pixmap *pixmap;
 	fz_pixmap *orig_pixmap;
-	int dx, dy;
+	int dx, dy, whole_w, whole_h, part;
 	int i;
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model = state->dest->colorspace;
@@ -1218,19 +1268,20 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 
 	dx = sqrtf(local_ctm.a * local_ctm.a + local_ctm.b * local_ctm.b);
 	dy = sqrtf(local_ctm.c * local_ctm.c + local_ctm.d * local_ctm.d);
-	pixmap = fz_image_get_pixmap(ctx, image, dx, dy);
+	pixmap = get_visible_image_pixmap(ctx, image, &local_ctm, &clip, dx, dy, &whole_w, &whole_h);
 	orig_pixmap = pixmap;
+	part = (pixmap->w != whole_w || pixmap->h != whole_h);
 
 	fz_try(ctx)
 	{
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
 			state = fz_knockout_begin(ctx, dev);
 
-		if (dx < pixmap->w && dy < pixmap->h)
+		if (dx < whole_w && dy < whole_h)
 		{
 			int gridfit = alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(ctx, dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
-			if (!scaled)
+			scaled = fz_transform_pixmap(ctx, dev, pixmap, whole_w, whole_h, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			if (!scaled && !part)
 			{
 				if (dx < 1)
 					dx = 1;
@@ -1239,7 +1290,10 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 				scaled = fz_scale_pixmap_cached(ctx, pixmap, pixmap->x, pixmap->y, dx, dy, NULL, dev->cache_x, dev->cache_y);
 			}
 			if (scaled)
+			{
 				pixmap = scaled;
+				part = 0;
+			}
 		}
 
 		fz_convert_color(ctx, model, colorfv, colorspace, color);
@@ -1247,7 +1301,10 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 			colorbv[i] = colorfv[i] * 255;
 		colorbv[i] = alpha * 255;
 
-		fz_paint_image_with_color(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, colorbv, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
+		if (!part)
+			fz_paint_image_with_color(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, colorbv, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
+		else
+			fz_paint_sub_image_with_color(state->dest, &state->scissor, state->shape, pixmap, whole_w, whole_h, &local_ctm, colorbv, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
 
 		if (scaled)
 			fz_drop_pixmap(ctx, scaled);
@@ -1341,7 +1398,7 @@ fz_draw_clip_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 		if (dx < pixmap->w && dy < pixmap->h)
 		{
 			int gridfit = !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3);
-			scaled = fz_transform_pixmap(ctx, dev, pixmap, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
+			scaled = fz_transform_pixmap(ctx, dev, pixmap, pixmap->w, pixmap->h, &local_ctm, state->dest->x, state->dest->y, dx, dy, gridfit, &clip);
 			if (!scaled)
 			{
 				if (dx < 1)
@@ -6,7 +6,16 @@
 
 #define GLYPH_HASH_LEN 509
 
+/* Each stripe of the cache has its own lock (FZ_LOCK_GLYPHCACHE + stripe),
+ * LRU list and share of MAX_CACHE_SIZE. A hash bucket belongs to stripe
+ * (bucket % FZ_GLYPH_CACHE_STRIPES), so threads drawing different glyphs
+ * mostly take different locks. */
+#define STRIPE_OF(hash) ((hash) % FZ_GLYPH_CACHE_STRIPES)
+#define STRIPE_LOCK(s) (FZ_LOCK_GLYPHCACHE + (s))
+#define MAX_STRIPE_SIZE (MAX_CACHE_SIZE / FZ_GLYPH_CACHE_STRIPES)
+
 typedef struct fz_glyph_cache_entry_s fz_glyph_cache_entry;
+typedef struct fz_glyph_cache_stripe_s fz_glyph_cache_stripe;
 typedef struct fz_glyph_key_s fz_glyph_key;
 
 struct fz_glyph_key_s
@@ -23,6 +32,7 @@ struct fz_glyph_cache_entry_s
 {
 	fz_glyph_key key;
 	unsigned hash;
+	int used; /* hit since it last reached the LRU tail */
 	fz_glyph_cache_entry *lru_prev;
 	fz_glyph_cache_entry *lru_next;
 	fz_glyph_cache_entry *bucket_next;
@@ -30,45 +40,53 @@ struct fz_glyph_cache_entry_s
 	fz_glyph *val;
 };
 
-struct fz_glyph_cache_s
+struct fz_glyph_cache_stripe_s
 {
-	int refs;
 	int total;
-#ifndef NDEBUG
+	int count;
+	int hits;
+	int misses;
 	int num_evictions;
 	int evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
 };
 
+struct fz_glyph_cache_s
+{
+	int refs;
+	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	fz_glyph_cache_stripe stripe[FZ_GLYPH_CACHE_STRIPES];
+};
+
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
 }
 
+/* The lock for the entry's stripe is always held when this is called. */
 static void
 drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_stripe *stripe = &cache->stripe[STRIPE_OF(entry->hash)];
 
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		stripe->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		stripe->lru_head = entry->lru_next;
+	stripe->total -= fz_glyph_size(ctx, entry->val);
+	stripe->count--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
@@ -80,45 +98,68 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* Drop the entries of a stripe for the given font (or all of them, for
+ * NULL). The stripe's lock is always held when this is called. */
 static void
-do_purge(fz_context *ctx)
+do_purge(fz_context *ctx, int s, fz_font *font)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-	int i;
+	fz_glyph_cache_stripe *stripe = &ctx->glyph_cache->stripe[s];
+	fz_glyph_cache_entry *entry, *next;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (entry = stripe->lru_head; entry; entry = next)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		next = entry->lru_next;
+		if (!font || entry->key.font == font)
+			drop_glyph_cache_entry(ctx, entry);
 	}
-
-	cache->total = 0;
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	int s;
+
+	for (s = 0; s < FZ_GLYPH_CACHE_STRIPES; s++)
+	{
+		fz_lock(ctx, STRIPE_LOCK(s));
+		do_purge(ctx, s, NULL);
+		fz_unlock(ctx, STRIPE_LOCK(s));
+	}
+}
+
+void
+fz_purge_glyph_cache_font(fz_context *ctx, fz_font *font)
+{
+	int s;
+
+	if (!font)
+		return;
+
+	for (s = 0; s < FZ_GLYPH_CACHE_STRIPES; s++)
+	{
+		fz_lock(ctx, STRIPE_LOCK(s));
+		do_purge(ctx, s, font);
+		fz_unlock(ctx, STRIPE_LOCK(s));
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	int refs;
+
 	if (!ctx->glyph_cache)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	refs = --ctx->glyph_cache->refs;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	if (refs == 0)
 	{
-		do_purge(ctx);
+		fz_purge_glyph_cache(ctx);
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
 fz_glyph_cache *
@@ -221,7 +262,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_stripe *stripe, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -231,25 +272,66 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		stripe->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = stripe->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	stripe->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
+/* Look for a glyph in the cache, with the lock for its stripe held. Hits
+ * only mark the entry as used; the LRU list is put in order lazily, as
+ * entries reach its tail during eviction. */
+static fz_glyph *
+find_glyph(fz_context *ctx, fz_glyph_cache *cache, fz_glyph_key *key, unsigned hash)
+{
+	fz_glyph_cache_entry *entry;
+
+	for (entry = cache->entry[hash]; entry; entry = entry->bucket_next)
+	{
+		if (memcmp(&entry->key, key, sizeof(*key)) == 0)
+		{
+			entry->used = 1;
+			return fz_keep_glyph(ctx, entry->val);
+		}
+	}
+	return NULL;
+}
+
+/* Evict until the stripe fits its share of the cache, giving entries that
+ * have been used since they were last at the tail a second chance. */
+static void
+trim_stripe(fz_context *ctx, fz_glyph_cache_stripe *stripe)
+{
+	fz_glyph_cache_entry *entry;
+
+	while (stripe->total > MAX_STRIPE_SIZE && (entry = stripe->lru_tail) != NULL)
+	{
+		if (entry->used && entry != stripe->lru_head)
+		{
+			entry->used = 0;
+			move_to_front(stripe, entry);
+			continue;
+		}
+		stripe->num_evictions++;
+		stripe->evicted += fz_glyph_size(ctx, entry->val);
+		drop_glyph_cache_entry(ctx, entry);
+	}
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_stripe *stripe;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
 	float size;
-	fz_glyph *val;
-	int do_cache, locked, caching;
+	fz_glyph *val, *existing;
+	int do_cache, locked, caching, lock;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 
@@ -286,24 +368,30 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = fz_aa_level(ctx);
 
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
 	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	entry = cache->entry[hash];
-	while (entry)
+	stripe = &cache->stripe[STRIPE_OF(hash)];
+	lock = STRIPE_LOCK(STRIPE_OF(hash));
+
+	fz_lock(ctx, lock);
+	val = find_glyph(ctx, cache, &key, hash);
+	if (val)
 	{
-		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-		{
-			move_to_front(cache, entry);
-			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			return val;
-		}
-		entry = entry->bucket_next;
+		stripe->hits++;
+		fz_unlock(ctx, lock);
+		return val;
 	}
-
-	locked = 1;
+	stripe->misses++;
+
+	/* We drop the lock while we render, so that other threads can
+	 * use the cache in the meantime. The danger here is that some other
+	 * thread will come along, and want the same glyph too. If it does,
+	 * we may both end up rendering it. We cope with this later on, by
+	 * ensuring that only one gets inserted into the cache. If we insert
+	 * ours to find one already there, we abandon ours, and use the one
+	 * there already. */
+	fz_unlock(ctx, lock);
+	locked = 0;
 	caching = 0;
-	val = NULL;
 
 	fz_try(ctx)
 	{
@@ -313,20 +401,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		}
 		else if (font->t3procs)
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, &subpix_ctm, model, scissor);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
 		}
 		else
 		{
@@ -339,22 +414,17 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!font->ft_face)
+				fz_lock(ctx, lock);
+				locked = 1;
+
+				/* Someone else might have rendered it in the
+				 * meantime. */
+				existing = find_glyph(ctx, cache, &key, hash);
+				if (existing)
 				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
+					fz_drop_glyph(ctx, val);
+					val = existing;
+					goto unlock_and_return_val;
 				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
@@ -367,23 +437,16 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
-				entry->lru_next = cache->lru_head;
+				entry->lru_next = stripe->lru_head;
 				if (entry->lru_next)
 					entry->lru_next->lru_prev = entry;
 				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
-
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+					stripe->lru_tail = entry;
+				stripe->lru_head = entry;
 
+				stripe->total += fz_glyph_size(ctx, val);
+				stripe->count++;
+				trim_stripe(ctx, stripe);
 			}
 		}
 unlock_and_return_val:
@@ -393,7 +456,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 	}
 	fz_catch(ctx)
 	{
@@ -452,9 +515,53 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_stripe *stripe;
+	fz_glyph_cache_entry *entry;
+	struct { fz_font *font; int count, total; } fonts[16];
+	int nfonts = 0, other_count = 0, other_total = 0;
+	int total = 0, count = 0, hits = 0, misses = 0, num_evictions = 0, evicted = 0;
+	int s, i;
+
+	for (s = 0; s < FZ_GLYPH_CACHE_STRIPES; s++)
+	{
+		fz_lock(ctx, STRIPE_LOCK(s));
+		stripe = &cache->stripe[s];
+		total += stripe->total;
+		count += stripe->count;
+		hits += stripe->hits;
+		misses += stripe->misses;
+		num_evictions += stripe->num_evictions;
+		evicted += stripe->evicted;
+		for (entry = stripe->lru_head; entry; entry = entry->lru_next)
+		{
+			for (i = 0; i < nfonts; i++)
+				if (fonts[i].font == entry->key.font)
+					break;
+			if (i == nfonts && nfonts < (int)nelem(fonts))
+			{
+				fonts[i].font = entry->key.font;
+				fonts[i].count = fonts[i].total = 0;
+				nfonts++;
+			}
+			if (i < nfonts)
+			{
+				fonts[i].count++;
+				fonts[i].total += fz_glyph_size(ctx, entry->val);
+			}
+			else
+			{
+				other_count++;
+				other_total += fz_glyph_size(ctx, entry->val);
+			}
+		}
+		fz_unlock(ctx, STRIPE_LOCK(s));
+	}
 
-	printf("Glyph Cache Size: %d\n", cache->total);
-#ifndef NDEBUG
-	printf("Glyph Cache Evictions: %d (%d bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	printf("Glyph Cache Size: %d (%d glyphs)\n", total, count);
+	printf("Glyph Cache Lookups: %d hits, %d misses\n", hits, misses);
+	printf("Glyph Cache Evictions: %d (%d bytes)\n", num_evictions, evicted);
+	for (i = 0; i < nfonts; i++)
+		printf("Glyph Cache Font %s: %d glyphs (%d bytes)\n", fonts[i].font->name, fonts[i].count, fonts[i].total);
+	if (other_count)
+		printf("Glyph Cache Other Fonts: %d glyphs (%d bytes)\n", other_count, other_total);
 }
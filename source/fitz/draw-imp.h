@@ -1,6 +1,21 @@
 #ifndef MUPDF_DRAW_IMP_H
 #define MUPDF_DRAW_IMP_H
 
+/*
+ * SIMD support: HAVE_SSE2 when the compiler targets SSE2, HAVE_AVX2 when
+ * it can also build AVX2 code for selection at runtime. Define FZ_NO_SIMD
+ * to build the plain C versions only.
+ */
+
+#if !defined(FZ_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HAVE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
 /*
  * Scan converter
  */
@@ -38,6 +53,14 @@ void fz_paint_span_with_color(unsigned char * restrict dp, unsigned char * restr
 void fz_paint_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, int alpha, int lerp_allowed, int gridfit_as_tiled);
 void fz_paint_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, const fz_matrix *ctm, unsigned char *colorbv, int lerp_allowed, int gridfit_as_tiled);
 
+/*
+ * As above, but img is only part of an image of whole_w x whole_h
+ * pixels; img->x and img->y give its position within it, and ctm
+ * maps the whole image.
+ */
+void fz_paint_sub_image(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, int whole_w, int whole_h, const fz_matrix *ctm, int alpha, int lerp_allowed, int gridfit_as_tiled);
+void fz_paint_sub_image_with_color(fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *img, int whole_w, int whole_h, const fz_matrix *ctm, unsigned char *colorbv, int lerp_allowed, int gridfit_as_tiled);
+
 void fz_paint_pixmap(fz_pixmap *dst, fz_pixmap *src, int alpha);
 void fz_paint_pixmap_with_mask(fz_pixmap *dst, fz_pixmap *src, fz_pixmap *msk);
 void fz_paint_pixmap_with_bbox(fz_pixmap *dst, fz_pixmap *src, int alpha, fz_irect bbox);
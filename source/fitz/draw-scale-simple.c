@@ -198,6 +198,8 @@ struct fz_scale_cache_s
 	int patch_r;
 	int n;
 	int flip;
+	int part_x;
+	int part_w;
 	fz_weights *weights;
 };
 
@@ -417,8 +419,35 @@ check_weights(fz_weights *weights, int j, int w, float x, float wf)
 		weights->index[maxidx-1] += 256-sum;
 }
 
+/* When only part of the source row is held, move the weights for dst[j]
+ * to index into that part. Any that would fall outside it are dropped. */
+static void
+window_weights(fz_weights *weights, int j, int part_x, int part_w)
+{
+	int idx = weights->index[j - weights->patch_l];
+	int min = weights->index[idx] - part_x;
+	int len = weights->index[idx+1];
+
+	if (min < 0)
+	{
+		int skip = fz_mini(-min, len);
+		len -= skip;
+		memmove(&weights->index[idx+2], &weights->index[idx+2+skip], sizeof(int)*len);
+		min = 0;
+	}
+	if (min + len > part_w)
+		len = part_w - min;
+	if (len <= 0)
+	{
+		min = 0;
+		len = 0;
+	}
+	weights->index[idx] = min;
+	weights->index[idx+1] = len;
+}
+
 static fz_weights *
-make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, fz_scale_cache *cache)
+make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *filter, int vertical, int dst_w_int, int patch_l, int patch_r, int n, int flip, int part_x, int part_w, fz_scale_cache *cache)
 {
 	fz_weights *weights;
 	float F, G;
@@ -431,7 +460,8 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 			cache->filter == filter && cache->vertical == vertical &&
 			cache->dst_w_int == dst_w_int &&
 			cache->patch_l == patch_l && cache->patch_r == patch_r &&
-			cache->n == n && cache->flip == flip)
+			cache->n == n && cache->flip == flip &&
+			cache->part_x == part_x && cache->part_w == part_w)
 		{
 			return cache->weights;
 		}
@@ -445,6 +475,8 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		cache->patch_r = patch_r;
 		cache->n = n;
 		cache->flip = flip;
+		cache->part_x = part_x;
+		cache->part_w = part_w;
 		fz_free(ctx, cache->weights);
 		cache->weights = NULL;
 	}
@@ -482,6 +514,10 @@ make_weights(fz_context *ctx, int src_w, float x, float dst_w, fz_scale_filter *
 		{
 			reorder_weights(weights, j, src_w);
 		}
+		else if (part_x != 0 || part_w != src_w)
+		{
+			window_weights(weights, j, part_x, part_w);
+		}
 	}
 	weights->count++; /* weights->count = dst_w_int now */
 	if (cache)
@@ -858,6 +894,168 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 }
 #else
 
+#ifdef HAVE_SSE2
+/*
+ * SSE2 versions of the inner loops below. They compute exactly what the
+ * C code does: pixels are widened to 16 bits and multiplied by pairs of
+ * 16 bit weights with pmaddwd, summing into 32 bit lanes that start at
+ * 128 just as the C accumulators do. The C code stores (val>>8) into a
+ * byte, which wraps for sums outside 0..255, so we mask to 8 bits before
+ * packing rather than letting the packs saturate. This relies on every
+ * weight fitting in 16 bits, which holds as they are scaled to sum to
+ * 256.
+ */
+
+static inline __m128i
+sse2_weight_pair(const int *contrib)
+{
+	return _mm_set1_epi32((contrib[0] & 0xFFFF) | ((unsigned int)contrib[1] << 16));
+}
+
+static inline __m128i
+sse2_weight_single(const int *contrib)
+{
+	return _mm_set1_epi32(contrib[0] & 0xFFFF);
+}
+
+static inline __m128i
+sse2_load32(const unsigned char *p)
+{
+	int v;
+	memcpy(&v, p, 4);
+	return _mm_cvtsi32_si128(v);
+}
+
+/* Shift the 32 bit sums down and keep the low byte of each. */
+static inline __m128i
+sse2_result(__m128i acc)
+{
+	return _mm_and_si128(_mm_srai_epi32(acc, 8), _mm_set1_epi32(0xFF));
+}
+
+/* Scale one output pixel of a 4 component row, returning its 4 bytes. */
+static inline int
+sse2_scale_pixel4(const unsigned char *min, const int *contrib, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_set1_epi32(128);
+	__m128i p;
+
+	for (; len >= 2; len -= 2, min += 8, contrib += 2)
+	{
+		/* r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1 */
+		p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+		p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, sse2_weight_pair(contrib)));
+	}
+	if (len)
+	{
+		p = _mm_unpacklo_epi8(sse2_load32(min), zero);
+		p = _mm_unpacklo_epi16(p, zero);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, sse2_weight_single(contrib)));
+	}
+	acc = sse2_result(acc);
+	acc = _mm_packs_epi32(acc, acc);
+	return _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+}
+
+/* Scale one output pixel of a 2 component row, returning its 2 bytes. */
+static inline int
+sse2_scale_pixel2(const unsigned char *min, const int *contrib, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_set1_epi32(128);
+	__m128i p;
+
+	for (; len >= 2; len -= 2, min += 4, contrib += 2)
+	{
+		/* g0 a0 g1 a1 -> g0 g1 a0 a1 */
+		p = _mm_unpacklo_epi8(sse2_load32(min), zero);
+		p = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 1, 2, 0));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, sse2_weight_pair(contrib)));
+	}
+	if (len)
+	{
+		p = _mm_set_epi32(0, 0, min[1], min[0]);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, sse2_weight_single(contrib)));
+	}
+	acc = sse2_result(acc);
+	return _mm_cvtsi128_si32(acc) | (_mm_cvtsi128_si32(_mm_srli_si128(acc, 4)) << 8);
+}
+
+/* Scale one output pixel of a 1 component row, 8 weights at a time. */
+static inline int
+sse2_scale_pixel1(const unsigned char *min, const int *contrib, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	__m128i p, w;
+	int val;
+
+	for (; len >= 8; len -= 8, min += 8, contrib += 8)
+	{
+		p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)min), zero);
+		w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), _mm_loadu_si128((const __m128i *)(contrib + 4)));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(p, w));
+	}
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+	acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+	val = 128 + _mm_cvtsi128_si32(acc);
+	while (len-- > 0)
+		val += *min++ * *contrib++;
+	return (unsigned char)(val>>8);
+}
+
+/*
+ * Vertical pass: 16 output bytes at a time, taking the temporary rows in
+ * pairs so that each pmaddwd applies two weights. Returns the number of
+ * bytes done; the C code does the rest.
+ */
+static int
+sse2_scale_row_from_temp(unsigned char *dst, const unsigned char *src, const int *contrib, int len, int width)
+{
+	__m128i zero = _mm_setzero_si128();
+	int x, k;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const unsigned char *min = src + x;
+		__m128i acc0 = _mm_set1_epi32(128);
+		__m128i acc1 = acc0;
+		__m128i acc2 = acc0;
+		__m128i acc3 = acc0;
+		__m128i a, b, w, lo, hi;
+
+		for (k = 0; k < len; k += 2)
+		{
+			a = _mm_loadu_si128((const __m128i *)min);
+			if (k + 1 < len)
+			{
+				b = _mm_loadu_si128((const __m128i *)(min + width));
+				w = sse2_weight_pair(contrib + k);
+			}
+			else
+			{
+				b = zero;
+				w = sse2_weight_single(contrib + k);
+			}
+			min += 2 * width;
+			/* a0 b0 a1 b1 ... as 16 bit lanes */
+			lo = _mm_unpacklo_epi8(a, b);
+			hi = _mm_unpackhi_epi8(a, b);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		}
+		lo = _mm_packs_epi32(sse2_result(acc0), sse2_result(acc1));
+		hi = _mm_packs_epi32(sse2_result(acc2), sse2_result(acc3));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	return x;
+}
+#endif /* HAVE_SSE2 */
+
 static void
 scale_row_to_temp1(unsigned char *dst, unsigned char *src, fz_weights *weights)
 {
@@ -871,6 +1069,12 @@ scale_row_to_temp1(unsigned char *dst, unsigned char *src, fz_weights *weights)
 		dst += weights->count;
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			min = &src[*contrib++];
+			len = *contrib++;
+			*--dst = sse2_scale_pixel1(min, contrib, len);
+			contrib += len;
+#else
 			int val = 128;
 			min = &src[*contrib++];
 			len = *contrib++;
@@ -879,12 +1083,19 @@ scale_row_to_temp1(unsigned char *dst, unsigned char *src, fz_weights *weights)
 				val += *min++ * *contrib++;
 			}
 			*--dst = (unsigned char)(val>>8);
+#endif
 		}
 	}
 	else
 	{
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			min = &src[*contrib++];
+			len = *contrib++;
+			*dst++ = sse2_scale_pixel1(min, contrib, len);
+			contrib += len;
+#else
 			int val = 128;
 			min = &src[*contrib++];
 			len = *contrib++;
@@ -893,6 +1104,7 @@ scale_row_to_temp1(unsigned char *dst, unsigned char *src, fz_weights *weights)
 				val += *min++ * *contrib++;
 			}
 			*dst++ = (unsigned char)(val>>8);
+#endif
 		}
 	}
 }
@@ -910,6 +1122,15 @@ scale_row_to_temp2(unsigned char *dst, unsigned char *src, fz_weights *weights)
 		dst += 2*weights->count;
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			int v;
+			min = &src[2 * *contrib++];
+			len = *contrib++;
+			v = sse2_scale_pixel2(min, contrib, len);
+			contrib += len;
+			*--dst = (unsigned char)(v>>8);
+			*--dst = (unsigned char)v;
+#else
 			int c1 = 128;
 			int c2 = 128;
 			min = &src[2 * *contrib++];
@@ -921,12 +1142,22 @@ scale_row_to_temp2(unsigned char *dst, unsigned char *src, fz_weights *weights)
 			}
 			*--dst = (unsigned char)(c2>>8);
 			*--dst = (unsigned char)(c1>>8);
+#endif
 		}
 	}
 	else
 	{
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			int v;
+			min = &src[2 * *contrib++];
+			len = *contrib++;
+			v = sse2_scale_pixel2(min, contrib, len);
+			contrib += len;
+			*dst++ = (unsigned char)v;
+			*dst++ = (unsigned char)(v>>8);
+#else
 			int c1 = 128;
 			int c2 = 128;
 			min = &src[2 * *contrib++];
@@ -938,6 +1169,7 @@ scale_row_to_temp2(unsigned char *dst, unsigned char *src, fz_weights *weights)
 			}
 			*dst++ = (unsigned char)(c1>>8);
 			*dst++ = (unsigned char)(c2>>8);
+#endif
 		}
 	}
 }
@@ -955,6 +1187,15 @@ scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
 		dst += 4*weights->count;
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			int v;
+			min = &src[4 * *contrib++];
+			len = *contrib++;
+			v = sse2_scale_pixel4(min, contrib, len);
+			contrib += len;
+			dst -= 4;
+			memcpy(dst, &v, 4);
+#else
 			int r = 128;
 			int g = 128;
 			int b = 128;
@@ -972,12 +1213,22 @@ scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
 			*--dst = (unsigned char)(b>>8);
 			*--dst = (unsigned char)(g>>8);
 			*--dst = (unsigned char)(r>>8);
+#endif
 		}
 	}
 	else
 	{
 		for (i=weights->count; i > 0; i--)
 		{
+#ifdef HAVE_SSE2
+			int v;
+			min = &src[4 * *contrib++];
+			len = *contrib++;
+			v = sse2_scale_pixel4(min, contrib, len);
+			contrib += len;
+			memcpy(dst, &v, 4);
+			dst += 4;
+#else
 			int r = 128;
 			int g = 128;
 			int b = 128;
@@ -995,6 +1246,7 @@ scale_row_to_temp4(unsigned char *dst, unsigned char *src, fz_weights *weights)
 			*dst++ = (unsigned char)(g>>8);
 			*dst++ = (unsigned char)(b>>8);
 			*dst++ = (unsigned char)(a>>8);
+#endif
 		}
 	}
 }
@@ -1007,7 +1259,16 @@ scale_row_from_temp(unsigned char *dst, unsigned char *src, fz_weights *weights,
 
 	contrib++; /* Skip min */
 	len = *contrib++;
-	for (x=width; x > 0; x--)
+	x = width;
+#ifdef HAVE_SSE2
+	{
+		int done = sse2_scale_row_from_temp(dst, src, contrib, len, width);
+		dst += done;
+		src += done;
+		x -= done;
+	}
+#endif
+	for (; x > 0; x--)
 	{
 		unsigned char *min = src;
 		int val = 128;
@@ -1172,27 +1433,105 @@ scale_single_col(unsigned char *dst, unsigned char *src, fz_weights *weights, in
 }
 #endif /* SINGLE_PIXEL_SPECIALS */
 
+/*
+ * The vertical pass for output rows row0 <= row < row1, scaling source
+ * rows into its own temporary buffer as they are needed. Bands share
+ * nothing else, so several may run at once.
+ */
+typedef struct fz_scale_band_s fz_scale_band;
+
+struct fz_scale_band_s
+{
+	fz_pixmap *src;
+	int src_y;	/* position of src within the whole source */
+	int src_h;	/* height of the whole source */
+	fz_pixmap *dst;
+	fz_weights *contrib_rows;
+	fz_weights *contrib_cols;
+	void (*row_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights);
+	unsigned char *temp;
+	int temp_span;
+	int temp_rows;
+	int flip_y;
+	int row0;
+	int row1;
+};
+
+static void
+scale_band(fz_scale_band *band)
+{
+	fz_weights *contrib_rows = band->contrib_rows;
+	fz_pixmap *src = band->src;
+	fz_pixmap *dst = band->dst;
+	unsigned char *temp = band->temp;
+	int temp_span = band->temp_span;
+	int temp_rows = band->temp_rows;
+	int max_row, row;
+
+	max_row = contrib_rows->index[contrib_rows->index[band->row0]];
+	for (row = band->row0; row < band->row1; row++)
+	{
+		/*
+		Which source rows do we need to have scaled into the
+		temporary buffer in order to be able to do the final
+		scale?
+		*/
+		int row_index = contrib_rows->index[row];
+		int row_min = contrib_rows->index[row_index++];
+		int row_len = contrib_rows->index[row_index];
+		while (max_row < row_min+row_len)
+		{
+			/* Scale another row */
+			int src_row = (band->flip_y ? (band->src_h-1-max_row): max_row) - band->src_y;
+			assert(max_row < band->src_h);
+			src_row = fz_clampi(src_row, 0, src->h-1);
+			(*band->row_scale)(&temp[temp_span*(max_row % temp_rows)], &src->samples[src_row*src->w*src->n], band->contrib_cols);
+			max_row++;
+		}
+
+		scale_row_from_temp(&dst->samples[row*dst->w*dst->n], temp, contrib_rows, temp_span, row);
+	}
+}
+
+static void
+scale_band_job(void *arg, int i)
+{
+	scale_band(&((fz_scale_band *)arg)[i]);
+}
+
+/*
+ * Scales producing fewer bytes than this, or bands of fewer rows, are not
+ * worth handing to other threads.
+ */
+#define PARALLEL_SCALE_MIN_BYTES (1<<20)
+#define PARALLEL_SCALE_MIN_ROWS 32
+
 fz_pixmap *
 fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, fz_irect *clip)
 {
 	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
 }
 
-fz_pixmap *
-fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+static fz_pixmap *
+fz_scale_pixmap_imp(fz_context *ctx, fz_pixmap *src, int src_x, int src_y, int whole_w, int whole_h, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
 {
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
 	fz_weights *contrib_cols = NULL;
 	fz_pixmap *output = NULL;
 	unsigned char *temp = NULL;
-	int max_row, temp_span, temp_rows, row;
+	fz_scale_band *bands = NULL;
+	int temp_span, temp_rows, nbands, i;
 	int dst_w_int, dst_h_int, dst_x_int, dst_y_int;
 	int flip_x, flip_y;
+#ifdef SINGLE_PIXEL_SPECIALS
+	int is_whole;
+#endif /* SINGLE_PIXEL_SPECIALS */
 	fz_rect patch;
 
 	fz_var(contrib_cols);
 	fz_var(contrib_rows);
+	fz_var(bands);
 
 	/* Avoid extreme scales where overflows become problematic. */
 	if (w > (1<<24) || h > (1<<24) || w < -(1<<24) || h < -(1<<24))
@@ -1336,21 +1675,27 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 	if (patch.x0 >= patch.x1 || patch.y0 >= patch.y1)
 		return NULL;
 
+#ifdef SINGLE_PIXEL_SPECIALS
+	is_whole = (src_x == 0 && src_y == 0 && src->w == whole_w && src->h == whole_h);
+#endif /* SINGLE_PIXEL_SPECIALS */
+
 	fz_try(ctx)
 	{
-		/* Step 1: Calculate the weights for columns and rows */
+		/* Step 1: Calculate the weights for columns and rows. These
+		 * are for the whole source; the columns they use are moved
+		 * into the part of it we have. */
 #ifdef SINGLE_PIXEL_SPECIALS
-		if (src->w == 1)
+		if (is_whole && src->w == 1)
 			contrib_cols = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_cols = make_weights(ctx, src->w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x, cache_x);
+			contrib_cols = make_weights(ctx, whole_w, x, w, filter, 0, dst_w_int, patch.x0, patch.x1, src->n, flip_x, src_x, src->w, cache_x);
 #ifdef SINGLE_PIXEL_SPECIALS
-		if (src->h == 1)
+		if (is_whole && src->h == 1)
 			contrib_rows = NULL;
 		else
 #endif /* SINGLE_PIXEL_SPECIALS */
-			contrib_rows = make_weights(ctx, src->h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y, cache_y);
+			contrib_rows = make_weights(ctx, whole_h, y, h, filter, 1, dst_h_int, patch.y0, patch.y1, src->n, flip_y, 0, whole_h, cache_y);
 
 		output = fz_new_pixmap(ctx, src->colorspace, patch.x1 - patch.x0, patch.y1 - patch.y0);
 	}
@@ -1390,17 +1735,30 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
 		void (*row_scale)(unsigned char *dst, unsigned char *src, fz_weights *weights);
+		fz_parallel_context *parallel = ctx->parallel;
 
 		temp_span = contrib_cols->count * src->n;
 		temp_rows = contrib_rows->max_len;
 		if (temp_span <= 0 || temp_rows > INT_MAX / temp_span)
 			goto cleanup;
+
+		/* Split large scales into bands of output rows, one per thread. */
+		nbands = 1;
+		if (parallel && parallel->threads > 1 && (size_t)output->w * output->h * output->n >= PARALLEL_SCALE_MIN_BYTES)
+		{
+			nbands = fz_mini(parallel->threads, contrib_rows->count / PARALLEL_SCALE_MIN_ROWS);
+			if (nbands < 1 || temp_span * temp_rows > INT_MAX / nbands)
+				nbands = 1;
+		}
+
 		fz_try(ctx)
 		{
-			temp = fz_calloc(ctx, temp_span*temp_rows, sizeof(unsigned char));
+			bands = fz_malloc_array(ctx, nbands, sizeof(*bands));
+			temp = fz_calloc(ctx, nbands, temp_span*temp_rows);
 		}
 		fz_catch(ctx)
 		{
+			fz_free(ctx, bands);
 			fz_drop_pixmap(ctx, output);
 			if (!cache_x)
 				fz_free(ctx, contrib_cols);
@@ -1423,28 +1781,28 @@ fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float
 			row_scale = scale_row_to_temp4;
 			break;
 		}
-		max_row = contrib_rows->index[contrib_rows->index[0]];
-		for (row = 0; row < contrib_rows->count; row++)
+		for (i = 0; i < nbands; i++)
 		{
-			/*
-			Which source rows do we need to have scaled into the
-			temporary buffer in order to be able to do the final
-			scale?
-			*/
-			int row_index = contrib_rows->index[row];
-			int row_min = contrib_rows->index[row_index++];
-			int row_len = contrib_rows->index[row_index];
-			while (max_row < row_min+row_len)
-			{
-				/* Scale another row */
-				assert(max_row < src->h);
-				(*row_scale)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->w*src->n], contrib_cols);
-				max_row++;
-			}
-
-			scale_row_from_temp(&output->samples[row*output->w*output->n], temp, contrib_rows, temp_span, row);
+			bands[i].src = src;
+			bands[i].src_y = src_y;
+			bands[i].src_h = whole_h;
+			bands[i].dst = output;
+			bands[i].contrib_rows = contrib_rows;
+			bands[i].contrib_cols = contrib_cols;
+			bands[i].row_scale = row_scale;
+			bands[i].temp = &temp[i*temp_span*temp_rows];
+			bands[i].temp_span = temp_span;
+			bands[i].temp_rows = temp_rows;
+			bands[i].flip_y = flip_y;
+			bands[i].row0 = (int)((int64_t)contrib_rows->count * i / nbands);
+			bands[i].row1 = (int)((int64_t)contrib_rows->count * (i+1) / nbands);
 		}
+		if (nbands > 1)
+			parallel->run(parallel->user, scale_band_job, bands, nbands);
+		else
+			scale_band(&bands[0]);
 		fz_free(ctx, temp);
+		fz_free(ctx, bands);
 	}
 
 cleanup:
@@ -1455,6 +1813,18 @@ cleanup:
 	return output;
 }
 
+fz_pixmap *
+fz_scale_pixmap_cached(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+{
+	return fz_scale_pixmap_imp(ctx, src, 0, 0, src->w, src->h, x, y, w, h, clip, cache_x, cache_y);
+}
+
+fz_pixmap *
+fz_scale_sub_pixmap_cached(fz_context *ctx, fz_pixmap *src, int whole_w, int whole_h, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+{
+	return fz_scale_pixmap_imp(ctx, src, src->x, src->y, whole_w, whole_h, x, y, w, h, clip, cache_x, cache_y);
+}
+
 void
 fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
@@ -15,9 +15,32 @@ struct null_filter
 	fz_stream *chain;
 	int remain;
 	fz_off_t offset;
+	fz_stream_memory mem;
 	unsigned char buffer[4096];
 };
 
+/* When the chain is held in memory we hand out the data where it lies,
+ * without copying and without touching the chain, so null filters from
+ * several threads can read from one shared file. */
+static int
+next_null_memory(fz_context *ctx, fz_stream *stm, int max)
+{
+	struct null_filter *state = stm->state;
+	int n;
+
+	if (state->remain == 0 || state->offset < 0 || state->offset >= state->mem.len)
+		return EOF;
+	n = state->remain;
+	if (n > state->mem.len - state->offset)
+		n = (int)(state->mem.len - state->offset);
+	stm->rp = state->mem.data + state->offset;
+	stm->wp = stm->rp + n;
+	state->remain -= n;
+	state->offset += n;
+	stm->pos += n;
+	return *stm->rp++;
+}
+
 static int
 next_null(fz_context *ctx, fz_stream *stm, int max)
 {
@@ -57,6 +80,7 @@ fz_stream *
 fz_open_null(fz_context *ctx, fz_stream *chain, int len, fz_off_t offset)
 {
 	struct null_filter *state;
+	int memory;
 
 	if (len < 0)
 		len = 0;
@@ -73,7 +97,8 @@ fz_open_null(fz_context *ctx, fz_stream *chain, int len, fz_off_t offset)
 		fz_rethrow(ctx);
 	}
 
-	return fz_new_stream(ctx, state, next_null, close_null);
+	memory = fz_stream_meta(ctx, chain, FZ_STREAM_META_MEMORY, sizeof state->mem, &state->mem) > 0;
+	return fz_new_stream(ctx, state, memory ? next_null_memory : next_null, close_null);
 }
 
 /* Concat filter concatenates several streams into one */
@@ -406,6 +406,28 @@ fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, in
 	return font;
 }
 
+fz_buffer *
+fz_font_file_data(fz_context *ctx, fz_font *font, int *index)
+{
+	FT_Face face = font->ft_face;
+
+	if (!face)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "font '%s' has no font file", font->name);
+
+	*index = face->face_index;
+	if (font->ft_buffer)
+		return fz_keep_buffer(ctx, font->ft_buffer);
+	if (face->stream && face->stream->base)
+	{
+		fz_buffer *buf = fz_new_buffer(ctx, face->stream->size);
+		fz_write_buffer(ctx, buf, face->stream->base, face->stream->size);
+		return buf;
+	}
+	if (font->ft_filepath)
+		return fz_read_file(ctx, font->ft_filepath);
+	fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find font file for '%s'", font->name);
+}
+
 static fz_matrix *
 fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm)
 {
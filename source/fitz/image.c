@@ -28,14 +28,16 @@ struct fz_image_key_s {
 	int refs;
 	fz_image *image;
 	int l2factor;
+	fz_irect rect;
 };
 
 static int
 fz_make_hash_image_key(fz_context *ctx, fz_store_hash *hash, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
-	hash->u.pi.ptr = key->image;
-	hash->u.pi.i = key->l2factor;
+	hash->u.pir.ptr = key->image;
+	hash->u.pir.i = key->l2factor;
+	hash->u.pir.r = key->rect;
 	return 1;
 }
 
@@ -62,7 +64,9 @@ fz_cmp_image_key(fz_context *ctx, void *k0_, void *k1_)
 {
 	fz_image_key *k0 = (fz_image_key *)k0_;
 	fz_image_key *k1 = (fz_image_key *)k1_;
-	return k0->image == k1->image && k0->l2factor == k1->l2factor;
+	return k0->image == k1->image && k0->l2factor == k1->l2factor &&
+		k0->rect.x0 == k1->rect.x0 && k0->rect.y0 == k1->rect.y0 &&
+		k0->rect.x1 == k1->rect.x1 && k0->rect.y1 == k1->rect.y1;
 }
 
 #ifndef NDEBUG
@@ -71,7 +75,10 @@ fz_debug_image(fz_context *ctx, FILE *out, void *key_)
 {
 	fz_image_key *key = (fz_image_key *)key_;
 
-	fprintf(out, "(image %d x %d sf=%d) ", key->image->w, key->image->h, key->l2factor);
+	fprintf(out, "(image %d x %d sf=%d", key->image->w, key->image->h, key->l2factor);
+	if (key->rect.x0 != 0 || key->rect.y0 != 0 || key->rect.x1 != key->image->w || key->rect.y1 != key->image->h)
+		fprintf(out, " area=%d %d %d %d", key->rect.x0, key->rect.y0, key->rect.x1, key->rect.y1);
+	fprintf(out, ") ");
 }
 #endif
 
@@ -135,33 +142,97 @@ fz_unblend_masked_tile(fz_context *ctx, fz_pixmap *tile, fz_image *image)
 
 fz_pixmap *
 fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, int indexed, int l2factor)
+{
+	return fz_decomp_sub_image_from_stream(ctx, stm, image, NULL, indexed, l2factor);
+}
+
+fz_pixmap *
+fz_decomp_sub_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, fz_irect *subarea, int indexed, int l2factor)
 {
 	fz_pixmap *tile = NULL;
 	int stride, len, i;
 	unsigned char *samples = NULL;
+	unsigned char *row = NULL;
 	int f = 1<<l2factor;
 	int w = (image->w + f-1) >> l2factor;
 	int h = (image->h + f-1) >> l2factor;
+	int x0 = 0, y0 = 0, x1 = w, y1 = h;
 
 	fz_var(tile);
 	fz_var(samples);
+	fz_var(row);
+
+	/* Map the subarea onto the rows and columns of the stream, with
+	 * the left edge on a byte boundary so that columns can be cropped
+	 * without shifting bits. */
+	if (subarea)
+	{
+		x0 = (fz_clampi(subarea->x0, 0, image->w) >> l2factor) & ~7;
+		y0 = fz_clampi(subarea->y0, 0, image->h) >> l2factor;
+		x1 = (fz_clampi(subarea->x1, 0, image->w) + f-1) >> l2factor;
+		y1 = (fz_clampi(subarea->y1, 0, image->h) + f-1) >> l2factor;
+		/* A /Matte needs the mask to match the whole image */
+		if (x1 <= x0 || y1 <= y0 || (image->usecolorkey && image->mask))
+		{
+			x0 = y0 = 0;
+			x1 = w;
+			y1 = h;
+		}
+		subarea->x0 = x0 << l2factor;
+		subarea->y0 = y0 << l2factor;
+		subarea->x1 = fz_mini(x1 << l2factor, image->w);
+		subarea->y1 = fz_mini(y1 << l2factor, image->h);
+	}
 
 	fz_try(ctx)
 	{
-		tile = fz_new_pixmap(ctx, image->colorspace, w, h);
+		tile = fz_new_pixmap(ctx, image->colorspace, x1 - x0, y1 - y0);
 		tile->interpolate = image->interpolate;
 
 		stride = (w * image->n * image->bpc + 7) / 8;
 
-		samples = fz_malloc_array(ctx, h, stride);
+		if (x0 == 0 && y0 == 0 && x1 == w && y1 == h)
+		{
+			samples = fz_malloc_array(ctx, h, stride);
 
-		len = fz_read(ctx, stm, samples, h * stride);
+			len = fz_read(ctx, stm, samples, h * stride);
 
-		/* Pad truncated images */
-		if (len < stride * h)
+			/* Pad truncated images */
+			if (len < stride * h)
+			{
+				fz_warn(ctx, "padding truncated image");
+				memset(samples + len, 0, stride * h - len);
+			}
+		}
+		else
 		{
-			fz_warn(ctx, "padding truncated image");
-			memset(samples + len, 0, stride * h - len);
+			/* Read the rows in turn through a one row buffer, keeping
+			 * only the columns wanted from the rows wanted, and stop
+			 * reading (and decompressing) after the last of them. */
+			int skip = x0 * image->n * image->bpc / 8;
+			int sub_stride = ((x1 - x0) * image->n * image->bpc + 7) / 8;
+			int truncated = 0;
+
+			row = fz_malloc(ctx, stride);
+			samples = fz_malloc_array(ctx, y1 - y0, sub_stride);
+			for (i = 0; i < y1; i++)
+			{
+				len = truncated ? 0 : fz_read(ctx, stm, row, stride);
+				if (len < stride)
+				{
+					if (!truncated)
+						fz_warn(ctx, "padding truncated image");
+					truncated = 1;
+					memset(row + len, 0, stride - len);
+				}
+				if (i >= y0)
+					memcpy(samples + (i - y0) * sub_stride, row + skip, sub_stride);
+			}
+
+			fz_free(ctx, row);
+			row = NULL;
+			h = y1 - y0;
+			stride = sub_stride;
 		}
 
 		/* Invert 1-bit image masks */
@@ -209,6 +280,7 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_image *image, in
 		if (tile)
 			fz_drop_pixmap(ctx, tile);
 		fz_free(ctx, samples);
+		fz_free(ctx, row);
 
 		fz_rethrow(ctx);
 	}
@@ -231,7 +303,7 @@ fz_drop_image_imp(fz_context *ctx, fz_storable *image_)
 }
 
 static fz_pixmap *
-standard_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h, int *l2factor)
+standard_image_get_sub_pixmap(fz_context *ctx, fz_image *image, fz_irect *subarea, int w, int h, int *l2factor)
 {
 	int native_l2factor;
 	fz_stream *stm;
@@ -249,6 +321,9 @@ standard_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h, int *l
 		tile = fz_load_gif(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_TIFF:
+		/* TIFF strips are coded separately, so we can pick out a part */
+		if (subarea)
+			return fz_load_tiff_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, subarea);
 		tile = fz_load_tiff(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JXR:
@@ -280,7 +355,7 @@ standard_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h, int *l
 			native_l2factor -= *l2factor;
 
 		indexed = fz_colorspace_is_indexed(ctx, image->colorspace);
-		tile = fz_decomp_image_from_stream(ctx, stm, image, indexed, native_l2factor);
+		tile = fz_decomp_sub_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor);
 
 		/* CMYK JPEGs in XPS documents have to be inverted */
 		if (image->invert_cmyk_jpeg &&
@@ -291,19 +366,100 @@ standard_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h, int *l
 			fz_invert_pixmap(ctx, tile);
 		}
 
-		break;
+		return tile;
+	}
+
+	/* These formats are only ever decoded whole */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = 0;
+		subarea->x1 = image->w;
+		subarea->y1 = image->h;
 	}
 
 	return tile;
 }
 
+static fz_pixmap *
+standard_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h, int *l2factor)
+{
+	return standard_image_get_sub_pixmap(ctx, image, NULL, w, h, l2factor);
+}
+
+/* Find a cached tile at the given factor, or failing that at any
+ * larger size. */
+static fz_pixmap *
+find_image_tile(fz_context *ctx, fz_image_key *key, int l2factor)
+{
+	fz_pixmap *tile;
+
+	for (key->l2factor = l2factor; key->l2factor >= 0; key->l2factor--)
+	{
+		tile = fz_find_item(ctx, fz_drop_pixmap_imp, key, &fz_image_store_type);
+		if (tile)
+			return tile;
+	}
+	return NULL;
+}
+
+/* Only decode part of an image when the whole of it would take a lot of
+ * memory, and the part wanted is a small fraction of it. Parts are
+ * rounded out to a grid of (subsampled) pixels, so that panning across
+ * an image finds the tiles already decoded for its neighbours. */
+#define SUBAREA_MIN_SIZE (16<<20)
+#define SUBAREA_GRID 256
+
+static void
+whole_image_area(fz_image *image, fz_irect *area)
+{
+	area->x0 = 0;
+	area->y0 = 0;
+	area->x1 = image->w;
+	area->y1 = image->h;
+}
+
+static int
+choose_subarea(fz_image *image, fz_irect *subarea, int l2factor)
+{
+	int grid = SUBAREA_GRID << l2factor;
+	double whole, part;
+	fz_irect r;
+
+	r.x0 = fz_clampi(subarea->x0, 0, image->w) / grid * grid;
+	r.y0 = fz_clampi(subarea->y0, 0, image->h) / grid * grid;
+	r.x1 = fz_mini((fz_clampi(subarea->x1, 0, image->w) + grid - 1) / grid * grid, image->w);
+	r.y1 = fz_mini((fz_clampi(subarea->y1, 0, image->h) + grid - 1) / grid * grid, image->h);
+	if (r.x1 <= r.x0 || r.y1 <= r.y0)
+		return 0;
+
+	whole = (double)(image->w >> l2factor) * (image->h >> l2factor) * (image->n + 1);
+	part = (double)((r.x1 - r.x0) >> l2factor) * ((r.y1 - r.y0) >> l2factor) * (image->n + 1);
+	if (whole < SUBAREA_MIN_SIZE || part * 4 > whole)
+		return 0;
+
+	*subarea = r;
+	return 1;
+}
+
 fz_pixmap *
 fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
+{
+	int whole_w, whole_h;
+
+	return fz_image_get_sub_pixmap(ctx, image, NULL, w, h, &whole_w, &whole_h);
+}
+
+fz_pixmap *
+fz_image_get_sub_pixmap(fz_context *ctx, fz_image *image, const fz_irect *subarea, int w, int h, int *whole_w, int *whole_h)
 {
 	fz_pixmap *tile;
 	int l2factor, l2factor_remaining;
 	fz_image_key key;
-	fz_image_key *keyp;
+	fz_image_key *keyp = NULL;
+	int claim, partial;
+
+	fz_var(tile);
 
 	/* 'Simple' images created direct from pixmaps will have no buffer
 	 * of compressed data. We cannot do any better than just returning
@@ -313,7 +469,11 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	 * with masks applied, so we need both parts of the following test.
 	 */
 	if (image->buffer == NULL && image->tile != NULL)
+	{
+		*whole_w = image->tile->w;
+		*whole_h = image->tile->h;
 		return fz_keep_pixmap(ctx, image->tile); /* That's all we can give you! */
+	}
 
 	/* Ensure our expectations for tile size are reasonable */
 	if (w < 0 || w > image->w)
@@ -330,29 +490,76 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	else
 		for (l2factor=0; image->w>>(l2factor+1) >= w+2 && image->h>>(l2factor+1) >= h+2 && l2factor < 8; l2factor++);
 
-	/* Can we find any suitable tiles in the cache? */
+	/* Can we find any suitable tiles in the cache? A tile of the whole
+	 * image will do for any part of it. */
 	key.refs = 1;
 	key.image = image;
+	whole_image_area(image, &key.rect);
+	tile = find_image_tile(ctx, &key, l2factor);
+	if (tile)
+	{
+		*whole_w = tile->w;
+		*whole_h = tile->h;
+		return tile;
+	}
+
+	partial = 0;
+	if (subarea && image->get_sub_pixmap)
+	{
+		key.rect = *subarea;
+		partial = choose_subarea(image, &key.rect, l2factor);
+		if (partial)
+		{
+			tile = find_image_tile(ctx, &key, l2factor);
+			if (tile)
+				goto found;
+		}
+		else
+			whole_image_area(image, &key.rect);
+	}
+
+	/* Only one thread decodes an image at a given size at once. Any
+	 * others wanting it wait for the claim, and then find the tile
+	 * that thread stored. */
 	key.l2factor = l2factor;
-	do
+	claim = fz_claim_item(ctx, &key, &fz_image_store_type);
+	if (claim)
 	{
-		tile = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_image_store_type);
+		tile = find_image_tile(ctx, &key, l2factor);
 		if (tile)
-			return tile;
-		key.l2factor--;
+		{
+			fz_release_claim(ctx, claim, 0);
+			goto found;
+		}
 	}
-	while (key.l2factor >= 0);
 
-	/* We'll have to decode the image; request the correct amount of
-	 * downscaling. */
-	l2factor_remaining = l2factor;
-	tile = image->get_pixmap(ctx, image, w, h, &l2factor_remaining);
+	fz_try(ctx)
+	{
+		/* We'll have to decode the image; request the correct amount of
+		 * downscaling. The decoder may give us more of the image than we
+		 * asked for; key.rect is updated to what it gave. */
+		l2factor_remaining = l2factor;
+		if (partial)
+			tile = image->get_sub_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
+		else
+			tile = image->get_pixmap(ctx, image, w, h, &l2factor_remaining);
 
-	/* l2factor_remaining is updated to the amount of subscaling left to do */
-	assert(l2factor_remaining >= 0 && l2factor_remaining < 8);
-	if (l2factor_remaining)
+		/* l2factor_remaining is updated to the amount of subscaling left to do */
+		assert(l2factor_remaining >= 0 && l2factor_remaining < 8);
+		if (l2factor_remaining)
+		{
+			fz_subsample_pixmap(ctx, tile, l2factor_remaining);
+		}
+
+		/* Parts start on the grid, so their pixels line up with
+		 * those of the whole image at this factor. */
+		tile->x = key.rect.x0 >> l2factor;
+		tile->y = key.rect.y0 >> l2factor;
+	}
+	fz_catch(ctx)
 	{
-		fz_subsample_pixmap(ctx, tile, l2factor_remaining);
+		fz_release_claim(ctx, claim, 1);
+		fz_rethrow(ctx);
 	}
 
 	/* Now we try to cache the pixmap. Any failure here will just result
@@ -366,6 +573,7 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 		keyp->refs = 1;
 		keyp->image = fz_keep_image(ctx, image);
 		keyp->l2factor = l2factor;
+		keyp->rect = key.rect;
 		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
 		if (existing_tile)
 		{
@@ -378,12 +586,26 @@ fz_image_get_pixmap(fz_context *ctx, fz_image *image, int w, int h)
 	fz_always(ctx)
 	{
 		fz_drop_image_key(ctx, keyp);
+		fz_release_claim(ctx, claim, 1);
 	}
 	fz_catch(ctx)
 	{
 		/* Do nothing */
 	}
 
+	key.l2factor = l2factor;
+found:
+	if (key.rect.x0 == 0 && key.rect.y0 == 0 && key.rect.x1 == image->w && key.rect.y1 == image->h)
+	{
+		*whole_w = tile->w;
+		*whole_h = tile->h;
+	}
+	else
+	{
+		/* As both decoding and subsampling round up */
+		*whole_w = (image->w + (1 << key.l2factor) - 1) >> key.l2factor;
+		*whole_h = (image->h + (1 << key.l2factor) - 1) >> key.l2factor;
+	}
 	return tile;
 }
 
@@ -433,6 +655,7 @@ fz_new_image(fz_context *ctx, int w, int h, int bpc, fz_colorspace *colorspace,
 		image = fz_malloc_struct(ctx, fz_image);
 		FZ_INIT_STORABLE(image, 1, fz_drop_image_imp);
 		image->get_pixmap = standard_image_get_pixmap;
+		image->get_sub_pixmap = standard_image_get_sub_pixmap;
 		image->w = w;
 		image->h = h;
 		image->xres = xres;
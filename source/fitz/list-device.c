@@ -111,6 +111,33 @@ enum {
 	MAX_NODE_SIZE = (1<<9)-sizeof(fz_display_node)
 };
 
+/* The graphics state that nodes update, as tracked while building the
+ * spatial index. Pointers are borrowed from the list. */
+typedef struct fz_display_state_s
+{
+	fz_rect rect;
+	fz_colorspace *colorspace;
+	float color[FZ_MAX_COLORS];
+	float alpha;
+	fz_matrix ctm;
+	fz_stroke_state *stroke;
+	fz_path *path;
+} fz_display_state;
+
+/* A chunk is a run of nodes, starting at node offset start and ending
+ * before end, whose clips, masks and groups are balanced. If bbox misses
+ * the area being drawn then so does every node in the chunk, and replay
+ * can jump straight to end, taking on the state the chunk leaves behind.
+ */
+typedef struct fz_display_chunk_s
+{
+	int start;
+	int end;
+	int count;
+	fz_rect bbox;
+	fz_display_state state;
+} fz_display_chunk;
+
 struct fz_display_list_s
 {
 	fz_storable storable;
@@ -118,6 +145,9 @@ struct fz_display_list_s
 	fz_rect mediabox;
 	int max;
 	int len;
+	int num_chunks;
+	int max_chunks;
+	fz_display_chunk *chunks;
 };
 
 struct fz_list_device_s
@@ -1249,6 +1279,228 @@ fz_list_render_flags(fz_context *ctx, fz_device *dev, int set, int clear)
 		0); /* private_data_len */
 }
 
+/* Chunks hold at most CHUNK_NODES nodes, and runs of fewer than
+ * MIN_CHUNK_NODES are not worth indexing. Lists shorter than
+ * MIN_INDEX_LEN are not indexed at all. */
+#define CHUNK_NODES 32
+#define MIN_CHUNK_NODES 4
+#define MIN_INDEX_LEN 256
+
+#define CHUNK_BREAK 2
+
+/* How a node changes the clip depth that fz_run_display_list counts
+ * while culling, or CHUNK_BREAK for nodes that are never culled. */
+static int
+chunk_depth_change(const fz_display_node *n)
+{
+	switch (n->cmd)
+	{
+	case FZ_CMD_CLIP_PATH:
+	case FZ_CMD_CLIP_STROKE_PATH:
+	case FZ_CMD_CLIP_STROKE_TEXT:
+	case FZ_CMD_CLIP_IMAGE_MASK:
+	case FZ_CMD_BEGIN_MASK:
+	case FZ_CMD_BEGIN_GROUP:
+		return 1;
+	case FZ_CMD_CLIP_TEXT:
+		/* Accumulated text has no extra pops */
+		return n->flags != 2;
+	case FZ_CMD_POP_CLIP:
+	case FZ_CMD_END_GROUP:
+		return -1;
+	case FZ_CMD_FILL_PATH:
+	case FZ_CMD_STROKE_PATH:
+	case FZ_CMD_FILL_TEXT:
+	case FZ_CMD_STROKE_TEXT:
+	case FZ_CMD_IGNORE_TEXT:
+	case FZ_CMD_FILL_SHADE:
+	case FZ_CMD_FILL_IMAGE:
+	case FZ_CMD_FILL_IMAGE_MASK:
+	case FZ_CMD_END_MASK:
+		return 0;
+	default:
+		return CHUNK_BREAK;
+	}
+}
+
+/* Apply the state changes packed into a node, as fz_run_display_list
+ * does, but without taking references. Returns the next node. */
+static fz_display_node *
+unpack_node_state(fz_context *ctx, fz_display_node *node, fz_display_state *st)
+{
+	fz_display_node n = *node;
+	fz_display_node *next = node + n.size;
+	int i;
+
+	node++;
+	if (n.rect)
+	{
+		st->rect = *(fz_rect *)node;
+		node += SIZE_IN_NODES(sizeof(fz_rect));
+	}
+	switch (n.cs)
+	{
+	case CS_UNCHANGED:
+		break;
+	default:
+	case CS_GRAY_0:
+	case CS_GRAY_1:
+		st->colorspace = fz_device_gray(ctx);
+		st->color[0] = (n.cs == CS_GRAY_1);
+		break;
+	case CS_RGB_0:
+	case CS_RGB_1:
+		st->colorspace = fz_device_rgb(ctx);
+		st->color[0] = st->color[1] = st->color[2] = (n.cs == CS_RGB_1);
+		break;
+	case CS_CMYK_0:
+	case CS_CMYK_1:
+		st->colorspace = fz_device_cmyk(ctx);
+		st->color[0] = st->color[1] = st->color[2] = 0;
+		st->color[3] = (n.cs == CS_CMYK_1);
+		break;
+	case CS_OTHER_0:
+		st->colorspace = *(fz_colorspace **)node;
+		node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+		for (i = 0; i < st->colorspace->n; i++)
+			st->color[i] = 0;
+		break;
+	}
+	if (n.color)
+	{
+		memcpy(st->color, (float *)node, st->colorspace->n * sizeof(float));
+		node += SIZE_IN_NODES(st->colorspace->n * sizeof(float));
+	}
+	switch (n.alpha)
+	{
+	case ALPHA_UNCHANGED:
+		break;
+	default:
+	case ALPHA_0:
+		st->alpha = 0;
+		break;
+	case ALPHA_1:
+		st->alpha = 1;
+		break;
+	case ALPHA_PRESENT:
+		st->alpha = *(float *)node;
+		node += SIZE_IN_NODES(sizeof(float));
+		break;
+	}
+	if (n.ctm & CTM_CHANGE_AD)
+	{
+		st->ctm.a = ((float *)node)[0];
+		st->ctm.d = ((float *)node)[1];
+		node += SIZE_IN_NODES(2*sizeof(float));
+	}
+	if (n.ctm & CTM_CHANGE_BC)
+	{
+		st->ctm.b = ((float *)node)[0];
+		st->ctm.c = ((float *)node)[1];
+		node += SIZE_IN_NODES(2*sizeof(float));
+	}
+	if (n.ctm & CTM_CHANGE_EF)
+	{
+		st->ctm.e = ((float *)node)[0];
+		st->ctm.f = ((float *)node)[1];
+		node += SIZE_IN_NODES(2*sizeof(float));
+	}
+	if (n.stroke)
+	{
+		st->stroke = *(fz_stroke_state **)node;
+		node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+	}
+	if (n.path)
+		st->path = (fz_path *)node;
+
+	return next;
+}
+
+static void
+add_display_chunk(fz_context *ctx, fz_display_list *list, int start, const fz_display_chunk *chunk)
+{
+	if (list->num_chunks == list->max_chunks)
+	{
+		int new_max = list->max_chunks ? list->max_chunks * 2 : 64;
+		list->chunks = fz_resize_array(ctx, list->chunks, new_max, sizeof(*list->chunks));
+		list->max_chunks = new_max;
+	}
+	list->chunks[list->num_chunks] = *chunk;
+	list->chunks[list->num_chunks].start = start;
+	list->num_chunks++;
+}
+
+/* Split the finished list into chunks that fz_run_display_list can skip
+ * as a whole when they fall outside the area being drawn. Chunks never
+ * nest, so a chunk whose clips or groups do not close within CHUNK_NODES
+ * nodes is cut back to the last point where they were balanced. */
+static void
+fz_index_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_node *base = list->list;
+	fz_display_node *end = base + list->len;
+	fz_display_node *node = base;
+	fz_display_state st = { { 0 } };
+
+	fz_free(ctx, list->chunks);
+	list->chunks = NULL;
+	list->num_chunks = list->max_chunks = 0;
+
+	if (list->len < MIN_INDEX_LEN)
+		return;
+
+	st.colorspace = fz_device_gray(ctx);
+	st.alpha = 1;
+	st.ctm = fz_identity;
+
+	while (node != end)
+	{
+		fz_display_node *start = node;
+		fz_display_state start_st = st;
+		fz_display_chunk good;
+		fz_rect bbox = fz_empty_rect;
+		int count = 0;
+		int depth = 0;
+
+		good.count = 0;
+		while (node != end && count < CHUNK_NODES)
+		{
+			int delta = chunk_depth_change(node);
+
+			if (delta == CHUNK_BREAK || depth + delta < 0)
+				break;
+			/* An end mask outside a mask begun in this chunk may
+			 * be drawn even when culled. */
+			if (node->cmd == FZ_CMD_END_MASK && depth == 0)
+				break;
+			node = unpack_node_state(ctx, node, &st);
+			fz_union_rect(&bbox, &st.rect);
+			depth += delta;
+			count++;
+			if (depth == 0)
+			{
+				good.end = node - base;
+				good.count = count;
+				good.bbox = bbox;
+				good.state = st;
+			}
+		}
+
+		if (good.count >= MIN_CHUNK_NODES)
+			add_display_chunk(ctx, list, start - base, &good);
+		if (good.count > 0)
+		{
+			node = base + good.end;
+			st = good.state;
+		}
+		else
+		{
+			st = start_st;
+			node = unpack_node_state(ctx, start, &st);
+		}
+	}
+}
+
 static void
 drop_writer(fz_context *ctx, fz_device *dev)
 {
@@ -1257,6 +1509,17 @@ drop_writer(fz_context *ctx, fz_device *dev)
 	fz_drop_colorspace(ctx, writer->colorspace);
 	fz_drop_stroke_state(ctx, writer->stroke);
 	fz_drop_path(ctx, writer->path);
+
+	/* The index is only an optimisation; carry on without it if
+	 * we cannot build it. */
+	fz_try(ctx)
+		fz_index_display_list(ctx, writer->list);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, writer->list->chunks);
+		writer->list->chunks = NULL;
+		writer->list->num_chunks = writer->list->max_chunks = 0;
+	}
 }
 
 fz_device *
@@ -1401,6 +1664,7 @@ fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
 
 		node = next;
 	}
+	fz_free(ctx, list->chunks);
 	fz_free(ctx, list->list);
 	fz_free(ctx, list);
 }
@@ -1414,6 +1678,9 @@ fz_new_display_list(fz_context *ctx)
 	list->mediabox = fz_empty_rect;
 	list->max = 0;
 	list->len = 0;
+	list->num_chunks = 0;
+	list->max_chunks = 0;
+	list->chunks = NULL;
 	return list;
 }
 
@@ -1445,6 +1712,7 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 	int clipped = 0;
 	int tiled = 0;
 	int progress = 0;
+	int chunk = 0;
 
 	/* Current graphics state as unpacked from list */
 	fz_path *path = NULL;
@@ -1488,6 +1756,46 @@ fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, cons
 			cookie->progress = progress++;
 		}
 
+		/* Jump over whole chunks that would be culled node by node */
+		if (chunk < list->num_chunks && node == list->list + list->chunks[chunk].start)
+		{
+			const fz_display_chunk *ch = &list->chunks[chunk++];
+			int skip = tile_skip_depth > 0 || clipped > 0;
+
+			if (!skip && !tiled)
+			{
+				fz_rect irect = ch->bbox;
+				fz_transform_rect(&irect, top_ctm);
+				fz_intersect_rect(&irect, scissor);
+				skip = fz_is_empty_rect(&irect);
+			}
+			if (skip)
+			{
+				rect = ch->state.rect;
+				if (colorspace != ch->state.colorspace)
+				{
+					fz_drop_colorspace(ctx, colorspace);
+					colorspace = fz_keep_colorspace(ctx, ch->state.colorspace);
+				}
+				memcpy(color, ch->state.color, sizeof color);
+				alpha = ch->state.alpha;
+				ctm = ch->state.ctm;
+				if (stroke != ch->state.stroke)
+				{
+					fz_drop_stroke_state(ctx, stroke);
+					stroke = fz_keep_stroke_state(ctx, ch->state.stroke);
+				}
+				if (path != ch->state.path)
+				{
+					fz_drop_path(ctx, path);
+					path = fz_keep_path(ctx, ch->state.path);
+				}
+				next_node = list->list + ch->end;
+				progress += ch->count - 1;
+				continue;
+			}
+		}
+
 		node++;
 		if (n.rect)
 		{
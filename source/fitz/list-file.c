@@ -0,0 +1,1790 @@
+#include "mupdf/fitz.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+/* Display list serialization.
+ *
+ * A list is written by running it through a device that records each
+ * call, and read back by replaying the recorded calls into a list
+ * device. The file format therefore depends only on the device
+ * interface, not on how the list packs its nodes in memory.
+ *
+ * The file starts with the magic "MuDL" and a version number, and is
+ * followed by records, each an opcode byte and its operands, ending
+ * with DL_END. Integers and floats are 32 bit little endian.
+ *
+ * Colorspaces, stroke states, fonts, images and shades are written
+ * once, by a DL_DEF_* record before the first record that uses them,
+ * and referred to afterwards by their index among definitions of the
+ * same kind (-1 for none). Font files and image data are not written
+ * to the file at all; they go to the resource store, keyed by the MD5
+ * digest that is written in their place.
+ */
+
+#define DL_MAGIC "MuDL"
+#define DL_VERSION 1
+
+enum
+{
+	DL_END,
+	DL_BEGIN_PAGE,
+	DL_END_PAGE,
+	DL_FILL_PATH,
+	DL_STROKE_PATH,
+	DL_CLIP_PATH,
+	DL_CLIP_STROKE_PATH,
+	DL_FILL_TEXT,
+	DL_STROKE_TEXT,
+	DL_CLIP_TEXT,
+	DL_CLIP_STROKE_TEXT,
+	DL_IGNORE_TEXT,
+	DL_FILL_SHADE,
+	DL_FILL_IMAGE,
+	DL_FILL_IMAGE_MASK,
+	DL_CLIP_IMAGE_MASK,
+	DL_POP_CLIP,
+	DL_BEGIN_MASK,
+	DL_END_MASK,
+	DL_BEGIN_GROUP,
+	DL_END_GROUP,
+	DL_BEGIN_TILE,
+	DL_END_TILE,
+	DL_RENDER_FLAGS,
+
+	DL_DEF_COLORSPACE = 64,
+	DL_DEF_STROKE,
+	DL_DEF_FONT,
+	DL_DEF_IMAGE,
+	DL_DEF_SHADE
+};
+
+/* Colorspace kinds */
+enum { DL_CS_GRAY, DL_CS_RGB, DL_CS_BGR, DL_CS_CMYK, DL_CS_INDEXED };
+
+/* Image kinds */
+enum { DL_IMAGE_COMPRESSED, DL_IMAGE_PIXMAP };
+
+/* Path segments */
+enum { DL_PATH_END, DL_PATH_MOVE, DL_PATH_LINE, DL_PATH_CURVE, DL_PATH_QUAD, DL_PATH_CURVEV, DL_PATH_CURVEY, DL_PATH_RECT, DL_PATH_CLOSE };
+
+#define NUM_PARAMS ((int)(sizeof(((fz_compression_params *)0)->u) / sizeof(int)))
+
+/* Writing */
+
+typedef struct list_writer_s list_writer;
+
+struct list_writer_s
+{
+	fz_device super;
+	fz_output *out;
+	fz_display_list_resources *res;
+	fz_hash_table *ids;
+	int num_colorspaces;
+	int num_strokes;
+	int num_fonts;
+	int num_images;
+	int num_shades;
+	char reason[256];
+};
+
+static void
+put_byte(fz_context *ctx, list_writer *wri, int x)
+{
+	fz_write_byte(ctx, wri->out, x);
+}
+
+static void
+put_int(fz_context *ctx, list_writer *wri, int x)
+{
+	fz_write_int32le(ctx, wri->out, x);
+}
+
+static void
+put_float(fz_context *ctx, list_writer *wri, float f)
+{
+	union { float f; int i; } u;
+	u.f = f;
+	fz_write_int32le(ctx, wri->out, u.i);
+}
+
+static void
+put_floats(fz_context *ctx, list_writer *wri, const float *f, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		put_float(ctx, wri, f[i]);
+}
+
+static void
+put_rect(fz_context *ctx, list_writer *wri, const fz_rect *r)
+{
+	put_float(ctx, wri, r->x0);
+	put_float(ctx, wri, r->y0);
+	put_float(ctx, wri, r->x1);
+	put_float(ctx, wri, r->y1);
+}
+
+static void
+put_matrix(fz_context *ctx, list_writer *wri, const fz_matrix *m)
+{
+	put_float(ctx, wri, m->a);
+	put_float(ctx, wri, m->b);
+	put_float(ctx, wri, m->c);
+	put_float(ctx, wri, m->d);
+	put_float(ctx, wri, m->e);
+	put_float(ctx, wri, m->f);
+}
+
+static void
+put_data(fz_context *ctx, list_writer *wri, const unsigned char *data, int len)
+{
+	put_int(ctx, wri, len);
+	fz_write(ctx, wri->out, data, len);
+}
+
+/* Hand buf to the resource store and write its digest. */
+static void
+put_resource(fz_context *ctx, list_writer *wri, fz_buffer *buf)
+{
+	unsigned char digest[16];
+	fz_md5 md5;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, buf->data, buf->len);
+	fz_md5_final(&md5, digest);
+	wri->res->put(ctx, wri->res->user, digest, buf);
+	fz_write(ctx, wri->out, digest, 16);
+}
+
+/* Abandon the run; fz_run_display_list stops quietly on FZ_ERROR_ABORT
+ * and fz_write_display_list reports the reason. */
+static void
+unsupported(fz_context *ctx, list_writer *wri, const char *what, const char *name)
+{
+	fz_snprintf(wri->reason, sizeof wri->reason, "cannot write %s '%s' to display list file", what, name);
+	fz_throw(ctx, FZ_ERROR_ABORT, "%s", wri->reason);
+}
+
+static int
+find_id(fz_context *ctx, list_writer *wri, void *ptr)
+{
+	void *val = fz_hash_find(ctx, wri->ids, &ptr);
+	return val ? (int)(intptr_t)val - 1 : -1;
+}
+
+static void
+add_id(fz_context *ctx, list_writer *wri, void *ptr, int id)
+{
+	fz_hash_insert(ctx, wri->ids, &ptr, (void *)(intptr_t)(id + 1));
+}
+
+static int
+def_colorspace(fz_context *ctx, list_writer *wri, fz_colorspace *cs)
+{
+	int id, kind, base_id = -1, high = 0;
+	fz_colorspace *base = NULL;
+	unsigned char *lookup = NULL;
+
+	if (!cs)
+		return -1;
+	id = find_id(ctx, wri, cs);
+	if (id >= 0)
+		return id;
+
+	if (cs == fz_device_gray(ctx))
+		kind = DL_CS_GRAY;
+	else if (cs == fz_device_rgb(ctx))
+		kind = DL_CS_RGB;
+	else if (cs == fz_device_bgr(ctx))
+		kind = DL_CS_BGR;
+	else if (cs == fz_device_cmyk(ctx))
+		kind = DL_CS_CMYK;
+	else if (fz_colorspace_is_indexed(ctx, cs))
+	{
+		kind = DL_CS_INDEXED;
+		base = fz_indexed_colorspace_data(ctx, cs, &high, &lookup);
+		base_id = def_colorspace(ctx, wri, base);
+	}
+	else
+		unsupported(ctx, wri, "colorspace", cs->name);
+
+	put_byte(ctx, wri, DL_DEF_COLORSPACE);
+	put_int(ctx, wri, kind);
+	if (kind == DL_CS_INDEXED)
+	{
+		put_int(ctx, wri, base_id);
+		put_int(ctx, wri, high);
+		put_data(ctx, wri, lookup, (high + 1) * base->n);
+	}
+
+	id = wri->num_colorspaces++;
+	add_id(ctx, wri, cs, id);
+	return id;
+}
+
+static int
+def_stroke(fz_context *ctx, list_writer *wri, fz_stroke_state *stroke)
+{
+	int id;
+
+	if (!stroke)
+		return -1;
+	id = find_id(ctx, wri, stroke);
+	if (id >= 0)
+		return id;
+
+	put_byte(ctx, wri, DL_DEF_STROKE);
+	put_int(ctx, wri, stroke->start_cap);
+	put_int(ctx, wri, stroke->dash_cap);
+	put_int(ctx, wri, stroke->end_cap);
+	put_int(ctx, wri, stroke->linejoin);
+	put_float(ctx, wri, stroke->linewidth);
+	put_float(ctx, wri, stroke->miterlimit);
+	put_float(ctx, wri, stroke->dash_phase);
+	put_int(ctx, wri, stroke->dash_len);
+	put_floats(ctx, wri, stroke->dash_list, stroke->dash_len);
+
+	id = wri->num_strokes++;
+	add_id(ctx, wri, stroke, id);
+	return id;
+}
+
+static int
+def_font(fz_context *ctx, list_writer *wri, fz_font *font)
+{
+	fz_buffer *buf;
+	int id, index, i;
+
+	id = find_id(ctx, wri, font);
+	if (id >= 0)
+		return id;
+
+	if (font->t3procs || !font->ft_face)
+		unsupported(ctx, wri, "type3 font", font->name);
+
+	buf = fz_font_file_data(ctx, font, &index);
+	fz_try(ctx)
+	{
+		put_byte(ctx, wri, DL_DEF_FONT);
+		put_resource(ctx, wri, buf);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	put_int(ctx, wri, index);
+	put_data(ctx, wri, (unsigned char *)font->name, strlen(font->name));
+	put_int(ctx, wri, font->use_glyph_bbox);
+	put_int(ctx, wri, font->ft_substitute);
+	put_int(ctx, wri, font->ft_stretch);
+	put_int(ctx, wri, font->ft_bold);
+	put_int(ctx, wri, font->ft_italic);
+	put_int(ctx, wri, font->ft_hint);
+	put_rect(ctx, wri, &font->bbox);
+	put_int(ctx, wri, font->width_default);
+	put_int(ctx, wri, font->width_table ? font->width_count : 0);
+	if (font->width_table)
+		for (i = 0; i < font->width_count; i++)
+			put_int(ctx, wri, font->width_table[i]);
+
+	id = wri->num_fonts++;
+	add_id(ctx, wri, font, id);
+	return id;
+}
+
+static void
+put_compressed_params(fz_context *ctx, list_writer *wri, fz_compression_params *params)
+{
+	const int *u = (const int *)&params->u;
+	int i;
+
+	put_int(ctx, wri, params->type);
+	put_int(ctx, wri, NUM_PARAMS);
+	for (i = 0; i < NUM_PARAMS; i++)
+		put_int(ctx, wri, u[i]);
+}
+
+static int
+def_image(fz_context *ctx, list_writer *wri, fz_image *image)
+{
+	int id, mask_id, cs_id, pix_cs_id, i;
+	fz_pixmap *pix = NULL;
+	fz_buffer *buf = NULL;
+
+	id = find_id(ctx, wri, image);
+	if (id >= 0)
+		return id;
+
+	mask_id = image->mask ? def_image(ctx, wri, image->mask) : -1;
+	cs_id = def_colorspace(ctx, wri, image->colorspace);
+
+	fz_var(pix);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		if (!image->buffer)
+		{
+			/* Images made from pixmaps have nothing but
+			 * their samples to write. */
+			pix = fz_image_get_pixmap(ctx, image, image->w, image->h);
+			pix_cs_id = def_colorspace(ctx, wri, pix->colorspace);
+			buf = fz_new_buffer(ctx, pix->w * pix->h * pix->n);
+			fz_write_buffer(ctx, buf, pix->samples, pix->w * pix->h * pix->n);
+		}
+
+		put_byte(ctx, wri, DL_DEF_IMAGE);
+		put_int(ctx, wri, pix ? DL_IMAGE_PIXMAP : DL_IMAGE_COMPRESSED);
+		put_int(ctx, wri, image->w);
+		put_int(ctx, wri, image->h);
+		put_int(ctx, wri, image->n);
+		put_int(ctx, wri, image->bpc);
+		put_int(ctx, wri, cs_id);
+		put_int(ctx, wri, image->xres);
+		put_int(ctx, wri, image->yres);
+		put_int(ctx, wri, image->interpolate);
+		put_int(ctx, wri, image->imagemask);
+		put_int(ctx, wri, image->invert_cmyk_jpeg);
+		put_int(ctx, wri, image->usecolorkey);
+		for (i = 0; i < image->n * 2; i++)
+			put_int(ctx, wri, image->colorkey[i]);
+		put_floats(ctx, wri, image->decode, image->n * 2);
+		put_int(ctx, wri, mask_id);
+
+		if (pix)
+		{
+			put_int(ctx, wri, pix->w);
+			put_int(ctx, wri, pix->h);
+			put_int(ctx, wri, pix_cs_id);
+			put_int(ctx, wri, pix->xres);
+			put_int(ctx, wri, pix->yres);
+			put_resource(ctx, wri, buf);
+		}
+		else
+		{
+			put_compressed_params(ctx, wri, &image->buffer->params);
+			put_resource(ctx, wri, image->buffer->buffer);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	id = wri->num_images++;
+	add_id(ctx, wri, image, id);
+	return id;
+}
+
+static int
+def_shade(fz_context *ctx, list_writer *wri, fz_shade *shade)
+{
+	int id, cs_id, n, i;
+
+	id = find_id(ctx, wri, shade);
+	if (id >= 0)
+		return id;
+
+	cs_id = def_colorspace(ctx, wri, shade->colorspace);
+	n = shade->colorspace ? shade->colorspace->n : 1;
+
+	put_byte(ctx, wri, DL_DEF_SHADE);
+	put_int(ctx, wri, shade->type);
+	put_int(ctx, wri, cs_id);
+	put_rect(ctx, wri, &shade->bbox);
+	put_matrix(ctx, wri, &shade->matrix);
+	put_int(ctx, wri, shade->use_background);
+	put_floats(ctx, wri, shade->background, n);
+	put_int(ctx, wri, shade->use_function);
+	if (shade->use_function)
+		for (i = 0; i < 256; i++)
+			put_floats(ctx, wri, shade->function[i], n + 1);
+
+	switch (shade->type)
+	{
+	case FZ_FUNCTION_BASED:
+		put_matrix(ctx, wri, &shade->u.f.matrix);
+		put_int(ctx, wri, shade->u.f.xdivs);
+		put_int(ctx, wri, shade->u.f.ydivs);
+		put_floats(ctx, wri, &shade->u.f.domain[0][0], 4);
+		put_floats(ctx, wri, shade->u.f.fn_vals, (shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n);
+		break;
+	case FZ_LINEAR:
+	case FZ_RADIAL:
+		put_int(ctx, wri, shade->u.l_or_r.extend[0]);
+		put_int(ctx, wri, shade->u.l_or_r.extend[1]);
+		put_floats(ctx, wri, &shade->u.l_or_r.coords[0][0], 6);
+		break;
+	default:
+		put_int(ctx, wri, shade->u.m.vprow);
+		put_int(ctx, wri, shade->u.m.bpflag);
+		put_int(ctx, wri, shade->u.m.bpcoord);
+		put_int(ctx, wri, shade->u.m.bpcomp);
+		put_float(ctx, wri, shade->u.m.x0);
+		put_float(ctx, wri, shade->u.m.x1);
+		put_float(ctx, wri, shade->u.m.y0);
+		put_float(ctx, wri, shade->u.m.y1);
+		put_floats(ctx, wri, shade->u.m.c0, FZ_MAX_COLORS);
+		put_floats(ctx, wri, shade->u.m.c1, FZ_MAX_COLORS);
+		break;
+	}
+
+	if (shade->buffer)
+	{
+		put_int(ctx, wri, 1);
+		put_compressed_params(ctx, wri, &shade->buffer->params);
+		put_data(ctx, wri, shade->buffer->buffer->data, shade->buffer->buffer->len);
+	}
+	else
+		put_int(ctx, wri, 0);
+
+	id = wri->num_shades++;
+	add_id(ctx, wri, shade, id);
+	return id;
+}
+
+static void
+put_color(fz_context *ctx, list_writer *wri, int cs_id, fz_colorspace *cs, const float *color, float alpha)
+{
+	put_int(ctx, wri, cs_id);
+	put_floats(ctx, wri, color, cs ? cs->n : 0);
+	put_float(ctx, wri, alpha);
+}
+
+static void
+put_path_moveto(fz_context *ctx, void *arg, float x, float y)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_MOVE);
+	put_float(ctx, wri, x);
+	put_float(ctx, wri, y);
+}
+
+static void
+put_path_lineto(fz_context *ctx, void *arg, float x, float y)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_LINE);
+	put_float(ctx, wri, x);
+	put_float(ctx, wri, y);
+}
+
+static void
+put_path_curveto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2, float x3, float y3)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_CURVE);
+	put_float(ctx, wri, x1);
+	put_float(ctx, wri, y1);
+	put_float(ctx, wri, x2);
+	put_float(ctx, wri, y2);
+	put_float(ctx, wri, x3);
+	put_float(ctx, wri, y3);
+}
+
+static void
+put_path_close(fz_context *ctx, void *arg)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_CLOSE);
+}
+
+static void
+put_path_quadto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_QUAD);
+	put_float(ctx, wri, x1);
+	put_float(ctx, wri, y1);
+	put_float(ctx, wri, x2);
+	put_float(ctx, wri, y2);
+}
+
+static void
+put_path_curvetov(fz_context *ctx, void *arg, float x2, float y2, float x3, float y3)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_CURVEV);
+	put_float(ctx, wri, x2);
+	put_float(ctx, wri, y2);
+	put_float(ctx, wri, x3);
+	put_float(ctx, wri, y3);
+}
+
+static void
+put_path_curvetoy(fz_context *ctx, void *arg, float x1, float y1, float x3, float y3)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_CURVEY);
+	put_float(ctx, wri, x1);
+	put_float(ctx, wri, y1);
+	put_float(ctx, wri, x3);
+	put_float(ctx, wri, y3);
+}
+
+static void
+put_path_rectto(fz_context *ctx, void *arg, float x1, float y1, float x2, float y2)
+{
+	list_writer *wri = arg;
+	put_byte(ctx, wri, DL_PATH_RECT);
+	put_float(ctx, wri, x1);
+	put_float(ctx, wri, y1);
+	put_float(ctx, wri, x2);
+	put_float(ctx, wri, y2);
+}
+
+static const fz_path_processor put_path_proc =
+{
+	put_path_moveto,
+	put_path_lineto,
+	put_path_curveto,
+	put_path_close,
+	put_path_quadto,
+	put_path_curvetov,
+	put_path_curvetoy,
+	put_path_rectto
+};
+
+static void
+put_path(fz_context *ctx, list_writer *wri, fz_path *path)
+{
+	fz_process_path(ctx, &put_path_proc, wri, path);
+	put_byte(ctx, wri, DL_PATH_END);
+}
+
+/* Fonts are defined before the record, so the text goes inline. */
+static void
+put_text(fz_context *ctx, list_writer *wri, int font_id, fz_text *text)
+{
+	int i;
+
+	put_int(ctx, wri, font_id);
+	put_matrix(ctx, wri, &text->trm);
+	put_int(ctx, wri, text->wmode);
+	put_int(ctx, wri, text->len);
+	for (i = 0; i < text->len; i++)
+	{
+		put_float(ctx, wri, text->items[i].x);
+		put_float(ctx, wri, text->items[i].y);
+		put_int(ctx, wri, text->items[i].gid);
+		put_int(ctx, wri, text->items[i].ucs);
+	}
+}
+
+static void
+lw_begin_page(fz_context *ctx, fz_device *dev, const fz_rect *rect, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	put_byte(ctx, wri, DL_BEGIN_PAGE);
+	put_rect(ctx, wri, rect);
+	put_matrix(ctx, wri, ctm);
+}
+
+static void
+lw_end_page(fz_context *ctx, fz_device *dev)
+{
+	put_byte(ctx, (list_writer *)dev, DL_END_PAGE);
+}
+
+static void
+lw_fill_path(fz_context *ctx, fz_device *dev, fz_path *path, int even_odd, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	put_byte(ctx, wri, DL_FILL_PATH);
+	put_int(ctx, wri, even_odd);
+	put_matrix(ctx, wri, ctm);
+	put_color(ctx, wri, cs_id, colorspace, color, alpha);
+	put_path(ctx, wri, path);
+}
+
+static void
+lw_stroke_path(fz_context *ctx, fz_device *dev, fz_path *path, fz_stroke_state *stroke, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	int stroke_id = def_stroke(ctx, wri, stroke);
+	put_byte(ctx, wri, DL_STROKE_PATH);
+	put_int(ctx, wri, stroke_id);
+	put_matrix(ctx, wri, ctm);
+	put_color(ctx, wri, cs_id, colorspace, color, alpha);
+	put_path(ctx, wri, path);
+}
+
+static void
+lw_clip_path(fz_context *ctx, fz_device *dev, fz_path *path, const fz_rect *rect, int even_odd, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	put_byte(ctx, wri, DL_CLIP_PATH);
+	put_rect(ctx, wri, rect ? rect : &fz_infinite_rect);
+	put_int(ctx, wri, even_odd);
+	put_matrix(ctx, wri, ctm);
+	put_path(ctx, wri, path);
+}
+
+static void
+lw_clip_stroke_path(fz_context *ctx, fz_device *dev, fz_path *path, const fz_rect *rect, fz_stroke_state *stroke, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	int stroke_id = def_stroke(ctx, wri, stroke);
+	put_byte(ctx, wri, DL_CLIP_STROKE_PATH);
+	put_rect(ctx, wri, rect ? rect : &fz_infinite_rect);
+	put_int(ctx, wri, stroke_id);
+	put_matrix(ctx, wri, ctm);
+	put_path(ctx, wri, path);
+}
+
+static void
+lw_fill_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	int font_id = def_font(ctx, wri, text->font);
+	put_byte(ctx, wri, DL_FILL_TEXT);
+	put_matrix(ctx, wri, ctm);
+	put_color(ctx, wri, cs_id, colorspace, color, alpha);
+	put_text(ctx, wri, font_id, text);
+}
+
+static void
+lw_stroke_text(fz_context *ctx, fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	int stroke_id = def_stroke(ctx, wri, stroke);
+	int font_id = def_font(ctx, wri, text->font);
+	put_byte(ctx, wri, DL_STROKE_TEXT);
+	put_int(ctx, wri, stroke_id);
+	put_matrix(ctx, wri, ctm);
+	put_color(ctx, wri, cs_id, colorspace, color, alpha);
+	put_text(ctx, wri, font_id, text);
+}
+
+static void
+lw_clip_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matrix *ctm, int accumulate)
+{
+	list_writer *wri = (list_writer *)dev;
+	int font_id = def_font(ctx, wri, text->font);
+	put_byte(ctx, wri, DL_CLIP_TEXT);
+	put_int(ctx, wri, accumulate);
+	put_matrix(ctx, wri, ctm);
+	put_text(ctx, wri, font_id, text);
+}
+
+static void
+lw_clip_stroke_text(fz_context *ctx, fz_device *dev, fz_text *text, fz_stroke_state *stroke, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	int stroke_id = def_stroke(ctx, wri, stroke);
+	int font_id = def_font(ctx, wri, text->font);
+	put_byte(ctx, wri, DL_CLIP_STROKE_TEXT);
+	put_int(ctx, wri, stroke_id);
+	put_matrix(ctx, wri, ctm);
+	put_text(ctx, wri, font_id, text);
+}
+
+static void
+lw_ignore_text(fz_context *ctx, fz_device *dev, fz_text *text, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	int font_id = def_font(ctx, wri, text->font);
+	put_byte(ctx, wri, DL_IGNORE_TEXT);
+	put_matrix(ctx, wri, ctm);
+	put_text(ctx, wri, font_id, text);
+}
+
+static void
+lw_fill_shade(fz_context *ctx, fz_device *dev, fz_shade *shade, const fz_matrix *ctm, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int shade_id = def_shade(ctx, wri, shade);
+	put_byte(ctx, wri, DL_FILL_SHADE);
+	put_int(ctx, wri, shade_id);
+	put_matrix(ctx, wri, ctm);
+	put_float(ctx, wri, alpha);
+}
+
+static void
+lw_fill_image(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int image_id = def_image(ctx, wri, image);
+	put_byte(ctx, wri, DL_FILL_IMAGE);
+	put_int(ctx, wri, image_id);
+	put_matrix(ctx, wri, ctm);
+	put_float(ctx, wri, alpha);
+}
+
+static void
+lw_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_matrix *ctm,
+	fz_colorspace *colorspace, float *color, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	int image_id = def_image(ctx, wri, image);
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	put_byte(ctx, wri, DL_FILL_IMAGE_MASK);
+	put_int(ctx, wri, image_id);
+	put_matrix(ctx, wri, ctm);
+	put_color(ctx, wri, cs_id, colorspace, color, alpha);
+}
+
+static void
+lw_clip_image_mask(fz_context *ctx, fz_device *dev, fz_image *image, const fz_rect *rect, const fz_matrix *ctm)
+{
+	list_writer *wri = (list_writer *)dev;
+	int image_id = def_image(ctx, wri, image);
+	put_byte(ctx, wri, DL_CLIP_IMAGE_MASK);
+	put_int(ctx, wri, image_id);
+	put_rect(ctx, wri, rect ? rect : &fz_infinite_rect);
+	put_matrix(ctx, wri, ctm);
+}
+
+static void
+lw_pop_clip(fz_context *ctx, fz_device *dev)
+{
+	put_byte(ctx, (list_writer *)dev, DL_POP_CLIP);
+}
+
+static void
+lw_begin_mask(fz_context *ctx, fz_device *dev, const fz_rect *rect, int luminosity, fz_colorspace *colorspace, float *color)
+{
+	list_writer *wri = (list_writer *)dev;
+	int cs_id = def_colorspace(ctx, wri, colorspace);
+	put_byte(ctx, wri, DL_BEGIN_MASK);
+	put_rect(ctx, wri, rect);
+	put_int(ctx, wri, luminosity);
+	put_color(ctx, wri, cs_id, colorspace, color, 1);
+}
+
+static void
+lw_end_mask(fz_context *ctx, fz_device *dev)
+{
+	put_byte(ctx, (list_writer *)dev, DL_END_MASK);
+}
+
+static void
+lw_begin_group(fz_context *ctx, fz_device *dev, const fz_rect *rect, int isolated, int knockout, int blendmode, float alpha)
+{
+	list_writer *wri = (list_writer *)dev;
+	put_byte(ctx, wri, DL_BEGIN_GROUP);
+	put_rect(ctx, wri, rect);
+	put_int(ctx, wri, isolated);
+	put_int(ctx, wri, knockout);
+	put_int(ctx, wri, blendmode);
+	put_float(ctx, wri, alpha);
+}
+
+static void
+lw_end_group(fz_context *ctx, fz_device *dev)
+{
+	put_byte(ctx, (list_writer *)dev, DL_END_GROUP);
+}
+
+static int
+lw_begin_tile(fz_context *ctx, fz_device *dev, const fz_rect *area, const fz_rect *view, float xstep, float ystep, const fz_matrix *ctm, int id)
+{
+	list_writer *wri = (list_writer *)dev;
+	put_byte(ctx, wri, DL_BEGIN_TILE);
+	put_rect(ctx, wri, area);
+	put_rect(ctx, wri, view);
+	put_float(ctx, wri, xstep);
+	put_float(ctx, wri, ystep);
+	put_matrix(ctx, wri, ctm);
+	put_int(ctx, wri, id);
+	return 0;
+}
+
+static void
+lw_end_tile(fz_context *ctx, fz_device *dev)
+{
+	put_byte(ctx, (list_writer *)dev, DL_END_TILE);
+}
+
+static void
+lw_render_flags(fz_context *ctx, fz_device *dev, int set, int clear)
+{
+	list_writer *wri = (list_writer *)dev;
+	put_byte(ctx, wri, DL_RENDER_FLAGS);
+	put_int(ctx, wri, set);
+	put_int(ctx, wri, clear);
+}
+
+static void
+lw_drop_imp(fz_context *ctx, fz_device *dev)
+{
+	list_writer *wri = (list_writer *)dev;
+	fz_drop_hash(ctx, wri->ids);
+}
+
+void
+fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list, fz_display_list_resources *res)
+{
+	list_writer *wri;
+	fz_cookie cookie = { 0 };
+
+	wri = fz_new_device(ctx, sizeof *wri);
+	wri->super.drop_imp = lw_drop_imp;
+
+	wri->super.begin_page = lw_begin_page;
+	wri->super.end_page = lw_end_page;
+
+	wri->super.fill_path = lw_fill_path;
+	wri->super.stroke_path = lw_stroke_path;
+	wri->super.clip_path = lw_clip_path;
+	wri->super.clip_stroke_path = lw_clip_stroke_path;
+
+	wri->super.fill_text = lw_fill_text;
+	wri->super.stroke_text = lw_stroke_text;
+	wri->super.clip_text = lw_clip_text;
+	wri->super.clip_stroke_text = lw_clip_stroke_text;
+	wri->super.ignore_text = lw_ignore_text;
+
+	wri->super.fill_shade = lw_fill_shade;
+	wri->super.fill_image = lw_fill_image;
+	wri->super.fill_image_mask = lw_fill_image_mask;
+	wri->super.clip_image_mask = lw_clip_image_mask;
+
+	wri->super.pop_clip = lw_pop_clip;
+
+	wri->super.begin_mask = lw_begin_mask;
+	wri->super.end_mask = lw_end_mask;
+	wri->super.begin_group = lw_begin_group;
+	wri->super.end_group = lw_end_group;
+
+	wri->super.begin_tile = lw_begin_tile;
+	wri->super.end_tile = lw_end_tile;
+
+	wri->super.render_flags = lw_render_flags;
+
+	wri->out = out;
+	wri->res = res;
+
+	fz_try(ctx)
+	{
+		wri->ids = fz_new_hash_table(ctx, 256, sizeof(void *), -1);
+
+		fz_write(ctx, out, DL_MAGIC, 4);
+		put_int(ctx, wri, DL_VERSION);
+
+		/* Errors during the run are counted in the cookie rather
+		 * than thrown, and any one of them spoils the file. */
+		fz_run_display_list(ctx, list, &wri->super, &fz_identity, NULL, &cookie);
+		if (wri->reason[0])
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", wri->reason);
+		if (cookie.errors)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write display list file");
+
+		put_byte(ctx, wri, DL_END);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, &wri->super);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Reading */
+
+typedef struct list_reader_s list_reader;
+
+struct list_reader_s
+{
+	fz_stream *stm;
+	fz_off_t len; /* of the whole file */
+	fz_display_list_resources *res;
+	int num_colorspaces, max_colorspaces;
+	fz_colorspace **colorspaces;
+	int num_strokes, max_strokes;
+	fz_stroke_state **strokes;
+	int num_fonts, max_fonts;
+	fz_font **fonts;
+	int num_images, max_images;
+	fz_image **images;
+	int num_shades, max_shades;
+	fz_shade **shades;
+};
+
+static int
+get_byte(fz_context *ctx, list_reader *rd)
+{
+	int c = fz_read_byte(ctx, rd->stm);
+	if (c == EOF)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of display list file");
+	return c;
+}
+
+static int
+get_int(fz_context *ctx, list_reader *rd)
+{
+	return fz_read_int32_le(ctx, rd->stm);
+}
+
+/* Make sure the file still holds n more bytes, so that a corrupt count
+ * cannot make us allocate more than the file could fill. */
+static void
+need_bytes(fz_context *ctx, list_reader *rd, fz_off_t n)
+{
+	if (n > rd->len - fz_tell(ctx, rd->stm))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of display list file");
+}
+
+/* Counts and sizes must be sane before we allocate for them. A count of
+ * things that take size bytes each in the file must also fit in what is
+ * left of it. */
+static int
+get_count(fz_context *ctx, list_reader *rd, int max, int size)
+{
+	int n = get_int(ctx, rd);
+	if (n < 0 || n > max)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt display list file");
+	need_bytes(ctx, rd, (fz_off_t)n * size);
+	return n;
+}
+
+static float
+get_float(fz_context *ctx, list_reader *rd)
+{
+	union { float f; int i; } u;
+	u.i = fz_read_int32_le(ctx, rd->stm);
+	return u.f;
+}
+
+static void
+get_floats(fz_context *ctx, list_reader *rd, float *f, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		f[i] = get_float(ctx, rd);
+}
+
+static fz_rect *
+get_rect(fz_context *ctx, list_reader *rd, fz_rect *r)
+{
+	r->x0 = get_float(ctx, rd);
+	r->y0 = get_float(ctx, rd);
+	r->x1 = get_float(ctx, rd);
+	r->y1 = get_float(ctx, rd);
+	return r;
+}
+
+static fz_matrix *
+get_matrix(fz_context *ctx, list_reader *rd, fz_matrix *m)
+{
+	m->a = get_float(ctx, rd);
+	m->b = get_float(ctx, rd);
+	m->c = get_float(ctx, rd);
+	m->d = get_float(ctx, rd);
+	m->e = get_float(ctx, rd);
+	m->f = get_float(ctx, rd);
+	return m;
+}
+
+static void
+get_bytes(fz_context *ctx, list_reader *rd, unsigned char *data, int len)
+{
+	if (fz_read(ctx, rd->stm, data, len) != len)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of display list file");
+}
+
+static fz_buffer *
+get_resource(fz_context *ctx, list_reader *rd)
+{
+	unsigned char digest[16];
+	get_bytes(ctx, rd, digest, 16);
+	return rd->res->get(ctx, rd->res->user, digest);
+}
+
+#define GET_ID(KIND) \
+static void * \
+get_##KIND(fz_context *ctx, list_reader *rd, int allow_null) \
+{ \
+	int id = get_int(ctx, rd); \
+	if (id == -1 && allow_null) \
+		return NULL; \
+	if (id < 0 || id >= rd->num_##KIND) \
+		fz_throw(ctx, FZ_ERROR_GENERIC, "undefined object in display list file"); \
+	return rd->KIND[id]; \
+}
+
+GET_ID(colorspaces)
+GET_ID(strokes)
+GET_ID(fonts)
+GET_ID(images)
+GET_ID(shades)
+
+/* Make room for one more definition. */
+static void
+grow_table(fz_context *ctx, void *table_, int num, int *max)
+{
+	void ***table = table_;
+	if (num == *max)
+	{
+		int new_max = *max ? *max * 2 : 16;
+		*table = fz_resize_array(ctx, *table, new_max, sizeof(void *));
+		*max = new_max;
+	}
+}
+
+static void
+read_def_colorspace(fz_context *ctx, list_reader *rd)
+{
+	fz_colorspace *cs, *base;
+	unsigned char *lookup;
+	int kind, high, len;
+
+	grow_table(ctx, &rd->colorspaces, rd->num_colorspaces, &rd->max_colorspaces);
+
+	kind = get_int(ctx, rd);
+	switch (kind)
+	{
+	case DL_CS_GRAY: cs = fz_device_gray(ctx); break;
+	case DL_CS_RGB: cs = fz_device_rgb(ctx); break;
+	case DL_CS_BGR: cs = fz_device_bgr(ctx); break;
+	case DL_CS_CMYK: cs = fz_device_cmyk(ctx); break;
+	case DL_CS_INDEXED:
+		base = get_colorspaces(ctx, rd, 0);
+		high = get_count(ctx, rd, 255, 0);
+		len = get_int(ctx, rd);
+		if (len != (high + 1) * base->n)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt display list file");
+		need_bytes(ctx, rd, len);
+		lookup = fz_malloc(ctx, len);
+		fz_try(ctx)
+		{
+			get_bytes(ctx, rd, lookup, len);
+			cs = fz_new_indexed_colorspace(ctx, fz_keep_colorspace(ctx, base), high, lookup);
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, lookup);
+			fz_rethrow(ctx);
+		}
+		rd->colorspaces[rd->num_colorspaces++] = cs;
+		return;
+	default:
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown colorspace in display list file");
+	}
+	rd->colorspaces[rd->num_colorspaces++] = fz_keep_colorspace(ctx, cs);
+}
+
+static void
+read_def_stroke(fz_context *ctx, list_reader *rd)
+{
+	fz_stroke_state *stroke;
+	int start_cap, dash_cap, end_cap, linejoin, dash_len;
+	float linewidth, miterlimit, dash_phase;
+
+	grow_table(ctx, &rd->strokes, rd->num_strokes, &rd->max_strokes);
+
+	start_cap = get_int(ctx, rd);
+	dash_cap = get_int(ctx, rd);
+	end_cap = get_int(ctx, rd);
+	linejoin = get_int(ctx, rd);
+	linewidth = get_float(ctx, rd);
+	miterlimit = get_float(ctx, rd);
+	dash_phase = get_float(ctx, rd);
+	dash_len = get_count(ctx, rd, 1 << 16, 4);
+
+	stroke = fz_new_stroke_state_with_dash_len(ctx, dash_len);
+	stroke->start_cap = start_cap;
+	stroke->dash_cap = dash_cap;
+	stroke->end_cap = end_cap;
+	stroke->linejoin = linejoin;
+	stroke->linewidth = linewidth;
+	stroke->miterlimit = miterlimit;
+	stroke->dash_phase = dash_phase;
+	stroke->dash_len = dash_len;
+	rd->strokes[rd->num_strokes++] = stroke;
+	get_floats(ctx, rd, stroke->dash_list, dash_len);
+}
+
+static void
+read_def_font(fz_context *ctx, list_reader *rd)
+{
+	fz_buffer *buf;
+	fz_font *font;
+	char name[32];
+	int index, len, use_glyph_bbox, i;
+
+	grow_table(ctx, &rd->fonts, rd->num_fonts, &rd->max_fonts);
+
+	buf = get_resource(ctx, rd);
+	fz_try(ctx)
+	{
+		index = get_int(ctx, rd);
+		len = get_count(ctx, rd, sizeof name - 1, 1);
+		get_bytes(ctx, rd, (unsigned char *)name, len);
+		name[len] = 0;
+		use_glyph_bbox = get_int(ctx, rd);
+		font = fz_new_font_from_buffer(ctx, name, buf, index, use_glyph_bbox);
+	}
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	rd->fonts[rd->num_fonts++] = font;
+
+	font->ft_substitute = get_int(ctx, rd);
+	font->ft_stretch = get_int(ctx, rd);
+	font->ft_bold = get_int(ctx, rd);
+	font->ft_italic = get_int(ctx, rd);
+	font->ft_hint = get_int(ctx, rd);
+	get_rect(ctx, rd, &font->bbox);
+	font->width_default = get_int(ctx, rd);
+	len = get_count(ctx, rd, 1 << 16, 4);
+	if (len)
+	{
+		font->width_table = fz_malloc_array(ctx, len, sizeof(short));
+		font->width_count = len;
+		for (i = 0; i < len; i++)
+			font->width_table[i] = get_int(ctx, rd);
+	}
+}
+
+static void
+get_compressed_params(fz_context *ctx, list_reader *rd, fz_compression_params *params)
+{
+	int *u = (int *)&params->u;
+	int i, n;
+
+	memset(params, 0, sizeof *params);
+	params->type = get_int(ctx, rd);
+	n = get_count(ctx, rd, 64, 4);
+	for (i = 0; i < n; i++)
+	{
+		int v = get_int(ctx, rd);
+		if (i < NUM_PARAMS)
+			u[i] = v;
+	}
+}
+
+static void
+read_def_image(fz_context *ctx, list_reader *rd)
+{
+	fz_image *image, *mask;
+	fz_colorspace *cs, *pix_cs;
+	fz_compressed_buffer *cbuf;
+	fz_buffer *buf;
+	fz_pixmap *pix;
+	int colorkey[FZ_MAX_COLORS * 2];
+	float decode[FZ_MAX_COLORS * 2];
+	int kind, w, h, n, bpc, xres, yres, interpolate, imagemask, invert_cmyk_jpeg, usecolorkey, i;
+	int pw, ph, pxres, pyres;
+
+	grow_table(ctx, &rd->images, rd->num_images, &rd->max_images);
+
+	kind = get_int(ctx, rd);
+	w = get_int(ctx, rd);
+	h = get_int(ctx, rd);
+	if (w <= 0 || h <= 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt image in display list file");
+	n = get_count(ctx, rd, FZ_MAX_COLORS, 16);
+	bpc = get_int(ctx, rd);
+	cs = get_colorspaces(ctx, rd, 1);
+	xres = get_int(ctx, rd);
+	yres = get_int(ctx, rd);
+	interpolate = get_int(ctx, rd);
+	imagemask = get_int(ctx, rd);
+	invert_cmyk_jpeg = get_int(ctx, rd);
+	usecolorkey = get_int(ctx, rd);
+	for (i = 0; i < n * 2; i++)
+		colorkey[i] = get_int(ctx, rd);
+	get_floats(ctx, rd, decode, n * 2);
+	mask = get_images(ctx, rd, 1);
+
+	if (kind == DL_IMAGE_PIXMAP)
+	{
+		pw = get_int(ctx, rd);
+		ph = get_int(ctx, rd);
+		pix_cs = get_colorspaces(ctx, rd, 1);
+		pxres = get_int(ctx, rd);
+		pyres = get_int(ctx, rd);
+		buf = get_resource(ctx, rd);
+		pix = NULL;
+		fz_var(pix);
+		fz_try(ctx)
+		{
+			/* Check against the data we have before allocating */
+			int pn = (pix_cs ? pix_cs->n : 0) + 1;
+			if (pw <= 0 || ph <= 0 || (int64_t)pw * ph * pn != buf->len)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "image data in display list resources is the wrong size");
+			pix = fz_new_pixmap(ctx, pix_cs, pw, ph);
+			memcpy(pix->samples, buf->data, buf->len);
+			pix->xres = pxres;
+			pix->yres = pyres;
+			pix->interpolate = interpolate;
+			image = fz_new_image_from_pixmap(ctx, pix, fz_keep_image(ctx, mask));
+		}
+		fz_always(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+			fz_drop_buffer(ctx, buf);
+		}
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	else if (kind == DL_IMAGE_COMPRESSED)
+	{
+		cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+		fz_try(ctx)
+		{
+			get_compressed_params(ctx, rd, &cbuf->params);
+			cbuf->buffer = get_resource(ctx, rd);
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, cbuf);
+			fz_rethrow(ctx);
+		}
+		image = fz_new_image(ctx, w, h, bpc, fz_keep_colorspace(ctx, cs), xres, yres, interpolate, imagemask,
+			decode, usecolorkey ? colorkey : NULL, cbuf, fz_keep_image(ctx, mask));
+	}
+	else
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown image in display list file");
+
+	image->xres = xres;
+	image->yres = yres;
+	image->interpolate = interpolate;
+	image->imagemask = imagemask;
+	image->invert_cmyk_jpeg = invert_cmyk_jpeg;
+	rd->images[rd->num_images++] = image;
+}
+
+static void
+read_def_shade(fz_context *ctx, list_reader *rd)
+{
+	fz_shade *shade;
+	int n, i, len;
+
+	grow_table(ctx, &rd->shades, rd->num_shades, &rd->max_shades);
+
+	shade = fz_malloc_struct(ctx, fz_shade);
+	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+	rd->shades[rd->num_shades++] = shade;
+
+	shade->type = get_int(ctx, rd);
+	if (shade->type < FZ_FUNCTION_BASED || shade->type > FZ_MESH_TYPE7)
+	{
+		/* Don't let the drop function look at a union
+		 * it does not know. */
+		shade->type = 0;
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown shading in display list file");
+	}
+	shade->colorspace = fz_keep_colorspace(ctx, get_colorspaces(ctx, rd, 1));
+	n = shade->colorspace ? shade->colorspace->n : 1;
+	get_rect(ctx, rd, &shade->bbox);
+	get_matrix(ctx, rd, &shade->matrix);
+	shade->use_background = get_int(ctx, rd);
+	get_floats(ctx, rd, shade->background, n);
+	shade->use_function = get_int(ctx, rd);
+	if (shade->use_function)
+		for (i = 0; i < 256; i++)
+			get_floats(ctx, rd, shade->function[i], n + 1);
+
+	switch (shade->type)
+	{
+	case FZ_FUNCTION_BASED:
+		get_matrix(ctx, rd, &shade->u.f.matrix);
+		shade->u.f.xdivs = get_count(ctx, rd, 1024, 0);
+		shade->u.f.ydivs = get_count(ctx, rd, 1024, 0);
+		get_floats(ctx, rd, &shade->u.f.domain[0][0], 4);
+		len = (shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * n;
+		need_bytes(ctx, rd, (fz_off_t)len * 4);
+		shade->u.f.fn_vals = fz_malloc_array(ctx, len, sizeof(float));
+		get_floats(ctx, rd, shade->u.f.fn_vals, len);
+		break;
+	case FZ_LINEAR:
+	case FZ_RADIAL:
+		shade->u.l_or_r.extend[0] = get_int(ctx, rd);
+		shade->u.l_or_r.extend[1] = get_int(ctx, rd);
+		get_floats(ctx, rd, &shade->u.l_or_r.coords[0][0], 6);
+		break;
+	default:
+		shade->u.m.vprow = get_int(ctx, rd);
+		shade->u.m.bpflag = get_int(ctx, rd);
+		shade->u.m.bpcoord = get_int(ctx, rd);
+		shade->u.m.bpcomp = get_int(ctx, rd);
+		shade->u.m.x0 = get_float(ctx, rd);
+		shade->u.m.x1 = get_float(ctx, rd);
+		shade->u.m.y0 = get_float(ctx, rd);
+		shade->u.m.y1 = get_float(ctx, rd);
+		get_floats(ctx, rd, shade->u.m.c0, FZ_MAX_COLORS);
+		get_floats(ctx, rd, shade->u.m.c1, FZ_MAX_COLORS);
+		break;
+	}
+
+	if (get_int(ctx, rd))
+	{
+		shade->buffer = fz_malloc_struct(ctx, fz_compressed_buffer);
+		get_compressed_params(ctx, rd, &shade->buffer->params);
+		len = get_count(ctx, rd, INT_MAX, 1);
+		shade->buffer->buffer = fz_new_buffer(ctx, len);
+		get_bytes(ctx, rd, shade->buffer->buffer->data, len);
+		shade->buffer->buffer->len = len;
+	}
+}
+
+static fz_colorspace *
+get_color(fz_context *ctx, list_reader *rd, float *color, float *alpha)
+{
+	fz_colorspace *cs = get_colorspaces(ctx, rd, 1);
+	memset(color, 0, FZ_MAX_COLORS * sizeof(float));
+	get_floats(ctx, rd, color, cs ? cs->n : 0);
+	*alpha = get_float(ctx, rd);
+	return cs;
+}
+
+static fz_path *
+get_path(fz_context *ctx, list_reader *rd)
+{
+	fz_path *path = fz_new_path(ctx);
+	float v[6];
+	int op;
+
+	fz_try(ctx)
+	{
+		while ((op = get_byte(ctx, rd)) != DL_PATH_END)
+		{
+			switch (op)
+			{
+			case DL_PATH_MOVE:
+				get_floats(ctx, rd, v, 2);
+				fz_moveto(ctx, path, v[0], v[1]);
+				break;
+			case DL_PATH_LINE:
+				get_floats(ctx, rd, v, 2);
+				fz_lineto(ctx, path, v[0], v[1]);
+				break;
+			case DL_PATH_CURVE:
+				get_floats(ctx, rd, v, 6);
+				fz_curveto(ctx, path, v[0], v[1], v[2], v[3], v[4], v[5]);
+				break;
+			case DL_PATH_QUAD:
+				get_floats(ctx, rd, v, 4);
+				fz_quadto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_PATH_CURVEV:
+				get_floats(ctx, rd, v, 4);
+				fz_curvetov(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_PATH_CURVEY:
+				get_floats(ctx, rd, v, 4);
+				fz_curvetoy(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_PATH_RECT:
+				get_floats(ctx, rd, v, 4);
+				fz_rectto(ctx, path, v[0], v[1], v[2], v[3]);
+				break;
+			case DL_PATH_CLOSE:
+				fz_closepath(ctx, path);
+				break;
+			default:
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt path in display list file");
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_rethrow(ctx);
+	}
+	return path;
+}
+
+static fz_text *
+get_text(fz_context *ctx, list_reader *rd)
+{
+	fz_font *font;
+	fz_matrix trm;
+	fz_text *text;
+	int wmode, len, i;
+
+	font = get_fonts(ctx, rd, 0);
+	get_matrix(ctx, rd, &trm);
+	wmode = get_int(ctx, rd);
+	len = get_count(ctx, rd, INT_MAX / sizeof(fz_text_item), 16);
+	text = fz_new_text(ctx, font, &trm, wmode);
+	fz_try(ctx)
+	{
+		for (i = 0; i < len; i++)
+		{
+			float x = get_float(ctx, rd);
+			float y = get_float(ctx, rd);
+			int gid = get_int(ctx, rd);
+			int ucs = get_int(ctx, rd);
+			fz_add_text(ctx, text, gid, ucs, x, y);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+/* Read one drawing record and replay it into dev. Paths and text made
+ * here are dropped in the caller's fz_always. */
+static void
+read_record(fz_context *ctx, list_reader *rd, fz_device *dev, int op, fz_path **path, fz_text **text)
+{
+	fz_colorspace *cs;
+	fz_stroke_state *stroke;
+	fz_image *image;
+	fz_shade *shade;
+	float color[FZ_MAX_COLORS];
+	fz_matrix ctm;
+	fz_rect rect, view;
+	float alpha, xstep, ystep;
+	int even_odd, luminosity, isolated, knockout, blendmode, id, set, clear;
+
+	switch (op)
+	{
+	case DL_BEGIN_PAGE:
+		get_rect(ctx, rd, &rect);
+		get_matrix(ctx, rd, &ctm);
+		fz_begin_page(ctx, dev, &rect, &ctm);
+		break;
+	case DL_END_PAGE:
+		fz_end_page(ctx, dev);
+		break;
+	case DL_FILL_PATH:
+		even_odd = get_int(ctx, rd);
+		get_matrix(ctx, rd, &ctm);
+		cs = get_color(ctx, rd, color, &alpha);
+		*path = get_path(ctx, rd);
+		fz_fill_path(ctx, dev, *path, even_odd, &ctm, cs, color, alpha);
+		break;
+	case DL_STROKE_PATH:
+		stroke = get_strokes(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		cs = get_color(ctx, rd, color, &alpha);
+		*path = get_path(ctx, rd);
+		fz_stroke_path(ctx, dev, *path, stroke, &ctm, cs, color, alpha);
+		break;
+	case DL_CLIP_PATH:
+		get_rect(ctx, rd, &rect);
+		even_odd = get_int(ctx, rd);
+		get_matrix(ctx, rd, &ctm);
+		*path = get_path(ctx, rd);
+		fz_clip_path(ctx, dev, *path, &rect, even_odd, &ctm);
+		break;
+	case DL_CLIP_STROKE_PATH:
+		get_rect(ctx, rd, &rect);
+		stroke = get_strokes(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		*path = get_path(ctx, rd);
+		fz_clip_stroke_path(ctx, dev, *path, &rect, stroke, &ctm);
+		break;
+	case DL_FILL_TEXT:
+		get_matrix(ctx, rd, &ctm);
+		cs = get_color(ctx, rd, color, &alpha);
+		*text = get_text(ctx, rd);
+		fz_fill_text(ctx, dev, *text, &ctm, cs, color, alpha);
+		break;
+	case DL_STROKE_TEXT:
+		stroke = get_strokes(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		cs = get_color(ctx, rd, color, &alpha);
+		*text = get_text(ctx, rd);
+		fz_stroke_text(ctx, dev, *text, stroke, &ctm, cs, color, alpha);
+		break;
+	case DL_CLIP_TEXT:
+		id = get_int(ctx, rd);
+		get_matrix(ctx, rd, &ctm);
+		*text = get_text(ctx, rd);
+		fz_clip_text(ctx, dev, *text, &ctm, id);
+		break;
+	case DL_CLIP_STROKE_TEXT:
+		stroke = get_strokes(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		*text = get_text(ctx, rd);
+		fz_clip_stroke_text(ctx, dev, *text, stroke, &ctm);
+		break;
+	case DL_IGNORE_TEXT:
+		get_matrix(ctx, rd, &ctm);
+		*text = get_text(ctx, rd);
+		fz_ignore_text(ctx, dev, *text, &ctm);
+		break;
+	case DL_FILL_SHADE:
+		shade = get_shades(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		alpha = get_float(ctx, rd);
+		fz_fill_shade(ctx, dev, shade, &ctm, alpha);
+		break;
+	case DL_FILL_IMAGE:
+		image = get_images(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		alpha = get_float(ctx, rd);
+		fz_fill_image(ctx, dev, image, &ctm, alpha);
+		break;
+	case DL_FILL_IMAGE_MASK:
+		image = get_images(ctx, rd, 0);
+		get_matrix(ctx, rd, &ctm);
+		cs = get_color(ctx, rd, color, &alpha);
+		fz_fill_image_mask(ctx, dev, image, &ctm, cs, color, alpha);
+		break;
+	case DL_CLIP_IMAGE_MASK:
+		image = get_images(ctx, rd, 0);
+		get_rect(ctx, rd, &rect);
+		get_matrix(ctx, rd, &ctm);
+		fz_clip_image_mask(ctx, dev, image, &rect, &ctm);
+		break;
+	case DL_POP_CLIP:
+		fz_pop_clip(ctx, dev);
+		break;
+	case DL_BEGIN_MASK:
+		get_rect(ctx, rd, &rect);
+		luminosity = get_int(ctx, rd);
+		cs = get_color(ctx, rd, color, &alpha);
+		fz_begin_mask(ctx, dev, &rect, luminosity, cs, color);
+		break;
+	case DL_END_MASK:
+		fz_end_mask(ctx, dev);
+		break;
+	case DL_BEGIN_GROUP:
+		get_rect(ctx, rd, &rect);
+		isolated = get_int(ctx, rd);
+		knockout = get_int(ctx, rd);
+		blendmode = get_int(ctx, rd);
+		alpha = get_float(ctx, rd);
+		fz_begin_group(ctx, dev, &rect, isolated, knockout, blendmode, alpha);
+		break;
+	case DL_END_GROUP:
+		fz_end_group(ctx, dev);
+		break;
+	case DL_BEGIN_TILE:
+		get_rect(ctx, rd, &rect);
+		get_rect(ctx, rd, &view);
+		xstep = get_float(ctx, rd);
+		ystep = get_float(ctx, rd);
+		get_matrix(ctx, rd, &ctm);
+		id = get_int(ctx, rd);
+		fz_begin_tile_id(ctx, dev, &rect, &view, xstep, ystep, &ctm, id);
+		break;
+	case DL_END_TILE:
+		fz_end_tile(ctx, dev);
+		break;
+	case DL_RENDER_FLAGS:
+		set = get_int(ctx, rd);
+		clear = get_int(ctx, rd);
+		fz_render_flags(ctx, dev, set, clear);
+		break;
+	default:
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unknown record in display list file");
+	}
+}
+
+static void
+drop_reader_tables(fz_context *ctx, list_reader *rd)
+{
+	int i;
+
+	for (i = 0; i < rd->num_shades; i++)
+		fz_drop_shade(ctx, rd->shades[i]);
+	for (i = 0; i < rd->num_images; i++)
+		fz_drop_image(ctx, rd->images[i]);
+	for (i = 0; i < rd->num_fonts; i++)
+		fz_drop_font(ctx, rd->fonts[i]);
+	for (i = 0; i < rd->num_strokes; i++)
+		fz_drop_stroke_state(ctx, rd->strokes[i]);
+	for (i = 0; i < rd->num_colorspaces; i++)
+		fz_drop_colorspace(ctx, rd->colorspaces[i]);
+	fz_free(ctx, rd->shades);
+	fz_free(ctx, rd->images);
+	fz_free(ctx, rd->fonts);
+	fz_free(ctx, rd->strokes);
+	fz_free(ctx, rd->colorspaces);
+}
+
+fz_display_list *
+fz_read_display_list(fz_context *ctx, fz_stream *stm, fz_display_list_resources *res)
+{
+	list_reader rd = { 0 };
+	fz_display_list *list = NULL;
+	fz_device *dev = NULL;
+	fz_path *path = NULL;
+	fz_text *text = NULL;
+	unsigned char magic[4];
+	int op;
+
+	rd.res = res;
+
+	fz_var(list);
+	fz_var(dev);
+	fz_var(path);
+	fz_var(text);
+
+	/* Counts are checked against the length of the file, so we must
+	 * know it. Files and buffers can tell us; read anything else into
+	 * memory first. */
+	if (stm->seek)
+		rd.stm = fz_keep_stream(ctx, stm);
+	else
+	{
+		fz_buffer *buf = fz_read_all(ctx, stm, 0);
+		fz_try(ctx)
+			rd.stm = fz_open_buffer(ctx, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+
+	fz_try(ctx)
+	{
+		fz_off_t start = fz_tell(ctx, rd.stm);
+		fz_seek(ctx, rd.stm, 0, SEEK_END);
+		rd.len = fz_tell(ctx, rd.stm);
+		fz_seek(ctx, rd.stm, start, SEEK_SET);
+
+		get_bytes(ctx, &rd, magic, 4);
+		if (memcmp(magic, DL_MAGIC, 4))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "not a display list file");
+		if (get_int(ctx, &rd) != DL_VERSION)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported display list file version");
+
+		list = fz_new_display_list(ctx);
+		dev = fz_new_list_device(ctx, list);
+
+		while ((op = get_byte(ctx, &rd)) != DL_END)
+		{
+			switch (op)
+			{
+			case DL_DEF_COLORSPACE: read_def_colorspace(ctx, &rd); break;
+			case DL_DEF_STROKE: read_def_stroke(ctx, &rd); break;
+			case DL_DEF_FONT: read_def_font(ctx, &rd); break;
+			case DL_DEF_IMAGE: read_def_image(ctx, &rd); break;
+			case DL_DEF_SHADE: read_def_shade(ctx, &rd); break;
+			default:
+				read_record(ctx, &rd, dev, op, &path, &text);
+				fz_drop_path(ctx, path);
+				path = NULL;
+				fz_drop_text(ctx, text);
+				text = NULL;
+				break;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_drop_text(ctx, text);
+		fz_drop_device(ctx, dev);
+		drop_reader_tables(ctx, &rd);
+		fz_drop_stream(ctx, rd.stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	return list;
+}
+
+/* Resources in a directory, one file per digest */
+
+static void
+resource_path(fz_context *ctx, char *path, int size, const char *dir, const unsigned char digest[16])
+{
+	char hex[33];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	if (fz_snprintf(path, size, "%s/%s", dir, hex) >= size)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "display list resource path too long");
+}
+
+static int
+file_exists(const char *path)
+{
+	FILE *file = fz_fopen(path, "rb");
+	if (!file)
+		return 0;
+	fclose(file);
+	return 1;
+}
+
+static void
+dir_put(fz_context *ctx, void *user, const unsigned char digest[16], fz_buffer *buf)
+{
+	static int counter = 0;
+	char path[4096], tmp[4128];
+	fz_output *out;
+	int n;
+
+	resource_path(ctx, path, sizeof path, user, digest);
+	if (file_exists(path))
+		return;
+
+	/* Write under a temporary name so that readers never see half a
+	 * resource. Other threads and processes may be writing the same
+	 * resource into the directory, so the name must be our own. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	n = counter++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_snprintf(tmp, sizeof tmp, "%s.%d.%d.tmp", path, (int)getpid(), n);
+	out = fz_new_output_to_filename(ctx, tmp);
+	fz_try(ctx)
+		fz_write(ctx, out, buf->data, buf->len);
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+	{
+		remove(tmp);
+		fz_rethrow(ctx);
+	}
+	if (rename(tmp, path) != 0)
+	{
+		remove(tmp);
+		/* Someone else got there first; theirs is the same data. */
+		if (!file_exists(path))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot rename '%s' to '%s'", tmp, path);
+	}
+}
+
+static fz_buffer *
+dir_get(fz_context *ctx, void *user, const unsigned char digest[16])
+{
+	char path[4096];
+	unsigned char check[16];
+	fz_buffer *buf;
+	fz_md5 md5;
+
+	resource_path(ctx, path, sizeof path, user, digest);
+	buf = fz_read_file(ctx, path);
+
+	/* The file is named by its digest; make sure it still matches
+	 * before handing it to the font and image loaders. */
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, buf->data, buf->len);
+	fz_md5_final(&md5, check);
+	if (memcmp(check, digest, 16))
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "display list resource '%s' does not match its digest", path);
+	}
+	return buf;
+}
+
+void
+fz_init_display_list_resource_directory(fz_context *ctx, fz_display_list_resources *res, const char *dir)
+{
+	res->user = (void *)dir;
+	res->put = dir_put;
+	res->get = dir_get;
+}
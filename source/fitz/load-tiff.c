@@ -6,6 +6,7 @@
  * Limited bit depths (1,2,4,8).
  * Limited planar configurations (1=chunky).
  * No tiles (easy fix if necessary).
+ * Strips can be decoded selectively, to load only a part of the image.
  * TODO: RGBPal images
  */
 
@@ -62,6 +63,9 @@ struct tiff
 	fz_colorspace *colorspace;
 	unsigned char *samples;
 	int stride;
+
+	/* rows of the image held in samples */
+	unsigned row0, rows;
 };
 
 enum
@@ -300,9 +304,9 @@ fz_expand_tiff_colormap(fz_context *ctx, struct tiff *tiff)
 
 	stride = tiff->imagewidth * (tiff->samplesperpixel + 2);
 
-	samples = fz_malloc(ctx, stride * tiff->imagelength);
+	samples = fz_malloc(ctx, stride * tiff->rows);
 
-	for (y = 0; y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->rows; y++)
 	{
 		src = tiff->samples + (unsigned int)(tiff->stride * y);
 		dst = samples + (unsigned int)(stride * y);
@@ -335,8 +339,10 @@ fz_expand_tiff_colormap(fz_context *ctx, struct tiff *tiff)
 	tiff->samples = samples;
 }
 
+/* Decode the strips holding rows y0 to y1 (exclusive) of the image. The
+ * samples start with the first row of the first such strip. */
 static void
-fz_decode_tiff_strips(fz_context *ctx, struct tiff *tiff)
+fz_decode_tiff_strips(fz_context *ctx, struct tiff *tiff, unsigned y0, unsigned y1)
 {
 	fz_stream *stm;
 
@@ -416,20 +422,24 @@ fz_decode_tiff_strips(fz_context *ctx, struct tiff *tiff)
 		tiff->yresolution = 96;
 	}
 
-	tiff->samples = fz_malloc_array(ctx, tiff->imagelength, tiff->stride);
-	memset(tiff->samples, 0x55, tiff->imagelength * tiff->stride);
+	/* Each strip is coded on its own, so we can start at any of them */
+	strip = y0 / tiff->rowsperstrip;
+	tiff->row0 = strip * tiff->rowsperstrip;
+	tiff->rows = y1 - tiff->row0;
+
+	tiff->samples = fz_malloc_array(ctx, tiff->rows, tiff->stride);
+	memset(tiff->samples, 0x55, tiff->rows * tiff->stride);
 	wp = tiff->samples;
 
-	strip = 0;
-	for (row = 0; row < tiff->imagelength; row += tiff->rowsperstrip)
+	for (row = tiff->row0; row < y1; row += tiff->rowsperstrip)
 	{
 		unsigned offset = tiff->stripoffsets[strip];
 		unsigned rlen = tiff->stripbytecounts[strip];
 		unsigned wlen = tiff->stride * tiff->rowsperstrip;
 		unsigned char *rp = tiff->bp + offset;
 
-		if (wp + wlen > tiff->samples + (unsigned int)(tiff->stride * tiff->imagelength))
-			wlen = tiff->samples + (unsigned int)(tiff->stride * tiff->imagelength) - wp;
+		if (wp + wlen > tiff->samples + (unsigned int)(tiff->stride * tiff->rows))
+			wlen = tiff->samples + (unsigned int)(tiff->stride * tiff->rows) - wp;
 
 		if (rp + rlen > tiff->ep)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "strip extends beyond the end of the file");
@@ -488,7 +498,7 @@ fz_decode_tiff_strips(fz_context *ctx, struct tiff *tiff)
 	if ((tiff->compression == 5 || tiff->compression == 8) && tiff->predictor == 2)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < tiff->rows; i++)
 		{
 			fz_unpredict_tiff(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample);
 			p += tiff->stride;
@@ -503,7 +513,7 @@ fz_decode_tiff_strips(fz_context *ctx, struct tiff *tiff)
 	if (tiff->photometric == 0)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < tiff->rows; i++)
 		{
 			fz_invert_tiff(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample, tiff->extrasamples);
 			p += tiff->stride;
@@ -824,11 +834,15 @@ fz_decode_tiff_ifd(fz_context *ctx, struct tiff *tiff)
 	}
 }
 
-fz_pixmap *
-fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage)
+static fz_pixmap *
+fz_load_tiff_imp(fz_context *ctx, unsigned char *buf, int len, int subimage, fz_irect *subarea)
 {
-	fz_pixmap *image;
+	fz_pixmap *image = NULL;
+	fz_pixmap *part;
 	struct tiff tiff = { 0 };
+	fz_irect bounds;
+
+	fz_var(image);
 
 	fz_try(ctx)
 	{
@@ -841,15 +855,33 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 		if (tiff.rowsperstrip > tiff.imagelength)
 			tiff.rowsperstrip = tiff.imagelength;
 
-		fz_decode_tiff_strips(ctx, &tiff);
+		bounds.x0 = 0;
+		bounds.y0 = 0;
+		bounds.x1 = tiff.imagewidth;
+		bounds.y1 = tiff.imagelength;
+		if (subarea)
+		{
+			/* Strips span the width of the image, so we give all of
+			 * it rather than decode them again for the next part. */
+			fz_intersect_irect(subarea, &bounds);
+			if (fz_is_empty_irect(subarea))
+				*subarea = bounds;
+			subarea->x0 = bounds.x0;
+			subarea->x1 = bounds.x1;
+		}
+		else
+			subarea = &bounds;
+
+		fz_decode_tiff_strips(ctx, &tiff, subarea->y0, subarea->y1);
 
 		/* Byte swap 16-bit images to big endian if necessary */
 		if (tiff.bitspersample == 16)
 			if (tiff.order == TII)
-				fz_swap_tiff_byte_order(tiff.samples, tiff.imagewidth * tiff.imagelength * tiff.samplesperpixel);
+				fz_swap_tiff_byte_order(tiff.samples, tiff.imagewidth * tiff.rows * tiff.samplesperpixel);
 
 		/* Expand into fz_pixmap struct */
-		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.imagewidth, tiff.imagelength);
+		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.imagewidth, tiff.rows);
+		image->y = tiff.row0;
 		image->xres = tiff.xresolution;
 		image->yres = tiff.yresolution;
 
@@ -863,6 +895,7 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 			{
 				fz_pixmap *rgb = fz_new_pixmap(ctx, fz_device_rgb(ctx), image->w, image->h);
 				fz_convert_pixmap(ctx, rgb, image);
+				rgb->y = image->y;
 				rgb->xres = image->xres;
 				rgb->yres = image->yres;
 				fz_drop_pixmap(ctx, image);
@@ -870,6 +903,19 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 			}
 			fz_premultiply_pixmap(ctx, image);
 		}
+
+		/* The first strip may start above the rows wanted */
+		if (subarea->y0 != image->y)
+		{
+			part = fz_new_pixmap_with_bbox(ctx, image->colorspace, subarea);
+			part->xres = image->xres;
+			part->yres = image->yres;
+			fz_copy_pixmap_rect(ctx, part, image, subarea);
+			fz_drop_pixmap(ctx, image);
+			image = part;
+		}
+		image->x = 0;
+		image->y = 0;
 	}
 	fz_always(ctx)
 	{
@@ -882,12 +928,25 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage
 	}
 	fz_catch(ctx)
 	{
+		fz_drop_pixmap(ctx, image);
 		fz_rethrow_message(ctx, "out of memory loading tiff");
 	}
 
 	return image;
 }
 
+fz_pixmap *
+fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, int len, int subimage)
+{
+	return fz_load_tiff_imp(ctx, buf, len, subimage, NULL);
+}
+
+fz_pixmap *
+fz_load_tiff_subarea(fz_context *ctx, unsigned char *buf, int len, fz_irect *subarea)
+{
+	return fz_load_tiff_imp(ctx, buf, len, 0, subarea);
+}
+
 fz_pixmap *
 fz_load_tiff(fz_context *ctx, unsigned char *buf, int len)
 {
@@ -0,0 +1,183 @@
+#include "mupdf/fitz.h"
+
+/* Flattened page text, and the store type that caches it per page. */
+
+static void
+fz_drop_page_text_imp(fz_context *ctx, fz_storable *text_)
+{
+	fz_page_text *text = (fz_page_text *)text_;
+
+	fz_free(ctx, text->text);
+	fz_free(ctx, text->bbox);
+	fz_free(ctx, text);
+}
+
+fz_page_text *
+fz_keep_page_text(fz_context *ctx, fz_page_text *text)
+{
+	return (fz_page_text *)fz_keep_storable(ctx, &text->storable);
+}
+
+void
+fz_drop_page_text(fz_context *ctx, fz_page_text *text)
+{
+	fz_drop_storable(ctx, &text->storable);
+}
+
+fz_page_text *
+fz_new_page_text_from_text_page(fz_context *ctx, fz_text_page *page)
+{
+	fz_text_index *index;
+	fz_page_text *text;
+	int i;
+
+	index = fz_index_text_page(ctx, page);
+
+	text = fz_malloc_struct(ctx, fz_page_text);
+	FZ_INIT_STORABLE(text, 1, fz_drop_page_text_imp);
+	fz_try(ctx)
+	{
+		text->text = fz_malloc_array(ctx, index->len, sizeof *text->text);
+		text->bbox = fz_malloc_array(ctx, index->len, sizeof *text->bbox);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_page_text_imp(ctx, &text->storable);
+		fz_rethrow(ctx);
+	}
+
+	text->len = index->len;
+	for (i = 0; i < index->len; i++)
+	{
+		text->text[i] = index->chars[i].c;
+		text->bbox[i] = index->chars[i].bbox;
+	}
+
+	return text;
+}
+
+typedef struct fz_page_text_key_s fz_page_text_key;
+
+struct fz_page_text_key_s {
+	int refs;
+	int doc_id;
+	int number;
+};
+
+static int
+fz_make_hash_page_text_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_page_text_key *key = (fz_page_text_key *)key_;
+	hash->u.i.i0 = key->doc_id;
+	hash->u.i.i1 = key->number;
+	return 1;
+}
+
+static void *
+fz_keep_page_text_key(fz_context *ctx, void *key_)
+{
+	fz_page_text_key *key = (fz_page_text_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_page_text_key(fz_context *ctx, void *key_)
+{
+	fz_page_text_key *key = (fz_page_text_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+fz_cmp_page_text_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_page_text_key *k0 = (fz_page_text_key *)k0_;
+	fz_page_text_key *k1 = (fz_page_text_key *)k1_;
+	return k0->doc_id == k1->doc_id && k0->number == k1->number;
+}
+
+#ifndef NDEBUG
+static void
+fz_debug_page_text(fz_context *ctx, FILE *out, void *key_)
+{
+	fz_page_text_key *key = (fz_page_text_key *)key_;
+
+	fprintf(out, "(page text doc=%d page=%d) ", key->doc_id, key->number);
+}
+#endif
+
+static fz_store_type fz_page_text_store_type =
+{
+	fz_make_hash_page_text_key,
+	fz_keep_page_text_key,
+	fz_drop_page_text_key,
+	fz_cmp_page_text_key,
+#ifndef NDEBUG
+	fz_debug_page_text
+#endif
+};
+
+fz_page_text *
+fz_load_page_text(fz_context *ctx, fz_document *doc, int number)
+{
+	fz_page_text_key key;
+	fz_page_text_key *keyp = NULL;
+	fz_page_text *text;
+	fz_text_sheet *sheet;
+	fz_text_page *page;
+
+	if (doc->id == 0)
+		doc->id = fz_gen_id(ctx);
+
+	key.refs = 1;
+	key.doc_id = doc->id;
+	key.number = number;
+	text = fz_find_item(ctx, fz_drop_page_text_imp, &key, &fz_page_text_store_type);
+	if (text)
+		return text;
+
+	sheet = fz_new_text_sheet(ctx);
+	fz_try(ctx)
+	{
+		page = fz_new_text_page_from_page_number(ctx, doc, number, sheet);
+		fz_try(ctx)
+			text = fz_new_page_text_from_text_page(ctx, page);
+		fz_always(ctx)
+			fz_drop_text_page(ctx, page);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+	fz_always(ctx)
+		fz_drop_text_sheet(ctx, sheet);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	/* Now we try to cache the text. Any failure here will just result
+	 * in us not caching. */
+	fz_var(keyp);
+	fz_try(ctx)
+	{
+		fz_page_text *existing;
+
+		keyp = fz_malloc_struct(ctx, fz_page_text_key);
+		*keyp = key;
+		existing = fz_store_item(ctx, keyp, text, text->len * (sizeof *text->text + sizeof *text->bbox), &fz_page_text_store_type);
+		if (existing)
+		{
+			/* Extracted by a racing thread; use that one. */
+			fz_drop_page_text(ctx, text);
+			text = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			fz_drop_page_text_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return text;
+}
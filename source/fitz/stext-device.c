@@ -464,6 +464,7 @@ fz_new_text_page(fz_context *ctx)
 	page->cap = 0;
 	page->blocks = NULL;
 	page->next = NULL;
+	page->index = NULL;
 	return page;
 }
 
@@ -507,6 +508,7 @@ fz_drop_text_page(fz_context *ctx, fz_text_page *page)
 	fz_page_block *block;
 	if (page == NULL)
 		return;
+	fz_invalidate_text_page_index(ctx, page);
 	for (block = page->blocks; block < page->blocks + page->len; block++)
 	{
 		switch (block->type)
@@ -1031,6 +1033,7 @@ fz_text_end_page(fz_context *ctx, fz_device *dev)
 	/* TODO: unicode NFC normalization */
 
 	fz_bidi_reorder_text_page(ctx, tdev->page);
+	fz_invalidate_text_page_index(ctx, tdev->page);
 }
 
 static void
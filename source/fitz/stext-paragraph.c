@@ -1023,6 +1023,8 @@ fz_analyze_text(fz_context *ctx, fz_text_sheet *sheet, fz_text_page *page)
 	region_masks *rms;
 	int block_num;
 
+	fz_invalidate_text_page_index(ctx, page);
+
 	/* Simple paragraph analysis; look for the most common 'inter line'
 	 * spacing. This will be assumed to be our line spacing. Anything
 	 * more than 25% wider than this will be assumed to be a paragraph
@@ -14,42 +14,109 @@ static inline int iswhite(int c)
 	return c == ' ' || c == '\r' || c == '\n' || c == '\t' || c == 0xA0 || c == 0x2028 || c == 0x2029;
 }
 
-fz_char_and_box *fz_text_char_at(fz_context *ctx, fz_char_and_box *cab, fz_text_page *page, int idx)
+void
+fz_invalidate_text_page_index(fz_context *ctx, fz_text_page *page)
+{
+	fz_text_index *index = page->index;
+
+	if (!index)
+		return;
+	fz_free(ctx, index->chars);
+	fz_free(ctx, index->lines);
+	fz_free(ctx, index->line_start);
+	fz_free(ctx, index);
+	page->index = NULL;
+}
+
+fz_text_index *
+fz_index_text_page(fz_context *ctx, fz_text_page *page)
 {
-	int block_num;
-	int ofs = 0;
+	fz_text_index *index;
+	fz_text_index_char *ch;
+	fz_text_block *block;
+	fz_text_line *line;
+	fz_text_span *span;
+	int block_num, i, n, len, line_count;
 
+	if (page->index)
+		return page->index;
+
+	len = 0;
+	line_count = 0;
 	for (block_num = 0; block_num < page->len; block_num++)
 	{
-		fz_text_block *block;
-		fz_text_line *line;
-		fz_text_span *span;
+		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
+			continue;
+		block = page->blocks[block_num].u.text;
+		for (line = block->lines; line < block->lines + block->len; line++)
+		{
+			for (span = line->first_span; span; span = span->next)
+				len += span->len;
+			len++; /* pseudo-newline */
+			line_count++;
+		}
+	}
+
+	index = fz_malloc_struct(ctx, fz_text_index);
+	fz_try(ctx)
+	{
+		index->chars = fz_malloc_array(ctx, len, sizeof *index->chars);
+		index->lines = fz_malloc_array(ctx, line_count, sizeof *index->lines);
+		index->line_start = fz_malloc_array(ctx, line_count + 1, sizeof *index->line_start);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, index->chars);
+		fz_free(ctx, index->lines);
+		fz_free(ctx, index);
+		fz_rethrow(ctx);
+	}
+	index->len = len;
+	index->line_count = line_count;
 
+	ch = index->chars;
+	n = 0;
+	for (block_num = 0; block_num < page->len; block_num++)
+	{
 		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
 			continue;
 		block = page->blocks[block_num].u.text;
 		for (line = block->lines; line < block->lines + block->len; line++)
 		{
+			index->lines[n] = line;
+			index->line_start[n++] = ch - index->chars;
 			for (span = line->first_span; span; span = span->next)
 			{
-				if (idx < ofs + span->len)
+				for (i = 0; i < span->len; i++, ch++)
 				{
-					cab->c = span->text[idx - ofs].c;
-					fz_text_char_bbox(ctx, &cab->bbox, span, idx - ofs);
-					return cab;
+					ch->c = span->text[i].c;
+					fz_text_char_bbox(ctx, &ch->bbox, span, i);
+					ch->span = span;
 				}
-				ofs += span->len;
 			}
 			/* pseudo-newline */
-			if (idx == ofs)
-			{
-				cab->bbox = fz_empty_rect;
-				cab->c = ' ';
-				return cab;
-			}
-			ofs++;
+			ch->c = ' ';
+			ch->bbox = fz_empty_rect;
+			ch->span = NULL;
+			ch++;
 		}
 	}
+	index->line_start[n] = len;
+
+	page->index = index;
+	return index;
+}
+
+fz_char_and_box *fz_text_char_at(fz_context *ctx, fz_char_and_box *cab, fz_text_page *page, int idx)
+{
+	fz_text_index *index = fz_index_text_page(ctx, page);
+
+	if (idx >= 0 && idx < index->len)
+	{
+		cab->c = index->chars[idx].c;
+		cab->bbox = index->chars[idx].bbox;
+		return cab;
+	}
 	cab->bbox = fz_empty_rect;
 	cab->c = 0;
 	return cab;
@@ -57,42 +124,14 @@ fz_char_and_box *fz_text_char_at(fz_context *ctx, fz_char_and_box *cab, fz_text_
 
 static int charat(fz_context *ctx, fz_text_page *page, int idx)
 {
-	fz_char_and_box cab;
-	return fz_text_char_at(ctx, &cab, page, idx)->c;
+	fz_text_index *index = page->index;
+	return idx < index->len ? index->chars[idx].c : 0;
 }
 
-static fz_rect *bboxat(fz_context *ctx, fz_text_page *page, int idx, fz_rect *bbox)
+static const fz_rect *bboxat(fz_context *ctx, fz_text_page *page, int idx)
 {
-	fz_char_and_box cab;
-	/* FIXME: Nasty extra copy */
-	*bbox = fz_text_char_at(ctx, &cab, page, idx)->bbox;
-	return bbox;
-}
-
-static int textlen(fz_context *ctx, fz_text_page *page)
-{
-	int len = 0;
-	int block_num;
-
-	for (block_num = 0; block_num < page->len; block_num++)
-	{
-		fz_text_block *block;
-		fz_text_line *line;
-		fz_text_span *span;
-
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
-		{
-			for (span = line->first_span; span; span = span->next)
-			{
-				len += span->len;
-			}
-			len++; /* pseudo-newline */
-		}
-	}
-	return len;
+	fz_text_index *index = page->index;
+	return idx < index->len ? &index->chars[idx].bbox : &fz_empty_rect;
 }
 
 static int match(fz_context *ctx, fz_text_page *page, const char *s, int n)
@@ -134,7 +173,7 @@ fz_search_text_page(fz_context *ctx, fz_text_page *text, const char *needle, fz_
 		return 0;
 
 	hit_count = 0;
-	len = textlen(ctx, text);
+	len = fz_index_text_page(ctx, text)->len;
 	for (pos = 0; pos < len; pos++)
 	{
 		n = match(ctx, text, needle, pos);
@@ -143,24 +182,89 @@ fz_search_text_page(fz_context *ctx, fz_text_page *text, const char *needle, fz_
 			fz_rect linebox = fz_empty_rect;
 			for (i = 0; i < n; i++)
 			{
-				fz_rect charbox;
-				bboxat(ctx, text, pos + i, &charbox);
-				if (!fz_is_empty_rect(&charbox))
+				const fz_rect *charbox = bboxat(ctx, text, pos + i);
+				if (!fz_is_empty_rect(charbox))
 				{
-					if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
+					if (charbox->y0 != linebox.y0 || fz_abs(charbox->x0 - linebox.x1) > 5)
 					{
 						if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
 							hit_bbox[hit_count++] = linebox;
-						linebox = charbox;
+						linebox = *charbox;
 					}
 					else
 					{
-						fz_union_rect(&linebox, &charbox);
+						fz_union_rect(&linebox, charbox);
 					}
 				}
-				else
+			}
+			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+				hit_bbox[hit_count++] = linebox;
+		}
+	}
+
+	return hit_count;
+}
+
+static int match_page_text(fz_page_text *text, const char *s, int n)
+{
+	int orig = n;
+	int c;
+	while (*s)
+	{
+		s += fz_chartorune(&c, (char *)s);
+		if (iswhite(c) && n < text->len && iswhite(text->text[n]))
+		{
+			const char *s_next;
+
+			/* Skip over whitespace in the document */
+			do
+				n++;
+			while (n < text->len && iswhite(text->text[n]));
+
+			/* Skip over multiple whitespace in the search string */
+			while (s_next = s + fz_chartorune(&c, (char *)s), iswhite(c))
+				s = s_next;
+		}
+		else
+		{
+			if (n >= text->len || fz_tolower(c) != fz_tolower(text->text[n]))
+				return 0;
+			n++;
+		}
+	}
+	return n - orig;
+}
+
+int
+fz_search_page_text(fz_context *ctx, fz_page_text *text, const char *needle, fz_rect *hit_bbox, int hit_max)
+{
+	int pos, i, n, hit_count;
+
+	if (strlen(needle) == 0)
+		return 0;
+
+	hit_count = 0;
+	for (pos = 0; pos < text->len; pos++)
+	{
+		n = match_page_text(text, needle, pos);
+		if (n)
+		{
+			fz_rect linebox = fz_empty_rect;
+			for (i = 0; i < n; i++)
+			{
+				const fz_rect *charbox = &text->bbox[pos + i];
+				if (!fz_is_empty_rect(charbox))
 				{
-					printf("fz_is_empty_rect :(\n");
+					if (charbox->y0 != linebox.y0 || fz_abs(charbox->x0 - linebox.x1) > 5)
+					{
+						if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+							hit_bbox[hit_count++] = linebox;
+						linebox = *charbox;
+					}
+					else
+					{
+						fz_union_rect(&linebox, charbox);
+					}
 				}
 			}
 			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
@@ -171,14 +275,247 @@ fz_search_text_page(fz_context *ctx, fz_text_page *text, const char *needle, fz_
 	return hit_count;
 }
 
+/*
+ * Multi-needle matching. The needles are folded (lower case, whitespace
+ * runs collapsed to one space) into a trie with Aho-Corasick failure
+ * links, and the page text, folded the same way, is fed through it once.
+ * Node 0 is the root; since no needle is empty, it never ends a needle,
+ * so 0 doubles as 'none' for the dict links.
+ */
+
+typedef struct fz_match_node_s fz_match_node;
+
+struct fz_match_node_s
+{
+	int c;
+	int child;	/* first child */
+	int sibling;	/* next child of our parent */
+	int fail;	/* longest proper suffix in the trie */
+	int needle;	/* needle ending here, or -1 */
+	int dict;	/* nearest suffix (via fail) that ends a needle */
+};
+
+struct fz_text_matcher_s
+{
+	int count;
+	int *len;	/* folded length of each needle */
+	int *same;	/* next needle with the same folded text, or -1 */
+	int node_len, node_cap;
+	fz_match_node *nodes;
+};
+
+static int
+find_child(fz_text_matcher *m, int node, int c)
+{
+	int i;
+	for (i = m->nodes[node].child; i; i = m->nodes[i].sibling)
+		if (m->nodes[i].c == c)
+			return i;
+	return 0;
+}
+
+static int
+add_child(fz_context *ctx, fz_text_matcher *m, int node, int c)
+{
+	fz_match_node *n;
+
+	if (m->node_len == m->node_cap)
+	{
+		int new_cap = m->node_cap * 2;
+		m->nodes = fz_resize_array(ctx, m->nodes, new_cap, sizeof *m->nodes);
+		m->node_cap = new_cap;
+	}
+	n = &m->nodes[m->node_len];
+	n->c = c;
+	n->child = 0;
+	n->sibling = m->nodes[node].child;
+	n->fail = 0;
+	n->needle = -1;
+	n->dict = 0;
+	m->nodes[node].child = m->node_len;
+	return m->node_len++;
+}
+
+static void
+add_needle(fz_context *ctx, fz_text_matcher *m, int idx, const char *s)
+{
+	int node = 0;
+	int len = 0;
+	int white = 0;
+	int c, next;
+
+	while (*s)
+	{
+		s += fz_chartorune(&c, (char *)s);
+		if (iswhite(c))
+		{
+			if (white)
+				continue;
+			c = ' ';
+			white = 1;
+		}
+		else
+		{
+			c = fz_tolower(c);
+			white = 0;
+		}
+		next = find_child(m, node, c);
+		if (!next)
+			next = add_child(ctx, m, node, c);
+		node = next;
+		len++;
+	}
+
+	m->len[idx] = len;
+	if (len == 0)
+		return;
+	m->same[idx] = m->nodes[node].needle;
+	m->nodes[node].needle = idx;
+}
+
+static void
+link_matcher(fz_context *ctx, fz_text_matcher *m)
+{
+	int *queue;
+	int head = 0, tail = 0;
+	int u, v, f, t;
+
+	queue = fz_malloc_array(ctx, m->node_len, sizeof *queue);
+
+	for (v = m->nodes[0].child; v; v = m->nodes[v].sibling)
+		queue[tail++] = v;
+
+	while (head < tail)
+	{
+		u = queue[head++];
+		for (v = m->nodes[u].child; v; v = m->nodes[v].sibling)
+		{
+			f = m->nodes[u].fail;
+			while (f && !find_child(m, f, m->nodes[v].c))
+				f = m->nodes[f].fail;
+			t = find_child(m, f, m->nodes[v].c);
+			m->nodes[v].fail = t;
+			m->nodes[v].dict = m->nodes[t].needle >= 0 ? t : m->nodes[t].dict;
+			queue[tail++] = v;
+		}
+	}
+
+	fz_free(ctx, queue);
+}
+
+fz_text_matcher *
+fz_new_text_matcher(fz_context *ctx, int count, const char **needles)
+{
+	fz_text_matcher *m;
+	int i;
+
+	m = fz_malloc_struct(ctx, fz_text_matcher);
+	fz_try(ctx)
+	{
+		m->count = count;
+		m->len = fz_malloc_array(ctx, count, sizeof *m->len);
+		m->same = fz_malloc_array(ctx, count, sizeof *m->same);
+		m->node_cap = 64;
+		m->nodes = fz_malloc_array(ctx, m->node_cap, sizeof *m->nodes);
+		m->node_len = 1;
+		memset(&m->nodes[0], 0, sizeof m->nodes[0]);
+		m->nodes[0].needle = -1;
+		for (i = 0; i < count; i++)
+		{
+			m->same[i] = -1;
+			add_needle(ctx, m, i, needles[i]);
+		}
+		link_matcher(ctx, m);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text_matcher(ctx, m);
+		fz_rethrow(ctx);
+	}
+	return m;
+}
+
+void
+fz_drop_text_matcher(fz_context *ctx, fz_text_matcher *m)
+{
+	if (!m)
+		return;
+	fz_free(ctx, m->len);
+	fz_free(ctx, m->same);
+	fz_free(ctx, m->nodes);
+	fz_free(ctx, m);
+}
+
+int
+fz_match_page_text(fz_context *ctx, fz_text_matcher *m, fz_page_text *text, int *counts, int *first)
+{
+	int *pos = NULL;
+	int i, k, n, c, next, needle;
+	int state = 0;
+	int white = 0;
+	int total = 0;
+
+	for (i = 0; i < m->count; i++)
+	{
+		counts[i] = 0;
+		if (first)
+			first[i] = -1;
+	}
+
+	/* Map from folded text back to page text positions. */
+	if (first)
+		pos = fz_malloc_array(ctx, text->len, sizeof *pos);
+
+	k = 0;
+	for (i = 0; i < text->len; i++)
+	{
+		c = text->text[i];
+		if (iswhite(c))
+		{
+			if (white)
+				continue;
+			c = ' ';
+			white = 1;
+		}
+		else
+		{
+			c = fz_tolower(c);
+			white = 0;
+		}
+		if (pos)
+			pos[k] = i;
+
+		while (state && !(next = find_child(m, state, c)))
+			state = m->nodes[state].fail;
+		if (!state)
+			next = find_child(m, 0, c);
+		state = next;
+
+		n = m->nodes[state].needle >= 0 ? state : m->nodes[state].dict;
+		while (n)
+		{
+			for (needle = m->nodes[n].needle; needle >= 0; needle = m->same[needle])
+			{
+				if (pos && first[needle] < 0)
+					first[needle] = pos[k - m->len[needle] + 1];
+				counts[needle]++;
+				total++;
+			}
+			n = m->nodes[n].dict;
+		}
+		k++;
+	}
+
+	fz_free(ctx, pos);
+	return total;
+}
+
 int
 fz_highlight_selection(fz_context *ctx, fz_text_page *page, fz_rect rect, fz_rect *hit_bbox, int hit_max)
 {
-	fz_rect linebox, charbox;
-	fz_text_block *block;
-	fz_text_line *line;
-	fz_text_span *span;
-	int i, block_num, hit_count;
+	fz_text_index *index;
+	fz_rect linebox;
+	int i, n, hit_count;
 
 	float x0 = rect.x0;
 	float x1 = rect.x1;
@@ -187,37 +524,30 @@ fz_highlight_selection(fz_context *ctx, fz_text_page *page, fz_rect rect, fz_rec
 
 	hit_count = 0;
 
-	for (block_num = 0; block_num < page->len; block_num++)
+	index = fz_index_text_page(ctx, page);
+	for (n = 0; n < index->line_count; n++)
 	{
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
+		linebox = fz_empty_rect;
+		/* the last char of each line is the pseudo-newline */
+		for (i = index->line_start[n]; i < index->line_start[n+1] - 1; i++)
 		{
-			linebox = fz_empty_rect;
-			for (span = line->first_span; span; span = span->next)
+			const fz_rect *charbox = &index->chars[i].bbox;
+			if (charbox->x1 >= x0 && charbox->x0 <= x1 && charbox->y1 >= y0 && charbox->y0 <= y1)
 			{
-				for (i = 0; i < span->len; i++)
+				if (charbox->y0 != linebox.y0 || fz_abs(charbox->x0 - linebox.x1) > 5)
 				{
-					fz_text_char_bbox(ctx, &charbox, span, i);
-					if (charbox.x1 >= x0 && charbox.x0 <= x1 && charbox.y1 >= y0 && charbox.y0 <= y1)
-					{
-						if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
-						{
-							if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-								hit_bbox[hit_count++] = linebox;
-							linebox = charbox;
-						}
-						else
-						{
-							fz_union_rect(&linebox, &charbox);
-						}
-					}
+					if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+						hit_bbox[hit_count++] = linebox;
+					linebox = *charbox;
+				}
+				else
+				{
+					fz_union_rect(&linebox, charbox);
 				}
 			}
-			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-				hit_bbox[hit_count++] = linebox;
 		}
+		if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+			hit_bbox[hit_count++] = linebox;
 	}
 
 	return hit_count;
@@ -226,9 +556,10 @@ fz_highlight_selection(fz_context *ctx, fz_text_page *page, fz_rect rect, fz_rec
 char *
 fz_copy_selection(fz_context *ctx, fz_text_page *page, fz_rect rect)
 {
+	fz_text_index *index;
+	fz_text_span *span;
 	fz_buffer *buffer;
-	fz_rect hitbox;
-	int c, i, block_num, seen = 0;
+	int c, i, n, seen = 0;
 	char *s;
 
 	float x0 = rect.x0;
@@ -236,43 +567,40 @@ fz_copy_selection(fz_context *ctx, fz_text_page *page, fz_rect rect)
 	float y0 = rect.y0;
 	float y1 = rect.y1;
 
+	index = fz_index_text_page(ctx, page);
+
 	buffer = fz_new_buffer(ctx, 1024);
 
-	for (block_num = 0; block_num < page->len; block_num++)
+	for (n = 0; n < index->line_count; n++)
 	{
-		fz_text_block *block;
-		fz_text_line *line;
-		fz_text_span *span;
-
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
+		span = NULL;
+		for (i = index->line_start[n]; i < index->line_start[n+1] - 1; i++)
 		{
-			for (span = line->first_span; span; span = span->next)
+			const fz_text_index_char *ch = &index->chars[i];
+
+			if (ch->span != span)
 			{
+				/* first char of a span */
 				if (seen)
 				{
 					fz_write_buffer_byte(ctx, buffer, '\n');
 				}
-
+				span = ch->span;
 				seen = 0;
+			}
 
-				for (i = 0; i < span->len; i++)
-				{
-					fz_text_char_bbox(ctx, &hitbox, span, i);
-					c = span->text[i].c;
-					if (c < 32)
-						c = '?';
-					if (hitbox.x1 >= x0 && hitbox.x0 <= x1 && hitbox.y1 >= y0 && hitbox.y0 <= y1)
-					{
-						fz_write_buffer_rune(ctx, buffer, c);
-						seen = 1;
-					}
-				}
-
-				seen = (seen && span == line->last_span);
+			c = ch->c;
+			if (c < 32)
+				c = '?';
+			if (ch->bbox.x1 >= x0 && ch->bbox.x0 <= x1 && ch->bbox.y1 >= y0 && ch->bbox.y0 <= y1)
+			{
+				fz_write_buffer_rune(ctx, buffer, c);
+				seen = 1;
 			}
+
+			/* only a selection reaching the end of a line breaks it */
+			if (i + 1 == index->line_start[n+1] - 1 || index->chars[i+1].span != span)
+				seen = (seen && span == index->lines[n]->last_span);
 		}
 	}
 
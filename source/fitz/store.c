@@ -7,17 +7,22 @@ struct fz_item_s
 	void *key;
 	fz_storable *val;
 	unsigned int size;
+	uint64_t stamp;
 	fz_item *next;
 	fz_item *prev;
-	fz_store *store;
 	fz_store_type *type;
 };
 
-struct fz_store_s
+/* Items are spread over the shards by key. Each shard has its own lock,
+ * which protects its linked list and hash table, so that threads finding
+ * and storing different items rarely wait on one another. */
+typedef struct fz_store_shard_s fz_store_shard;
+
+struct fz_store_shard_s
 {
-	int refs;
+	int lock;
 
-	/* Every item in the store is kept in a doubly linked list, ordered
+	/* Every item in the shard is kept in a doubly linked list, ordered
 	 * by usage (so LRU entries are at the end). */
 	fz_item *head;
 	fz_item *tail;
@@ -25,29 +30,55 @@ struct fz_store_s
 	/* We have a hash table that allows to quickly find a subset of the
 	 * entries (those whose keys are indirect objects). */
 	fz_hash_table *hash;
+};
+
+struct fz_store_s
+{
+	int refs;
+
+	fz_store_shard shard[FZ_STORE_SHARDS];
+
+	/* The rest is global, and protected by the alloc lock (which also
+	 * protects the reference counts of the stored values). Every use
+	 * of an item gives it a new stamp, so that eviction can pick the
+	 * least recently used item from across all the shards. */
+	uint64_t stamp;
 
 	/* We keep track of the size of the store, and keep it below max. */
 	unsigned int max;
 	unsigned int size;
+
+	/* The context holding each claim stripe (see fz_claim_item), and
+	 * how the claims have ended. */
+	fz_context *claim_owner[FZ_STORE_CLAIM_STRIPES];
+	int claims_made;
+	int claims_found;
 };
 
 void
 fz_new_store_context(fz_context *ctx, unsigned int max)
 {
 	fz_store *store;
+	int i;
+
 	store = fz_malloc_struct(ctx, fz_store);
 	fz_try(ctx)
 	{
-		store->hash = fz_new_hash_table(ctx, 4096, sizeof(fz_store_hash), FZ_LOCK_ALLOC);
+		for (i = 0; i < FZ_STORE_SHARDS; i++)
+		{
+			store->shard[i].lock = FZ_LOCK_STORE + i;
+			store->shard[i].hash = fz_new_hash_table(ctx, 4096 / FZ_STORE_SHARDS, sizeof(fz_store_hash), FZ_LOCK_STORE + i);
+		}
 	}
 	fz_catch(ctx)
 	{
+		for (i = 0; i < FZ_STORE_SHARDS; i++)
+			fz_drop_hash(ctx, store->shard[i].hash);
 		fz_free(ctx, store);
 		fz_rethrow(ctx);
 	}
 	store->refs = 1;
-	store->head = NULL;
-	store->tail = NULL;
+	store->stamp = 0;
 	store->size = 0;
 	store->max = max;
 	ctx->store = store;
@@ -73,137 +104,233 @@ fz_drop_storable(fz_context *ctx, fz_storable *s)
 		s->drop(ctx, s);
 }
 
-static void
-evict(fz_context *ctx, fz_item *item)
+/* Hashable keys are spread over the shards by their hash; the others are
+ * grouped by type, so that a search for one only has to look through
+ * a single shard. */
+static fz_store_shard *
+find_shard(fz_store *store, fz_store_hash *hash, int use_hash, fz_store_type *type)
 {
-	fz_store *store = ctx->store;
-	int drop;
+	unsigned int h = 2166136261u;
+	unsigned char *p;
+	int i, n;
 
-	store->size -= item->size;
-	/* Unlink from the linked list */
+	if (use_hash)
+	{
+		p = (unsigned char *)hash;
+		n = sizeof *hash;
+	}
+	else
+	{
+		p = (unsigned char *)&type;
+		n = sizeof type;
+	}
+	for (i = 0; i < n; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return &store->shard[h % FZ_STORE_SHARDS];
+}
+
+static void
+unlink_item(fz_store_shard *shard, fz_item *item)
+{
+	/* Items are momentarily in the hash table before they are in the
+	 * list. Don't attempt to unlink these. We indicate such items by
+	 * setting item->next == item. */
+	if (item->next == item)
+		return;
 	if (item->next)
 		item->next->prev = item->prev;
 	else
-		store->tail = item->prev;
+		shard->tail = item->prev;
 	if (item->prev)
 		item->prev->next = item->next;
 	else
-		store->head = item->next;
-	/* Drop a reference to the value (freeing if required) */
-	drop = (item->val->refs > 0 && --item->val->refs == 0);
+		shard->head = item->next;
+}
+
+static void
+touch(fz_store_shard *shard, fz_item *item)
+{
+	unlink_item(shard, item);
+	/* Now relink it at the start of the LRU chain */
+	item->next = shard->head;
+	if (item->next)
+		item->next->prev = item;
+	else
+		shard->tail = item;
+	shard->head = item;
+	item->prev = NULL;
+}
+
+/* Take a reference to the value of an item we have found, and mark it as
+ * the most recently used. Called with the shard lock held. */
+static void *
+use_item(fz_context *ctx, fz_store_shard *shard, fz_item *item)
+{
+	fz_store *store = ctx->store;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (item->val->refs > 0)
+		item->val->refs++;
+	item->stamp = ++store->stamp;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	touch(shard, item);
+	return item->val;
+}
+
+/* Remove an item from the store. Called with the shard lock held, which
+ * is dropped before the value is (perhaps) freed. Returns the number of
+ * bytes the item accounted for. */
+static unsigned int
+evict(fz_context *ctx, fz_store_shard *shard, fz_item *item)
+{
+	fz_store *store = ctx->store;
+	unsigned int size = item->size;
+	int drop;
+
+	/* Unlink from the linked list */
+	unlink_item(shard, item);
 	/* Remove from the hash table */
 	if (item->type->make_hash_key)
 	{
 		fz_store_hash hash = { NULL };
 		hash.drop = item->val->drop;
 		if (item->type->make_hash_key(ctx, &hash, item->key))
-			fz_hash_remove(ctx, store->hash, &hash);
+			fz_hash_remove(ctx, shard->hash, &hash);
 	}
+	/* Drop a reference to the value (freeing if required) */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->size -= size;
+	drop = (item->val->refs > 0 && --item->val->refs == 0);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_unlock(ctx, shard->lock);
 	if (drop)
 		item->val->drop(ctx, item->val);
 	/* Always drops the key and drop the item */
 	item->type->drop_key(ctx, item->key);
 	fz_free(ctx, item);
+	return size;
+}
+
+/* Find the least recently used item in a shard that nothing but the store
+ * holds a reference to. Called with the shard lock held; as long as it
+ * stays held, no one else can find (and so take a reference to) the
+ * item. */
+static fz_item *
+find_evictable(fz_context *ctx, fz_store_shard *shard)
+{
+	fz_item *item;
+
 	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (item = shard->tail; item; item = item->prev)
+		if (item->val->refs == 1)
+			break;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return item;
 }
 
-static int
-ensure_space(fz_context *ctx, unsigned int tofree)
+/* The oldest stamp of a shard with nothing we can evict. */
+#define NO_STAMP ((uint64_t)-1)
+
+/* Evict items, least recently used first across all the shards, until we
+ * have freed at least tofree bytes or run out of items we can evict. If
+ * check is set, we first make sure that we *can* free tofree, and free
+ * nothing if not. Called without the alloc lock or any store locks held.
+ * Returns the number of bytes freed. */
+static unsigned int
+evict_lru(fz_context *ctx, unsigned int tofree, int check)
 {
-	fz_item *item, *prev;
-	unsigned int count;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
+	fz_item *item;
+	uint64_t oldest[FZ_STORE_SHARDS];
+	unsigned int count = 0;
+	int i, k;
 
-	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
-
-	/* First check that we *can* free tofree; if not, we'd rather not
-	 * cache this. */
-	count = 0;
-	for (item = store->tail; item; item = item->prev)
+	/* Note the oldest item we could evict from each shard. */
+	for (i = 0; i < FZ_STORE_SHARDS; i++)
 	{
-		if (item->val->refs == 1)
+		shard = &store->shard[i];
+		oldest[i] = NO_STAMP;
+		fz_lock(ctx, shard->lock);
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		for (item = shard->tail; item; item = item->prev)
 		{
-			count += item->size;
-			if (count >= tofree)
-				break;
+			if (item->val->refs == 1)
+			{
+				if (oldest[i] == NO_STAMP)
+					oldest[i] = item->stamp;
+				count += item->size;
+				if (!check || count >= tofree)
+					break;
+			}
 		}
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, shard->lock);
 	}
 
 	/* If we ran out of items to search, then we can never free enough */
-	if (item == NULL)
-	{
+	if (check && count < tofree)
 		return 0;
-	}
 
-	/* Actually free the items */
+	/* Actually free the items, always taking from the shard with the
+	 * oldest candidate. Other threads may use or evict items in the
+	 * meantime, so we look again each time rather than trusting the
+	 * items we saw. */
 	count = 0;
-	for (item = store->tail; item; item = prev)
+	while (count < tofree)
 	{
-		prev = item->prev;
-		if (item->val->refs == 1)
+		k = 0;
+		for (i = 1; i < FZ_STORE_SHARDS; i++)
+			if (oldest[i] < oldest[k])
+				k = i;
+		if (oldest[k] == NO_STAMP)
+			break;
+
+		shard = &store->shard[k];
+		fz_lock(ctx, shard->lock);
+		item = find_evictable(ctx, shard);
+		if (item)
 		{
-			/* Free this item. Evict has to drop the lock to
-			 * manage that, which could cause prev to be removed
-			 * in the meantime. To avoid that we bump its reference
-			 * count here. This may cause another simultaneous
-			 * evict process to fail to make enough space as prev is
-			 * pinned - but that will only happen if we're near to
-			 * the limit anyway, and it will only cause something to
-			 * not be cached. */
-			count += item->size;
-			if (prev)
-				prev->val->refs++;
-			evict(ctx, item); /* Drops then retakes lock */
-			/* So the store has 1 reference to prev, as do we, so
-			 * no other evict process can have thrown prev away in
-			 * the meantime. So we are safe to just decrement its
-			 * reference count here. */
-			if (prev)
-				--prev->val->refs;
-
-			if (count >= tofree)
-				return count;
+			count += evict(ctx, shard, item); /* Drops the lock */
+			fz_lock(ctx, shard->lock);
+			item = find_evictable(ctx, shard);
 		}
+		oldest[k] = item ? item->stamp : NO_STAMP;
+		fz_unlock(ctx, shard->lock);
 	}
 
 	return count;
 }
 
-static void
-touch(fz_store *store, fz_item *item)
+static fz_item *
+find_item(fz_context *ctx, fz_store_shard *shard, fz_store_drop_fn *drop, void *key, fz_store_type *type, fz_store_hash *hash, int use_hash)
 {
-	if (item->next != item)
+	fz_item *item;
+
+	if (use_hash)
 	{
-		/* Already in the list - unlink it */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		/* We can find objects keyed on indirected objects quickly */
+		return fz_hash_find(ctx, shard->hash, hash);
 	}
-	/* Now relink it at the start of the LRU chain */
-	item->next = store->head;
-	if (item->next)
-		item->next->prev = item;
-	else
-		store->tail = item;
-	store->head = item;
-	item->prev = NULL;
+
+	/* Others we have to hunt for slowly */
+	for (item = shard->head; item; item = item->next)
+		if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
+			break;
+	return item;
 }
 
 void *
 fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_store_type *type)
 {
 	fz_item *item = NULL;
-	unsigned int size;
 	fz_storable *val = (fz_storable *)val_;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
+	unsigned int over = 0;
+	uint64_t stamp;
 	unsigned pos;
 
 	if (!store)
@@ -235,9 +362,10 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 		hash.drop = val->drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, &hash, use_hash, type);
 
 	type->keep_key(ctx, key);
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	fz_lock(ctx, shard->lock);
 
 	/* Fill out the item. To start with, we always set item->next == item
 	 * and item->prev == item. This is so that we can spot items that have
@@ -259,13 +387,13 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 		fz_try(ctx)
 		{
 			/* May drop and retake the lock */
-			existing = fz_hash_insert_with_pos(ctx, store->hash, &hash, item, &pos);
+			existing = fz_hash_insert_with_pos(ctx, shard->hash, &hash, item, &pos);
 		}
 		fz_catch(ctx)
 		{
 			/* Any error here means that item never made it into the
 			 * hash - so no one else can have a reference. */
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_unlock(ctx, shard->lock);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
 			return NULL;
@@ -274,56 +402,43 @@ fz_store_item(fz_context *ctx, void *key, void *val_, unsigned int itemsize, fz_
 		{
 			/* There was one there already! Take a new reference
 			 * to the existing one, and drop our current one. */
-			touch(store, existing);
-			if (existing->val->refs > 0)
-				existing->val->refs++;
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			val = use_item(ctx, shard, existing);
+			fz_unlock(ctx, shard->lock);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
-			return existing->val;
+			return val;
 		}
 	}
-	/* Now bump the ref */
+
+	/* Now bump the ref, and account for the item. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
 	if (val->refs > 0)
 		val->refs++;
-	/* If we haven't got an infinite store, check for space within it */
-	if (store->max != FZ_STORE_UNLIMITED)
+	stamp = item->stamp = ++store->stamp;
+	store->size += itemsize;
+	if (store->max != FZ_STORE_UNLIMITED && store->size > store->max)
+		over = store->size - store->max;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	/* Regardless of whether it's indexed, it goes into the linked list */
+	touch(shard, item);
+	fz_unlock(ctx, shard->lock);
+
+	/* If we haven't got an infinite store, make space within it. We
+	 * hold a reference to val, so our own item cannot be evicted. */
+	if (over && evict_lru(ctx, over, 1) == 0)
 	{
-		size = store->size + itemsize;
-		while (size > store->max)
+		/* Failed to free any space. Unless someone else has found
+		 * (or removed) our item in the meantime, take it out again. */
+		fz_lock(ctx, shard->lock);
+		if (find_item(ctx, shard, val->drop, key, type, &hash, use_hash) == item && item->stamp == stamp)
 		{
-			/* ensure_space may drop, then retake the lock */
-			int saved = ensure_space(ctx, size - store->max);
-			if (saved == 0)
-			{
-				/* Failed to free any space. */
-				/* If we are using the hash table, then we've already
-				 * inserted item - remove it. */
-				if (use_hash)
-				{
-					/* If someone else has already picked up a reference
-					 * to item, then we cannot remove it. Leave it in the
-					 * store, and we'll live with being over budget. We
-					 * know this is the case, if it's in the linked list. */
-					if (item->next != item)
-						break;
-					fz_hash_remove_fast(ctx, store->hash, &hash, pos);
-				}
-				fz_unlock(ctx, FZ_LOCK_ALLOC);
-				fz_free(ctx, item);
-				type->drop_key(ctx, key);
-				if (val->refs > 0)
-					val->refs--;
-				return NULL;
-			}
-			size -= saved;
+			evict(ctx, shard, item); /* Drops the lock */
+			return NULL;
 		}
+		/* Otherwise we'll live with being over budget. */
+		fz_unlock(ctx, shard->lock);
 	}
-	store->size += itemsize;
-
-	/* Regardless of whether it's indexed, it goes into the linked list */
-	touch(store, item);
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
 }
@@ -333,8 +448,10 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type *
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
+	void *val = NULL;
 
 	if (!store)
 		return NULL;
@@ -347,38 +464,18 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type *
 		hash.drop = drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, &hash, use_hash, type);
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (use_hash)
-	{
-		/* We can find objects keyed on indirected objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
-	}
-	else
-	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
-		{
-			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
-				break;
-		}
-	}
+	fz_lock(ctx, shard->lock);
+	item = find_item(ctx, shard, drop, key, type, &hash, use_hash);
 	if (item)
 	{
-		/* LRU the block. This also serves to ensure that any item
-		 * picked up from the hash before it has made it into the
-		 * linked list does not get whipped out again due to the
-		 * store being full. */
-		touch(store, item);
-		/* And bump the refcount before returning */
-		if (item->val->refs > 0)
-			item->val->refs++;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		return (void *)item->val;
+		/* LRU the block, and bump the refcount before returning. */
+		val = use_item(ctx, shard, item);
 	}
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_unlock(ctx, shard->lock);
 
-	return NULL;
+	return val;
 }
 
 void
@@ -386,72 +483,116 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, fz_store_type
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
-	int dodrop;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
 
+	if (!store)
+		return;
+
 	if (type->make_hash_key)
 	{
 		hash.drop = drop;
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
+	shard = find_shard(store, &hash, use_hash, type);
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (use_hash)
-	{
-		/* We can find objects keyed on indirect objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
-		if (item)
-			fz_hash_remove(ctx, store->hash, &hash);
-	}
-	else
-	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
-			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
-				break;
-	}
+	fz_lock(ctx, shard->lock);
+	item = find_item(ctx, shard, drop, key, type, &hash, use_hash);
 	if (item)
-	{
-		/* Momentarily things can be in the hash table without being
-		 * in the list. Don't attempt to unlink these. We indicate
-		 * such items by setting item->next == item. */
-		if (item->next != item)
-		{
-			if (item->next)
-				item->next->prev = item->prev;
-			else
-				store->tail = item->prev;
-			if (item->prev)
-				item->prev->next = item->next;
-			else
-				store->head = item->next;
-		}
-		dodrop = (item->val->refs > 0 && --item->val->refs == 0);
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		if (dodrop)
-			item->val->drop(ctx, item->val);
-		type->drop_key(ctx, item->key);
-		fz_free(ctx, item);
-	}
+		evict(ctx, shard, item); /* Drops the lock */
 	else
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, shard->lock);
 }
 
 void
 fz_empty_store(fz_context *ctx)
 {
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
+	int i;
 
 	if (store == NULL)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
 	/* Run through all the items in the store */
-	while (store->head)
+	for (i = 0; i < FZ_STORE_SHARDS; i++)
 	{
-		evict(ctx, store->head); /* Drops then retakes lock */
+		shard = &store->shard[i];
+		fz_lock(ctx, shard->lock);
+		while (shard->head)
+		{
+			evict(ctx, shard, shard->head); /* Drops the lock */
+			fz_lock(ctx, shard->lock);
+		}
+		fz_unlock(ctx, shard->lock);
 	}
+}
+
+int
+fz_claim_item(fz_context *ctx, void *key, fz_store_type *type)
+{
+	fz_store *store = ctx->store;
+	fz_store_hash hash = { NULL };
+	unsigned int h = 2166136261u;
+	unsigned char *p;
+	int i, held = 0;
+
+	if (!store || !key || !type->make_hash_key)
+		return 0;
+	if (!type->make_hash_key(ctx, &hash, key))
+		return 0;
+
+	/* A thread making one item may need another on the way (an image
+	 * needs its mask, say). Claiming that too would take claim locks
+	 * out of order, so the inner item is made without a claim. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < FZ_STORE_CLAIM_STRIPES; i++)
+		if (store->claim_owner[i] == ctx)
+			held = 1;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (held)
+		return 0;
+
+	p = (unsigned char *)&hash;
+	for (i = 0; i < (int)sizeof hash; i++)
+		h = (h ^ p[i]) * 16777619u;
+	i = h % FZ_STORE_CLAIM_STRIPES;
+
+	fz_lock(ctx, FZ_LOCK_CLAIM + i);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->claim_owner[i] = ctx;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return i + 1;
+}
+
+void
+fz_release_claim(fz_context *ctx, int claim, int made)
+{
+	fz_store *store = ctx->store;
+
+	if (claim <= 0)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->claim_owner[claim - 1] = NULL;
+	if (made)
+		store->claims_made++;
+	else
+		store->claims_found++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_unlock(ctx, FZ_LOCK_CLAIM + claim - 1);
+}
+
+void
+fz_store_claim_stats(fz_context *ctx, int *made, int *found)
+{
+	fz_store *store = ctx->store;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*made = store ? store->claims_made : 0;
+	*found = store ? store->claims_found : 0;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
@@ -469,7 +610,7 @@ fz_keep_store_context(fz_context *ctx)
 void
 fz_drop_store_context(fz_context *ctx)
 {
-	int refs;
+	int refs, i;
 	if (ctx == NULL || ctx->store == NULL)
 		return;
 	fz_lock(ctx, FZ_LOCK_ALLOC);
@@ -479,7 +620,8 @@ fz_drop_store_context(fz_context *ctx)
 		return;
 
 	fz_empty_store(ctx);
-	fz_drop_hash(ctx, ctx->store->hash);
+	for (i = 0; i < FZ_STORE_SHARDS; i++)
+		fz_drop_hash(ctx, ctx->store->shard[i].hash);
 	fz_free(ctx, ctx->store);
 	ctx->store = NULL;
 }
@@ -493,71 +635,70 @@ print_item(FILE *out, void *item_)
 	fflush(out);
 }
 
-void
-fz_print_store_locked(fz_context *ctx, FILE *out)
+static void
+print_shard(fz_context *ctx, FILE *out, int i)
 {
+	fz_store_shard *shard = &ctx->store->shard[i];
 	fz_item *item, *next;
-	fz_store *store = ctx->store;
 
-	fprintf(out, "-- resource store contents --\n");
-	fflush(out);
-
-	for (item = store->head; item; item = next)
+	fz_lock(ctx, shard->lock);
+	for (item = shard->head; item; item = next)
 	{
 		next = item->next;
+		fz_lock(ctx, FZ_LOCK_ALLOC);
 		if (next)
 			next->val->refs++;
-		fprintf(out, "store[*][refs=%d][size=%d] ", item->val->refs, item->size);
+		fprintf(out, "store[%d][refs=%d][size=%d] ", i, item->val->refs, item->size);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, shard->lock);
 		item->type->debug(ctx, out, item->key);
 		fprintf(out, " = %p\n", item->val);
 		fflush(out);
+		fz_lock(ctx, shard->lock);
 		fz_lock(ctx, FZ_LOCK_ALLOC);
 		if (next)
 			next->val->refs--;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
 	}
-	fprintf(out, "-- resource store hash contents --\n");
-	fz_print_hash_details(ctx, out, store->hash, print_item);
-	fprintf(out, "-- end --\n");
-	fflush(out);
+	fprintf(out, "-- resource store shard %d hash contents --\n", i);
+	fz_print_hash_details(ctx, out, shard->hash, print_item);
+	fz_unlock(ctx, shard->lock);
 }
 
 void
-fz_print_store(fz_context *ctx, FILE *out)
+fz_print_store_locked(fz_context *ctx, FILE *out)
 {
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-	fz_print_store_locked(ctx, out);
+	/* The shard locks cannot be taken while holding the alloc lock. */
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_print_store(ctx, out);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_print_store(fz_context *ctx, FILE *out)
+{
+	int i;
+
+	fprintf(out, "-- resource store contents --\n");
+	fflush(out);
+
+	for (i = 0; i < FZ_STORE_SHARDS; i++)
+		print_shard(ctx, out, i);
+	fprintf(out, "-- end --\n");
+	fflush(out);
 }
 #endif
 
-/* This is now an n^2 algorithm - not ideal, but it'll only be bad if we are
- * actually managing to scavenge lots of blocks back. */
+/* Called with the alloc lock held, but drops it while evicting. */
 static int
 scavenge(fz_context *ctx, unsigned int tofree)
 {
-	fz_store *store = ctx->store;
-	unsigned int count = 0;
-	fz_item *item, *prev;
-
-	/* Free the items */
-	for (item = store->tail; item; item = prev)
-	{
-		prev = item->prev;
-		if (item->val->refs == 1)
-		{
-			/* Free this item */
-			count += item->size;
-			evict(ctx, item); /* Drops then retakes lock */
+	unsigned int count;
 
-			if (count >= tofree)
-				break;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	count = evict_lru(ctx, tofree, 0);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
 
-			/* Have to restart search again, as prev may no longer
-			 * be valid due to release of lock in evict. */
-			prev = store->tail;
-		}
-	}
 	/* Success is managing to evict any blocks */
 	return count != 0;
 }
@@ -603,7 +744,7 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase)
 		{
 #ifdef DEBUG_SCAVENGING
 			printf("scavenged: store=%d\n", store->size);
-			fz_print_store(ctx, stderr);
+			fz_print_store_locked(ctx, stderr);
 			Memento_stats();
 #endif
 			return 1;
@@ -613,7 +754,7 @@ int fz_store_scavenge(fz_context *ctx, unsigned int size, int *phase)
 
 #ifdef DEBUG_SCAVENGING
 	printf("scavenging failed\n");
-	fz_print_store(ctx, stderr);
+	fz_print_store_locked(ctx, stderr);
 	Memento_listBlocks();
 #endif
 	return 0;
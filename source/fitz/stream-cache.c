@@ -0,0 +1,266 @@
+#include "mupdf/fitz.h"
+
+/* Block cache stream - keeps the most recently used fixed size blocks of
+ * a seekable stream in memory, so that readers which hop between distant
+ * offsets (xref tables, object streams, images) do not keep refetching
+ * the same regions from slow storage. A miss on the block following the
+ * previous miss is taken as a sequential scan, and fetches a growing run
+ * of blocks with a single seek and read on the underlying stream. */
+
+#define CACHE_DEFAULT_BLOCK_SIZE (64<<10)
+#define CACHE_DEFAULT_MAX_BLOCKS 64
+#define CACHE_MAX_READAHEAD 16
+
+typedef struct fz_cache_block_s fz_cache_block;
+
+struct fz_cache_block_s
+{
+	fz_off_t index; /* block number, or -1 if empty */
+	int len;
+	unsigned int used;
+	unsigned char *data;
+};
+
+typedef struct fz_cache_stream_s
+{
+	fz_stream *chain;
+	int block_size;
+	int max_blocks;
+	fz_cache_block *blocks;
+	unsigned int clock;
+	fz_off_t last_miss;
+	int readahead;
+	fz_off_t eof_block; /* first block known to lie past the end, or -1 */
+	fz_stream_cache_stats stats;
+} fz_cache_stream;
+
+static fz_cache_block *
+find_block(fz_cache_stream *state, fz_off_t index)
+{
+	int i;
+	for (i = 0; i < state->max_blocks; i++)
+		if (state->blocks[i].index == index)
+			return &state->blocks[i];
+	return NULL;
+}
+
+static fz_cache_block *
+evict_block(fz_cache_stream *state)
+{
+	fz_cache_block *victim = &state->blocks[0];
+	int i;
+	for (i = 0; i < state->max_blocks; i++)
+	{
+		fz_cache_block *b = &state->blocks[i];
+		if (b->index < 0)
+			return b;
+		if (b->used < victim->used)
+			victim = b;
+	}
+	victim->index = -1;
+	return victim;
+}
+
+static void
+fill_block(fz_context *ctx, fz_cache_stream *state, fz_cache_block *b, fz_off_t index)
+{
+	fz_off_t ofs = index * state->block_size;
+	int n;
+
+	if (fz_tell(ctx, state->chain) != ofs)
+		fz_seek(ctx, state->chain, ofs, SEEK_SET);
+	n = fz_read(ctx, state->chain, b->data, state->block_size);
+	state->stats.bytes_read += n;
+
+	b->index = index;
+	b->len = n;
+	if (n < state->block_size && (state->eof_block < 0 || index < state->eof_block))
+		state->eof_block = index + 1;
+}
+
+static fz_cache_block *
+load_block(fz_context *ctx, fz_cache_stream *state, fz_off_t index)
+{
+	fz_cache_block *b = find_block(state, index);
+	fz_off_t i;
+	int ahead;
+
+	if (b)
+	{
+		state->stats.hits++;
+		b->used = ++state->clock;
+		return b;
+	}
+
+	state->stats.misses++;
+
+	/* Grow the read-ahead run while the misses stay sequential, and
+	 * drop back to single blocks as soon as the reader jumps away.
+	 * Never read ahead into more than half the cache, so that a scan
+	 * cannot flush everything else out of it. */
+	if (index == state->last_miss + 1)
+	{
+		state->readahead *= 2;
+		if (state->readahead > CACHE_MAX_READAHEAD)
+			state->readahead = CACHE_MAX_READAHEAD;
+		if (state->readahead > state->max_blocks / 2)
+			state->readahead = fz_maxi(state->max_blocks / 2, 1);
+	}
+	else
+		state->readahead = 1;
+
+	b = evict_block(state);
+	fill_block(ctx, state, b, index);
+	b->used = ++state->clock;
+	state->last_miss = index;
+
+	/* The underlying stream is now positioned at the next block, so
+	 * the read-ahead blocks cost no further seeks. */
+	ahead = state->readahead - 1;
+	for (i = index + 1; ahead > 0 && (state->eof_block < 0 || i < state->eof_block); i++, ahead--)
+	{
+		fz_cache_block *rb;
+		if (find_block(state, i))
+			break;
+		rb = evict_block(state);
+		fz_try(ctx)
+			fill_block(ctx, state, rb, i);
+		fz_catch(ctx)
+		{
+			/* Read-ahead is speculative; leave any error for a real read */
+			break;
+		}
+		/* Not yet used, so these are the first to go if unwanted */
+		rb->used = state->clock - 1;
+		state->stats.readahead++;
+		state->last_miss = i;
+	}
+
+	return b;
+}
+
+static int
+next_cache(fz_context *ctx, fz_stream *stm, int max)
+{
+	fz_cache_stream *state = stm->state;
+	fz_off_t index = stm->pos / state->block_size;
+	int ofs = (int)(stm->pos - index * state->block_size);
+	fz_cache_block *b;
+
+	if (state->eof_block >= 0 && index >= state->eof_block)
+		return EOF;
+
+	b = load_block(ctx, state, index);
+	if (ofs >= b->len)
+		return EOF;
+
+	stm->rp = b->data + ofs;
+	stm->wp = b->data + b->len;
+	stm->pos += b->len - ofs;
+	return *stm->rp++;
+}
+
+static void
+seek_cache(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
+{
+	fz_cache_stream *state = stm->state;
+
+	if (whence == SEEK_END)
+	{
+		fz_seek(ctx, state->chain, offset, SEEK_END);
+		offset = fz_tell(ctx, state->chain);
+	}
+	if (offset < 0)
+		offset = 0;
+	stm->pos = offset;
+	stm->rp = stm->wp = NULL;
+}
+
+static int
+meta_cache(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr)
+{
+	fz_cache_stream *state = stm->state;
+
+	switch (key)
+	{
+	case FZ_STREAM_META_CACHE_STATS:
+		if (size != sizeof(fz_stream_cache_stats))
+			return -1;
+		*(fz_stream_cache_stats *)ptr = state->stats;
+		return 0;
+	case FZ_STREAM_META_MEMORY:
+		/* The data is not in one contiguous block */
+		return -1;
+	}
+	return fz_stream_meta(ctx, state->chain, key, size, ptr);
+}
+
+static void
+close_cache(fz_context *ctx, void *state_)
+{
+	fz_cache_stream *state = state_;
+	int i;
+
+	for (i = 0; i < state->max_blocks; i++)
+		fz_free(ctx, state->blocks[i].data);
+	fz_free(ctx, state->blocks);
+	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state);
+}
+
+fz_stream *
+fz_open_cached(fz_context *ctx, fz_stream *chain, int block_size, int max_blocks)
+{
+	fz_cache_stream *state = NULL;
+	fz_stream *stm;
+	int i;
+
+	if (!chain->seek)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot cache a stream that does not seek");
+
+	if (block_size <= 0)
+		block_size = CACHE_DEFAULT_BLOCK_SIZE;
+	if (max_blocks <= 0)
+		max_blocks = CACHE_DEFAULT_MAX_BLOCKS;
+
+	fz_var(state);
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, fz_cache_stream);
+		state->block_size = block_size;
+		state->blocks = fz_malloc_array(ctx, max_blocks, sizeof(fz_cache_block));
+		for (i = 0; i < max_blocks; i++)
+		{
+			state->blocks[i].index = -1;
+			state->blocks[i].len = 0;
+			state->blocks[i].used = 0;
+			state->blocks[i].data = NULL;
+		}
+		state->max_blocks = max_blocks;
+		for (i = 0; i < max_blocks; i++)
+			state->blocks[i].data = fz_malloc(ctx, block_size);
+	}
+	fz_catch(ctx)
+	{
+		if (state)
+		{
+			if (state->blocks)
+				for (i = 0; i < state->max_blocks; i++)
+					fz_free(ctx, state->blocks[i].data);
+			fz_free(ctx, state->blocks);
+			fz_free(ctx, state);
+		}
+		fz_rethrow(ctx);
+	}
+
+	state->chain = fz_keep_stream(ctx, chain);
+	state->last_miss = -2;
+	state->readahead = 1;
+	state->eof_block = -1;
+
+	stm = fz_new_stream(ctx, state, next_cache, close_cache);
+	stm->seek = seek_cache;
+	stm->meta = meta_cache;
+	return stm;
+}
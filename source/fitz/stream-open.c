@@ -1,5 +1,11 @@
 #include "mupdf/fitz.h"
 
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(FZ_NO_MMAP)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 fz_stream *
 fz_new_stream(fz_context *ctx, void *state, fz_stream_next_fn *next, fz_stream_close_fn *close)
 {
@@ -37,18 +43,13 @@ fz_new_stream(fz_context *ctx, void *state, fz_stream_next_fn *next, fz_stream_c
 fz_stream *
 fz_keep_stream(fz_context *ctx, fz_stream *stm)
 {
-	if (stm)
-		stm->refs ++;
-	return stm;
+	return fz_keep_imp(ctx, stm, &stm->refs);
 }
 
 void
 fz_drop_stream(fz_context *ctx, fz_stream *stm)
 {
-	if (!stm)
-		return;
-	stm->refs --;
-	if (stm->refs == 0)
+	if (fz_drop_imp(ctx, stm, &stm->refs))
 	{
 		if (stm->close)
 			stm->close(ctx, stm->state);
@@ -101,11 +102,144 @@ static void close_file(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
+#ifdef HAVE_MMAP
+
+/* Mapped file stream. The whole file is mapped read only up front, and
+ * next() and seek() just move a window over the mapping, so reading
+ * never copies and seeking never makes a system call. The window keeps
+ * (wp - rp) within the range of an int however large the file is. */
+
+#define MMAP_WINDOW (1<<20)
+
+typedef struct fz_mmap_stream_s
+{
+	FILE *file;
+	unsigned char *base;
+	fz_off_t len;
+} fz_mmap_stream;
+
+static void set_mmap_window(fz_stream *stm, fz_off_t offset)
+{
+	fz_mmap_stream *state = stm->state;
+	fz_off_t n = state->len - offset;
+
+	if (n <= 0)
+	{
+		/* At or beyond the end; reads will give EOF. */
+		stm->rp = stm->wp = state->base + state->len;
+		stm->pos = offset;
+		return;
+	}
+	if (n > MMAP_WINDOW)
+		n = MMAP_WINDOW;
+	stm->rp = state->base + offset;
+	stm->wp = stm->rp + n;
+	stm->pos = offset + n;
+}
+
+static int next_mmap(fz_context *ctx, fz_stream *stm, int n)
+{
+	/* n is only a hint, that we can safely ignore */
+	set_mmap_window(stm, stm->pos);
+	if (stm->rp == stm->wp)
+		return EOF;
+	return *stm->rp++;
+}
+
+static void seek_mmap(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
+{
+	fz_mmap_stream *state = stm->state;
+	if (whence == 2)
+		offset += state->len;
+	if (offset < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot seek: %s", strerror(EINVAL));
+	set_mmap_window(stm, offset);
+}
+
+static int meta_mmap(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr)
+{
+	fz_mmap_stream *state = stm->state;
+	fz_stream_memory *mem = ptr;
+
+	if (key != FZ_STREAM_META_MEMORY || size != sizeof *mem)
+		return -1;
+	mem->data = state->base;
+	mem->len = state->len;
+	return 1;
+}
+
+static void close_mmap(fz_context *ctx, void *state_)
+{
+	fz_mmap_stream *state = state_;
+	int n;
+	if (munmap(state->base, state->len) < 0)
+		fz_warn(ctx, "munmap error: %s", strerror(errno));
+	n = fclose(state->file);
+	if (n < 0)
+		fz_warn(ctx, "close error: %s", strerror(errno));
+	fz_free(ctx, state);
+}
+
+/* Map the file if it is a non-empty regular file, read from the start.
+ * Returns NULL (and leaves the file alone) if it can't be mapped, in
+ * which case we fall back to reading through stdio. Once mapped, the
+ * stream owns the file: if we then fail, the file is closed, just as
+ * fz_new_stream closes the state of a stream it fails to create. */
+static fz_stream *
+fz_open_file_ptr_mmap(fz_context *ctx, FILE *file)
+{
+	fz_stream *stm;
+	fz_mmap_stream *state;
+	struct stat info;
+	void *base;
+
+	if (fz_ftell(file) != 0)
+		return NULL;
+	if (fstat(fileno(file), &info) < 0 || !S_ISREG(info.st_mode))
+		return NULL;
+	if (info.st_size <= 0 || info.st_size > FZ_OFF_MAX || (uint64_t)info.st_size > SIZE_MAX)
+		return NULL;
+
+	base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, fz_mmap_stream);
+	}
+	fz_catch(ctx)
+	{
+		munmap(base, info.st_size);
+		fclose(file);
+		fz_rethrow(ctx);
+	}
+	state->file = file;
+	state->base = base;
+	state->len = info.st_size;
+
+	stm = fz_new_stream(ctx, state, next_mmap, close_mmap);
+	stm->seek = seek_mmap;
+	stm->meta = meta_mmap;
+
+	return stm;
+}
+
+#endif
+
 fz_stream *
 fz_open_file_ptr(fz_context *ctx, FILE *file)
 {
 	fz_stream *stm;
-	fz_file_stream *state = fz_malloc_struct(ctx, fz_file_stream);
+	fz_file_stream *state;
+
+#ifdef HAVE_MMAP
+	stm = fz_open_file_ptr_mmap(ctx, file);
+	if (stm)
+		return stm;
+#endif
+
+	state = fz_malloc_struct(ctx, fz_file_stream);
 	state->file = file;
 
 	fz_try(ctx)
@@ -184,6 +318,18 @@ static void seek_buffer(fz_context *ctx, fz_stream *stm, fz_off_t offset, int wh
 	stm->rp += (int)(offset - pos);
 }
 
+static int meta_buffer(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr)
+{
+	fz_stream_memory *mem = ptr;
+
+	if (key != FZ_STREAM_META_MEMORY || size != sizeof *mem)
+		return -1;
+	/* Seeking only moves rp, so wp and pos always mark the end. */
+	mem->data = stm->wp - stm->pos;
+	mem->len = stm->pos;
+	return 1;
+}
+
 static void close_buffer(fz_context *ctx, void *state_)
 {
 	fz_buffer *state = (fz_buffer *)state_;
@@ -199,6 +345,7 @@ fz_open_buffer(fz_context *ctx, fz_buffer *buf)
 	fz_keep_buffer(ctx, buf);
 	stm = fz_new_stream(ctx, buf, next_buffer, close_buffer);
 	stm->seek = seek_buffer;
+	stm->meta = meta_buffer;
 
 	stm->rp = buf->data;
 	stm->wp = buf->data + buf->len;
@@ -215,6 +362,7 @@ fz_open_memory(fz_context *ctx, unsigned char *data, int len)
 
 	stm = fz_new_stream(ctx, NULL, next_buffer, close_buffer);
 	stm->seek = seek_buffer;
+	stm->meta = meta_buffer;
 
 	stm->rp = data;
 	stm->wp = data + len;
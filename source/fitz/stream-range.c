@@ -0,0 +1,225 @@
+#include "mupdf/fitz.h"
+
+/* Range stream - a progressive stream over a file of known length whose
+ * data arrives out of order, typically as the answers to http byte range
+ * requests. The file is split into fixed size blocks. Reading a block we
+ * do not have yet asks the caller's provider for it (once) and throws
+ * FZ_ERROR_TRYLATER; the caller retries once fz_range_stream_supply has
+ * been given the data. */
+
+#define RANGE_DEFAULT_BLOCK_SIZE (32<<10)
+
+typedef struct fz_range_stream_s
+{
+	fz_off_t length;
+	int block_size;
+	int nblocks;
+	int have;
+	unsigned char **blocks;
+	unsigned char *asked;
+	fz_range_request_fn *request;
+	void *opaque;
+} fz_range_stream;
+
+static int
+block_len(fz_range_stream *state, int i)
+{
+	fz_off_t ofs = (fz_off_t)i * state->block_size;
+	if (state->length - ofs < state->block_size)
+		return (int)(state->length - ofs);
+	return state->block_size;
+}
+
+/* Ask the provider for every block in [first, last] that is neither
+ * here nor already asked for, one request per run of such blocks. */
+static void
+ask_blocks(fz_context *ctx, fz_range_stream *state, int first, int last)
+{
+	int i, start = -1;
+
+	if (first < 0)
+		first = 0;
+	if (last >= state->nblocks)
+		last = state->nblocks - 1;
+
+	for (i = first; i <= last + 1; i++)
+	{
+		int missing = i <= last && !state->blocks[i] && !state->asked[i];
+		if (missing)
+		{
+			state->asked[i] = 1;
+			if (start < 0)
+				start = i;
+		}
+		else if (start >= 0)
+		{
+			fz_off_t ofs = (fz_off_t)start * state->block_size;
+			fz_off_t end = (fz_off_t)(i - 1) * state->block_size + block_len(state, i - 1);
+			state->request(ctx, state->opaque, ofs, end - ofs);
+			start = -1;
+		}
+	}
+}
+
+static int
+next_range(fz_context *ctx, fz_stream *stm, int max)
+{
+	fz_range_stream *state = stm->state;
+	int i, ofs;
+
+	if (stm->pos >= state->length)
+		return EOF;
+
+	i = (int)(stm->pos / state->block_size);
+	ofs = (int)(stm->pos - (fz_off_t)i * state->block_size);
+	if (!state->blocks[i])
+	{
+		ask_blocks(ctx, state, i, i);
+		fz_throw(ctx, FZ_ERROR_TRYLATER, "data at offset %lld not loaded yet", (long long)stm->pos);
+	}
+
+	stm->rp = state->blocks[i] + ofs;
+	stm->wp = state->blocks[i] + block_len(state, i);
+	stm->pos += block_len(state, i) - ofs;
+	return *stm->rp++;
+}
+
+static void
+seek_range(fz_context *ctx, fz_stream *stm, fz_off_t offset, int whence)
+{
+	fz_range_stream *state = stm->state;
+
+	if (whence == SEEK_END)
+		offset += state->length;
+	if (offset < 0)
+		offset = 0;
+	if (offset > state->length)
+		offset = state->length;
+	stm->pos = offset;
+	stm->rp = stm->wp = NULL;
+}
+
+static int
+meta_range(fz_context *ctx, fz_stream *stm, int key, int size, void *ptr)
+{
+	fz_range_stream *state = stm->state;
+
+	switch (key)
+	{
+	case FZ_STREAM_META_PROGRESSIVE:
+		return 1;
+	case FZ_STREAM_META_LENGTH:
+		return (int)state->length;
+	case FZ_STREAM_META_WANT:
+	{
+		fz_range *range = ptr;
+		fz_off_t end;
+		if (size != sizeof(fz_range) || range->offset < 0 || range->length <= 0)
+			return -1;
+		end = range->offset + range->length;
+		if (range->offset >= state->length)
+			return 0;
+		if (end > state->length)
+			end = state->length;
+		ask_blocks(ctx, state, (int)(range->offset / state->block_size), (int)((end - 1) / state->block_size));
+		return 1;
+	}
+	}
+	return -1;
+}
+
+static void
+close_range(fz_context *ctx, void *state_)
+{
+	fz_range_stream *state = state_;
+	int i;
+
+	for (i = 0; i < state->nblocks; i++)
+		fz_free(ctx, state->blocks[i]);
+	fz_free(ctx, state->blocks);
+	fz_free(ctx, state->asked);
+	fz_free(ctx, state);
+}
+
+fz_stream *
+fz_open_range_stream(fz_context *ctx, fz_off_t length, int block_size, fz_range_request_fn *request, void *opaque)
+{
+	fz_range_stream *state = NULL;
+	fz_stream *stm;
+
+	if (length < 0 || length > INT_MAX)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported range stream length");
+	if (block_size <= 0)
+		block_size = RANGE_DEFAULT_BLOCK_SIZE;
+
+	fz_var(state);
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, fz_range_stream);
+		state->length = length;
+		state->block_size = block_size;
+		state->nblocks = (int)((length + block_size - 1) / block_size);
+		state->blocks = fz_calloc(ctx, state->nblocks, sizeof(*state->blocks));
+		state->asked = fz_calloc(ctx, state->nblocks, 1);
+		state->request = request;
+		state->opaque = opaque;
+	}
+	fz_catch(ctx)
+	{
+		if (state)
+		{
+			fz_free(ctx, state->blocks);
+			fz_free(ctx, state);
+		}
+		fz_rethrow(ctx);
+	}
+
+	stm = fz_new_stream(ctx, state, next_range, close_range);
+	stm->seek = seek_range;
+	stm->meta = meta_range;
+	return stm;
+}
+
+void
+fz_range_stream_supply(fz_context *ctx, fz_stream *stm, fz_off_t offset, const unsigned char *data, int len)
+{
+	fz_range_stream *state;
+	int i;
+
+	if (stm->next != next_range)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not a range stream");
+	state = stm->state;
+
+	if (offset < 0 || offset % state->block_size != 0 || len < 0 || offset + len > state->length)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "range supplied is not on a block boundary");
+
+	i = (int)(offset / state->block_size);
+	while (len > 0)
+	{
+		int n = block_len(state, i);
+		if (len < n)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "range supplied ends part way through a block");
+		if (!state->blocks[i])
+		{
+			state->blocks[i] = fz_malloc(ctx, n);
+			memcpy(state->blocks[i], data, n);
+			state->have++;
+		}
+		state->asked[i] = 1;
+		data += n;
+		len -= n;
+		i++;
+	}
+}
+
+int
+fz_range_stream_complete(fz_context *ctx, fz_stream *stm)
+{
+	fz_range_stream *state;
+
+	if (stm->next != next_range)
+		return 1;
+	state = stm->state;
+	return state->have == state->nblocks;
+}
@@ -379,6 +379,33 @@ fz_has_archive_entry(fz_context *ctx, fz_archive *zip, const char *name)
 	}
 }
 
+int
+fz_archive_entry_size(fz_context *ctx, fz_archive *zip, const char *name)
+{
+	if (zip->directory)
+	{
+		char path[2048];
+		FILE *file;
+		long size = -1;
+		fz_strlcpy(path, zip->directory, sizeof path);
+		fz_strlcat(path, "/", sizeof path);
+		fz_strlcat(path, name, sizeof path);
+		file = fz_fopen(path, "rb");
+		if (file)
+		{
+			if (fseek(file, 0, SEEK_END) == 0)
+				size = ftell(file);
+			fclose(file);
+		}
+		return size < 0 || size > INT_MAX ? -1 : (int)size;
+	}
+	else
+	{
+		struct zip_entry *ent = lookup_zip_entry(ctx, zip, name);
+		return ent ? ent->usize : -1;
+	}
+}
+
 fz_stream *
 fz_open_archive_entry(fz_context *ctx, fz_archive *zip, const char *name)
 {
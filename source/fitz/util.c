@@ -304,14 +304,14 @@ fz_search_page(fz_context *ctx, fz_page *page, const char *needle, fz_rect *hit_
 int
 fz_search_page_number(fz_context *ctx, fz_document *doc, int number, const char *needle, fz_rect *hit_bbox, int hit_max)
 {
-	fz_page *page;
+	fz_page_text *text;
 	int count;
 
-	page = fz_load_page(ctx, doc, number);
+	text = fz_load_page_text(ctx, doc, number);
 	fz_try(ctx)
-		count = fz_search_page(ctx, page, needle, hit_bbox, hit_max);
+		count = fz_search_page_text(ctx, text, needle, hit_bbox, hit_max);
 	fz_always(ctx)
-		fz_drop_page(ctx, page);
+		fz_drop_page_text(ctx, text);
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 	return count;
@@ -320,12 +320,11 @@ fz_search_page_number(fz_context *ctx, fz_document *doc, int number, const char
 fz_buffer *
 fz_new_buffer_from_text_page(fz_context *ctx, fz_text_page *text, const fz_rect *sel, int crlf)
 {
+	fz_text_index *index;
 	fz_buffer *buf;
-	fz_rect hitbox;
 	float x0, y0, x1, y1;
-	int block_num;
 	int need_newline;
-	int i;
+	int i, n;
 
 	need_newline = 0;
 
@@ -345,46 +344,33 @@ fz_new_buffer_from_text_page(fz_context *ctx, fz_text_page *text, const fz_rect
 	buf = fz_new_buffer(ctx, 256);
 	fz_try(ctx)
 	{
-		for (block_num = 0; block_num < text->len; block_num++)
+		index = fz_index_text_page(ctx, text);
+		for (n = 0; n < index->line_count; n++)
 		{
-			fz_text_line *line;
-			fz_text_block *block;
-			fz_text_span *span;
-
-			if (text->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-				continue;
-
-			block = text->blocks[block_num].u.text;
-			for (line = block->lines; line < block->lines + block->len; line++)
+			int saw_text = 0;
+			/* the last char of each line is the pseudo-newline */
+			for (i = index->line_start[n]; i < index->line_start[n+1] - 1; i++)
 			{
-				int saw_text = 0;
-				for (span = line->first_span; span; span = span->next)
+				const fz_rect *hitbox = &index->chars[i].bbox;
+				int c = index->chars[i].c;
+				if (c < 32)
+					c = '?';
+				if (hitbox->x1 >= x0 && hitbox->x0 <= x1 && hitbox->y1 >= y0 && hitbox->y0 <= y1)
 				{
-					for (i = 0; i < span->len; i++)
+					saw_text = 1;
+					if (need_newline)
 					{
-						int c;
-						fz_text_char_bbox(ctx, &hitbox, span, i);
-						c = span->text[i].c;
-						if (c < 32)
-							c = '?';
-						if (hitbox.x1 >= x0 && hitbox.x0 <= x1 && hitbox.y1 >= y0 && hitbox.y0 <= y1)
-						{
-							saw_text = 1;
-							if (need_newline)
-							{
-								if (crlf)
-									fz_write_buffer_rune(ctx, buf, '\r');
-								fz_write_buffer_rune(ctx, buf, '\n');
-								need_newline = 0;
-							}
-							fz_write_buffer_rune(ctx, buf, c);
-						}
+						if (crlf)
+							fz_write_buffer_rune(ctx, buf, '\r');
+						fz_write_buffer_rune(ctx, buf, '\n');
+						need_newline = 0;
 					}
+					fz_write_buffer_rune(ctx, buf, c);
 				}
-
-				if (saw_text)
-					need_newline = 1;
 			}
+
+			if (saw_text)
+				need_newline = 1;
 		}
 	}
 	fz_catch(ctx)
@@ -454,93 +440,327 @@ fz_new_buffer_from_page_number(fz_context *ctx, fz_document *doc, int number, co
 	return buf;
 }
 
-int fz_gen_thumb_image(fz_context *ctx, fz_document *doc, int pagenum, int width, char *outfile)
+static int
+fz_is_white_span(const unsigned char *p, int w, int n)
 {
-    fz_page *page;
-    float zoom;
-    fz_matrix ctm;
-    fz_rect bounds, tbounds;
-    fz_irect ibounds;
-	fz_colorspace *colorspace;
-    fz_output *output_file = NULL;
-    fz_png_output_context *poc = NULL;
-    fz_device *dev = NULL;
-    fz_pixmap *pix = NULL;
-    fz_cookie cookie = {0};
-
-    int resolution = 72;
-    int alphabits = 8;
+	for (; w > 0; w--, p += n)
+		if (*p != 0xff)
+			return 0;
+	return 1;
+}
+
+/* Find the inked area of a gray pixmap. Rows are scanned in memory
+ * order; the top and bottom scans stop at the first inked row, and
+ * each row in between is only scanned as far as the left and right
+ * edges found so far. */
+static void
+fz_trim_white_pixmap(fz_context *ctx, fz_pixmap *pix, fz_irect *ink)
+{
+	int w = pix->w, h = pix->h, n = pix->n;
+	int stride = w * n;
+	unsigned char *s = pix->samples;
+	int x, y, x0, y0, x1, y1;
+
+	for (y0 = 0; y0 < h; y0++)
+		if (!fz_is_white_span(s + y0 * stride, w, n))
+			break;
+	if (y0 == h)
+	{
+		*ink = fz_empty_irect;
+		return;
+	}
+	for (y1 = h; y1 > y0 + 1; y1--)
+		if (!fz_is_white_span(s + (y1 - 1) * stride, w, n))
+			break;
 
+	x0 = w;
+	x1 = 0;
+	for (y = y0; y < y1; y++)
+	{
+		unsigned char *row = s + y * stride;
+		for (x = 0; x < x0; x++)
+			if (row[x * n] != 0xff)
+			{
+				x0 = x;
+				break;
+			}
+		for (x = w; x > x1; x--)
+			if (row[(x - 1) * n] != 0xff)
+			{
+				x1 = x;
+				break;
+			}
+	}
+
+	ink->x0 = pix->x + x0;
+	ink->y0 = pix->y + y0;
+	ink->x1 = pix->x + x1;
+	ink->y1 = pix->y + y1;
+}
+
+fz_rect *
+fz_bound_page_ink(fz_context *ctx, fz_page *page, fz_rect *bounds, float resolution)
+{
+	fz_rect page_bounds, ink;
+	fz_display_list *list = NULL;
+	fz_device *dev = NULL;
+	fz_pixmap *pix = NULL;
+
+	fz_var(list);
 	fz_var(dev);
-    fz_var(pix);
-    fz_var(poc);
+	fz_var(pix);
 
-    fz_set_aa_level(ctx, alphabits);
-	colorspace = fz_device_rgb(ctx);
+	fz_bound_page(ctx, page, &page_bounds);
 
 	fz_try(ctx)
-		page = fz_load_page(ctx, doc, pagenum - 1);
+	{
+		/* Interpret the page only once if we have to run it twice. */
+		if (resolution > 0)
+			list = fz_new_display_list_from_page(ctx, page);
+
+		dev = fz_new_ink_device(ctx, &ink);
+		if (list)
+			fz_run_display_list(ctx, list, dev, &fz_identity, NULL, NULL);
+		else
+			fz_run_page(ctx, page, dev, &fz_identity, NULL);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+		fz_intersect_rect(&ink, &page_bounds);
+
+		/* The device only knows object bounds (glyphs by their font
+		 * bbox, images by their whole extent), so if asked we refine
+		 * it by rasterizing just that area and trimming white. */
+		if (list && !fz_is_empty_rect(&ink))
+		{
+			float zoom = resolution / 72;
+			fz_matrix ctm;
+			fz_irect area, found;
+			fz_rect r = ink;
+
+			fz_scale(&ctm, zoom, zoom);
+			fz_round_rect(&area, fz_transform_rect(&r, &ctm));
+			fz_rect_from_irect(&r, &area);
+			pix = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), &area);
+			fz_clear_pixmap_with_value(ctx, pix, 0xff);
+			dev = fz_new_draw_device(ctx, pix);
+			fz_run_display_list(ctx, list, dev, &ctm, &r, NULL);
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+
+			fz_trim_white_pixmap(ctx, pix, &found);
+			if (fz_is_empty_irect(&found))
+				ink = fz_empty_rect;
+			else
+			{
+				fz_rect_from_irect(&r, &found);
+				fz_scale(&ctm, 1 / zoom, 1 / zoom);
+				fz_transform_rect(&r, &ctm);
+				fz_intersect_rect(&ink, &r);
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_display_list(ctx, list);
+	}
 	fz_catch(ctx)
 	{
+		fz_rethrow(ctx);
+	}
+
+	*bounds = ink;
+	return bounds;
+}
+
+fz_rect *
+fz_bound_page_fix(fz_context *ctx, fz_page *page, fz_rect *bounds)
+{
+	fz_rect ink;
+	float wleft, hleft;
+
+	fz_bound_page(ctx, page, bounds);
+	fz_bound_page_ink(ctx, page, &ink, 36);
+	if (fz_is_empty_rect(&ink))
+		return bounds;
+
+	/* leave 5% white space around the ink */
+	wleft = (ink.x1 - ink.x0) * 5 / 100;
+	hleft = (ink.y1 - ink.y0) * 5 / 100;
+	ink.x0 -= wleft;
+	ink.y0 -= hleft;
+	ink.x1 += wleft;
+	ink.y1 += hleft;
+
+	return fz_intersect_rect(bounds, &ink);
+}
+
+static void
+fz_thumb_matrix(fz_context *ctx, const fz_rect *bounds, int width, fz_matrix *ctm)
+{
+	*ctm = fz_identity;
+	if (width && bounds->x1 > bounds->x0)
+	{
+		float scale = width / (bounds->x1 - bounds->x0);
+		fz_scale(ctm, scale, scale);
+	}
+}
+
+static void
+fz_write_thumb(fz_context *ctx, fz_page *page, fz_display_list *list, int width, const char *outfile)
+{
+	fz_rect bounds;
+	fz_irect ibounds;
+	fz_matrix ctm;
+	fz_pixmap *pix;
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	if (list)
+		fz_bound_display_list(ctx, list, &bounds);
+	else
+		fz_bound_page(ctx, page, &bounds);
+
+	/* Render straight at thumbnail scale; the draw device asks
+	 * fz_image_get_pixmap for images at their device size, so images
+	 * are subsampled while decoding rather than after. */
+	fz_thumb_matrix(ctx, &bounds, width, &ctm);
+	fz_round_rect(&ibounds, fz_transform_rect(&bounds, &ctm));
+
+	pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), &ibounds);
+	fz_try(ctx)
+	{
+		fz_pixmap_set_resolution(pix, 72);
+		fz_clear_pixmap(ctx, pix);
+		dev = fz_new_draw_device(ctx, pix);
+		if (list)
+			fz_run_display_list(ctx, list, dev, &ctm, NULL, NULL);
+		else
+			fz_run_page(ctx, page, dev, &ctm, NULL);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+
+		fz_unmultiply_pixmap(ctx, pix);
+		fz_write_png(ctx, pix, (char *)outfile, 1);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, pix);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+int fz_gen_thumb_image(fz_context *ctx, fz_document *doc, int pagenum, int width, char *outfile)
+{
+	fz_page *page;
+
+	fz_set_aa_level(ctx, 8);
+
+	fz_try(ctx)
+		page = fz_load_page(ctx, doc, pagenum - 1);
+	fz_catch(ctx)
 		fz_rethrow_message(ctx, "cannot load page %d", pagenum);
-		return -1;
-	}
-
-    fz_bound_page(ctx, page, &bounds);
-
-    zoom = resolution / 72;
-    fz_pre_scale(fz_rotate(&ctm, 0), zoom, zoom);
-    tbounds = bounds;
-    fz_round_rect(&ibounds, fz_transform_rect(&tbounds, &ctm));
-
-    if(width)
-    {
-        float scalex = width / (tbounds.x1 - tbounds.x0);
-        float scaley = scalex;
-        fz_matrix scale_mat;
-
-        fz_scale(&scale_mat, scalex, scaley);
-        fz_concat(&ctm, &ctm, &scale_mat);
-        tbounds = bounds;
-        fz_transform_rect(&tbounds, &ctm);
-    }
-    fz_round_rect(&ibounds, &tbounds);
-    fz_rect_from_irect(&tbounds, &ibounds);
-
-
-    fz_try(ctx)
-    {
-        int totalheight = ibounds.y1 - ibounds.y0;
-        fz_irect band_ibounds = ibounds;
-        int drawheight = totalheight;
-
-        pix = fz_new_pixmap_with_bbox(ctx, colorspace, &band_ibounds);
-        fz_pixmap_set_resolution(pix, resolution);
-
-        output_file = fz_new_output_to_filename(ctx, outfile);
-        poc = fz_output_png_header(ctx, output_file, pix->w, totalheight, pix->n, 1);
-
-        fz_clear_pixmap(ctx, pix);
-        dev = fz_new_draw_device(ctx, pix);
-        fz_run_page(ctx, page, dev, &ctm, &cookie);
-
-        fz_unmultiply_pixmap(ctx, pix);
-        fz_output_png_band(ctx, output_file, pix->w, totalheight, pix->n, 0, drawheight, pix->samples, 1, poc);
-    }
-    fz_always(ctx)
-    {
-        fz_output_png_trailer(ctx, output_file, poc);
-        fz_drop_device(ctx, dev);
-        fz_drop_pixmap(ctx, pix);
-        fz_drop_output(ctx, output_file);
+
+	fz_try(ctx)
+		fz_write_thumb(ctx, page, NULL, width, outfile);
+	fz_always(ctx)
 		fz_drop_page(ctx, page);
-    }
-    fz_catch(ctx)
-    {
-        fz_drop_page(ctx, page);
-        fz_rethrow(ctx);
-		return -1;
-    }
-
-    return 0;
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return 0;
+}
+
+void
+fz_gen_thumb_image_from_display_list(fz_context *ctx, fz_display_list *list, int width, const char *outfile)
+{
+	fz_write_thumb(ctx, NULL, list, width, outfile);
+}
+
+/* Replace the first %d in the pattern, which may carry a width as in
+ * %03d, with the page number. Everything else in the pattern, including
+ * any other '%', is part of the file name. */
+static void
+format_thumb_name(char *buf, int size, const char *pattern, int pagenum)
+{
+	const char *p = pattern;
+	const char *d = NULL;
+	char num[24];
+	int width = 0;
+	int n;
+
+	while ((p = strchr(p, '%')) != NULL)
+	{
+		const char *q = p + 1;
+		width = 0;
+		while (*q >= '0' && *q <= '9')
+			width = width * 10 + *q++ - '0';
+		if (*q == 'd')
+		{
+			d = p;
+			p = q + 1;
+			break;
+		}
+		p++;
+	}
+
+	if (!d)
+	{
+		fz_strlcpy(buf, pattern, size);
+		return;
+	}
+
+	fz_snprintf(num, sizeof num, "%d", pagenum);
+	n = strlen(num);
+	width = fz_clampi(width, n, sizeof num - 1);
+	memmove(num + width - n, num, n + 1);
+	memset(num, '0', width - n);
+
+	n = fz_mini(d - pattern, size - 1);
+	memcpy(buf, pattern, n);
+	buf[n] = 0;
+	fz_strlcat(buf, num, size);
+	fz_strlcat(buf, p, size);
+}
+
+int
+fz_gen_thumbs(fz_context *ctx, fz_document *doc, int first, int last, int width, const char *pattern)
+{
+	char outfile[1024];
+	int count, pagenum, done = 0;
+	fz_page *page = NULL;
+
+	fz_var(page);
+
+	count = fz_count_pages(ctx, doc);
+	first = fz_clampi(first, 1, count);
+	last = fz_clampi(last, 1, count);
+
+	for (pagenum = first; pagenum <= last; pagenum++)
+	{
+		format_thumb_name(outfile, sizeof outfile, pattern, pagenum);
+		fz_try(ctx)
+		{
+			page = fz_load_page(ctx, doc, pagenum - 1);
+			fz_write_thumb(ctx, page, NULL, width, outfile);
+			done++;
+		}
+		fz_always(ctx)
+		{
+			fz_drop_page(ctx, page);
+			page = NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_warn(ctx, "cannot generate thumbnail for page %d: %s", pagenum, fz_caught_message(ctx));
+		}
+	}
+
+	return done;
 }
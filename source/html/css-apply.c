@@ -219,7 +219,7 @@ match_class_condition(fz_xml *node, const char *p)
 	const char *s = fz_xml_att(node, "class");
 	char buf[1024];
 	if (s) {
-		strcpy(buf, s);
+		fz_strlcpy(buf, s, sizeof buf);
 		s = strtok(buf, " ");
 		while (s) {
 			if (!strcmp(s, p))
@@ -576,16 +576,259 @@ add_property(fz_css_match *match, const char *name, fz_css_value *value, int spe
 	++match->count;
 }
 
+/*
+ * Selector index. Each selector is filed under the id, class or tag that
+ * its rightmost part requires, or as universal if it requires none of
+ * them, so that a node only needs to be tested against the rules filed
+ * under its own id, classes and tag. The candidates are then tried in
+ * stylesheet order, exactly as if every rule had been tried.
+ */
+
+enum { INDEX_UNIVERSAL, INDEX_ID, INDEX_CLASS, INDEX_TAG };
+
+typedef struct fz_css_index_entry_s fz_css_index_entry;
+
+struct fz_css_index_entry_s
+{
+	int type;
+	const char *key; /* not owned */
+	int rule;
+};
+
+struct fz_css_index_s
+{
+	fz_css_rule *css;
+	int rule_count;
+	fz_css_rule **rules;
+	int entry_count;
+	fz_css_index_entry *entries;
+	int *candidates;
+	int share_siblings;
+};
+
+static int
+cmp_index_entry(const void *a_, const void *b_)
+{
+	const fz_css_index_entry *a = a_;
+	const fz_css_index_entry *b = b_;
+	int c;
+	if (a->type != b->type)
+		return a->type - b->type;
+	if (a->key && b->key)
+	{
+		c = strcmp(a->key, b->key);
+		if (c)
+			return c;
+	}
+	return a->rule - b->rule;
+}
+
+static int
+cmp_rule_number(const void *a_, const void *b_)
+{
+	return *(const int *)a_ - *(const int *)b_;
+}
+
+static int
+selector_has_sibling_combinator(fz_css_selector *sel)
+{
+	if (!sel)
+		return 0;
+	if (sel->combine == '+')
+		return 1;
+	return selector_has_sibling_combinator(sel->left) || selector_has_sibling_combinator(sel->right);
+}
+
+static void
+index_selector(fz_css_index_entry *entry, fz_css_selector *sel, int rule)
+{
+	fz_css_condition *cond;
+
+	while (sel->combine && sel->right)
+		sel = sel->right;
+
+	entry->type = INDEX_UNIVERSAL;
+	entry->key = NULL;
+	entry->rule = rule;
+
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		if (cond->type == '#' && cond->val)
+		{
+			entry->type = INDEX_ID;
+			entry->key = cond->val;
+			return;
+		}
+	}
+	for (cond = sel->cond; cond; cond = cond->next)
+	{
+		if (cond->type == '.' && cond->val)
+		{
+			entry->type = INDEX_CLASS;
+			entry->key = cond->val;
+			return;
+		}
+	}
+	if (sel->name)
+	{
+		entry->type = INDEX_TAG;
+		entry->key = sel->name;
+	}
+}
+
+fz_css_index *
+fz_new_css_index(fz_context *ctx, fz_css_rule *css)
+{
+	fz_css_index *index;
+	fz_css_rule *rule;
+	fz_css_selector *sel;
+	int i, n;
+
+	index = fz_malloc_struct(ctx, fz_css_index);
+	index->css = css;
+	index->share_siblings = 1;
+
+	fz_try(ctx)
+	{
+		for (rule = css; rule; rule = rule->next)
+		{
+			index->rule_count++;
+			for (sel = rule->selector; sel; sel = sel->next)
+				index->entry_count++;
+		}
+
+		index->rules = fz_malloc_array(ctx, fz_maxi(index->rule_count, 1), sizeof *index->rules);
+		index->entries = fz_malloc_array(ctx, fz_maxi(index->entry_count, 1), sizeof *index->entries);
+		index->candidates = fz_malloc_array(ctx, fz_maxi(index->entry_count, 1), sizeof *index->candidates);
+
+		for (i = n = 0, rule = css; rule; rule = rule->next, i++)
+		{
+			index->rules[i] = rule;
+			for (sel = rule->selector; sel; sel = sel->next)
+			{
+				index_selector(&index->entries[n++], sel, i);
+				if (selector_has_sibling_combinator(sel))
+					index->share_siblings = 0;
+			}
+		}
+
+		qsort(index->entries, index->entry_count, sizeof *index->entries, cmp_index_entry);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_css_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
+void
+fz_drop_css_index(fz_context *ctx, fz_css_index *index)
+{
+	if (index)
+	{
+		fz_free(ctx, index->rules);
+		fz_free(ctx, index->entries);
+		fz_free(ctx, index->candidates);
+		fz_free(ctx, index);
+	}
+}
+
+/* Compare an entry against a key that need not be terminated */
+static int
+cmp_entry_key(const fz_css_index_entry *entry, int type, const char *key, int len)
+{
+	int c;
+	if (entry->type != type)
+		return entry->type - type;
+	if (!key)
+		return 0;
+	c = strncmp(entry->key, key, len);
+	if (c)
+		return c;
+	return entry->key[len] ? 1 : 0;
+}
+
+static int
+add_candidates(fz_css_index *index, int n, int type, const char *key, int len)
+{
+	int l = 0;
+	int r = index->entry_count;
+
+	/* find the first entry not less than the key */
+	while (l < r)
+	{
+		int m = (l + r) >> 1;
+		if (cmp_entry_key(&index->entries[m], type, key, len) < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	while (l < index->entry_count && cmp_entry_key(&index->entries[l], type, key, len) == 0)
+		index->candidates[n++] = index->entries[l++].rule;
+
+	return n;
+}
+
+static int
+class_seen_before(const char *list, const char *name, int len)
+{
+	while (list < name)
+	{
+		int n = 0;
+		while (*list == ' ')
+			++list;
+		while (list[n] && list[n] != ' ')
+			++n;
+		if (list < name && n == len && !memcmp(list, name, len))
+			return 1;
+		list += n;
+	}
+	return 0;
+}
+
 void
-fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *css, fz_xml *node)
+fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_index *index, fz_xml *node)
 {
 	fz_css_rule *rule;
 	fz_css_selector *sel;
 	fz_css_property *prop, *head, *tail;
 	const char *s;
+	int i, n;
 
-	for (rule = css; rule; rule = rule->next)
+	n = add_candidates(index, 0, INDEX_UNIVERSAL, NULL, 0);
+	s = fz_xml_tag(node);
+	if (s)
+		n = add_candidates(index, n, INDEX_TAG, s, strlen(s));
+	s = fz_xml_att(node, "id");
+	if (s)
+		n = add_candidates(index, n, INDEX_ID, s, strlen(s));
+	/* Each distinct key finds distinct entries, so the candidates
+	 * cannot outnumber the entries as long as no class is looked up
+	 * twice. */
+	s = fz_xml_att(node, "class");
+	while (s && *s)
+	{
+		int len = 0;
+		while (*s == ' ')
+			++s;
+		while (s[len] && s[len] != ' ')
+			++len;
+		if (len > 0 && !class_seen_before(fz_xml_att(node, "class"), s, len))
+			n = add_candidates(index, n, INDEX_CLASS, s, len);
+		s += len;
+	}
+
+	/* A rule may be filed under several of the node's keys */
+	qsort(index->candidates, n, sizeof *index->candidates, cmp_rule_number);
+
+	for (i = 0; i < n; i++)
 	{
+		if (i > 0 && index->candidates[i] == index->candidates[i - 1])
+			continue;
+		rule = index->rules[index->candidates[i]];
 		sel = rule->selector;
 		while (sel)
 		{
@@ -600,7 +843,7 @@ fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *css, fz_xml *nod
 	}
 
 	s = fz_xml_att(node, "style");
-	if (s)
+	if (s && index->css)
 	{
 		fz_try(ctx)
 		{
@@ -612,8 +855,8 @@ fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *css, fz_xml *nod
 				prop = prop->next;
 			}
 			if (tail)
-				tail->next = css->garbage;
-			css->garbage = head;
+				tail->next = index->css->garbage;
+			index->css->garbage = head;
 		}
 		fz_catch(ctx)
 		{
@@ -622,6 +865,30 @@ fz_match_css(fz_context *ctx, fz_css_match *match, fz_css_rule *css, fz_xml *nod
 	}
 }
 
+static int
+same_att(fz_xml *a, fz_xml *b, const char *name)
+{
+	const char *sa = fz_xml_att(a, name);
+	const char *sb = fz_xml_att(b, name);
+	if (!sa || !sb)
+		return sa == sb;
+	return !strcmp(sa, sb);
+}
+
+int
+fz_can_share_css_match(fz_context *ctx, fz_css_index *index, fz_xml *prev, fz_xml *node)
+{
+	const char *a, *b;
+
+	if (!index->share_siblings || !prev || fz_xml_up(prev) != fz_xml_up(node))
+		return 0;
+	a = fz_xml_tag(prev);
+	b = fz_xml_tag(node);
+	if (!a || !b || strcmp(a, b))
+		return 0;
+	return same_att(prev, node, "id") && same_att(prev, node, "class") && same_att(prev, node, "style");
+}
+
 void
 fz_match_css_at_page(fz_context *ctx, fz_css_match *match, fz_css_rule *css)
 {
@@ -6,6 +6,16 @@ typedef struct epub_document_s epub_document;
 typedef struct epub_chapter_s epub_chapter;
 typedef struct epub_page_s epub_page;
 
+/*
+	Chapters are parsed and laid out, in spine order, when a page in or
+	after them is first asked for. Until then the number of pages in a
+	chapter is estimated from the size of its XHTML, at the rate measured
+	from the chapters that have been laid out, so the page count refines
+	as the book is read: it is only exact as far as the last page loaded.
+	The start page of each chapter is kept up to date in the chapter
+	array, which is searched to find the chapter holding a page.
+*/
+
 struct epub_document_s
 {
 	fz_document super;
@@ -13,6 +23,11 @@ struct epub_document_s
 	fz_html_font_set *set;
 	int count;
 	epub_chapter *spine;
+	epub_chapter **chapters;
+	int page_count;
+	int laid_out; /* chapters laid out, from the start of the spine */
+	float layout_w, layout_h, layout_em;
+	int laid_out_size, laid_out_pages;
 	fz_outline *outline;
 	char *dc_title, *dc_creator;
 };
@@ -20,7 +35,9 @@ struct epub_document_s
 struct epub_chapter_s
 {
 	char *path;
+	int size; /* of the XHTML, for estimating the page count */
 	int start;
+	int count; /* estimated until laid out */
 	float page_w, page_h, em;
 	float page_margin[4];
 	fz_html *box;
@@ -57,42 +74,156 @@ epub_update_link_dests(fz_context *ctx, epub_document *doc, fz_outline *node)
 	}
 }
 
+/* Rough guess at how many bytes of XHTML fill a page, for use before any
+ * chapter has been laid out: a few bytes of markup and text for each
+ * square em of the page. */
+#define EPUB_BYTES_PER_SQUARE_EM 2
+
+static int
+epub_estimate_pages(epub_document *doc, epub_chapter *ch)
+{
+	float per_page;
+
+	if (ch->size <= 0)
+		return 1;
+	if (doc->laid_out_pages > 0)
+		per_page = (float)doc->laid_out_size / doc->laid_out_pages;
+	else
+		per_page = doc->layout_w * doc->layout_h / (doc->layout_em * doc->layout_em) * EPUB_BYTES_PER_SQUARE_EM;
+	if (per_page < 1)
+		per_page = 1;
+	return (int)ceilf(ch->size / per_page);
+}
+
+/* Refresh the estimates for the chapters not yet laid out, and the start
+ * page of every chapter. */
 static void
-epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
+epub_update_page_starts(fz_context *ctx, epub_document *doc)
 {
-	epub_document *doc = (epub_document*)doc_;
-	epub_chapter *ch;
-	int count = 0;
+	int i, count = 0;
 
-	printf("epub: laying out chapters.\n");
-	for (ch = doc->spine; ch; ch = ch->next)
+	for (i = 0; i < doc->count; i++)
 	{
+		epub_chapter *ch = doc->chapters[i];
+		if (i >= doc->laid_out)
+			ch->count = epub_estimate_pages(doc, ch);
 		ch->start = count;
-		ch->em = em;
-		ch->page_margin[T] = fz_from_css_number(ch->box->style.margin[T], em, em);
-		ch->page_margin[B] = fz_from_css_number(ch->box->style.margin[B], em, em);
-		ch->page_margin[L] = fz_from_css_number(ch->box->style.margin[L], em, em);
-		ch->page_margin[R] = fz_from_css_number(ch->box->style.margin[R], em, em);
-		ch->page_w = w - ch->page_margin[L] - ch->page_margin[R];
-		ch->page_h = h - ch->page_margin[T] - ch->page_margin[B];
-		fz_layout_html(ctx, ch->box, ch->page_w, ch->page_h, ch->em);
-		count += ceilf(ch->box->h / ch->page_h);
+		count += ch->count;
 	}
+	doc->page_count = count;
 
 	epub_update_link_dests(ctx, doc, doc->outline);
+}
 
-	printf("epub: done.\n");
+/* Lay out the first chapter not yet laid out */
+static void
+epub_layout_next_chapter(fz_context *ctx, epub_document *doc)
+{
+	epub_chapter *ch = doc->chapters[doc->laid_out];
+	float em = doc->layout_em;
+
+	if (!ch->box)
+	{
+		fz_archive *zip = doc->zip;
+		fz_buffer *buf;
+		char base_uri[2048];
+
+		fz_dirname(base_uri, ch->path, sizeof base_uri);
+
+		buf = fz_read_archive_entry(ctx, zip, ch->path);
+		fz_try(ctx)
+		{
+			fz_write_buffer_byte(ctx, buf, 0);
+			ch->box = fz_parse_html(ctx, doc->set, zip, base_uri, buf, fz_user_css(ctx));
+		}
+		fz_always(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+		}
+		fz_catch(ctx)
+		{
+			fz_rethrow(ctx);
+		}
+	}
+
+	ch->em = em;
+	ch->page_margin[T] = fz_from_css_number(ch->box->style.margin[T], em, em);
+	ch->page_margin[B] = fz_from_css_number(ch->box->style.margin[B], em, em);
+	ch->page_margin[L] = fz_from_css_number(ch->box->style.margin[L], em, em);
+	ch->page_margin[R] = fz_from_css_number(ch->box->style.margin[R], em, em);
+	ch->page_w = doc->layout_w - ch->page_margin[L] - ch->page_margin[R];
+	ch->page_h = doc->layout_h - ch->page_margin[T] - ch->page_margin[B];
+	fz_layout_html(ctx, ch->box, ch->page_w, ch->page_h, ch->em);
+	ch->count = ceilf(ch->box->h / ch->page_h);
+	doc->laid_out++;
+
+	if (ch->size > 0)
+	{
+		doc->laid_out_size += ch->size;
+		doc->laid_out_pages += ch->count;
+	}
+
+	epub_update_page_starts(ctx, doc);
+}
+
+/* Find the chapter holding page n. Which page that is depends on the
+ * real page counts of all the chapters before it, so first lay out every
+ * chapter that (on the current estimates) starts at or before n. Laying
+ * one out replaces its estimate with the real count and moves the rest,
+ * so check the next against its new start. */
+static epub_chapter *
+epub_find_page(fz_context *ctx, epub_document *doc, int n, int *local)
+{
+	epub_chapter *ch;
+	int l = 0, r;
+
+	if (n < 0)
+		return NULL;
+
+	while (doc->laid_out < doc->count && doc->chapters[doc->laid_out]->start <= n)
+		epub_layout_next_chapter(ctx, doc);
+
+	if (n >= doc->page_count)
+		return NULL;
+
+	/* The last chapter that starts at or before n, which is laid out */
+	r = doc->laid_out - 1;
+	while (l < r)
+	{
+		int m = (l + r + 1) >> 1;
+		if (doc->chapters[m]->start <= n)
+			l = m;
+		else
+			r = m - 1;
+	}
+
+	ch = doc->chapters[l];
+	*local = n - ch->start;
+	return ch;
+}
+
+static void
+epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
+{
+	epub_document *doc = (epub_document*)doc_;
+
+	doc->layout_w = w;
+	doc->layout_h = h;
+	doc->layout_em = em;
+	doc->laid_out_size = 0;
+	doc->laid_out_pages = 0;
+
+	/* Keep the parsed chapters, but lay them out again when needed */
+	doc->laid_out = 0;
+
+	epub_update_page_starts(ctx, doc);
 }
 
 static int
 epub_count_pages(fz_context *ctx, fz_document *doc_)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_chapter *ch;
-	int count = 0;
-	for (ch = doc->spine; ch; ch = ch->next)
-		count += ceilf(ch->box->h / ch->page_h);
-	return count;
+	return doc->page_count;
 }
 
 static void
@@ -106,21 +237,16 @@ epub_bound_page(fz_context *ctx, fz_page *page_, fz_rect *bbox)
 	epub_page *page = (epub_page*)page_;
 	epub_document *doc = page->doc;
 	epub_chapter *ch;
-	int n = page->number;
-	int count = 0;
+	int n;
 
-	for (ch = doc->spine; ch; ch = ch->next)
+	ch = epub_find_page(ctx, doc, page->number, &n);
+	if (ch)
 	{
-		int cn = ceilf(ch->box->h / ch->page_h);
-		if (n < count + cn)
-		{
-			bbox->x0 = 0;
-			bbox->y0 = 0;
-			bbox->x1 = ch->page_w + ch->page_margin[L] + ch->page_margin[R];
-			bbox->y1 = ch->page_h + ch->page_margin[T] + ch->page_margin[B];
-			return bbox;
-		}
-		count += cn;
+		bbox->x0 = 0;
+		bbox->y0 = 0;
+		bbox->x1 = ch->page_w + ch->page_margin[L] + ch->page_margin[R];
+		bbox->y1 = ch->page_h + ch->page_margin[T] + ch->page_margin[B];
+		return bbox;
 	}
 
 	*bbox = fz_unit_rect;
@@ -134,19 +260,13 @@ epub_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *
 	epub_document *doc = page->doc;
 	epub_chapter *ch;
 	fz_matrix local_ctm = *ctm;
-	int n = page->number;
-	int count = 0;
+	int n;
 
-	for (ch = doc->spine; ch; ch = ch->next)
+	ch = epub_find_page(ctx, doc, page->number, &n);
+	if (ch)
 	{
-		int cn = ceilf(ch->box->h / ch->page_h);
-		if (n < count + cn)
-		{
-			fz_pre_translate(&local_ctm, ch->page_margin[L], ch->page_margin[T]);
-			fz_draw_html(ctx, ch->box, (n-count) * ch->page_h, (n-count+1) * ch->page_h, dev, &local_ctm);
-			break;
-		}
-		count += cn;
+		fz_pre_translate(&local_ctm, ch->page_margin[L], ch->page_margin[T]);
+		fz_draw_html(ctx, ch->box, n * ch->page_h, (n+1) * ch->page_h, dev, &local_ctm);
 	}
 }
 
@@ -154,7 +274,13 @@ static fz_page *
 epub_load_page(fz_context *ctx, fz_document *doc_, int number)
 {
 	epub_document *doc = (epub_document*)doc_;
-	epub_page *page = fz_new_page(ctx, sizeof *page);
+	epub_page *page;
+	int n;
+
+	/* Settle the page count at least as far as this page */
+	(void)epub_find_page(ctx, doc, number, &n);
+
+	page = fz_new_page(ctx, sizeof *page);
 	page->super.bound_page = epub_bound_page;
 	page->super.run_page_contents = epub_run_page;
 	page->super.drop_page_imp = epub_drop_page_imp;
@@ -177,6 +303,7 @@ epub_close_document(fz_context *ctx, fz_document *doc_)
 		fz_free(ctx, ch);
 		ch = next;
 	}
+	fz_free(ctx, doc->chapters);
 	fz_drop_archive(ctx, doc->zip);
 	fz_drop_html_font_set(ctx, doc->set);
 	fz_free(ctx, doc->dc_title);
@@ -219,23 +346,14 @@ path_from_idref(char *path, fz_xml *manifest, const char *base_uri, const char *
 static epub_chapter *
 epub_parse_chapter(fz_context *ctx, epub_document *doc, const char *path)
 {
-	fz_archive *zip = doc->zip;
-	fz_buffer *buf;
 	epub_chapter *ch;
-	char base_uri[2048];
-
-	fz_dirname(base_uri, path, sizeof base_uri);
-
-	buf = fz_read_archive_entry(ctx, zip, path);
-	fz_write_buffer_byte(ctx, buf, 0);
 
 	ch = fz_malloc_struct(ctx, epub_chapter);
 	ch->path = fz_strdup(ctx, path);
-	ch->box = fz_parse_html(ctx, doc->set, zip, base_uri, buf, fz_user_css(ctx));
+	ch->size = fz_archive_entry_size(ctx, doc->zip, path);
+	ch->box = NULL;
 	ch->next = NULL;
 
-	fz_drop_buffer(ctx, buf);
-
 	return ch;
 }
 
@@ -267,7 +385,7 @@ epub_parse_ncx_imp(fz_context *ctx, epub_document *doc, fz_xml *node, char *base
 			outline->title = fz_strdup(ctx, text);
 			outline->dest.kind = FZ_LINK_GOTO;
 			outline->dest.ld.gotor.dest = fz_strdup(ctx, path);
-			outline->dest.ld.gotor.page = 0; /* computed in epub_layout */
+			outline->dest.ld.gotor.page = 0; /* computed as chapters are laid out */
 			outline->down = epub_parse_ncx_imp(ctx, doc, node, base_uri);
 
 			if (!head)
@@ -322,7 +440,8 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 	const char *full_path;
 	const char *version;
 	char ncx[2048], s[2048];
-	epub_chapter *head, *tail;
+	epub_chapter *head, *tail, *ch;
+	int i;
 
 	if (fz_has_archive_entry(ctx, zip, "META-INF/rights.xml"))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "EPUB is locked by DRM");
@@ -386,12 +505,17 @@ epub_parse_header(fz_context *ctx, epub_document *doc)
 				head = tail = epub_parse_chapter(ctx, doc, s);
 			else
 				tail = tail->next = epub_parse_chapter(ctx, doc, s);
+			doc->count++;
 		}
 		itemref = fz_xml_find_next(itemref, "itemref");
 	}
 
 	doc->spine = head;
 
+	doc->chapters = fz_malloc_array(ctx, fz_maxi(doc->count, 1), sizeof *doc->chapters);
+	for (i = 0, ch = head; ch; ch = ch->next)
+		doc->chapters[i++] = ch;
+
 	printf("epub: done.\n");
 
 	fz_drop_xml(ctx, container_xml);
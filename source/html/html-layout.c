@@ -261,9 +261,13 @@ static void init_box(fz_context *ctx, fz_html *box)
 	box->flow_head = NULL;
 	box->flow_tail = &box->flow_head;
 
+	box->pages = NULL;
+
 	fz_default_css_style(ctx, &box->style);
 }
 
+static void drop_html_pages(fz_context *ctx, fz_html_pages *pages);
+
 void fz_drop_html(fz_context *ctx, fz_html *box)
 {
 	while (box)
@@ -271,6 +275,7 @@ void fz_drop_html(fz_context *ctx, fz_html *box)
 		fz_html *next = box->next;
 		fz_drop_html_flow(ctx, box->flow_head);
 		fz_drop_html(ctx, box->down);
+		drop_html_pages(ctx, box->pages);
 		fz_free(ctx, box);
 		box = next;
 	}
@@ -372,22 +377,28 @@ static void insert_inline_box(fz_context *ctx, fz_html *box, fz_html *top)
 }
 
 static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const char *base_uri,
-	fz_xml *node, fz_html *top, fz_css_rule *rule, fz_css_match *up_match, int list_counter)
+	fz_xml *node, fz_html *top, fz_css_index *index, fz_css_match *up_match, int list_counter)
 {
 	fz_css_match match;
+	fz_xml *prev = NULL; /* last element sibling, whose rules are in match */
 	fz_html *box;
 	const char *tag;
 	int display;
 
 	while (node)
 	{
-		match.up = up_match;
-		match.count = 0;
-
 		tag = fz_xml_tag(node);
 		if (tag)
 		{
-			fz_match_css(ctx, &match, rule, node);
+			/* Runs of like siblings, such as the paragraphs of a
+			 * chapter, all match the same rules. */
+			if (!fz_can_share_css_match(ctx, index, prev, node))
+			{
+				match.up = up_match;
+				match.count = 0;
+				fz_match_css(ctx, &match, index, node);
+			}
+			prev = node;
 
 			display = fz_get_css_match_display(&match);
 
@@ -449,7 +460,7 @@ static void generate_boxes(fz_context *ctx, fz_html_font_set *set, fz_archive *z
 					int child_counter = list_counter;
 					if (!strcmp(tag, "ul") || !strcmp(tag, "ol"))
 						child_counter = 0;
-					generate_boxes(ctx, set, zip, base_uri, fz_xml_down(node), box, rule, &match, child_counter);
+					generate_boxes(ctx, set, zip, base_uri, fz_xml_down(node), box, index, &match, child_counter);
 				}
 
 				// TODO: remove empty flow boxes
@@ -598,6 +609,92 @@ static void layout_line(fz_context *ctx, float indent, float page_w, float line_
 	}
 }
 
+/*
+ * The page index, kept in the root box by fz_layout_html. For each page it
+ * records the first line whose bottom reaches down to the page, and the
+ * first line whose top lies below it, so that drawing a page can go
+ * straight to its text and stop after it rather than walking every flow
+ * node before and after. Lines are matched to pages with a point of
+ * slack either way, so rounding can only make a page start a line early
+ * or stop a line late.
+ */
+
+#define PAGE_SLACK 1
+
+struct fz_html_pages_s
+{
+	float page_h;
+	float last_top;
+	int valid;
+	int start_len, start_cap;
+	fz_html **start_box;
+	fz_html_flow **start;
+	int end_len, end_cap;
+	fz_html_flow **end;
+};
+
+static void drop_html_pages(fz_context *ctx, fz_html_pages *pages)
+{
+	if (pages)
+	{
+		fz_free(ctx, pages->start_box);
+		fz_free(ctx, pages->start);
+		fz_free(ctx, pages->end);
+		fz_free(ctx, pages);
+	}
+}
+
+static fz_html_pages *find_html_pages(fz_html *box)
+{
+	while (box->up)
+		box = box->up;
+	return box->pages && box->pages->valid ? box->pages : NULL;
+}
+
+static void index_line(fz_context *ctx, fz_html *box, fz_html_flow *node, float top, float bottom)
+{
+	fz_html_pages *pages = find_html_pages(box);
+	float page_h;
+
+	if (!pages)
+		return;
+	page_h = pages->page_h;
+
+	/* Lines must come down the page in order for the index to work */
+	if (!(top >= pages->last_top - PAGE_SLACK) || !(bottom < page_h * (1 << 20)))
+	{
+		pages->valid = 0;
+		return;
+	}
+	pages->last_top = top;
+
+	while (bottom > pages->start_len * page_h - PAGE_SLACK)
+	{
+		if (pages->start_len == pages->start_cap)
+		{
+			int cap = pages->start_cap ? pages->start_cap * 2 : 16;
+			pages->start_box = fz_resize_array(ctx, pages->start_box, cap, sizeof *pages->start_box);
+			pages->start = fz_resize_array(ctx, pages->start, cap, sizeof *pages->start);
+			pages->start_cap = cap;
+		}
+		pages->start_box[pages->start_len] = box;
+		pages->start[pages->start_len] = node;
+		pages->start_len++;
+	}
+
+	while (top > (pages->end_len + 1) * page_h + PAGE_SLACK)
+	{
+		if (pages->end_len == pages->end_cap)
+		{
+			int cap = pages->end_cap ? pages->end_cap * 2 : 16;
+			pages->end = fz_resize_array(ctx, pages->end, cap, sizeof *pages->end);
+			pages->end_cap = cap;
+		}
+		pages->end[pages->end_len] = node;
+		pages->end_len++;
+	}
+}
+
 static void find_accumulated_margins(fz_context *ctx, fz_html *box, float *w, float *h)
 {
 	while (box)
@@ -619,6 +716,7 @@ static void flush_line(fz_context *ctx, fz_html *box, float page_h, float page_w
 	line_h = measure_line(a, b, &baseline, &line_w);
 	if (line_h > avail)
 		box->h += avail;
+	index_line(ctx, box, a, box->y + box->h, box->y + box->h + line_h);
 	layout_line(ctx, indent, page_w, line_w, align, a, b, box, baseline);
 	box->h += line_h;
 }
@@ -744,6 +842,14 @@ static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float em,
 	border[2] = style->border_style[2] ? fz_from_css_number(style->border_width[2], em, top->w) : 0;
 	border[3] = style->border_style[3] ? fz_from_css_number(style->border_width[3], em, top->w) : 0;
 
+	/* Negative margins can pull boxes back up over earlier lines */
+	if (margin[T] < 0 || margin[B] < 0)
+	{
+		fz_html_pages *pages = find_html_pages(box);
+		if (pages)
+			pages->valid = 0;
+	}
+
 	box->x = top->x + margin[L] + border[L] + padding[L];
 	box->w = top->w - (margin[L] + margin[R] + border[L] + border[R] + padding[L] + padding[R]);
 
@@ -821,7 +927,16 @@ static float layout_block(fz_context *ctx, fz_html *box, fz_html *top, float em,
 	return vertical;
 }
 
-static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm)
+/* The part of the page index that applies to the page being drawn */
+typedef struct
+{
+	fz_html *start_box;
+	fz_html_flow *start;
+	fz_html_flow *end;
+	int done;
+} draw_range;
+
+static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, draw_range *range)
 {
 	fz_html_flow *node;
 	fz_text *text;
@@ -832,8 +947,18 @@ static void draw_flow_box(fz_context *ctx, fz_html *box, float page_top, float p
 	float x, y;
 	int c, g;
 
-	for (node = box->flow_head; node; node = node->next)
+	node = box->flow_head;
+	if (box == range->start_box)
+		node = range->start;
+
+	for (; node; node = node->next)
 	{
+		if (node == range->end)
+		{
+			range->done = 1;
+			break;
+		}
+
 		if (node->type == FLOW_IMAGE)
 		{
 			if (node->y >= page_bot || node->y + node->h <= page_top)
@@ -1096,7 +1221,7 @@ static void draw_list_mark(fz_context *ctx, fz_html *box, float page_top, float
 	fz_drop_text(ctx, text);
 }
 
-static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm)
+static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *ctm, draw_range *range)
 {
 	float x0, y0, x1, y1;
 
@@ -1128,12 +1253,18 @@ static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float
 			draw_list_mark(ctx, box, page_top, page_bot, dev, ctm, box->list_item);
 	}
 
-	for (box = box->down; box; box = box->next)
+	for (box = box->down; box && !range->done; box = box->next)
 	{
 		switch (box->type)
 		{
-		case BOX_BLOCK: draw_block_box(ctx, box, page_top, page_bot, dev, ctm); break;
-		case BOX_FLOW: draw_flow_box(ctx, box, page_top, page_bot, dev, ctm); break;
+		case BOX_BLOCK:
+			draw_block_box(ctx, box, page_top, page_bot, dev, ctm, range);
+			break;
+		case BOX_FLOW:
+			/* every line of a flow lies within its box */
+			if (box->y <= page_bot && box->y + box->h >= page_top)
+				draw_flow_box(ctx, box, page_top, page_bot, dev, ctm, range);
+			break;
 		}
 	}
 }
@@ -1141,9 +1272,28 @@ static void draw_block_box(fz_context *ctx, fz_html *box, float page_top, float
 void
 fz_draw_html(fz_context *ctx, fz_html *box, float page_top, float page_bot, fz_device *dev, const fz_matrix *inctm)
 {
+	fz_html_pages *pages = box->pages && box->pages->valid ? box->pages : NULL;
 	fz_matrix ctm = *inctm;
+	draw_range range = { NULL, NULL, NULL, 0 };
+
+	/* Use the page index when asked for exactly one of the laid out pages */
+	if (pages && fabsf(page_bot - page_top - pages->page_h) < 0.01f)
+	{
+		int n = (int)floorf(page_top / pages->page_h + 0.5f);
+		if (n >= 0 && fabsf(n * pages->page_h - page_top) < 0.01f)
+		{
+			if (n < pages->start_len)
+			{
+				range.start_box = pages->start_box[n];
+				range.start = pages->start[n];
+			}
+			if (n < pages->end_len)
+				range.end = pages->end[n];
+		}
+	}
+
 	fz_pre_translate(&ctm, 0, -page_top);
-	draw_block_box(ctx, box, page_top, page_bot, dev, &ctm);
+	draw_block_box(ctx, box, page_top, page_bot, dev, &ctm, &range);
 }
 
 static char *concat_text(fz_context *ctx, fz_xml *root)
@@ -1336,6 +1486,14 @@ fz_layout_html(fz_context *ctx, fz_html *box, float w, float h, float em)
 	page_box.w = w;
 	page_box.h = 0;
 
+	if (!box->pages)
+		box->pages = fz_malloc_struct(ctx, fz_html_pages);
+	box->pages->page_h = h;
+	box->pages->last_top = 0;
+	box->pages->valid = h > 0;
+	box->pages->start_len = 0;
+	box->pages->end_len = 0;
+
 	layout_block(ctx, box, &page_box, em, h, 0);
 }
 
@@ -1344,6 +1502,7 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 {
 	fz_xml *xml;
 	fz_css_rule *css;
+	fz_css_index *index;
 	fz_css_match match;
 	fz_html *box;
 
@@ -1363,8 +1522,10 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 	fz_match_css_at_page(ctx, &match, css);
 	fz_apply_css_style(ctx, set, &box->style, &match);
 
-	generate_boxes(ctx, set, zip, base_uri, xml, box, css, &match, 0);
+	index = fz_new_css_index(ctx, css);
+	generate_boxes(ctx, set, zip, base_uri, xml, box, index, &match, 0);
 
+	fz_drop_css_index(ctx, index);
 	fz_drop_css(ctx, css);
 	fz_drop_xml(ctx, xml);
 
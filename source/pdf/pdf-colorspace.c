@@ -347,8 +347,8 @@ pdf_load_colorspace_imp(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 	fz_throw(ctx, FZ_ERROR_GENERIC, "syntaxerror: could not parse color space (%d %d R)", pdf_to_num(ctx, obj), pdf_to_gen(ctx, obj));
 }
 
-fz_colorspace *
-pdf_load_colorspace(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
+static fz_colorspace *
+load_colorspace(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 {
 	fz_colorspace *cs;
 
@@ -363,3 +363,19 @@ pdf_load_colorspace(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 
 	return cs;
 }
+
+fz_colorspace *
+pdf_load_colorspace(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
+{
+	fz_colorspace *cs;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		cs = load_colorspace(ctx, doc, obj);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return cs;
+}
@@ -1216,8 +1216,8 @@ pdf_make_width_table(fz_context *ctx, pdf_font_desc *fontdesc)
 			font->width_table[i] = font->width_default;
 }
 
-pdf_font_desc *
-pdf_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, int nested_depth)
+static pdf_font_desc *
+load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, int nested_depth)
 {
 	pdf_obj *subtype;
 	pdf_obj *dfonts;
@@ -1275,6 +1275,22 @@ pdf_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, i
 	return fontdesc;
 }
 
+pdf_font_desc *
+pdf_load_font(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, pdf_obj *dict, int nested_depth)
+{
+	pdf_font_desc *fontdesc;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		fontdesc = load_font(ctx, doc, rdb, dict, nested_depth);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return fontdesc;
+}
+
 #ifndef NDEBUG
 void
 pdf_print_font(fz_context *ctx, pdf_font_desc *fontdesc)
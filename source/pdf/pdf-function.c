@@ -1605,8 +1605,8 @@ pdf_debug_function(fz_context *ctx, fz_function *func)
 }
 #endif
 
-fz_function *
-pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
+static fz_function *
+load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
 {
 	pdf_function *func;
 	pdf_obj *obj;
@@ -1704,3 +1704,19 @@ pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int
 
 	return (fz_function *)func;
 }
+
+fz_function *
+pdf_load_function(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int in, int out)
+{
+	fz_function *func;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		func = load_function(ctx, doc, dict, in, out);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return func;
+}
@@ -277,8 +277,8 @@ fz_image_size(fz_context *ctx, fz_image *im)
 	return sizeof(*im) + fz_pixmap_size(ctx, im->tile) + (im->buffer && im->buffer->buffer ? im->buffer->buffer->cap : 0);
 }
 
-fz_image *
-pdf_load_image(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+static fz_image *
+load_image(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	fz_image *image;
 
@@ -293,3 +293,19 @@ pdf_load_image(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 
 	return (fz_image *)image;
 }
+
+fz_image *
+pdf_load_image(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+{
+	fz_image *image;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		image = load_image(ctx, doc, dict);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
+}
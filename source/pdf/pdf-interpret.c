@@ -101,7 +101,7 @@ ocg_intents_include(fz_context *ctx, pdf_ocg_descriptor *desc, char *name)
 }
 
 static int
-pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
+is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
 {
 	char event_state[16];
 	pdf_obj *obj, *obj2, *type;
@@ -251,7 +251,7 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 				len = pdf_array_len(ctx, obj);
 				for (i = 0; i < len; i++)
 				{
-					int hidden = pdf_is_hidden_ocg(ctx, desc, rdb, event, pdf_array_get(ctx, obj, i));
+					int hidden = is_hidden_ocg(ctx, desc, rdb, event, pdf_array_get(ctx, obj, i));
 					if ((combine & 1) == 0)
 						hidden = !hidden;
 					if (combine & 2)
@@ -262,7 +262,7 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 			}
 			else
 			{
-				on = pdf_is_hidden_ocg(ctx, desc, rdb, event, obj);
+				on = is_hidden_ocg(ctx, desc, rdb, event, obj);
 				if ((combine & 1) == 0)
 					on = !on;
 			}
@@ -281,6 +281,26 @@ pdf_is_hidden_ocg(fz_context *ctx, pdf_ocg_descriptor *desc, pdf_obj *rdb, const
 	return 0;
 }
 
+static int
+pdf_is_hidden_ocg(fz_context *ctx, pdf_document *doc, pdf_obj *rdb, const char *event, pdf_obj *ocg)
+{
+	int hidden;
+
+	if (!ocg)
+		return 0;
+
+	/* The recursion check marks objects, so it must not race with other threads. */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		hidden = is_hidden_ocg(ctx, doc->ocg, rdb, event, ocg);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return hidden;
+}
+
 static fz_image *
 parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
 {
@@ -295,7 +315,7 @@ parse_inline_image(fz_context *ctx, pdf_csi *csi, fz_stream *stm)
 
 	fz_try(ctx)
 	{
-		obj = pdf_parse_dict(ctx, doc, stm, &doc->lexbuf.base);
+		obj = pdf_parse_dict(ctx, doc, stm, csi->buf);
 
 		/* read whitespace after ID keyword */
 		ch = fz_read_byte(ctx, stm);
@@ -503,7 +523,7 @@ pdf_process_Do(fz_context *ctx, pdf_processor *proc, pdf_csi *csi)
 	if (!pdf_is_name(ctx, subtype))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "no XObject subtype specified");
 
-	if (pdf_is_hidden_ocg(ctx, csi->doc->ocg, csi->rdb, proc->event, pdf_dict_get(ctx, xobj, PDF_NAME_OC)))
+	if (pdf_is_hidden_ocg(ctx, csi->doc, csi->rdb, proc->event, pdf_dict_get(ctx, xobj, PDF_NAME_OC)))
 		return;
 
 	if (pdf_name_eq(ctx, subtype, PDF_NAME_Form))
@@ -696,7 +716,7 @@ pdf_process_BDC(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, const char *
 	if (!pdf_name_eq(ctx, pdf_dict_get(ctx, properties, PDF_NAME_Type), PDF_NAME_OCG))
 		return;
 
-	if (pdf_is_hidden_ocg(ctx, csi->doc->ocg, csi->rdb, proc->event, properties))
+	if (pdf_is_hidden_ocg(ctx, csi->doc, csi->rdb, proc->event, properties))
 		++proc->hidden;
 }
 
@@ -1243,7 +1263,7 @@ pdf_process_annot(fz_context *ctx, pdf_processor *proc, pdf_document *doc, pdf_p
 	/* TODO: NoZoom and NoRotate */
 
 	/* XXX what resources, if any, to use for this check? */
-	if (pdf_is_hidden_ocg(ctx, doc->ocg, NULL, proc->event, pdf_dict_get(ctx, annot->obj, PDF_NAME_OC)))
+	if (pdf_is_hidden_ocg(ctx, doc, NULL, proc->event, pdf_dict_get(ctx, annot->obj, PDF_NAME_OC)))
 		return;
 
 	if (proc->op_q && proc->op_cm && proc->op_Do_form && proc->op_Q)
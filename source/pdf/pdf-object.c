@@ -30,7 +30,7 @@ enum
 
 struct pdf_obj_s
 {
-	short refs;
+	int16_t refs;
 	unsigned char kind;
 	unsigned char flags;
 };
@@ -61,8 +61,8 @@ typedef struct pdf_obj_name_s
 typedef struct pdf_obj_array_s
 {
 	pdf_obj super;
-	pdf_document *doc;
 	int parent_num;
+	pdf_obj_arena *arena;
 	int len;
 	int cap;
 	pdf_obj **items;
@@ -71,8 +71,8 @@ typedef struct pdf_obj_array_s
 typedef struct pdf_obj_dict_s
 {
 	pdf_obj super;
-	pdf_document *doc;
 	int parent_num;
+	pdf_obj_arena *arena;
 	int len;
 	int cap;
 	struct keyval *items;
@@ -81,8 +81,8 @@ typedef struct pdf_obj_dict_s
 typedef struct pdf_obj_ref_s
 {
 	pdf_obj super;
-	pdf_document *doc; /* Only needed for arrays, dicts and indirects */
 	int num;
+	pdf_obj_arena *arena; /* Gives the document, while it is open */
 	int gen;
 } pdf_obj_ref;
 
@@ -93,6 +93,267 @@ typedef struct pdf_obj_ref_s
 #define ARRAY(obj) ((pdf_obj_array *)(obj))
 #define REF(obj) ((pdf_obj_ref *)(obj))
 
+/*
+	Small integers, and on 64-bit platforms all reals, are not
+	allocated at all but live in the pdf_obj pointer itself. Real
+	objects are at least 4 byte aligned, so the bottom two bits tell
+	them apart: 01 for an inline integer and 11 for an inline real.
+	The encodings always lie above PDF_OBJ__LIMIT, so they cannot be
+	mistaken for null, the booleans or the standard names.
+*/
+
+#define INLINE_INT_MIN (-(1 << 28))
+#define INLINE_INT_MAX ((1 << 28) - 1)
+
+#define OBJ_IS_BOXED(obj) ((obj) >= PDF_OBJ__LIMIT && !((uintptr_t)(obj) & 1))
+#define OBJ_IS_INLINE_INT(obj) ((obj) >= PDF_OBJ__LIMIT && ((uintptr_t)(obj) & 3) == 1)
+#define OBJ_IS_INLINE_REAL(obj) ((obj) >= PDF_OBJ__LIMIT && ((uintptr_t)(obj) & 3) == 3)
+
+#if defined(_WIN64) || (defined(UINTPTR_MAX) && UINTPTR_MAX > 0xffffffffu)
+#define INLINE_REALS
+#endif
+
+static inline pdf_obj *
+inline_int(int i)
+{
+	return (pdf_obj *)((((uintptr_t)(i + (1 << 29))) << 2) | 1);
+}
+
+static inline int
+inline_int_value(pdf_obj *obj)
+{
+	return (int)((uintptr_t)obj >> 2) - (1 << 29);
+}
+
+#ifdef INLINE_REALS
+static inline pdf_obj *
+inline_real(float f)
+{
+	union { float f; uint32_t u; } v;
+	v.f = f;
+	return (pdf_obj *)(((uintptr_t)v.u << 32) | (1 << 30) | 3);
+}
+
+static inline float
+inline_real_value(pdf_obj *obj)
+{
+	union { float f; uint32_t u; } v;
+	v.u = (uint32_t)((uintptr_t)obj >> 32);
+	return v.f;
+}
+#else
+static inline float
+inline_real_value(pdf_obj *obj)
+{
+	return 0;
+}
+#endif
+
+/* Returns PDF_INT or PDF_REAL for numbers, whatever their storage, else 0. */
+static inline int
+num_kind(pdf_obj *obj)
+{
+	if (OBJ_IS_INLINE_INT(obj))
+		return PDF_INT;
+	if (OBJ_IS_INLINE_REAL(obj))
+		return PDF_REAL;
+	if (OBJ_IS_BOXED(obj) && (obj->kind == PDF_INT || obj->kind == PDF_REAL))
+		return obj->kind;
+	return 0;
+}
+
+static inline fz_off_t
+num_int(pdf_obj *obj)
+{
+	return OBJ_IS_INLINE_INT(obj) ? inline_int_value(obj) : NUM(obj)->u.i;
+}
+
+static inline float
+num_real(pdf_obj *obj)
+{
+	return OBJ_IS_INLINE_REAL(obj) ? inline_real_value(obj) : NUM(obj)->u.f;
+}
+
+/*
+	The nodes of arrays, dicts and indirect references made for a
+	document come from that document's arena: chunks carved into
+	fixed size slots with a free list per size, which avoids a trip
+	through the allocator (and its per block overhead) for each of
+	the millions of small objects a big file can hold. The arena
+	also interns the document's non-standard names, so that every
+	occurrence of a name shares one object.
+
+	Objects may outlive their document, so the arena is reference
+	counted: the document holds one reference and every live node
+	another. The free lists and counts are guarded by FZ_LOCK_ALLOC,
+	the name table by the document lock.
+*/
+
+#define ARENA_CHUNK_SIZE (32 << 10)
+#define ARENA_SIZE_CLASSES 8 /* slots of 8 to 64 bytes */
+
+typedef struct arena_chunk_s arena_chunk;
+
+struct arena_chunk_s
+{
+	arena_chunk *next;
+	double align;
+};
+
+struct pdf_obj_arena_s
+{
+	int refs;
+	pdf_document *doc; /* NULL once the document has been closed */
+	void *free[ARENA_SIZE_CLASSES];
+	arena_chunk *chunks;
+	unsigned char *bump;
+	unsigned char *end;
+	int name_len;
+	int name_cap;
+	pdf_obj **names;
+};
+
+#define ARENA_DOC(arena) ((arena) ? (arena)->doc : NULL)
+
+pdf_obj_arena *
+pdf_new_obj_arena(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj_arena *arena = fz_malloc_struct(ctx, pdf_obj_arena);
+	arena->refs = 1;
+	arena->doc = doc;
+	return arena;
+}
+
+static void
+arena_destroy(fz_context *ctx, pdf_obj_arena *arena)
+{
+	arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next)
+	{
+		next = chunk->next;
+		fz_free(ctx, chunk);
+	}
+	fz_free(ctx, arena);
+}
+
+void
+pdf_drop_obj_arena(fz_context *ctx, pdf_obj_arena *arena)
+{
+	int i, drop;
+
+	if (!arena)
+		return;
+
+	for (i = 0; i < arena->name_cap; i++)
+		pdf_drop_obj(ctx, arena->names[i]);
+	fz_free(ctx, arena->names);
+	arena->names = NULL;
+	arena->name_len = arena->name_cap = 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	arena->doc = NULL;
+	drop = --arena->refs == 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop)
+		arena_destroy(ctx, arena);
+}
+
+static void *
+arena_alloc(fz_context *ctx, pdf_obj_arena *arena, size_t size)
+{
+	int c = (int)((size + 7) >> 3) - 1;
+	size_t slot = (size_t)(c + 1) << 3;
+	arena_chunk *chunk = NULL;
+	void *p;
+
+	assert(c < ARENA_SIZE_CLASSES);
+
+#ifdef MEMENTO
+	/* Keep every node visible to the leak checker */
+	p = fz_malloc(ctx, size);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	arena->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return p;
+#endif
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (;;)
+	{
+		p = arena->free[c];
+		if (p)
+		{
+			arena->free[c] = *(void **)p;
+			break;
+		}
+		if ((size_t)(arena->end - arena->bump) >= slot)
+		{
+			p = arena->bump;
+			arena->bump += slot;
+			break;
+		}
+		if (chunk)
+		{
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+			arena->bump = (unsigned char *)(chunk + 1);
+			arena->end = (unsigned char *)chunk + ARENA_CHUNK_SIZE;
+			chunk = NULL;
+			continue;
+		}
+		/* fz_malloc takes the alloc lock itself */
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		chunk = fz_malloc(ctx, ARENA_CHUNK_SIZE);
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+	}
+	arena->refs++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	/* Another thread refilled the arena while we were allocating */
+	fz_free(ctx, chunk);
+
+	return p;
+}
+
+static void
+arena_free(fz_context *ctx, pdf_obj_arena *arena, void *p, size_t size)
+{
+	int c = (int)((size + 7) >> 3) - 1;
+	int drop;
+
+#ifdef MEMENTO
+	fz_free(ctx, p);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+#else
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*(void **)p = arena->free[c];
+	arena->free[c] = p;
+#endif
+	drop = --arena->refs == 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (drop)
+		arena_destroy(ctx, arena);
+}
+
+static void *
+new_node(fz_context *ctx, pdf_document *doc, size_t size, pdf_obj_arena **arenap)
+{
+	*arenap = doc ? doc->arena : NULL;
+	if (*arenap)
+		return arena_alloc(ctx, *arenap, size);
+	return fz_malloc(ctx, size);
+}
+
+static void
+free_node(fz_context *ctx, pdf_obj_arena *arena, void *p, size_t size)
+{
+	if (arena)
+		arena_free(ctx, arena, p, size);
+	else
+		fz_free(ctx, p);
+}
+
 pdf_obj *
 pdf_new_null(fz_context *ctx, pdf_document *doc)
 {
@@ -109,6 +370,8 @@ pdf_obj *
 pdf_new_int(fz_context *ctx, pdf_document *doc, int i)
 {
 	pdf_obj_num *obj;
+	if (i >= INLINE_INT_MIN && i <= INLINE_INT_MAX)
+		return inline_int(i);
 	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(int)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
@@ -121,6 +384,8 @@ pdf_obj *
 pdf_new_int_offset(fz_context *ctx, pdf_document *doc, fz_off_t i)
 {
 	pdf_obj_num *obj;
+	if (i >= INLINE_INT_MIN && i <= INLINE_INT_MAX)
+		return inline_int((int)i);
 	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(offset)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
@@ -132,6 +397,9 @@ pdf_new_int_offset(fz_context *ctx, pdf_document *doc, fz_off_t i)
 pdf_obj *
 pdf_new_real(fz_context *ctx, pdf_document *doc, float f)
 {
+#ifdef INLINE_REALS
+	return inline_real(f);
+#else
 	pdf_obj_num *obj;
 	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(real)");
 	obj->super.refs = 1;
@@ -139,6 +407,7 @@ pdf_new_real(fz_context *ctx, pdf_document *doc, float f)
 	obj->super.flags = 0;
 	obj->u.f = f;
 	return &obj->super;
+#endif
 }
 
 pdf_obj *
@@ -161,33 +430,120 @@ namecmp(const void *key, const void *name)
 	return strcmp((char *)key, *(char **)name);
 }
 
+static pdf_obj *
+new_name_obj(fz_context *ctx, const char *str)
+{
+	pdf_obj_name *obj;
+	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_name, n) + strlen(str) + 1), "pdf_obj(name)");
+	obj->super.refs = 1;
+	obj->super.kind = PDF_NAME;
+	obj->super.flags = 0;
+	strcpy(obj->n, str);
+	return &obj->super;
+}
+
+static unsigned int
+name_hash(const char *s)
+{
+	unsigned int h = 0;
+	while (*s)
+		h = h * 31 + (unsigned char)*s++;
+	return h;
+}
+
+static void
+arena_grow_names(fz_context *ctx, pdf_obj_arena *arena)
+{
+	int cap = arena->name_cap ? arena->name_cap * 2 : 256;
+	pdf_obj **names = fz_malloc_array(ctx, cap, sizeof(pdf_obj *));
+	int i, k;
+
+	memset(names, 0, cap * sizeof(pdf_obj *));
+	for (i = 0; i < arena->name_cap; i++)
+	{
+		pdf_obj *name = arena->names[i];
+		if (!name)
+			continue;
+		k = name_hash(NAME(name)->n) & (cap - 1);
+		while (names[k])
+			k = (k + 1) & (cap - 1);
+		names[k] = name;
+	}
+	fz_free(ctx, arena->names);
+	arena->names = names;
+	arena->name_cap = cap;
+}
+
+/* Find or add a name in the arena's table; open addressing, linear probing. */
+static pdf_obj *
+arena_intern_name(fz_context *ctx, pdf_obj_arena *arena, const char *str)
+{
+	pdf_obj *name;
+	int k;
+
+	if ((arena->name_len + 1) * 2 > arena->name_cap)
+		arena_grow_names(ctx, arena);
+	k = name_hash(str) & (arena->name_cap - 1);
+	while ((name = arena->names[k]) != NULL)
+	{
+		if (!strcmp(NAME(name)->n, str))
+			return pdf_keep_obj(ctx, name);
+		k = (k + 1) & (arena->name_cap - 1);
+	}
+	name = new_name_obj(ctx, str);
+	name->refs = 2; /* one for the table */
+	arena->names[k] = name;
+	arena->name_len++;
+	return name;
+}
+
+/* Only a shared document can have several threads adding names at
+ * once, and then its own lock is enough: every document has its own
+ * table. */
+static pdf_obj *
+pdf_intern_name(fz_context *ctx, pdf_document *doc, const char *str)
+{
+	pdf_obj *name = NULL;
+
+	if (!doc->shared)
+		return arena_intern_name(ctx, doc->arena, str);
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		name = arena_intern_name(ctx, doc->arena, str);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return name;
+}
+
 pdf_obj *
 pdf_new_name(fz_context *ctx, pdf_document *doc, const char *str)
 {
-	pdf_obj_name *obj;
 	char **stdname;
 
 	stdname = bsearch(str, &PDF_NAMES[1], PDF_OBJ_ENUM_NAME__LIMIT-1, sizeof(char *), namecmp);
 	if (stdname != NULL)
 		return (pdf_obj *)(intptr_t)(stdname - &PDF_NAMES[0]);
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_name, n) + strlen(str) + 1), "pdf_obj(name)");
-	obj->super.refs = 1;
-	obj->super.kind = PDF_NAME;
-	obj->super.flags = 0;
-	strcpy(obj->n, str);
-	return &obj->super;
+	if (doc && doc->arena)
+		return pdf_intern_name(ctx, doc, str);
+
+	return new_name_obj(ctx, str);
 }
 
 pdf_obj *
 pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
 	pdf_obj_ref *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
+	pdf_obj_arena *arena;
+	obj = new_node(ctx, doc, sizeof(pdf_obj_ref), &arena);
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INDIRECT;
 	obj->super.flags = 0;
-	obj->doc = doc;
+	obj->arena = arena;
 	obj->num = num;
 	obj->gen = gen;
 	return &obj->super;
@@ -196,18 +552,18 @@ pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 pdf_obj *
 pdf_keep_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_OBJ__LIMIT)
-		obj->refs ++;
+	if (OBJ_IS_BOXED(obj))
+		return fz_keep_imp16(ctx, obj, &obj->refs);
 	return obj;
 }
 
 int pdf_is_indirect(fz_context *ctx, pdf_obj *obj)
 {
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_INDIRECT : 0;
+	return OBJ_IS_BOXED(obj) ? obj->kind == PDF_INDIRECT : 0;
 }
 
 #define RESOLVE(obj) \
-	if (obj >= PDF_OBJ__LIMIT && obj->kind == PDF_INDIRECT) \
+	if (OBJ_IS_BOXED(obj) && obj->kind == PDF_INDIRECT) \
 		obj = pdf_resolve_indirect(ctx, obj); \
 
 int pdf_is_null(fz_context *ctx, pdf_obj *obj)
@@ -225,31 +581,31 @@ int pdf_is_bool(fz_context *ctx, pdf_obj *obj)
 int pdf_is_int(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_INT : 0;
+	return num_kind(obj) == PDF_INT;
 }
 
 int pdf_is_real(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_REAL : 0;
+	return num_kind(obj) == PDF_REAL;
 }
 
 int pdf_is_number(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? (obj->kind == PDF_REAL || obj->kind == PDF_INT) : 0;
+	return num_kind(obj) != 0;
 }
 
 int pdf_is_string(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_STRING : 0;
+	return OBJ_IS_BOXED(obj) ? obj->kind == PDF_STRING : 0;
 }
 
 int pdf_is_name(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return obj != NULL && obj < PDF_OBJ_NAME__LIMIT;
 	return obj->kind == PDF_NAME;
 }
@@ -257,13 +613,13 @@ int pdf_is_name(fz_context *ctx, pdf_obj *obj)
 int pdf_is_array(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_ARRAY : 0;
+	return OBJ_IS_BOXED(obj) ? obj->kind == PDF_ARRAY : 0;
 }
 
 int pdf_is_dict(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return obj >= PDF_OBJ__LIMIT ? obj->kind == PDF_DICT : 0;
+	return OBJ_IS_BOXED(obj) ? obj->kind == PDF_DICT : 0;
 }
 
 int pdf_to_bool(fz_context *ctx, pdf_obj *obj)
@@ -275,36 +631,39 @@ int pdf_to_bool(fz_context *ctx, pdf_obj *obj)
 int pdf_to_int(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
-		return 0;
-	if (obj->kind == PDF_INT)
-		return (int)NUM(obj)->u.i;
-	if (obj->kind == PDF_REAL)
-		return (int)(NUM(obj)->u.f + 0.5f); /* No roundf in MSVC */
+	switch (num_kind(obj))
+	{
+	case PDF_INT:
+		return (int)num_int(obj);
+	case PDF_REAL:
+		return (int)(num_real(obj) + 0.5f); /* No roundf in MSVC */
+	}
 	return 0;
 }
 
 fz_off_t pdf_to_offset(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
-		return 0;
-	if (obj->kind == PDF_INT)
-		return NUM(obj)->u.i;
-	if (obj->kind == PDF_REAL)
-		return (fz_off_t)(NUM(obj)->u.f + 0.5f); /* No roundf in MSVC */
+	switch (num_kind(obj))
+	{
+	case PDF_INT:
+		return num_int(obj);
+	case PDF_REAL:
+		return (fz_off_t)(num_real(obj) + 0.5f); /* No roundf in MSVC */
+	}
 	return 0;
 }
 
 float pdf_to_real(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
-		return 0;
-	if (obj->kind == PDF_REAL)
-		return NUM(obj)->u.f;
-	if (obj->kind == PDF_INT)
-		return NUM(obj)->u.i;
+	switch (num_kind(obj))
+	{
+	case PDF_REAL:
+		return num_real(obj);
+	case PDF_INT:
+		return num_int(obj);
+	}
 	return 0;
 }
 
@@ -315,7 +674,7 @@ char *pdf_to_name(fz_context *ctx, pdf_obj *obj)
 		return "";
 	if (obj < PDF_OBJ_NAME__LIMIT)
 		return PDF_NAMES[(intptr_t)obj];
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_NAME)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_NAME)
 		return "";
 	return NAME(obj)->n;
 }
@@ -323,7 +682,7 @@ char *pdf_to_name(fz_context *ctx, pdf_obj *obj)
 char *pdf_to_str_buf(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_STRING)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_STRING)
 		return "";
 	return STRING(obj)->buf;
 }
@@ -331,21 +690,21 @@ char *pdf_to_str_buf(fz_context *ctx, pdf_obj *obj)
 int pdf_to_str_len(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_STRING)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_STRING)
 		return 0;
 	return STRING(obj)->len;
 }
 
 void pdf_set_int(fz_context *ctx, pdf_obj *obj, int i)
 {
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_INT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_INT)
 		return;
 	NUM(obj)->u.i = i;
 }
 
 void pdf_set_int_offset(fz_context *ctx, pdf_obj *obj, fz_off_t i)
 {
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_INT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_INT)
 		return;
 	NUM(obj)->u.i = i;
 }
@@ -354,7 +713,7 @@ void pdf_set_int_offset(fz_context *ctx, pdf_obj *obj, fz_off_t i)
 void pdf_set_str_len(fz_context *ctx, pdf_obj *obj, int newlen)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_STRING)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_STRING)
 		return; /* This should never happen */
 	if (newlen > STRING(obj)->len)
 		return; /* This should never happen */
@@ -364,28 +723,28 @@ void pdf_set_str_len(fz_context *ctx, pdf_obj *obj, int newlen)
 pdf_obj *pdf_to_dict(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	return (obj >= PDF_OBJ__LIMIT && obj->kind == PDF_DICT ? obj : NULL);
+	return (OBJ_IS_BOXED(obj) && obj->kind == PDF_DICT ? obj : NULL);
 }
 
 int pdf_to_num(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_INDIRECT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_INDIRECT)
 		return 0;
 	return REF(obj)->num;
 }
 
 int pdf_to_gen(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_INDIRECT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_INDIRECT)
 		return 0;
 	return REF(obj)->gen;
 }
 
 pdf_document *pdf_get_indirect_document(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_INDIRECT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_INDIRECT)
 		return NULL;
-	return REF(obj)->doc;
+	return ARENA_DOC(REF(obj)->arena);
 }
 
 int pdf_objcmp_resolve(fz_context *ctx, pdf_obj *a, pdf_obj *b)
@@ -398,7 +757,7 @@ int pdf_objcmp_resolve(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 int
 pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 {
-	int i;
+	int i, ka, kb;
 
 	if (a == b)
 		return 0;
@@ -406,11 +765,29 @@ pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 	if (!a || !b)
 		return 1;
 
+	ka = num_kind(a);
+	kb = num_kind(b);
+	if (ka || kb)
+	{
+		if (ka != kb)
+			return 1;
+		if (ka == PDF_INT)
+		{
+			fz_off_t ia = num_int(a), ib = num_int(b);
+			return ia < ib ? -1 : ia > ib;
+		}
+		if (num_real(a) < num_real(b))
+			return -1;
+		if (num_real(a) > num_real(b))
+			return 1;
+		return 0;
+	}
+
 	if (a < PDF_OBJ_NAME__LIMIT)
 	{
 		if (b < PDF_OBJ_NAME__LIMIT)
 			return a != b;
-		if (b < PDF_OBJ__LIMIT)
+		if (!OBJ_IS_BOXED(b))
 			return 1;
 		if (b->kind != PDF_NAME)
 			return 1;
@@ -419,14 +796,14 @@ pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 
 	if (b < PDF_OBJ_NAME__LIMIT)
 	{
-		if (a < PDF_OBJ__LIMIT)
+		if (!OBJ_IS_BOXED(a))
 			return 1;
 		if (a->kind != PDF_NAME)
 			return 1;
 		return strcmp(NAME(a)->n, PDF_NAMES[(intptr_t)b]);
 	}
 
-	if (a < PDF_OBJ__LIMIT || b < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(a) || !OBJ_IS_BOXED(b))
 		return a != b;
 
 	if (a->kind != b->kind)
@@ -434,16 +811,6 @@ pdf_objcmp(fz_context *ctx, pdf_obj *a, pdf_obj *b)
 
 	switch (a->kind)
 	{
-	case PDF_INT:
-		return NUM(a)->u.i - NUM(b)->u.i;
-
-	case PDF_REAL:
-		if (NUM(a)->u.f < NUM(b)->u.f)
-			return -1;
-		if (NUM(a)->u.f > NUM(b)->u.f)
-			return 1;
-		return 0;
-
 	case PDF_STRING:
 		if (STRING(a)->len < STRING(b)->len)
 		{
@@ -502,6 +869,10 @@ pdf_objkindstr(pdf_obj *obj)
 		return "boolean";
 	if (obj == PDF_OBJ_NULL)
 		return "null";
+	if (OBJ_IS_INLINE_INT(obj))
+		return "integer";
+	if (OBJ_IS_INLINE_REAL(obj))
+		return "real";
 
 	switch (obj->kind)
 	{
@@ -520,13 +891,14 @@ pdf_obj *
 pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 {
 	pdf_obj_array *obj;
+	pdf_obj_arena *arena;
 	int i;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_array)), "pdf_obj(array)");
+	obj = new_node(ctx, doc, sizeof(pdf_obj_array), &arena);
 	obj->super.refs = 1;
 	obj->super.kind = PDF_ARRAY;
 	obj->super.flags = 0;
-	obj->doc = doc;
+	obj->arena = arena;
 	obj->parent_num = 0;
 
 	obj->len = 0;
@@ -538,7 +910,7 @@ pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		free_node(ctx, arena, obj, sizeof(pdf_obj_array));
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->cap; i++)
@@ -569,10 +941,10 @@ pdf_copy_array(fz_context *ctx, pdf_obj *obj)
 	int n;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_ARRAY)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_ARRAY)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "assert: not an array (%s)", pdf_objkindstr(obj));
 
-	doc = ARRAY(obj)->doc;
+	doc = ARENA_DOC(ARRAY(obj)->arena);
 
 	n = pdf_array_len(ctx, obj);
 	arr = pdf_new_array(ctx, doc, n);
@@ -586,7 +958,7 @@ int
 pdf_array_len(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_ARRAY)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_ARRAY)
 		return 0;
 	return ARRAY(obj)->len;
 }
@@ -595,7 +967,7 @@ pdf_obj *
 pdf_array_get(fz_context *ctx, pdf_obj *obj, int i)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_ARRAY)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_ARRAY)
 		return NULL;
 	if (i < 0 || i >= ARRAY(obj)->len)
 		return NULL;
@@ -611,17 +983,17 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 		obj should be a dict or an array. We don't care about
 		any other types, as they aren't 'containers'.
 	*/
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 
 	switch (obj->kind)
 	{
 	case PDF_DICT:
-		doc = DICT(obj)->doc;
+		doc = ARENA_DOC(DICT(obj)->arena);
 		parent = DICT(obj)->parent_num;
 		break;
 	case PDF_ARRAY:
-		doc = ARRAY(obj)->doc;
+		doc = ARENA_DOC(ARRAY(obj)->arena);
 		parent = ARRAY(obj)->parent_num;
 		break;
 	default:
@@ -631,9 +1003,12 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 		parent_num = 0 while an object is being parsed from the file.
 		No further action is necessary.
 	*/
-	if (parent == 0 || doc->freeze_updates)
+	if (parent == 0 || !doc || doc->freeze_updates)
 		return;
 
+	/* Whatever was cached from the pages before the edit is stale */
+	doc->super.id = 0;
+
 	/*
 		Otherwise we need to ensure that the containing hierarchy of objects
 		has been moved to the incremental xref section and the newly linked
@@ -647,7 +1022,7 @@ void
 pdf_array_put(fz_context *ctx, pdf_obj *obj, int i, pdf_obj *item)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		prepare_object_for_alteration(ctx, obj, item);
 
@@ -677,7 +1052,7 @@ void
 pdf_array_push(fz_context *ctx, pdf_obj *obj, pdf_obj *item)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		prepare_object_for_alteration(ctx, obj, item);
 
@@ -698,7 +1073,7 @@ void
 pdf_array_push_drop(fz_context *ctx, pdf_obj *obj, pdf_obj *item)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		fz_try(ctx)
 			pdf_array_push(ctx, obj, item);
@@ -713,7 +1088,7 @@ void
 pdf_array_insert(fz_context *ctx, pdf_obj *obj, pdf_obj *item, int i)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		prepare_object_for_alteration(ctx, obj, item);
 
@@ -737,7 +1112,7 @@ void
 pdf_array_insert_drop(fz_context *ctx, pdf_obj *obj, pdf_obj *item, int i)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		fz_try(ctx)
 			pdf_array_insert(ctx, obj, item, i);
@@ -752,7 +1127,7 @@ void
 pdf_array_delete(fz_context *ctx, pdf_obj *obj, int i)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		if (obj->kind != PDF_ARRAY)
 			fz_warn(ctx, "assert: not an array (%s)", pdf_objkindstr(obj));
@@ -885,14 +1260,14 @@ static int keyvalcmp(const void *ap, const void *bp)
 	 * do, then they match. */
 	if (a->k < PDF_OBJ_NAME__LIMIT)
 		an = PDF_NAMES[(intptr_t)a->k];
-	else if (a->k >= PDF_OBJ__LIMIT && a->k->kind == PDF_NAME)
+	else if (OBJ_IS_BOXED(a->k) && a->k->kind == PDF_NAME)
 		an = NAME(a->k)->n;
 	else
 		return 0;
 
 	if (b->k < PDF_OBJ_NAME__LIMIT)
 		bn = PDF_NAMES[(intptr_t)b->k];
-	else if (b->k >= PDF_OBJ__LIMIT && b->k->kind == PDF_NAME)
+	else if (OBJ_IS_BOXED(b->k) && b->k->kind == PDF_NAME)
 		bn = NAME(b->k)->n;
 	else
 		return 0;
@@ -904,13 +1279,14 @@ pdf_obj *
 pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 {
 	pdf_obj_dict *obj;
+	pdf_obj_arena *arena;
 	int i;
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
+	obj = new_node(ctx, doc, sizeof(pdf_obj_dict), &arena);
 	obj->super.refs = 1;
 	obj->super.kind = PDF_DICT;
 	obj->super.flags = 0;
-	obj->doc = doc;
+	obj->arena = arena;
 	obj->parent_num = 0;
 
 	obj->len = 0;
@@ -922,7 +1298,7 @@ pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		free_node(ctx, arena, obj, sizeof(pdf_obj_dict));
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < DICT(obj)->cap; i++)
@@ -957,9 +1333,9 @@ pdf_copy_dict(fz_context *ctx, pdf_obj *obj)
 	int i, n;
 
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
-		pdf_document *doc = DICT(obj)->doc;
+		pdf_document *doc = ARENA_DOC(DICT(obj)->arena);
 
 		if (obj->kind != PDF_DICT)
 			fz_warn(ctx, "assert: not a dict (%s)", pdf_objkindstr(obj));
@@ -978,7 +1354,7 @@ int
 pdf_dict_len(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return 0;
 	return DICT(obj)->len;
 }
@@ -987,7 +1363,7 @@ pdf_obj *
 pdf_dict_get_key(fz_context *ctx, pdf_obj *obj, int i)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return NULL;
 	if (i < 0 || i >= DICT(obj)->len)
 		return NULL;
@@ -998,7 +1374,7 @@ pdf_obj *
 pdf_dict_get_val(fz_context *ctx, pdf_obj *obj, int i)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return NULL;
 	if (i < 0 || i >= DICT(obj)->len)
 		return NULL;
@@ -1009,7 +1385,7 @@ void
 pdf_dict_put_val_drop(fz_context *ctx, pdf_obj *obj, int i, pdf_obj *new_obj)
 {
 	RESOLVE(obj);
-	if (!obj || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 	{
 		pdf_drop_obj(ctx, new_obj);
 		return;
@@ -1075,7 +1451,7 @@ pdf_dict_find(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 		int r = len - 1;
 		pdf_obj *k = DICT(obj)->items[r].k;
 
-		if (k == key || (k >= PDF_OBJ__LIMIT && strcmp(NAME(k)->n, PDF_NAMES[(intptr_t)key]) < 0))
+		if (k == key || (OBJ_IS_BOXED(k) && strcmp(NAME(k)->n, PDF_NAMES[(intptr_t)key]) < 0))
 		{
 			return -1 - (r+1);
 		}
@@ -1086,7 +1462,7 @@ pdf_dict_find(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 			int c;
 
 			k = DICT(obj)->items[m].k;
-			c = (k < PDF_OBJ__LIMIT ? (char *)key-(char *)k : -strcmp(NAME(k)->n, PDF_NAMES[(intptr_t)key]));
+			c = (!OBJ_IS_BOXED(k) ? (char *)key-(char *)k : -strcmp(NAME(k)->n, PDF_NAMES[(intptr_t)key]));
 			if (c < 0)
 				r = m - 1;
 			else if (c > 0)
@@ -1102,7 +1478,7 @@ pdf_dict_find(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 		for (i = 0; i < len; i++)
 		{
 			pdf_obj *k = DICT(obj)->items[i].k;
-			if (k < PDF_OBJ__LIMIT)
+			if (!OBJ_IS_BOXED(k))
 			{
 				if (k == key)
 					return i;
@@ -1124,7 +1500,7 @@ pdf_dict_gets(fz_context *ctx, pdf_obj *obj, const char *key)
 	int i;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return NULL;
 
 	i = pdf_dict_finds(ctx, obj, key);
@@ -1138,7 +1514,7 @@ pdf_obj *
 pdf_dict_getp(fz_context *ctx, pdf_obj *obj, const char *keys)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		char buf[256];
 		char *k, *e;
@@ -1192,10 +1568,10 @@ pdf_dict_get(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 	int i;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return NULL;
 
-	if (key < PDF_OBJ__LIMIT)
+	if (key < PDF_OBJ_NAME__LIMIT)
 		i = pdf_dict_find(ctx, obj, key);
 	else
 		i = pdf_dict_finds(ctx, obj, pdf_to_name(ctx, key));
@@ -1228,7 +1604,7 @@ void
 pdf_dict_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		int i;
 
@@ -1239,7 +1615,7 @@ pdf_dict_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 		}
 
 		RESOLVE(key);
-		if (!key || (key >= PDF_OBJ__LIMIT && key->kind != PDF_NAME))
+		if (!pdf_is_name(ctx, key))
 		{
 			fz_warn(ctx, "assert: key is not a name (%s)", pdf_objkindstr(obj));
 			return;
@@ -1256,7 +1632,7 @@ pdf_dict_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val)
 		if (DICT(obj)->len > 100 && !(obj->flags & PDF_FLAGS_SORTED))
 			pdf_sort_dict(ctx, obj);
 
-		if (key < PDF_OBJ__LIMIT)
+		if (key < PDF_OBJ_NAME__LIMIT)
 			i = pdf_dict_find(ctx, obj, key);
 		else
 			i = pdf_dict_finds(ctx, obj, pdf_to_name(ctx, key));
@@ -1306,10 +1682,10 @@ pdf_dict_puts(fz_context *ctx, pdf_obj *obj, const char *key, pdf_obj *val)
 	pdf_obj *keyobj;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a dictionary (%s)", pdf_objkindstr(obj));
 
-	doc = DICT(obj)->doc;
+	doc = ARENA_DOC(DICT(obj)->arena);
 	keyobj = pdf_new_name(ctx, doc, key);
 
 	fz_try(ctx)
@@ -1327,10 +1703,10 @@ pdf_dict_puts_drop(fz_context *ctx, pdf_obj *obj, const char *key, pdf_obj *val)
 	pdf_obj *keyobj;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a dictionary (%s)", pdf_objkindstr(obj));
 
-	doc = DICT(obj)->doc;
+	doc = ARENA_DOC(DICT(obj)->arena);
 	keyobj = pdf_new_name(ctx, doc, key);
 
 	fz_var(keyobj);
@@ -1357,10 +1733,10 @@ pdf_dict_putp(fz_context *ctx, pdf_obj *obj, const char *keys, pdf_obj *val)
 	pdf_obj *cobj = NULL;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a dictionary (%s)", pdf_objkindstr(obj));
 
-	doc = DICT(obj)->doc;
+	doc = ARENA_DOC(DICT(obj)->arena);
 
 	if (strlen(keys)+1 > 256)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "buffer overflow in pdf_dict_putp");
@@ -1429,10 +1805,10 @@ pdf_dict_vputl(fz_context *ctx, pdf_obj *obj, pdf_obj *val, va_list keys)
 	pdf_document *doc;
 
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "not a dictionary (%s)", pdf_objkindstr(obj));
 
-	doc = DICT(obj)->doc;
+	doc = ARENA_DOC(DICT(obj)->arena);
 
 	key = va_arg(keys, pdf_obj *);
 	if (key == NULL)
@@ -1500,7 +1876,7 @@ void
 pdf_dict_dels(fz_context *ctx, pdf_obj *obj, const char *key)
 {
 	RESOLVE(obj);
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
 		prepare_object_for_alteration(ctx, obj, NULL);
 
@@ -1529,9 +1905,9 @@ pdf_dict_del(fz_context *ctx, pdf_obj *obj, pdf_obj *key)
 	if (!key)
 		return; /* Can't warn */
 
-	if (key < PDF_OBJ__LIMIT)
+	if (key < PDF_OBJ_NAME__LIMIT)
 		pdf_dict_dels(ctx, obj, PDF_NAMES[(intptr_t)key]);
-	else if (key->kind == PDF_NAME)
+	else if (OBJ_IS_BOXED(key) && key->kind == PDF_NAME)
 		pdf_dict_dels(ctx, obj, NAME(key)->n);
 	/* else Can't warn */
 }
@@ -1540,7 +1916,7 @@ void
 pdf_sort_dict(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT || obj->kind != PDF_DICT)
+	if (!OBJ_IS_BOXED(obj) || obj->kind != PDF_DICT)
 		return;
 	if (!(obj->flags & PDF_FLAGS_SORTED))
 	{
@@ -1552,13 +1928,13 @@ pdf_sort_dict(fz_context *ctx, pdf_obj *obj)
 pdf_obj *
 pdf_deep_copy_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 	{
 		return pdf_keep_obj(ctx, obj);
 	}
 	if (obj->kind == PDF_DICT)
 	{
-		pdf_document *doc = DICT(obj)->doc;
+		pdf_document *doc = ARENA_DOC(DICT(obj)->arena);
 		int n = pdf_dict_len(ctx, obj);
 		pdf_obj *dict = pdf_new_dict(ctx, doc, n);
 		int i;
@@ -1574,7 +1950,7 @@ pdf_deep_copy_obj(fz_context *ctx, pdf_obj *obj)
 	}
 	else if (obj->kind == PDF_ARRAY)
 	{
-		pdf_document *doc = ARRAY(obj)->doc;
+		pdf_document *doc = ARENA_DOC(ARRAY(obj)->arena);
 		int n = pdf_array_len(ctx, obj);
 		pdf_obj *arr = pdf_new_array(ctx, doc, n);
 		int i;
@@ -1598,7 +1974,7 @@ int
 pdf_obj_marked(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	return !!(obj->flags & PDF_FLAGS_MARKED);
 }
@@ -1608,7 +1984,7 @@ pdf_mark_obj(fz_context *ctx, pdf_obj *obj)
 {
 	int marked;
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	marked = !!(obj->flags & PDF_FLAGS_MARKED);
 	obj->flags |= PDF_FLAGS_MARKED;
@@ -1619,7 +1995,7 @@ void
 pdf_unmark_obj(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags &= ~PDF_FLAGS_MARKED;
 }
@@ -1627,7 +2003,7 @@ pdf_unmark_obj(fz_context *ctx, pdf_obj *obj)
 void
 pdf_set_obj_memo(fz_context *ctx, pdf_obj *obj, int memo)
 {
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 
 	obj->flags |= PDF_FLAGS_MEMO;
@@ -1640,7 +2016,7 @@ pdf_set_obj_memo(fz_context *ctx, pdf_obj *obj, int memo)
 int
 pdf_obj_memo(fz_context *ctx, pdf_obj *obj, int *memo)
 {
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	if (!(obj->flags & PDF_FLAGS_MEMO))
 		return 0;
@@ -1651,7 +2027,7 @@ pdf_obj_memo(fz_context *ctx, pdf_obj *obj, int *memo)
 int pdf_obj_is_dirty(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 	return !!(obj->flags & PDF_FLAGS_DIRTY);
 }
@@ -1659,14 +2035,14 @@ int pdf_obj_is_dirty(fz_context *ctx, pdf_obj *obj)
 void pdf_dirty_obj(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags |= PDF_FLAGS_DIRTY;
 }
 
 void pdf_clean_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 	obj->flags &= ~PDF_FLAGS_DIRTY;
 }
@@ -1679,8 +2055,8 @@ pdf_drop_array(fz_context *ctx, pdf_obj *obj)
 	for (i = 0; i < DICT(obj)->len; i++)
 		pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
 
-	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	fz_free(ctx, ARRAY(obj)->items);
+	free_node(ctx, ARRAY(obj)->arena, obj, sizeof(pdf_obj_array));
 }
 
 static void
@@ -1694,20 +2070,22 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 	}
 
 	fz_free(ctx, DICT(obj)->items);
-	fz_free(ctx, obj);
+	free_node(ctx, DICT(obj)->arena, obj, sizeof(pdf_obj_dict));
 }
 
 void
 pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_OBJ__LIMIT)
+	if (OBJ_IS_BOXED(obj))
 	{
-		if (--obj->refs)
+		if (!fz_drop_imp16(ctx, obj, &obj->refs))
 			return;
 		if (obj->kind == PDF_ARRAY)
 			pdf_drop_array(ctx, obj);
 		else if (obj->kind == PDF_DICT)
 			pdf_drop_dict(ctx, obj);
+		else if (obj->kind == PDF_INDIRECT)
+			free_node(ctx, REF(obj)->arena, obj, sizeof(pdf_obj_ref));
 		else
 			fz_free(ctx, obj);
 	}
@@ -1718,7 +2096,7 @@ pdf_set_obj_parent(fz_context *ctx, pdf_obj *obj, int num)
 {
 	int n, i;
 
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return;
 
 	switch(obj->kind)
@@ -1740,7 +2118,7 @@ pdf_set_obj_parent(fz_context *ctx, pdf_obj *obj, int num)
 
 int pdf_obj_parent_num(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_OBJ__LIMIT)
+	if (!OBJ_IS_BOXED(obj))
 		return 0;
 
 	switch(obj->kind)
@@ -2141,5 +2519,5 @@ pdf_print_ref(fz_context *ctx, pdf_obj *ref)
 
 int pdf_obj_refs(fz_context *ctx, pdf_obj *ref)
 {
-	return (ref >= PDF_OBJ__LIMIT ? ref->refs : 0);
+	return (OBJ_IS_BOXED(ref) ? ref->refs : 0);
 }
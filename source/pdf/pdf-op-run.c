@@ -67,6 +67,14 @@ struct pdf_gstate_s
 	int luminosity;
 };
 
+typedef struct xobject_stack_s xobject_stack;
+
+struct xobject_stack_s
+{
+	pdf_obj *obj;
+	xobject_stack *up;
+};
+
 struct pdf_run_processor_s
 {
 	pdf_processor super;
@@ -74,6 +82,10 @@ struct pdf_run_processor_s
 
 	int nested_depth;
 
+	/* xobjects being run, innermost first; kept here rather than as
+	 * object marks so that several threads can run the same document */
+	xobject_stack *xobjects;
+
 	/* path object state */
 	fz_path *path;
 	int clip;
@@ -1221,11 +1233,19 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 	int cleanup_state = 0;
 	char errmess[256] = "";
 	pdf_obj *resources;
+	xobject_stack self, *up;
 
-	/* Avoid infinite recursion */
-	if (xobj == NULL || pdf_mark_obj(ctx, xobj->me))
+	if (xobj == NULL)
 		return;
 
+	/* Avoid infinite recursion */
+	self.obj = pdf_resolve_indirect(ctx, xobj->me);
+	for (up = pr->xobjects; up; up = up->up)
+		if (up->obj == self.obj)
+			return;
+	self.up = pr->xobjects;
+	pr->xobjects = &self;
+
 	fz_var(cleanup_state);
 	fz_var(gstate);
 	fz_var(oldtop);
@@ -1336,7 +1356,7 @@ pdf_run_xobject(fz_context *ctx, pdf_run_processor *proc, pdf_xobject *xobj, pdf
 			pdf_grestore(ctx, pr);
 		}
 
-		pdf_unmark_obj(ctx, xobj->me);
+		pr->xobjects = self.up;
 	}
 	fz_catch(ctx)
 	{
@@ -2127,6 +2147,7 @@ pdf_new_run_processor(fz_context *ctx, fz_device *dev, const fz_matrix *ctm, con
 	proc->dev = dev;
 
 	proc->nested_depth = nested;
+	proc->xobjects = NULL;
 
 	proc->path = NULL;
 	proc->clip = 0;
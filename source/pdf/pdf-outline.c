@@ -111,33 +111,6 @@ static char chapter_keywords[KEYWORKS_NUM][MAX_KEYWORD_LEN] =
 
 static fz_outline *first_node = NULL;
 
-//get form mupdf code
-int textlen(fz_context *ctx, fz_text_page *page)
-{
-	int len = 0;
-	int block_num;
-
-	for (block_num = 0; block_num < page->len; block_num++)
-	{
-		fz_text_block *block;
-		fz_text_line *line;
-		fz_text_span *span;
-
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
-		{
-			for (span = line->first_span; span; span = span->next)
-			{
-				len += span->len;
-			}
-			len++; /* pseudo-newline */
-		}
-	}
-	return len;
-}
-
 static int unicode_to_int(int *unicode)
 {
     int num = 0;
@@ -202,7 +175,9 @@ int *utf8_to_unicode(char *utf8, int *uni, int uni_len)
 static int *new_text_form_page_number(fz_context *ctx, fz_document *doc, int start_page, int total_page)
 {
     int i;
+#ifdef DUMP_DEBUG_PRINT
     int pos;
+#endif
     int len = 0;
     int *textbuf = NULL;
     
@@ -210,27 +185,25 @@ static int *new_text_form_page_number(fz_context *ctx, fz_document *doc, int sta
     {
         DEBUG_PRINT("get page%d text\n", i);
         
-        fz_text_sheet *sheet = fz_new_text_sheet(ctx);
-        fz_text_page *text = fz_new_text_page_from_page_number(ctx, doc, i, sheet);
-        int tlen = textlen(ctx, text);
+        fz_page_text *text = fz_load_page_text(ctx, doc, i);
+        int tlen = text->len;
         
         textbuf = (int *)realloc(textbuf, sizeof(int)*(len + tlen+1));
         if(!textbuf) {
             printf("malloc %d error\n", len+1);
+            fz_drop_page_text(ctx, text);
             return NULL;
         }
-        memset(textbuf+len,0,sizeof(int)*(tlen+1));
-
+        memcpy(textbuf+len, text->text, sizeof(int)*tlen);
+        textbuf[len+tlen] = 0;
+#ifdef DUMP_DEBUG_PRINT
         for(pos = 0; pos < tlen; pos++)
         {
-            fz_char_and_box cab;
-            textbuf[len+pos] = fz_text_char_at(ctx, &cab, text, pos)->c;
-#ifdef DUMP_DEBUG_PRINT
             if(!(pos%16)) printf("\n");
             printf("%04x ", textbuf[len+pos]);
-#endif
         }
-        fz_drop_text_page(ctx, text);
+#endif
+        fz_drop_page_text(ctx, text);
         len += tlen;
 #ifdef DUMP_DEBUG_PRINT
         printf("\n");
@@ -472,8 +445,11 @@ fz_outline *pdf_load_outline_fixed(fz_context *ctx, fz_document *doc)
 {
     DEBUG_PRINT("begin pdf_load_outline_fixed\n");
     
-    fz_rect search_hit_bbox[32];
-    int count;
+    fz_text_matcher *matcher;
+    fz_page_text *page_text = NULL;
+    const char *needles[KEYWORKS_NUM];
+    int counts[KEYWORKS_NUM];
+    int needle_count;
     int current_page;
     int index;
     int *text = NULL;
@@ -482,27 +458,45 @@ fz_outline *pdf_load_outline_fixed(fz_context *ctx, fz_document *doc)
     
     page_count = fz_count_pages(ctx, doc);
     
-    //直接使用章节关键字搜索
-    count = 0;
-    for(current_page = 0; current_page < SERACH_MAX_PAGE && current_page < page_count; current_page++)
+    //直接使用章节关键字搜索，一次扫描同时查找所有关键字
+    needle_count = 0;
+    while(needle_count < KEYWORKS_NUM && chapter_keywords[needle_count][0])
+    {
+        needles[needle_count] = chapter_keywords[needle_count];
+        needle_count++;
+    }
+    matcher = fz_new_text_matcher(ctx, needle_count, needles);
+    fz_var(page_text);
+    fz_try(ctx)
     {
-        index = 0;
-        while(index < KEYWORKS_NUM && chapter_keywords[index][0])
+        for(current_page = 0; current_page < SERACH_MAX_PAGE && current_page < page_count; current_page++)
         {
-            //DEBUG_PRINT("serach page%d (%s)\n", current_page, chapter_keywords[index]);
-            count = fz_search_page_number(ctx, doc, current_page, chapter_keywords[index], search_hit_bbox, 32);
-            //简单的认为，关键字数量大于4，就是目录页
-            if(count > 4)
+            page_text = fz_load_page_text(ctx, doc, current_page);
+            fz_match_page_text(ctx, matcher, page_text, counts, NULL);
+            fz_drop_page_text(ctx, page_text);
+            page_text = NULL;
+            for(index = 0; index < needle_count; index++)
             {
-                //DEBUG_PRINT("found page%d (%s) %d times\n", current_page,chapter_keywords[index],count);
-                if(content_start_page == -1)
-                    content_start_page = current_page;
-                content_total_page++;
-                break;
+                //简单的认为，关键字数量大于4，就是目录页
+                if(counts[index] > 4)
+                {
+                    //DEBUG_PRINT("found page%d (%s) %d times\n", current_page,chapter_keywords[index],counts[index]);
+                    if(content_start_page == -1)
+                        content_start_page = current_page;
+                    content_total_page++;
+                    break;
+                }
             }
-            index++;
         }
     }
+    fz_always(ctx)
+    {
+        if(page_text)
+            fz_drop_page_text(ctx, page_text);
+        fz_drop_text_matcher(ctx, matcher);
+    }
+    fz_catch(ctx)
+        fz_rethrow(ctx);
 
     //find contents
     if(content_total_page)
@@ -31,8 +31,8 @@ pdf_pattern_size(pdf_pattern *pat)
 	return sizeof(*pat);
 }
 
-pdf_pattern *
-pdf_load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+static pdf_pattern *
+load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	pdf_pattern *pat;
 	pdf_obj *obj;
@@ -80,3 +80,19 @@ pdf_load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 	}
 	return pat;
 }
+
+pdf_pattern *
+pdf_load_pattern(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+{
+	pdf_pattern *pat;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		pat = load_pattern(ctx, doc, dict);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return pat;
+}
@@ -48,7 +48,7 @@ void pdf_run_page_contents(fz_context *ctx, pdf_page *page, fz_device *dev, cons
 	pdf_document *doc = page->doc;
 	int nocache;
 
-	nocache = !!(dev->hints & FZ_NO_CACHE);
+	nocache = !!(dev->hints & FZ_NO_CACHE) && !doc->shared;
 	if (nocache)
 		pdf_mark_xref(ctx, doc);
 
@@ -74,7 +74,7 @@ void pdf_run_annot(fz_context *ctx, pdf_page *page, pdf_annot *annot, fz_device
 	pdf_document *doc = page->doc;
 	int nocache;
 
-	nocache = !!(dev->hints & FZ_NO_CACHE);
+	nocache = !!(dev->hints & FZ_NO_CACHE) && !doc->shared;
 	if (nocache)
 		pdf_mark_xref(ctx, doc);
 	fz_try(ctx)
@@ -123,7 +123,8 @@ static void pdf_run_page_annots_with_usage(fz_context *ctx, pdf_document *doc, p
 void
 pdf_run_page_with_usage(fz_context *ctx, pdf_document *doc, pdf_page *page, fz_device *dev, const fz_matrix *ctm, char *event, fz_cookie *cookie)
 {
-	int nocache = !!(dev->hints & FZ_NO_CACHE);
+	/* Other threads may be using the cached objects of a shared document */
+	int nocache = !!(dev->hints & FZ_NO_CACHE) && !doc->shared;
 
 	if (nocache)
 		pdf_mark_xref(ctx, doc);
@@ -435,8 +435,8 @@ fz_shade_size(fz_shade *s)
 	return sizeof(*s) + fz_compressed_buffer_size(s->buffer);
 }
 
-fz_shade *
-pdf_load_shading(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+static fz_shade *
+load_shading(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	fz_matrix mat;
 	pdf_obj *obj;
@@ -482,3 +482,19 @@ pdf_load_shading(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 
 	return shade;
 }
+
+fz_shade *
+pdf_load_shading(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+{
+	fz_shade *shade;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		shade = load_shading(ctx, doc, dict);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return shade;
+}
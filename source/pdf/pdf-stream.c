@@ -372,30 +372,53 @@ fz_stream *
 pdf_open_raw_renumbered_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen)
 {
 	pdf_xref_entry *x;
+	fz_stream *stm;
 
 	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "object id out of range (%d %d R)", num, gen);
 
-	x = pdf_cache_object(ctx, doc, num, gen);
-	if (x->stm_ofs == 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+	/* Hold the document lock while we look at the xref entry. */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		x = pdf_cache_object(ctx, doc, num, gen);
+		if (x->stm_ofs == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+
+		stm = pdf_open_raw_filter(ctx, doc->file, doc, x->obj, num, orig_num, orig_gen, x->stm_ofs);
+	}
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
-	return pdf_open_raw_filter(ctx, doc->file, doc, x->obj, num, orig_num, orig_gen, x->stm_ofs);
+	return stm;
 }
 
 static fz_stream *
 pdf_open_image_stream(fz_context *ctx, pdf_document *doc, int num, int gen, int orig_num, int orig_gen, fz_compression_params *params)
 {
 	pdf_xref_entry *x;
+	fz_stream *stm;
 
 	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "object id out of range (%d %d R)", num, gen);
 
-	x = pdf_cache_object(ctx, doc, num, gen);
-	if (x->stm_ofs == 0 && x->stm_buf == NULL)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		x = pdf_cache_object(ctx, doc, num, gen);
+		if (x->stm_ofs == 0 && x->stm_buf == NULL)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+
+		stm = pdf_open_filter(ctx, doc, doc->file, x->obj, orig_num, orig_gen, x->stm_ofs, params);
+	}
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
-	return pdf_open_filter(ctx, doc, doc->file, x->obj, orig_num, orig_gen, x->stm_ofs, params);
+	return stm;
 }
 
 /*
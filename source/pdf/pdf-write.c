@@ -62,6 +62,12 @@ struct pdf_write_options_s
 	int *renumber_map;
 	int continue_on_error;
 	int *errors;
+	int compression_level;
+	int do_keep_flate;
+	/* Streams compressed ahead of the writer (see prepare_streams) */
+	fz_buffer **deflated;
+	int prep_start;
+	int prep_end;
 	/* The following extras are required for linearization */
 	int *rev_renumber_map;
 	int *rev_gen_list;
@@ -593,88 +599,216 @@ static int markobj(fz_context *ctx, pdf_document *doc, pdf_write_options *opts,
 }
 
 /*
- * Scan for and remove duplicate objects (slow)
+ * Scan for and remove duplicate objects
+ *
+ * Objects are bucketed by a hash of their contents (and with -gggg of
+ * their stream data), so only objects whose hashes collide are compared.
  */
 
+static unsigned int hash_bytes(unsigned int h, const unsigned char *s, int n)
+{
+	/* FNV-1a */
+	while (n-- > 0)
+		h = (h ^ *s++) * 16777619;
+	return h;
+}
+
+static unsigned int hash_int(unsigned int h, int v)
+{
+	unsigned char b[4];
+
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+	return hash_bytes(h, b, 4);
+}
+
+/* Objects that pdf_objcmp finds equal hash equally. References are
+ * hashed by number, not followed. */
+static unsigned int hash_obj(fz_context *ctx, pdf_obj *obj, unsigned int h)
+{
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+	{
+		h = hash_int(h, 'R');
+		h = hash_int(h, pdf_to_num(ctx, obj));
+		return hash_int(h, pdf_to_gen(ctx, obj));
+	}
+	if (!obj || pdf_is_null(ctx, obj))
+		return hash_int(h, 'n');
+	if (pdf_is_bool(ctx, obj))
+		return hash_int(h, pdf_to_bool(ctx, obj) ? 't' : 'f');
+	if (pdf_is_int(ctx, obj))
+		return hash_int(hash_int(h, 'i'), pdf_to_int(ctx, obj));
+	if (pdf_is_real(ctx, obj))
+	{
+		float f = pdf_to_real(ctx, obj);
+		if (f == 0)
+			f = 0; /* -0 compares equal to 0 */
+		return hash_bytes(hash_int(h, 'r'), (unsigned char *)&f, sizeof f);
+	}
+	if (pdf_is_name(ctx, obj))
+	{
+		char *name = pdf_to_name(ctx, obj);
+		return hash_bytes(hash_int(h, '/'), (unsigned char *)name, strlen(name));
+	}
+	if (pdf_is_string(ctx, obj))
+		return hash_bytes(hash_int(h, '('), (unsigned char *)pdf_to_str_buf(ctx, obj), pdf_to_str_len(ctx, obj));
+	if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		h = hash_int(hash_int(h, '['), n);
+		for (i = 0; i < n; i++)
+			h = hash_obj(ctx, pdf_array_get(ctx, obj, i), h);
+		return h;
+	}
+	if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		h = hash_int(hash_int(h, '<'), n);
+		for (i = 0; i < n; i++)
+		{
+			h = hash_obj(ctx, pdf_dict_get_key(ctx, obj, i), h);
+			h = hash_obj(ctx, pdf_dict_get_val(ctx, obj, i), h);
+		}
+		return h;
+	}
+	return h;
+}
+
+static int samestreamdata(fz_context *ctx, pdf_document *doc, int num, int other)
+{
+	fz_buffer *sa = NULL;
+	fz_buffer *sb = NULL;
+	int same = 0;
+
+	fz_var(sa);
+	fz_var(sb);
+
+	fz_try(ctx)
+	{
+		unsigned char *dataa, *datab;
+		int lena, lenb;
+		sa = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
+		sb = pdf_load_raw_renumbered_stream(ctx, doc, other, 0, other, 0);
+		lena = fz_buffer_storage(ctx, sa, &dataa);
+		lenb = fz_buffer_storage(ctx, sb, &datab);
+		same = (lena == lenb && memcmp(dataa, datab, lena) == 0);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, sa);
+		fz_drop_buffer(ctx, sb);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+	return same;
+}
+
 static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_options *opts)
 {
 	int num, other;
 	int xref_len = pdf_xref_len(ctx, doc);
+	unsigned int *hash = NULL;
+	unsigned char *digest = NULL;
+	int *next = NULL;
+	int *head = NULL;
+	int mask;
+
+	fz_var(hash);
+	fz_var(digest);
+	fz_var(next);
+	fz_var(head);
+
+	mask = 1;
+	while (mask < xref_len && mask < (1 << 24))
+		mask <<= 1;
+	mask--;
 
-	for (num = 1; num < xref_len; num++)
+	fz_try(ctx)
 	{
-		/* Only compare an object to objects preceding it */
-		for (other = 1; other < num; other++)
+		hash = fz_malloc_array(ctx, xref_len, sizeof(*hash));
+		next = fz_malloc_array(ctx, xref_len, sizeof(*next));
+		head = fz_malloc_array(ctx, mask + 1, sizeof(*head));
+		if (opts->do_garbage >= 4)
+			digest = fz_malloc_array(ctx, xref_len, 16);
+		memset(head, 0, (mask + 1) * sizeof(*head));
+
+		/* head and next chain the objects kept so far (object 0 is never
+		 * one of them, so serves as the end marker). Streams are only
+		 * merged at -gggg, so otherwise they are left out entirely. */
+		for (num = 1; num < xref_len; num++)
 		{
 			pdf_obj *a, *b;
-			int differ, newnum, streama, streamb;
+			int stream, newnum;
+			unsigned int h;
 
-			if (num == other || !opts->use_list[num] || !opts->use_list[other])
+			if (!opts->use_list[num])
 				continue;
 
+			fz_var(stream);
+
 			/*
-			 * Comparing stream objects data contents would take too long.
-			 *
 			 * pdf_is_stream calls pdf_cache_object and ensures
 			 * that the xref table has the objects loaded.
 			 */
 			fz_try(ctx)
 			{
-				streama = pdf_is_stream(ctx, doc, num, 0);
-				streamb = pdf_is_stream(ctx, doc, other, 0);
-				differ = streama || streamb;
-				if (streama && streamb && opts->do_garbage >= 4)
-					differ = 0;
+				stream = pdf_is_stream(ctx, doc, num, 0);
+				if (stream && opts->do_garbage >= 4)
+				{
+					fz_buffer *buf = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
+					fz_md5 md5;
+					unsigned char *data;
+					int len = fz_buffer_storage(ctx, buf, &data);
+					fz_md5_init(&md5);
+					fz_md5_update(&md5, data, len);
+					fz_md5_final(&md5, &digest[num * 16]);
+					fz_drop_buffer(ctx, buf);
+				}
 			}
 			fz_catch(ctx)
 			{
 				/* Assume different */
-				differ = 1;
+				continue;
 			}
-			if (differ)
+			if (stream && opts->do_garbage < 4)
 				continue;
 
-			a = pdf_get_xref_entry(ctx, doc, num)->obj;
-			b = pdf_get_xref_entry(ctx, doc, other)->obj;
-
-			a = pdf_resolve_indirect(ctx, a);
-			b = pdf_resolve_indirect(ctx, b);
-
-			if (pdf_objcmp(ctx, a, b))
-				continue;
+			a = pdf_resolve_indirect(ctx, pdf_get_xref_entry(ctx, doc, num)->obj);
+			h = hash_obj(ctx, a, 2166136261u);
+			if (stream)
+				h = hash_bytes(h, &digest[num * 16], 16);
+			hash[num] = h;
 
-			if (streama && streamb)
+			for (other = head[h & mask]; other; other = next[other])
 			{
-				/* Check to see if streams match too. */
-				fz_buffer *sa = NULL;
-				fz_buffer *sb = NULL;
-
-				fz_var(sa);
-				fz_var(sb);
+				if (hash[other] != h)
+					continue;
+				/* A stream and a plain object never match, and the
+				 * digests of two streams must agree. */
+				if (stream != (digest && pdf_is_stream(ctx, doc, other, 0)))
+					continue;
+				if (stream && memcmp(&digest[num * 16], &digest[other * 16], 16))
+					continue;
 
-				differ = 1;
-				fz_try(ctx)
-				{
-					unsigned char *dataa, *datab;
-					int lena, lenb;
-					sa = pdf_load_raw_renumbered_stream(ctx, doc, num, 0, num, 0);
-					sb = pdf_load_raw_renumbered_stream(ctx, doc, other, 0, other, 0);
-					lena = fz_buffer_storage(ctx, sa, &dataa);
-					lenb = fz_buffer_storage(ctx, sb, &datab);
-					if (lena == lenb && memcmp(dataa, datab, lena) == 0)
-						differ = 0;
-				}
-				fz_always(ctx)
-				{
-					fz_drop_buffer(ctx, sa);
-					fz_drop_buffer(ctx, sb);
-				}
-				fz_catch(ctx)
-				{
-					fz_rethrow(ctx);
-				}
-				if (differ)
+				b = pdf_resolve_indirect(ctx, pdf_get_xref_entry(ctx, doc, other)->obj);
+				if (pdf_objcmp(ctx, a, b))
 					continue;
+				if (stream && !samestreamdata(ctx, doc, num, other))
+					continue;
+				break;
+			}
+
+			if (other == 0)
+			{
+				next[num] = head[h & mask];
+				head[h & mask] = num;
+				continue;
 			}
 
 			/* Keep the lowest numbered object */
@@ -683,11 +817,19 @@ static void removeduplicateobjs(fz_context *ctx, pdf_document *doc, pdf_write_op
 			opts->renumber_map[other] = newnum;
 			opts->rev_renumber_map[newnum] = num; /* Either will do */
 			opts->use_list[fz_maxi(num, other)] = 0;
-
-			/* One duplicate was found, do not look for another */
-			break;
 		}
 	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, hash);
+		fz_free(ctx, digest);
+		fz_free(ctx, next);
+		fz_free(ctx, head);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
 }
 
 /*
@@ -1569,7 +1711,7 @@ static void addhexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 	pdf_drop_obj(ctx, newdp);
 }
 
-static fz_buffer *deflatebuf(fz_context *ctx, unsigned char *p, int n)
+static fz_buffer *deflatebuf(fz_context *ctx, unsigned char *p, int n, int level)
 {
 	fz_buffer *buf;
 	uLongf csize;
@@ -1577,7 +1719,7 @@ static fz_buffer *deflatebuf(fz_context *ctx, unsigned char *p, int n)
 
 	buf = fz_new_buffer(ctx, compressBound(n));
 	csize = buf->cap;
-	t = compress(buf->data, &csize, p, n);
+	t = compress2(buf->data, &csize, p, n, level);
 	if (t != Z_OK)
 	{
 		fz_drop_buffer(ctx, buf);
@@ -1594,8 +1736,16 @@ static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	pdf_obj *obj;
 	int orig_num = opts->rev_renumber_map[num];
 	int orig_gen = opts->rev_gen_list[num];
+	int deflated = 0;
 
-	buf = pdf_load_raw_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen);
+	if (opts->deflated && opts->deflated[num])
+	{
+		buf = opts->deflated[num];
+		opts->deflated[num] = NULL;
+		deflated = 1;
+	}
+	else
+		buf = pdf_load_raw_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen);
 
 	obj = pdf_copy_dict(ctx, obj_orig);
 
@@ -1603,9 +1753,12 @@ static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	{
 		pdf_dict_put(ctx, obj, PDF_NAME_Filter, PDF_NAME_FlateDecode);
 
-		tmp = deflatebuf(ctx, buf->data, buf->len);
-		fz_drop_buffer(ctx, buf);
-		buf = tmp;
+		if (!deflated)
+		{
+			tmp = deflatebuf(ctx, buf->data, buf->len, opts->compression_level);
+			fz_drop_buffer(ctx, buf);
+			buf = tmp;
+		}
 	}
 
 	if (opts->do_ascii && isbinarystream(buf))
@@ -1639,10 +1792,20 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_options *
 	int orig_num = opts->rev_renumber_map[num];
 	int orig_gen = opts->rev_gen_list[num];
 	int truncated = 0;
+	int deflated = 0;
 
-	buf = pdf_load_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen, (opts->continue_on_error ? &truncated : NULL));
-	if (truncated && opts->errors)
-		(*opts->errors)++;
+	if (opts->deflated && opts->deflated[num])
+	{
+		buf = opts->deflated[num];
+		opts->deflated[num] = NULL;
+		deflated = 1;
+	}
+	else
+	{
+		buf = pdf_load_renumbered_stream(ctx, doc, num, gen, orig_num, orig_gen, (opts->continue_on_error ? &truncated : NULL));
+		if (truncated && opts->errors)
+			(*opts->errors)++;
+	}
 
 	obj = pdf_copy_dict(ctx, obj_orig);
 	pdf_dict_del(ctx, obj, PDF_NAME_Filter);
@@ -1652,9 +1815,12 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_options *
 	{
 		pdf_dict_put(ctx, obj, PDF_NAME_Filter, PDF_NAME_FlateDecode);
 
-		tmp = deflatebuf(ctx, buf->data, buf->len);
-		fz_drop_buffer(ctx, buf);
-		buf = tmp;
+		if (!deflated)
+		{
+			tmp = deflatebuf(ctx, buf->data, buf->len, opts->compression_level);
+			fz_drop_buffer(ctx, buf);
+			buf = tmp;
+		}
 	}
 
 	if (opts->do_ascii && isbinarystream(buf))
@@ -1708,6 +1874,54 @@ static int filter_implies_image(fz_context *ctx, pdf_document *doc, pdf_obj *o)
 	return 0;
 }
 
+static int is_flate_only(fz_context *ctx, pdf_obj *obj)
+{
+	pdf_obj *f = pdf_dict_get(ctx, obj, PDF_NAME_Filter);
+
+	if (pdf_is_array(ctx, f) && pdf_array_len(ctx, f) == 1)
+		f = pdf_array_get(ctx, f, 0);
+	return pdf_name_eq(ctx, f, PDF_NAME_FlateDecode) || pdf_name_eq(ctx, f, PDF_NAME_Fl);
+}
+
+/* Should the stream with this dictionary be written decompressed
+ * (expandstream) rather than copied as it is (copystream)? */
+static int should_expand_stream(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, pdf_obj *obj)
+{
+	int dontexpand = 0;
+
+	if (!opts->do_expand || pdf_is_jpx_image(ctx, obj))
+		return 0;
+	if (opts->do_keep_flate && is_flate_only(ctx, obj))
+		return 0;
+	if (opts->do_expand != 0 && opts->do_expand != fz_expand_all)
+	{
+		pdf_obj *o;
+
+		if ((o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_XObject)) &&
+			(o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Image)))
+			dontexpand = !(opts->do_expand & fz_expand_images);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_Font))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_FontDescriptor))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length1) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length2) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Length3) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Type1C))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_CIDFontType0C))
+			dontexpand = !(opts->do_expand & fz_expand_fonts);
+		if (o = pdf_dict_get(ctx, obj, PDF_NAME_Filter), filter_implies_image(ctx, doc, o))
+			dontexpand = !(opts->do_expand & fz_expand_images);
+		if (pdf_dict_get(ctx, obj, PDF_NAME_Width) != NULL && pdf_dict_get(ctx, obj, PDF_NAME_Height) != NULL)
+			dontexpand = !(opts->do_expand & fz_expand_images);
+	}
+	return !dontexpand;
+}
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num, int gen, int skip_xrefs)
 {
 	pdf_xref_entry *entry;
@@ -1766,36 +1980,9 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_options *o
 	}
 	else
 	{
-		int dontexpand = 0;
-		if (opts->do_expand != 0 && opts->do_expand != fz_expand_all)
-		{
-			pdf_obj *o;
-
-			if ((o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_XObject)) &&
-				(o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Image)))
-				dontexpand = !(opts->do_expand & fz_expand_images);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_Font))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Type), pdf_name_eq(ctx, o, PDF_NAME_FontDescriptor))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length1) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length2) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Length3) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_Type1C))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Subtype), pdf_name_eq(ctx, o, PDF_NAME_CIDFontType0C))
-				dontexpand = !(opts->do_expand & fz_expand_fonts);
-			if (o = pdf_dict_get(ctx, obj, PDF_NAME_Filter), filter_implies_image(ctx, doc, o))
-				dontexpand = !(opts->do_expand & fz_expand_images);
-			if (pdf_dict_get(ctx, obj, PDF_NAME_Width) != NULL && pdf_dict_get(ctx, obj, PDF_NAME_Height) != NULL)
-				dontexpand = !(opts->do_expand & fz_expand_images);
-		}
 		fz_try(ctx)
 		{
-			if (opts->do_expand && !dontexpand && !pdf_is_jpx_image(ctx, obj))
+			if (should_expand_stream(ctx, doc, opts, obj))
 				expandstream(ctx, doc, opts, obj, num, gen);
 			else
 				copystream(ctx, doc, opts, obj, num, gen);
@@ -2081,10 +2268,214 @@ padto(FILE *file, fz_off_t target)
 	}
 }
 
+/* The generation number dowriteobject will give an object in use. */
+static int
+write_gen(pdf_write_options *opts, pdf_xref_entry *entry, int num)
+{
+	if (opts->do_garbage >= 2)
+		return (num == 0 ? 65535 : 0);
+	return entry->type == 'o' ? 0 : entry->gen;
+}
+
+/*
+	With a parallel context, the streams that writeobject will need to
+	compress are loaded a window at a time ahead of the writer, and
+	compressed on the worker threads. The writer then picks the results
+	up from opts->deflated as it emits each object in order, so offsets
+	and output are the same as for a serial write.
+*/
+
+#define DEFLATE_JOBS_PER_THREAD 4
+
+typedef struct
+{
+	int num;
+	int level;
+	int ok;
+	fz_buffer *src;
+	fz_buffer *dst;
+} deflate_job;
+
+typedef struct
+{
+	deflate_job *jobs;
+	int count;
+	int stride;
+} deflate_batch;
+
+static void
+deflate_batch_fn(void *arg, int i)
+{
+	deflate_batch *batch = (deflate_batch *)arg;
+
+	for (; i < batch->count; i += batch->stride)
+	{
+		deflate_job *job = &batch->jobs[i];
+		uLongf csize = job->dst->cap;
+
+		job->ok = (compress2(job->dst->data, &csize, job->src->data, job->src->len, job->level) == Z_OK);
+		job->dst->len = csize;
+	}
+}
+
+/* Load the data writeobject would compress for object num, or return
+ * NULL if it will not compress anything (or cannot be loaded, in which
+ * case writeobject will report the error when it gets there). */
+static fz_buffer *
+load_stream_to_deflate(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num)
+{
+	pdf_xref_entry *entry;
+	pdf_obj *obj = NULL;
+	pdf_obj *type;
+	fz_buffer *buf = NULL;
+	int gen, truncated = 0;
+
+	if (opts->do_garbage && !opts->use_list[num])
+		return NULL;
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return NULL;
+	entry = pdf_get_xref_entry(ctx, doc, num);
+	if (entry->type != 'n' && entry->type != 'o')
+		return NULL;
+	gen = write_gen(opts, entry, num);
+	/* We may be ahead of dowriteobject, which sets this for each
+	 * incremental section in turn. */
+	if (opts->do_incremental)
+		opts->rev_gen_list[num] = entry->gen;
+
+	fz_var(obj);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		obj = pdf_load_object(ctx, doc, num, gen);
+		type = pdf_dict_get(ctx, obj, PDF_NAME_Type);
+		entry = pdf_get_xref_entry(ctx, doc, num);
+		if (pdf_name_eq(ctx, type, PDF_NAME_ObjStm) || pdf_name_eq(ctx, type, PDF_NAME_XRef))
+			;
+		else if (!pdf_is_stream(ctx, doc, num, gen) || (entry->stm_ofs < 0 && entry->stm_buf == NULL))
+			;
+		else if (should_expand_stream(ctx, doc, opts, obj))
+		{
+			buf = pdf_load_renumbered_stream(ctx, doc, num, gen, opts->rev_renumber_map[num], opts->rev_gen_list[num], (opts->continue_on_error ? &truncated : NULL));
+			if (truncated && opts->errors)
+				(*opts->errors)++;
+		}
+		else if (!pdf_dict_get(ctx, obj, PDF_NAME_Filter))
+			buf = pdf_load_raw_renumbered_stream(ctx, doc, num, gen, opts->rev_renumber_map[num], opts->rev_gen_list[num]);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, obj);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_drop_buffer(ctx, buf);
+		buf = NULL;
+	}
+
+	return buf;
+}
+
+static void
+drop_prepared_streams(fz_context *ctx, pdf_write_options *opts)
+{
+	int num;
+
+	if (!opts->deflated)
+		return;
+	for (num = opts->prep_start; num < opts->prep_end; num++)
+	{
+		fz_drop_buffer(ctx, opts->deflated[num]);
+		opts->deflated[num] = NULL;
+	}
+	opts->prep_start = opts->prep_end = 0;
+}
+
+/* Make sure the streams from object num onwards (up to, but not
+ * including, object to) are being compressed ahead of the writer. */
+static void
+prepare_streams(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num, int to)
+{
+	fz_parallel_context *parallel = ctx->parallel;
+	deflate_batch batch;
+	deflate_job *jobs;
+	int max, count, i;
+
+	if (!opts->deflated || (num >= opts->prep_start && num < opts->prep_end))
+		return;
+
+	drop_prepared_streams(ctx, opts);
+
+	max = parallel->threads * DEFLATE_JOBS_PER_THREAD;
+	jobs = fz_calloc(ctx, max, sizeof(*jobs));
+	count = 0;
+
+	fz_var(count);
+
+	fz_try(ctx)
+	{
+		opts->prep_start = num;
+		for (; num < to && count < max; num++)
+		{
+			fz_buffer *src = load_stream_to_deflate(ctx, doc, opts, num);
+			if (src)
+			{
+				jobs[count].num = num;
+				jobs[count].level = opts->compression_level;
+				jobs[count].src = src;
+				count++;
+				jobs[count-1].dst = fz_new_buffer(ctx, compressBound(src->len));
+			}
+		}
+		opts->prep_end = num;
+
+		batch.jobs = jobs;
+		batch.count = count;
+		batch.stride = fz_mini(parallel->threads, count);
+		if (count > 1)
+			parallel->run(parallel->user, deflate_batch_fn, &batch, batch.stride);
+		else if (count == 1)
+			deflate_batch_fn(&batch, 0);
+
+		for (i = 0; i < count; i++)
+		{
+			if (jobs[i].ok)
+			{
+				opts->deflated[jobs[i].num] = jobs[i].dst;
+				jobs[i].dst = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			fz_drop_buffer(ctx, jobs[i].src);
+			fz_drop_buffer(ctx, jobs[i].dst);
+		}
+		fz_free(ctx, jobs);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 static void
 dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int num, int pass)
 {
-	pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, num);
+	pdf_xref_entry *entry;
+
+	/* An incremental update holds only the objects changed in it; leave
+	 * the rest of the xref alone (it may not even have been read yet). */
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return;
+
+	entry = pdf_get_xref_entry(ctx, doc, num);
+	if (opts->do_incremental)
+		opts->rev_gen_list[num] = entry->gen;
 	if (entry->type == 'f')
 		opts->gen_list[num] = entry->gen;
 	if (entry->type == 'n')
@@ -2129,6 +2520,8 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int pa
 		fputs("%%\316\274\341\277\246\n\n", opts->out);
 	}
 
+	drop_prepared_streams(ctx, opts);
+
 	dowriteobject(ctx, doc, opts, opts->start, pass);
 
 	if (opts->do_linear)
@@ -2142,7 +2535,10 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int pa
 	}
 
 	for (num = opts->start+1; num < xref_len; num++)
+	{
+		prepare_streams(ctx, doc, opts, num, xref_len);
 		dowriteobject(ctx, doc, opts, num, pass);
+	}
 	if (opts->do_linear && pass == 1)
 	{
 		fz_off_t offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
@@ -2152,8 +2548,11 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_options *opts, int pa
 	{
 		if (pass == 1)
 			opts->ofs_list[num] += opts->hintstream_len;
+		prepare_streams(ctx, doc, opts, num, opts->start);
 		dowriteobject(ctx, doc, opts, num, pass);
 	}
+
+	drop_prepared_streams(ctx, opts);
 }
 
 static int
@@ -2192,6 +2591,8 @@ make_page_offset_hints(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	max_shared_object = 1;
 	min_shared_length = opts->file_len;
 	max_shared_length = 0;
+	for (i=0; i < opts->page_count; i++)
+		pop[i]->min_ofs = opts->file_len;
 	for (i=1; i < xref_len; i++)
 	{
 		int min, max, page;
@@ -2389,7 +2790,7 @@ make_page_offset_hints(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	fz_write_buffer_bits(ctx, buf, pop[0]->num_shared, 32);
 	/* Header Item 4: The number of shared object entries for the shared
 	 * objects section + first page. */
-	fz_write_buffer_bits(ctx, buf, max_shared_object - min_shared_object + pop[0]->num_shared, 32);
+	fz_write_buffer_bits(ctx, buf, max_shared_object - min_shared_object + 1 + pop[0]->num_shared, 32);
 	/* Header Item 5: The number of bits needed to represent the greatest
 	 * number of objects in a shared object group (Always 0). */
 	fz_write_buffer_bits(ctx, buf, 0, 16);
@@ -2433,7 +2834,7 @@ make_page_offset_hints(fz_context *ctx, pdf_document *doc, pdf_write_options *op
 	fz_write_buffer_pad(ctx, buf);
 
 	/* Item 2: MD5 presence flags */
-	for (i = max_shared_object - min_shared_object + pop[0]->num_shared; i > 0; i--)
+	for (i = max_shared_object - min_shared_object + 1 + pop[0]->num_shared; i > 0; i--)
 	{
 		fz_write_buffer_bits(ctx, buf, 0, 1);
 	}
@@ -2640,9 +3041,15 @@ static void initialise_write_options(fz_context *ctx, pdf_document *doc, const f
 	opts->gen_list = fz_calloc(ctx, xref_len + 3, sizeof(int));
 	opts->renumber_map = fz_malloc_array(ctx, xref_len + 3, sizeof(int));
 	opts->rev_renumber_map = fz_malloc_array(ctx, xref_len + 3, sizeof(int));
-	opts->rev_gen_list = fz_malloc_array(ctx, xref_len + 3, sizeof(int));
+	opts->rev_gen_list = fz_calloc(ctx, xref_len + 3, sizeof(int));
 	opts->continue_on_error = fz_opts->continue_on_error;
 	opts->errors = fz_opts->errors;
+	opts->compression_level = fz_opts->compression_level;
+	if (opts->compression_level <= 0 || opts->compression_level > 9)
+		opts->compression_level = Z_DEFAULT_COMPRESSION;
+	opts->do_keep_flate = fz_opts->do_keep_flate;
+	if (opts->do_deflate && ctx->parallel && ctx->parallel->threads > 1)
+		opts->deflated = fz_calloc(ctx, xref_len + 3, sizeof(fz_buffer *));
 
 	for (num = 0; num < xref_len; num++)
 	{
@@ -2650,7 +3057,11 @@ static void initialise_write_options(fz_context *ctx, pdf_document *doc, const f
 		opts->ofs_list[num] = 0;
 		opts->renumber_map[num] = num;
 		opts->rev_renumber_map[num] = num;
-		opts->rev_gen_list[num] = pdf_get_xref_entry(ctx, doc, num)->gen;
+		/* An incremental write never looks at the objects outside
+		 * the update, which need not even have been read yet; those
+		 * in older updates are filled in as each one is written. */
+		if (!opts->do_incremental || pdf_xref_is_incremental(ctx, doc, num))
+			opts->rev_gen_list[num] = pdf_get_xref_entry(ctx, doc, num)->gen;
 	}
 }
 
@@ -2663,6 +3074,8 @@ static void finalise_write_options(fz_context *ctx, pdf_write_options *opts)
 	fz_free(ctx, opts->renumber_map);
 	fz_free(ctx, opts->rev_renumber_map);
 	fz_free(ctx, opts->rev_gen_list);
+	drop_prepared_streams(ctx, opts);
+	fz_free(ctx, opts->deflated);
 	pdf_drop_obj(ctx, opts->linear_l);
 	pdf_drop_obj(ctx, opts->linear_h0);
 	pdf_drop_obj(ctx, opts->linear_h1);
@@ -2677,6 +3090,30 @@ static void finalise_write_options(fz_context *ctx, pdf_write_options *opts)
 		fclose(opts->out);
 }
 
+static void copy_document_file(fz_context *ctx, pdf_document *doc, FILE *out)
+{
+	unsigned char *buf = fz_malloc(ctx, 65536);
+	int n;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		fz_seek(ctx, doc->file, 0, SEEK_SET);
+		while ((n = fz_read(ctx, doc->file, buf, 65536)) > 0)
+			if (fwrite(buf, 1, n, out) != (size_t)n)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write to output file");
+	}
+	fz_always(ctx)
+	{
+		pdf_unlock_document(ctx, doc);
+		fz_free(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
 void pdf_write_document(fz_context *ctx, pdf_document *doc, char *filename, fz_write_options *fz_opts)
 {
 	fz_write_options opts_defaults = { 0 };
@@ -2710,13 +3147,30 @@ void pdf_write_document(fz_context *ctx, pdf_document *doc, char *filename, fz_w
 
 	if (fz_opts->do_incremental)
 	{
-		/* If no changes, nothing to write */
-		if (doc->num_incremental_sections == 0)
-			return;
 		opts.out = fz_fopen(filename, "ab");
 		if (opts.out)
 		{
 			fz_fseek(opts.out, 0, SEEK_END);
+
+			/* Saving to a new file rather than over the original:
+			 * start it with a verbatim copy of the original bytes. */
+			if (fz_ftell(opts.out) == 0)
+			{
+				fz_try(ctx)
+					copy_document_file(ctx, doc, opts.out);
+				fz_catch(ctx)
+				{
+					fclose(opts.out);
+					fz_rethrow(ctx);
+				}
+			}
+
+			/* If no changes, nothing more to write */
+			if (doc->num_incremental_sections == 0)
+			{
+				fclose(opts.out);
+				return;
+			}
 			fputs("\n", opts.out);
 		}
 	}
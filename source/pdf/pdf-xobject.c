@@ -33,8 +33,8 @@ pdf_xobject_size(pdf_xobject *xobj)
 	return sizeof(*xobj) + (xobj->colorspace ? xobj->colorspace->size : 0);
 }
 
-pdf_xobject *
-pdf_load_xobject(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+static pdf_xobject *
+load_xobject(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	pdf_xobject *form;
 	pdf_obj *obj;
@@ -114,6 +114,22 @@ pdf_load_xobject(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 	return form;
 }
 
+pdf_xobject *
+pdf_load_xobject(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
+{
+	pdf_xobject *form;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		form = load_xobject(ctx, doc, dict);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return form;
+}
+
 pdf_obj *
 pdf_new_xobject(fz_context *ctx, pdf_document *doc, const fz_rect *bbox, const fz_matrix *mat)
 {
@@ -20,10 +20,209 @@ static inline int iswhite(int ch)
  * xref tables
  */
 
+/* Subsections with fewer entries than this are decoded as they are read. */
+#define XREF_LAZY_MIN 4096
+#define XREF_BLOCK_SHIFT 8
+#define XREF_BLOCK_SIZE (1 << XREF_BLOCK_SHIFT)
+
+static int lazy_block_count(pdf_xref_subsec *sub)
+{
+	return (sub->len + XREF_BLOCK_SIZE - 1) >> XREF_BLOCK_SHIFT;
+}
+
+/* Decode n entries starting at first from the on-disk or packed records. */
+static void
+decode_xref_block(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub, int first, int n, pdf_xref_entry *out)
+{
+	int i, k;
+
+	if (sub->packed)
+	{
+		int w0 = sub->w[0], w1 = sub->w[1], w2 = sub->w[2];
+		unsigned char *p = sub->packed + (size_t)first * (w0 + w1 + w2);
+
+		for (i = 0; i < n; i++)
+		{
+			pdf_xref_entry *entry = &out[i];
+			int a = 0;
+			fz_off_t b = 0;
+			int c = 0;
+			int t;
+
+			for (k = 0; k < w0; k++)
+				a = (a << 8) + *p++;
+			for (k = 0; k < w1; k++)
+				b = (b << 8) + *p++;
+			for (k = 0; k < w2; k++)
+				c = (c << 8) + *p++;
+
+			t = w0 ? a : 1;
+			entry->type = t == 0 ? 'f' : t == 1 ? 'n' : t == 2 ? 'o' : 0;
+			entry->ofs = w1 ? b : 0;
+			entry->gen = w2 ? c : 0;
+			if (entry->type == 'n' && entry->ofs == 0)
+				entry->type = 'f';
+		}
+	}
+	else
+	{
+		fz_stream *file = doc->file;
+		fz_off_t save = fz_tell(ctx, file);
+		char rec[48];
+		char *s;
+
+		memset(rec, 0, sizeof rec);
+		fz_try(ctx)
+		{
+			fz_seek(ctx, file, sub->disk_ofs + (fz_off_t)first * 20, SEEK_SET);
+			for (i = 0; i < n; i++)
+			{
+				pdf_xref_entry *entry = &out[i];
+
+				if (fz_read(ctx, file, (unsigned char *)rec, 20) != 20)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "unexpected EOF in xref table");
+
+				/* broken pdfs where line start with white space */
+				s = rec;
+				while (*s != '\0' && iswhite(*s))
+					s++;
+
+				entry->ofs = fz_atoo(s);
+				entry->gen = fz_atoi(s + 11);
+				entry->type = s[17];
+				if (s[17] != 'f' && s[17] != 'n' && s[17] != 'o')
+					fz_throw(ctx, FZ_ERROR_GENERIC, "unexpected xref type: %#x (%d %d R)", s[17], (int)sub->start + first + i, entry->gen);
+				/* Special case code: "0000000000 * n" means free,
+				 * according to some producers (inc Quartz) */
+				if (entry->type == 'n' && entry->ofs == 0)
+					entry->type = 'f';
+			}
+		}
+		fz_always(ctx)
+			fz_seek(ctx, file, save, SEEK_SET);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+}
+
+static pdf_xref_entry *
+load_xref_block(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub, int b)
+{
+	int first = b << XREF_BLOCK_SHIFT;
+	int n = fz_mini(XREF_BLOCK_SIZE, sub->len - first);
+	pdf_xref_entry *block;
+
+	fz_var(block);
+
+	block = fz_calloc(ctx, n, sizeof(pdf_xref_entry));
+
+	/* Decoding moves the file position, and shared documents may
+	 * race to fill the same block. */
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+	{
+		if (sub->blocks[b] == NULL)
+		{
+			decode_xref_block(ctx, doc, sub, first, n, block);
+			sub->blocks[b] = block;
+			block = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_unlock_document(ctx, doc);
+		fz_free(ctx, block);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return sub->blocks[b];
+}
+
+/* Return entry k of a subsection, decoding it first if need be. */
+static pdf_xref_entry *
+subsec_entry(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub, int k)
+{
+	pdf_xref_entry *block;
+
+	if (sub->table)
+		return &sub->table[k];
+	block = sub->blocks[k >> XREF_BLOCK_SHIFT];
+	if (block == NULL)
+		block = load_xref_block(ctx, doc, sub, k >> XREF_BLOCK_SHIFT);
+	return &block[k & (XREF_BLOCK_SIZE - 1)];
+}
+
+static void
+drop_lazy_blocks(fz_context *ctx, pdf_xref_subsec *sub)
+{
+	int b;
+
+	if (sub->blocks)
+	{
+		for (b = 0; b < lazy_block_count(sub); b++)
+			fz_free(ctx, sub->blocks[b]);
+		fz_free(ctx, sub->blocks);
+		sub->blocks = NULL;
+	}
+	fz_free(ctx, sub->packed);
+	sub->packed = NULL;
+}
+
+/* Decode the whole of a lazy subsection into a plain table. */
+static void
+solidify_lazy_subsec(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub)
+{
+	pdf_xref_entry *table;
+	int b;
+
+	if (sub->table)
+		return;
+
+	table = fz_calloc(ctx, sub->len, sizeof(pdf_xref_entry));
+	fz_try(ctx)
+	{
+		for (b = 0; b < lazy_block_count(sub); b++)
+		{
+			int first = b << XREF_BLOCK_SHIFT;
+			int n = fz_mini(XREF_BLOCK_SIZE, sub->len - first);
+			if (sub->blocks[b])
+				memcpy(&table[first], sub->blocks[b], n * sizeof(pdf_xref_entry));
+			else
+				decode_xref_block(ctx, doc, sub, first, n, &table[first]);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, table);
+		fz_rethrow(ctx);
+	}
+
+	drop_lazy_blocks(ctx, sub);
+	sub->table = table;
+}
+
+static void
+drop_subsec_entries(fz_context *ctx, pdf_xref_entry *table, int n)
+{
+	int e;
+
+	for (e = 0; e < n; e++)
+	{
+		pdf_xref_entry *entry = &table[e];
+
+		if (entry->obj)
+		{
+			pdf_drop_obj(ctx, entry->obj);
+			fz_drop_buffer(ctx, entry->stm_buf);
+		}
+	}
+}
+
 static void pdf_drop_xref_sections(fz_context *ctx, pdf_document *doc)
 {
 	pdf_unsaved_sig *usig;
-	int x, e;
+	int x, b;
 
 	for (x = 0; x < doc->num_xref_sections; x++)
 	{
@@ -33,15 +232,14 @@ static void pdf_drop_xref_sections(fz_context *ctx, pdf_document *doc)
 		while (sub != NULL)
 		{
 			pdf_xref_subsec *next_sub = sub->next;
-			for (e = 0; e < sub->len; e++)
+			if (sub->table)
+				drop_subsec_entries(ctx, sub->table, sub->len);
+			else
 			{
-				pdf_xref_entry *entry = &sub->table[e];
-
-				if (entry->obj)
-				{
-					pdf_drop_obj(ctx, entry->obj);
-					fz_drop_buffer(ctx, entry->stm_buf);
-				}
+				for (b = 0; b < lazy_block_count(sub); b++)
+					if (sub->blocks[b])
+						drop_subsec_entries(ctx, sub->blocks[b], fz_mini(XREF_BLOCK_SIZE, sub->len - (b << XREF_BLOCK_SHIFT)));
+				drop_lazy_blocks(ctx, sub);
 			}
 			fz_free(ctx, sub->table);
 			fz_free(ctx, sub);
@@ -161,6 +359,10 @@ ensure_solid_xref(fz_context *ctx, pdf_document *doc, int num, int which)
 	if (num < xref->num_objects)
 		num = xref->num_objects;
 
+	for (; sub != NULL; sub = sub->next)
+		solidify_lazy_subsec(ctx, doc, sub);
+
+	sub = xref->subsec;
 	if (sub != NULL && sub->next == NULL && sub->start == 0 && sub->len >= num)
 		return;
 
@@ -223,7 +425,7 @@ pdf_xref_entry *pdf_get_populating_xref_entry(fz_context *ctx, pdf_document *doc
 	for (sub = xref->subsec; sub != NULL; sub = sub->next)
 	{
 		if (num >= sub->start && num < sub->start + sub->len)
-			return &sub->table[num-sub->start];
+			return subsec_entry(ctx, doc, sub, num-sub->start);
 	}
 
 	/* We've been asked for an object that's not in a subsec. */
@@ -234,10 +436,44 @@ pdf_xref_entry *pdf_get_populating_xref_entry(fz_context *ctx, pdf_document *doc
 	return &sub->table[num-sub->start];
 }
 
+/* Objects covered by lazy subsections are left at -1 by
+ * pdf_prime_xref_index. Work out the section priming would have
+ * picked: the newest one where the object is in use. */
+static int
+resolve_xref_index(fz_context *ctx, pdf_document *doc, int i)
+{
+	pdf_xref_subsec *sub;
+	int j;
+
+	for (j = 0; j < doc->num_xref_sections; j++)
+	{
+		pdf_xref *xref = &doc->xref_sections[j];
+
+		if (i >= xref->num_objects)
+			continue;
+		for (sub = xref->subsec; sub != NULL; sub = sub->next)
+		{
+			char t;
+
+			if (i < sub->start || i >= sub->start + sub->len)
+				continue;
+			t = subsec_entry(ctx, doc, sub, i - sub->start)->type;
+			if (t != 0 && t != 'f')
+			{
+				doc->xref_index[i] = j;
+				return j;
+			}
+		}
+	}
+	doc->xref_index[i] = 0;
+	return 0;
+}
+
 /* Used after loading a document to access entries */
 /* This will never throw anything, or return NULL if it is
  * only asked to return objects in range within a 'solid'
- * xref. */
+ * xref, other than failing to decode an entry from a lazy
+ * subsection. */
 pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 {
 	pdf_xref *xref;
@@ -251,6 +487,8 @@ pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 		j = doc->xref_index[i];
 	else
 		j = 0;
+	if (j < 0)
+		j = resolve_xref_index(ctx, doc, i);
 
 	/* We may be accessing an earlier version of the document using xref_base
 	 * and j may be an index into a later xref section */
@@ -271,7 +509,7 @@ pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 				if (i < sub->start || i >= sub->start + sub->len)
 					continue;
 
-				entry = &sub->table[i - sub->start];
+				entry = subsec_entry(ctx, doc, sub, i - sub->start);
 				if (entry->type)
 				{
 					/* Don't update xref_index if xref_base may have
@@ -293,7 +531,7 @@ pdf_xref_entry *pdf_get_xref_entry(fz_context *ctx, pdf_document *doc, int i)
 		for (sub = xref->subsec; sub != NULL; sub = sub->next)
 		{
 			if (i >= sub->start && i < sub->start + sub->len)
-				return &sub->table[i - sub->start];
+				return subsec_entry(ctx, doc, sub, i - sub->start);
 		}
 	}
 
@@ -359,7 +597,8 @@ static void ensure_incremental_xref(fz_context *ctx, pdf_document *doc)
 		/* Update the xref_index */
 		for (i = 0; i < doc->max_xref_len; i++)
 		{
-			doc->xref_index[i]++;
+			if (doc->xref_index[i] >= 0)
+				doc->xref_index[i]++;
 		}
 	}
 }
@@ -452,7 +691,10 @@ void pdf_xref_ensure_incremental_object(fz_context *ctx, pdf_document *doc, int
 	ensure_incremental_xref(ctx, doc);
 
 	/* Search for the section that contains this object */
-	for (i = doc->xref_index[num]; i < doc->num_xref_sections; i++)
+	i = doc->xref_index[num];
+	if (i < 0)
+		i = resolve_xref_index(ctx, doc, num);
+	for (; i < doc->num_xref_sections; i++)
 	{
 		pdf_xref *xref = &doc->xref_sections[i];
 
@@ -460,7 +702,7 @@ void pdf_xref_ensure_incremental_object(fz_context *ctx, pdf_document *doc, int
 			break;
 		for (sub = xref->subsec; sub != NULL; sub = sub->next)
 		{
-			if (sub->start <= num && num < sub->start + sub->len && sub->table[num - sub->start].type)
+			if (sub->start <= num && num < sub->start + sub->len && subsec_entry(ctx, doc, sub, num - sub->start)->type)
 				break;
 		}
 		if (sub != NULL)
@@ -474,7 +716,7 @@ void pdf_xref_ensure_incremental_object(fz_context *ctx, pdf_document *doc, int
 
 	/* Move the object to the incremental section */
 	doc->xref_index[num] = 0;
-	old_entry = &sub->table[num - sub->start];
+	old_entry = subsec_entry(ctx, doc, sub, num - sub->start);
 	new_entry = pdf_get_incremental_xref_entry(ctx, doc, num);
 	*new_entry = *old_entry;
 	if (i < doc->num_incremental_sections)
@@ -726,7 +968,10 @@ pdf_xref_find_subsection(fz_context *ctx, pdf_document *doc, fz_off_t ofs, int l
 	for (sub = xref->subsec; sub != NULL; sub = sub->next)
 	{
 		if (ofs >= sub->start && ofs + len <= sub->start + sub->len)
+		{
+			solidify_lazy_subsec(ctx, doc, sub);
 			return &sub->table[ofs-sub->start]; /* Case 1 */
+		}
 		if (ofs + len > sub->start && ofs <= sub->start + sub->len)
 			break; /* Case 3 */
 	}
@@ -766,6 +1011,74 @@ pdf_xref_find_subsection(fz_context *ctx, pdf_document *doc, fz_off_t ofs, int l
 	return &sub->table[ofs-sub->start];
 }
 
+/* Add a subsection whose entries will be decoded on first use.
+ * Returns NULL if it would overlap one we already have, in which
+ * case the caller reads it eagerly as before. */
+static pdf_xref_subsec *
+pdf_xref_new_lazy_subsection(fz_context *ctx, pdf_document *doc, fz_off_t ofs, int len)
+{
+	pdf_xref *xref = &doc->xref_sections[doc->num_xref_sections-1];
+	pdf_xref_subsec *sub;
+
+	for (sub = xref->subsec; sub != NULL; sub = sub->next)
+		if (ofs + len > sub->start && ofs <= sub->start + sub->len)
+			return NULL;
+
+	sub = fz_malloc_struct(ctx, pdf_xref_subsec);
+	fz_try(ctx)
+	{
+		sub->start = ofs;
+		sub->len = len;
+		sub->blocks = fz_calloc(ctx, lazy_block_count(sub), sizeof(pdf_xref_entry *));
+		if (doc->max_xref_len < ofs + len)
+			extend_xref_index(ctx, doc, ofs + len);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, sub->blocks);
+		fz_free(ctx, sub);
+		fz_rethrow(ctx);
+	}
+	sub->next = xref->subsec;
+	xref->subsec = sub;
+	if (xref->num_objects < ofs + len)
+		xref->num_objects = ofs + len;
+	return sub;
+}
+
+/* Check that a classic table has whole 20 byte records, so that
+ * they can be found again by index when needed. */
+static int
+is_lazy_old_xref(fz_context *ctx, pdf_document *doc, fz_off_t start, int len)
+{
+	fz_stream *file = doc->file;
+	unsigned char rec[20];
+	int ok = 1;
+	int i;
+
+	if (len < XREF_LAZY_MIN || doc->file_reading_linearly)
+		return 0;
+	if (start + (fz_off_t)len * 20 > doc->file_size)
+		return 0;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 2 && ok; i++)
+		{
+			fz_seek(ctx, file, start + (i ? (fz_off_t)(len - 1) * 20 : 0), SEEK_SET);
+			if (fz_read(ctx, file, rec, 20) != 20)
+				ok = 0;
+			else if (rec[10] != ' ' || rec[16] != ' ' || (rec[17] != 'f' && rec[17] != 'n' && rec[17] != 'o'))
+				ok = 0;
+		}
+	}
+	fz_catch(ctx)
+		ok = 0;
+
+	fz_seek(ctx, file, start, SEEK_SET);
+	return ok;
+}
+
 static pdf_obj *
 pdf_read_old_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 {
@@ -814,6 +1127,18 @@ pdf_read_old_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 			fz_warn(ctx, "broken xref section, proceeding anyway.");
 		}
 
+		if (is_lazy_old_xref(ctx, doc, fz_tell(ctx, file), len))
+		{
+			fz_off_t disk_ofs = fz_tell(ctx, file);
+			pdf_xref_subsec *sub = pdf_xref_new_lazy_subsection(ctx, doc, ofs, len);
+			if (sub)
+			{
+				sub->disk_ofs = disk_ofs;
+				fz_seek(ctx, file, disk_ofs + (fz_off_t)len * 20, SEEK_SET);
+				continue;
+			}
+		}
+
 		table = pdf_xref_find_subsection(ctx, doc, ofs, len);
 
 		for (i = ofs; i < ofs + len; i++)
@@ -869,6 +1194,25 @@ pdf_read_new_xref_section(fz_context *ctx, pdf_document *doc, fz_stream *stm, fz
 	//if (i0 + i1 > pdf_xref_len(ctx, doc))
 	//	fz_throw(ctx, FZ_ERROR_GENERIC, "xref stream has too many entries");
 
+	/* Keep the records of large sections packed as they are in the
+	 * stream, and only expand the entries that get looked up. */
+	n = w0 + w1 + w2;
+	if (i1 >= XREF_LAZY_MIN && n > 0 && w0 <= 4 && w1 <= 8 && w2 <= 4 && i1 <= INT_MAX / n)
+	{
+		pdf_xref_subsec *sub = pdf_xref_new_lazy_subsection(ctx, doc, i0, i1);
+		if (sub)
+		{
+			sub->w[0] = w0;
+			sub->w[1] = w1;
+			sub->w[2] = w2;
+			sub->packed = fz_malloc(ctx, (size_t)i1 * n);
+			if (fz_read(ctx, stm, sub->packed, i1 * n) != i1 * n)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "truncated xref stream");
+			doc->has_xref_streams = 1;
+			return;
+		}
+	}
+
 	table = pdf_xref_find_subsection(ctx, doc, i0, i1);
 	for (i = i0; i < i0 + i1; i++)
 	{
@@ -1139,11 +1483,20 @@ pdf_prime_xref_index(fz_context *ctx, pdf_document *doc)
 		{
 			int start = subsec->start;
 			int end = subsec->start + subsec->len;
-			for (j = start; j < end; j++)
+			if (subsec->table == NULL)
 			{
-				char t = subsec->table[j-start].type;
-				if (t != 0 && t != 'f')
-					idx[j] = i;
+				/* Resolved on demand by pdf_get_xref_entry */
+				for (j = start; j < end; j++)
+					idx[j] = -1;
+			}
+			else
+			{
+				for (j = start; j < end; j++)
+				{
+					char t = subsec->table[j-start].type;
+					if (t != 0 && t != 'f')
+						idx[j] = i;
+				}
 			}
 
 			subsec = subsec->next;
@@ -1185,10 +1538,15 @@ pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 		fz_warn(ctx, "first object in xref is not free");
 
 	/* broken pdfs where object offsets are out of range */
+	/* Entries of lazy subsections are left for pdf_cache_object to
+	 * repair if they turn out to be bad. */
 	xref_len = pdf_xref_len(ctx, doc);
 	for (i = 0; i < xref_len; i++)
 	{
-		pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, i);
+		pdf_xref_entry *entry;
+		if (doc->xref_index[i] < 0)
+			continue;
+		entry = pdf_get_xref_entry(ctx, doc, i);
 		if (entry->type == 'n')
 		{
 			/* Special case code: "0000000000 * n" means free,
@@ -1204,6 +1562,20 @@ pdf_load_xref(fz_context *ctx, pdf_document *doc, pdf_lexbuf *buf)
 	}
 }
 
+static void
+want_range(fz_context *ctx, pdf_document *doc, fz_off_t start, fz_off_t end)
+{
+	fz_range range;
+
+	if (end > doc->file_length)
+		end = doc->file_length;
+	if (start < 0 || end <= start)
+		return;
+	range.offset = start;
+	range.length = end - start;
+	fz_stream_meta(ctx, doc->file, FZ_STREAM_META_WANT, sizeof range, &range);
+}
+
 static void
 pdf_load_linear(fz_context *ctx, pdf_document *doc)
 {
@@ -1233,6 +1605,12 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 		if (len != doc->file_length)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "File has been updated since linearization");
 
+		/* Let the stream fetch the whole first page section and the
+		 * hint stream now, rather than block by block as we read. */
+		hint = pdf_dict_get(ctx, dict, PDF_NAME_H);
+		want_range(ctx, doc, 0, pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_E)));
+		want_range(ctx, doc, pdf_to_int(ctx, pdf_array_get(ctx, hint, 0)), pdf_to_int(ctx, pdf_array_get(ctx, hint, 0)) + pdf_to_int(ctx, pdf_array_get(ctx, hint, 1)));
+
 		pdf_read_xref_sections(ctx, doc, fz_tell(ctx, doc->file), &doc->lexbuf.base, 0);
 
 		doc->page_count = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_N));
@@ -1243,7 +1621,6 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
 		doc->linear_page1_obj_num = pdf_to_int(ctx, pdf_dict_get(ctx, dict, PDF_NAME_O));
 		doc->linear_page_refs[0] = pdf_new_indirect(ctx, doc, doc->linear_page1_obj_num, 0);
 		doc->linear_page_num = 0;
-		hint = pdf_dict_get(ctx, dict, PDF_NAME_H);
 		doc->hint_object_offset = pdf_to_int(ctx, pdf_array_get(ctx, hint, 0));
 		doc->hint_object_length = pdf_to_int(ctx, pdf_array_get(ctx, hint, 1));
 
@@ -1582,9 +1959,10 @@ pdf_close_document(fz_context *ctx, pdf_document *doc)
 		return;
 
 	/* Type3 glyphs in the glyph cache can contain pdf_obj pointers
-	 * that we are about to destroy. Simplest solution is to bin the
-	 * glyph cache at this point. */
-	fz_purge_glyph_cache(ctx);
+	 * that we are about to destroy. Bin the cached glyphs of this
+	 * document's type3 fonts; those of other documents can stay. */
+	for (i = 0; i < doc->num_type3_fonts; i++)
+		fz_purge_glyph_cache_font(ctx, doc->type3_fonts[i]);
 
 	if (doc->js)
 		doc->drop_js(doc->js);
@@ -1626,6 +2004,8 @@ pdf_close_document(fz_context *ctx, pdf_document *doc)
 
 	pdf_lexbuf_fin(ctx, &doc->lexbuf.base);
 
+	pdf_drop_obj_arena(ctx, doc->arena);
+
 	fz_free(ctx, doc);
 }
 
@@ -1894,7 +2274,7 @@ static void
 pdf_load_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
 {
 
-	if (!doc->hints_loaded || !doc->linear_page_refs)
+	if (!doc->hints_loaded || !doc->hint_page || !doc->linear_page_refs)
 		return;
 
 	if (doc->linear_page_refs[pagenum])
@@ -1953,6 +2333,8 @@ read_hinted_object(fz_context *ctx, pdf_document *doc, int num)
 			DEBUGMESS((ctx, "Searching for object %d @ %d", expected, offset));
 			pdf_obj_read(ctx, doc, &offset, &found, 0);
 			DEBUGMESS((ctx, "Found object %d - next will be @ %d", found, offset));
+			if (found < 0 || found + 1 >= doc->hint_obj_offsets_max)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "object number out of range in hinted file");
 			if (found <= expected)
 			{
 				/* We found the right one (or one earlier than
@@ -1992,8 +2374,67 @@ read_hinted_object(fz_context *ctx, pdf_document *doc, int num)
 	return 1;
 }
 
-pdf_xref_entry *
-pdf_cache_object(fz_context *ctx, pdf_document *doc, int num, int gen)
+/*
+ * Sharing a document between threads
+ */
+
+/* Each thread has its own context, so counting in the context how often
+ * it holds each lock tells us whether it is taking a lock it already has,
+ * whichever of the documents on that stripe it is for. */
+void
+pdf_lock_document(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc->shared)
+		return;
+	if (ctx->document_lock_depth[doc->lock]++ == 0)
+		fz_lock(ctx, FZ_LOCK_DOCUMENT + doc->lock);
+}
+
+void
+pdf_unlock_document(fz_context *ctx, pdf_document *doc)
+{
+	if (!doc->shared)
+		return;
+	assert(ctx->document_lock_depth[doc->lock] > 0);
+	if (--ctx->document_lock_depth[doc->lock] == 0)
+		fz_unlock(ctx, FZ_LOCK_DOCUMENT + doc->lock);
+}
+
+void
+pdf_share_document(fz_context *ctx, pdf_document *doc)
+{
+	fz_stream_memory mem;
+	fz_buffer *buf;
+	fz_stream *file;
+
+	if (doc->shared)
+		return;
+
+	if (fz_stream_meta(ctx, doc->file, FZ_STREAM_META_PROGRESSIVE, 0, NULL) > 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot share a document that is loaded progressively");
+
+	/* Null filters over a file in memory read without seeking it;
+	 * other files would have their position moved under them. */
+	if (fz_stream_meta(ctx, doc->file, FZ_STREAM_META_MEMORY, sizeof mem, &mem) <= 0)
+	{
+		fz_seek(ctx, doc->file, 0, SEEK_SET);
+		buf = fz_read_all(ctx, doc->file, doc->file_size < INT_MAX ? (int)doc->file_size : 0);
+		fz_try(ctx)
+			file = fz_open_buffer(ctx, buf);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, buf);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		fz_drop_stream(ctx, doc->file);
+		doc->file = file;
+	}
+
+	doc->lock = fz_gen_id(ctx) % FZ_DOCUMENT_LOCK_STRIPES;
+	doc->shared = 1;
+}
+
+static pdf_xref_entry *
+pdf_cache_object_imp(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
 	pdf_xref_entry *x;
 	int rnum, rgen, try_repair;
@@ -2097,6 +2538,21 @@ object_updated:
 	return x;
 }
 
+pdf_xref_entry *
+pdf_cache_object(fz_context *ctx, pdf_document *doc, int num, int gen)
+{
+	pdf_xref_entry *x;
+
+	pdf_lock_document(ctx, doc);
+	fz_try(ctx)
+		x = pdf_cache_object_imp(ctx, doc, num, gen);
+	fz_always(ctx)
+		pdf_unlock_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return x;
+}
+
 pdf_obj *
 pdf_load_object(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
@@ -2198,6 +2654,7 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 		return;
 	}
 
+	doc->super.id = 0;
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
 
 	fz_drop_buffer(ctx, x->stm_buf);
@@ -2222,6 +2679,7 @@ pdf_update_object(fz_context *ctx, pdf_document *doc, int num, pdf_obj *newobj)
 		return;
 	}
 
+	doc->super.id = 0;
 	x = pdf_get_incremental_xref_entry(ctx, doc, num);
 
 	pdf_drop_obj(ctx, x->obj);
@@ -2249,6 +2707,7 @@ pdf_update_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj, fz_buffer *n
 		return;
 	}
 
+	doc->super.id = 0;
 	x = pdf_get_xref_entry(ctx, doc, num);
 
 	fz_drop_buffer(ctx, x->stm_buf);
@@ -2339,6 +2798,7 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 	doc->super.write = (fz_document_write_fn *)pdf_write_document;
 	doc->update_appearance = pdf_update_appearance;
 
+	doc->arena = pdf_new_obj_arena(ctx, doc);
 	pdf_lexbuf_init(ctx, &doc->lexbuf.base, PDF_LEXBUF_LARGE);
 	doc->file = fz_keep_stream(ctx, file);
 
@@ -2470,7 +2930,7 @@ pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum, int gennum)
 
 			doc->hint_page[i].offset = j;
 			j += least_page_len + delta_page_len;
-			if (old <= doc->hint_object_offset && j > doc->hint_object_offset)
+			if (old <= doc->hint_object_offset && j >= doc->hint_object_offset)
 				j += doc->hint_object_length;
 		}
 		doc->hint_page[i].offset = j;
@@ -2529,7 +2989,7 @@ pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum, int gennum)
 			int old = j;
 			doc->hint_shared[i].offset = j;
 			j += off + least_shared_group_len;
-			if (old <= doc->hint_object_offset && j > doc->hint_object_offset)
+			if (old <= doc->hint_object_offset && j >= doc->hint_object_offset)
 				j += doc->hint_object_length;
 		}
 		/* FIXME: We would have problems recreating the length of the
@@ -2542,7 +3002,7 @@ pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum, int gennum)
 			int old = j;
 			doc->hint_shared[i].offset = j;
 			j += off + least_shared_group_len;
-			if (old <= doc->hint_object_offset && j > doc->hint_object_offset)
+			if (old <= doc->hint_object_offset && j >= doc->hint_object_offset)
 				j += doc->hint_object_length;
 		}
 		doc->hint_shared[i].offset = j;
@@ -2596,8 +3056,18 @@ pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum, int gennum)
 		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
 		/* Don't try to load hints again */
 		doc->hints_loaded = 1;
-		/* We won't use the linearized object any more. */
-		doc->file_reading_linearly = 0;
+		/* Carry on reading the file linearly without them; dropping
+		 * out of linear mode here would leave the objects we have not
+		 * reached yet unreachable until the whole file was reread. */
+		fz_free(ctx, doc->hint_page);
+		doc->hint_page = NULL;
+		fz_free(ctx, doc->hint_shared_ref);
+		doc->hint_shared_ref = NULL;
+		fz_free(ctx, doc->hint_shared);
+		doc->hint_shared = NULL;
+		fz_free(ctx, doc->hint_obj_offsets);
+		doc->hint_obj_offsets = NULL;
+		doc->hint_obj_offsets_max = 0;
 		/* Any other error becomes a TRYLATER */
 		fz_throw(ctx, FZ_ERROR_TRYLATER, "malformed hints object");
 	}
@@ -2645,17 +3115,91 @@ pdf_load_hint_object(fz_context *ctx, pdf_document *doc)
 	}
 }
 
+static int
+add_range(fz_range *ranges, int max, int n, fz_off_t start, fz_off_t end, fz_off_t file_length)
+{
+	if (end > file_length)
+		end = file_length;
+	if (start < 0 || end <= start)
+		return n;
+	if (n < max)
+	{
+		ranges[n].offset = start;
+		ranges[n].length = end - start;
+	}
+	return n + 1;
+}
+
+int
+pdf_hinted_page_ranges(fz_context *ctx, pdf_document *doc, int pagenum, fz_range *ranges, int max)
+{
+	fz_off_t first_end;
+	int i, n = 0;
+
+	if (!doc->file_reading_linearly || !doc->linear_obj || pagenum < 0 || pagenum >= doc->page_count)
+		return 0;
+
+	/* The first page section runs from the start of the file to /E */
+	first_end = pdf_to_int(ctx, pdf_dict_get(ctx, doc->linear_obj, PDF_NAME_E));
+	if (pagenum == 0)
+		return add_range(ranges, max, n, 0, first_end, doc->file_length);
+
+	/* Other pages cannot be found until the hints are in */
+	if (!doc->hints_loaded)
+		return add_range(ranges, max, n, doc->hint_object_offset, doc->hint_object_offset + doc->hint_object_length, doc->file_length);
+	if (!doc->hint_page)
+		return 0;
+
+	n = add_range(ranges, max, n, doc->hint_page[pagenum].offset, doc->hint_page[pagenum+1].offset, doc->file_length);
+	for (i = doc->hint_page[pagenum].index; i < doc->hint_page[pagenum+1].index; i++)
+	{
+		int r = doc->hint_shared_ref[i];
+		fz_off_t start = doc->hint_shared[r].offset;
+		fz_off_t end = doc->hint_shared[r+1].offset;
+
+		/* Groups shared with the first page lie within its section,
+		 * and the end of the last of them is not recorded. */
+		if (start < first_end && end > first_end)
+			end = first_end;
+		n = add_range(ranges, max, n, start, end, doc->file_length);
+	}
+	return n;
+}
+
+static void
+want_hinted_page(fz_context *ctx, pdf_document *doc, int pagenum)
+{
+	fz_range *ranges;
+	int i, n;
+
+	n = pdf_hinted_page_ranges(ctx, doc, pagenum, NULL, 0);
+	if (n == 0)
+		return;
+
+	ranges = fz_malloc_array(ctx, n, sizeof(*ranges));
+	fz_try(ctx)
+	{
+		n = pdf_hinted_page_ranges(ctx, doc, pagenum, ranges, n);
+		for (i = 0; i < n; i++)
+			fz_stream_meta(ctx, doc->file, FZ_STREAM_META_WANT, sizeof ranges[i], &ranges[i]);
+	}
+	fz_always(ctx)
+		fz_free(ctx, ranges);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum)
 {
 	pdf_lexbuf *buf = &doc->lexbuf.base;
 	int curr_pos;
 	pdf_obj *page;
 
-	pdf_load_hinted_page(ctx, doc, pagenum);
-
 	if (pagenum < 0 || pagenum >= doc->page_count)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "page load out of range (%d of %d)", pagenum, doc->page_count);
 
+	pdf_load_hinted_page(ctx, doc, pagenum);
+
 	if (doc->linear_pos == doc->file_length)
 		return doc->linear_page_refs[pagenum];
 
@@ -2663,9 +3207,21 @@ pdf_obj *pdf_progressive_advance(fz_context *ctx, pdf_document *doc, int pagenum
 	if (pagenum > 0 && !doc->hints_loaded && doc->hint_object_offset > 0 && doc->linear_pos >= doc->hint_object_offset)
 	{
 		/* Found hint object */
-		pdf_load_hint_object(ctx, doc);
+		fz_try(ctx)
+			pdf_load_hint_object(ctx, doc);
+		fz_catch(ctx)
+		{
+			/* Unusable hints have been dropped; go on without them
+			 * rather than wait for data that nobody has asked for. */
+			if (!doc->hints_loaded)
+				fz_rethrow(ctx);
+		}
 	}
 
+	/* Tell the stream where the page (or failing that, the hints that
+	 * will locate it) lives, so it can be fetched out of order. */
+	want_hinted_page(ctx, doc, pagenum);
+
 	DEBUGMESS((ctx, "continuing to try to advance from %d", doc->linear_pos));
 	curr_pos = fz_tell(ctx, doc->file);
 
@@ -2795,6 +3351,17 @@ fz_document_handler pdf_document_handler =
 	(fz_document_open_with_stream_fn *)&pdf_open_document_with_stream
 };
 
+/* Entries of lazy subsections that have not been decoded yet hold no objects. */
+static pdf_xref_entry *loaded_entry(pdf_xref_subsec *sub, int e)
+{
+	pdf_xref_entry *block;
+
+	if (sub->table)
+		return &sub->table[e];
+	block = sub->blocks[e >> XREF_BLOCK_SHIFT];
+	return block ? &block[e & (XREF_BLOCK_SIZE - 1)] : NULL;
+}
+
 void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
 {
 	int x, e;
@@ -2808,7 +3375,9 @@ void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
+				pdf_xref_entry *entry = loaded_entry(sub, e);
+				if (entry == NULL)
+					continue;
 				if (entry->obj)
 				{
 					entry->flags |= PDF_OBJ_FLAG_MARK;
@@ -2831,7 +3400,9 @@ void pdf_clear_xref(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
+				pdf_xref_entry *entry = loaded_entry(sub, e);
+				if (entry == NULL)
+					continue;
 				/* We cannot drop objects if the stream
 				 * buffer has been updated */
 				if (entry->obj != NULL && entry->stm_buf == NULL)
@@ -2860,7 +3431,9 @@ void pdf_clear_xref_to_mark(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
+				pdf_xref_entry *entry = loaded_entry(sub, e);
+				if (entry == NULL)
+					continue;
 
 				/* We cannot drop objects if the stream buffer has
 				 * been updated */
@@ -11,6 +11,13 @@
 #include <sys/time.h>
 #endif
 
+/*
+ * Banded rendering can be spread over a pool of worker threads (-T),
+ * and jobs the library splits out (such as scaling large images) over
+ * as many again, using the thread glue in muthreads.c.
+ */
+#include "muthreads.h"
+
 enum {
 	OUT_NONE,
 	OUT_PNG, OUT_TGA, OUT_PNM, OUT_PGM, OUT_PPM, OUT_PAM,
@@ -139,6 +146,27 @@ static float gamma_value = 1;
 static int invert = 0;
 static int bandheight = 0;
 
+#ifndef DISABLE_MUTHREADS
+typedef struct worker_s
+{
+	fz_context *ctx;
+	int band; /* band to render, or -1 to shut down */
+	int running;
+	fz_display_list *list;
+	fz_matrix ctm;
+	fz_rect tbounds;
+	fz_pixmap *pix;
+	fz_cookie cookie;
+	mu_semaphore start;
+	mu_semaphore stop;
+	mu_thread thread;
+} worker_t;
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+static worker_t *workers = NULL;
+#endif
+static int num_workers = 0;
+
 static int errored = 0;
 static int append = 0;
 static fz_text_sheet *sheet = NULL;
@@ -180,6 +208,9 @@ static void usage(void)
 		"\t-h -\theight (in pixels) (maximum height if -r is specified)\n"
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
 		"\t-B -\tmaximum bandheight (pgm, ppm, pam, png output only)\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+#endif
 		"\n"
 		"\t-W -\tpage width for EPUB layout\n"
 		"\t-H -\tpage height for EPUB layout\n"
@@ -240,6 +271,92 @@ static int has_percent_d(char *s)
 	return 0;
 }
 
+static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, const fz_matrix *ctm, const fz_rect *tbounds, fz_cookie *cookie, fz_pixmap *pix)
+{
+	int savealpha = (out_cs == CS_GRAY_ALPHA || out_cs == CS_RGB_ALPHA || out_cs == CS_CMYK_ALPHA);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		if (savealpha)
+			fz_clear_pixmap(ctx, pix);
+		else
+			fz_clear_pixmap_with_value(ctx, pix, 255);
+
+		dev = fz_new_draw_device(ctx, pix);
+		if (alphabits == 0)
+			fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+		if (list)
+			fz_run_display_list(ctx, list, dev, ctm, tbounds, cookie);
+		else
+			fz_run_page(ctx, page, dev, ctm, cookie);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+
+		if (invert)
+			fz_invert_pixmap(ctx, pix);
+		if (gamma_value != 1)
+			fz_gamma_pixmap(ctx, pix, gamma_value);
+
+		if (savealpha)
+			fz_unmultiply_pixmap(ctx, pix);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+#ifndef DISABLE_MUTHREADS
+MU_THREAD_FUNC(worker_thread)
+{
+	worker_t *me = (worker_t *)arg;
+
+	do
+	{
+		mu_wait_semaphore(&me->start);
+		if (me->band >= 0)
+		{
+			fz_try(me->ctx)
+				drawband(me->ctx, NULL, me->list, &me->ctm, &me->tbounds, &me->cookie, me->pix);
+			fz_catch(me->ctx)
+			{
+				fz_warn(me->ctx, "cannot draw band %d: %s", me->band, fz_caught_message(me->ctx));
+				me->cookie.errors++;
+			}
+		}
+		mu_trigger_semaphore(&me->stop);
+	}
+	while (me->band >= 0);
+
+	MU_THREAD_RETURN;
+}
+
+static void start_worker(worker_t *w, int band, fz_display_list *list, const fz_matrix *ctm, const fz_rect *tbounds, int drawheight)
+{
+	w->band = band;
+	w->list = list;
+	w->ctm = *ctm;
+	w->ctm.f -= band * drawheight;
+	w->tbounds = *tbounds;
+	memset(&w->cookie, 0, sizeof w->cookie);
+	w->running = 1;
+	mu_trigger_semaphore(&w->start);
+}
+
+static void finish_worker(worker_t *w)
+{
+	mu_wait_semaphore(&w->stop);
+	w->running = 0;
+}
+#endif
+
 static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 {
 	fz_page *page;
@@ -561,8 +678,26 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 				tbounds.y1 = tbounds.y0 + bandheight + 2;
 			}
 
-			pix = fz_new_pixmap_with_bbox(ctx, colorspace, &band_ibounds);
-			fz_pixmap_set_resolution(pix, resolution);
+#ifndef DISABLE_MUTHREADS
+			if (num_workers > 0 && list)
+			{
+				/* Each worker owns a band sized pixmap; prime as
+				 * many workers as there are bands to go round. */
+				for (band = 0; band < num_workers; band++)
+				{
+					workers[band].pix = fz_new_pixmap_with_bbox(ctx, colorspace, &band_ibounds);
+					fz_pixmap_set_resolution(workers[band].pix, resolution);
+				}
+				for (band = 0; band < fz_mini(num_workers, bands); band++)
+					start_worker(&workers[band], band, list, &ctm, &tbounds, drawheight);
+				pix = workers[0].pix;
+			}
+			else
+#endif
+			{
+				pix = fz_new_pixmap_with_bbox(ctx, colorspace, &band_ibounds);
+				fz_pixmap_set_resolution(pix, resolution);
+			}
 
 			if (output)
 			{
@@ -584,28 +719,22 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 
 			for (band = 0; band < bands; band++)
 			{
-				if (savealpha)
-					fz_clear_pixmap(ctx, pix);
-				else
-					fz_clear_pixmap_with_value(ctx, pix, 255);
+#ifndef DISABLE_MUTHREADS
+				worker_t *worker = NULL;
 
-				dev = fz_new_draw_device(ctx, pix);
-				if (alphabits == 0)
-					fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
-				if (list)
-					fz_run_display_list(ctx, list, dev, &ctm, &tbounds, &cookie);
+				if (num_workers > 0 && list)
+				{
+					/* Bands complete in order of submission,
+					 * so waiting on each worker in turn keeps
+					 * the output stream ordered. */
+					worker = &workers[band % num_workers];
+					finish_worker(worker);
+					pix = worker->pix;
+					cookie.errors += worker->cookie.errors;
+				}
 				else
-					fz_run_page(ctx, page, dev, &ctm, &cookie);
-				fz_drop_device(ctx, dev);
-				dev = NULL;
-
-				if (invert)
-					fz_invert_pixmap(ctx, pix);
-				if (gamma_value != 1)
-					fz_gamma_pixmap(ctx, pix, gamma_value);
-
-				if (savealpha)
-					fz_unmultiply_pixmap(ctx, pix);
+#endif
+				drawband(ctx, page, list, &ctm, &tbounds, &cookie, pix);
 
 				if (output)
 				{
@@ -657,6 +786,16 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 						fz_write_tga(ctx, pix, filename_buf, savealpha);
 					}
 				}
+
+#ifndef DISABLE_MUTHREADS
+				if (worker)
+				{
+					/* Hand the now free worker the next band it owns. */
+					if (band + num_workers < bands)
+						start_worker(worker, band + num_workers, list, &ctm, &tbounds, drawheight);
+				}
+				else
+#endif
 				ctm.f -= drawheight;
 			}
 
@@ -681,6 +820,23 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 
 			fz_drop_device(ctx, dev);
 			dev = NULL;
+#ifndef DISABLE_MUTHREADS
+			if (num_workers > 0 && list)
+			{
+				int i;
+
+				/* An error may leave workers still drawing from
+				 * the list; let them finish before it goes. */
+				for (i = 0; i < num_workers; i++)
+				{
+					if (workers[i].running)
+						finish_worker(&workers[i]);
+					fz_drop_pixmap(ctx, workers[i].pix);
+					workers[i].pix = NULL;
+				}
+			}
+			else
+#endif
 			fz_drop_pixmap(ctx, pix);
 			if (output_file)
 				fz_drop_output(ctx, output_file);
@@ -735,19 +891,36 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		errored = 1;
 }
 
+/* Reflowable documents that lay out chapters as they are loaded (EPUB)
+ * only estimate their page count up front, but have it right at least as
+ * far as the last page loaded. Return the count once it is settled that
+ * far for page pagenum. */
+static int count_pages_to(fz_context *ctx, fz_document *doc, int pagenum)
+{
+	if (doc->did_layout)
+		fz_drop_page(ctx, fz_load_page(ctx, doc, pagenum - 1));
+	return fz_count_pages(ctx, doc);
+}
+
 static void drawrange(fz_context *ctx, fz_document *doc, char *range)
 {
 	int page, spage, epage, pagecount;
 	char *spec, *dash;
+	int open_end;
 
-	pagecount = fz_count_pages(ctx, doc);
 	spec = fz_strsep(&range, ",");
 	while (spec)
 	{
 		dash = strchr(spec, '-');
+		open_end = dash && strlen(dash) == 1;
 
+		/* Page numbers are checked against the count as far as the
+		 * highest one asked for; "-" needs all of it. */
 		if (dash == spec)
+		{
+			pagecount = count_pages_to(ctx, doc, INT_MAX);
 			spage = epage = pagecount;
+		}
 		else
 			spage = epage = atoi(spec);
 
@@ -756,15 +929,24 @@ static void drawrange(fz_context *ctx, fz_document *doc, char *range)
 			if (strlen(dash) > 1)
 				epage = atoi(dash + 1);
 			else
-				epage = pagecount;
+				epage = spage;
 		}
 
+		pagecount = count_pages_to(ctx, doc, fz_maxi(spage, epage));
 		spage = fz_clampi(spage, 1, pagecount);
 		epage = fz_clampi(epage, 1, pagecount);
+		if (open_end)
+			epage = pagecount;
 
-		if (spage < epage)
+		if (spage < epage || open_end)
 			for (page = spage; page <= epage; page++)
+			{
 				drawpage(ctx, doc, page);
+				/* Settle the count for the next page before
+				 * deciding whether there is one */
+				if (open_end)
+					epage = count_pages_to(ctx, doc, page + 1);
+			}
 		else
 			for (page = spage; page >= epage; page--)
 				drawpage(ctx, doc, page);
@@ -849,6 +1031,66 @@ trace_realloc(void *arg, void *p_, unsigned int size)
 	return &p[1];
 }
 
+#ifndef DISABLE_MUTHREADS
+static void mudraw_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void mudraw_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context mudraw_locks =
+{
+	NULL, mudraw_lock, mudraw_unlock
+};
+
+static void start_workers(fz_context *ctx)
+{
+	int i;
+
+	workers = fz_calloc(ctx, num_workers, sizeof(*workers));
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].ctx = fz_clone_context(ctx);
+		if (workers[i].ctx == NULL)
+		{
+			fprintf(stderr, "cannot clone context for worker %d\n", i);
+			exit(1);
+		}
+		if (mu_create_semaphore(&workers[i].start) || mu_create_semaphore(&workers[i].stop))
+		{
+			fprintf(stderr, "cannot create semaphores for worker %d\n", i);
+			exit(1);
+		}
+		if (mu_create_thread(&workers[i].thread, worker_thread, &workers[i]))
+		{
+			fprintf(stderr, "cannot create thread for worker %d\n", i);
+			exit(1);
+		}
+	}
+}
+
+static void stop_workers(fz_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		workers[i].band = -1;
+		mu_trigger_semaphore(&workers[i].start);
+		mu_join_thread(&workers[i].thread);
+		mu_destroy_semaphore(&workers[i].start);
+		mu_destroy_semaphore(&workers[i].stop);
+		fz_drop_context(workers[i].ctx);
+	}
+	fz_free(ctx, workers);
+	workers = NULL;
+}
+#endif
+
 #ifdef MUDRAW_STANDALONE
 int main(int argc, char **argv)
 #else
@@ -861,10 +1103,11 @@ int mudraw_main(int argc, char **argv)
 	fz_context *ctx;
 	fz_alloc_context alloc_ctx = { NULL, trace_malloc, trace_realloc, trace_free };
 	FILE *my_output = NULL;
+	fz_locks_context *locks = NULL;
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:c:G:I:s:A:DiW:H:S:U:v")) != -1)
+	while ((c = fz_getopt(argc, argv, "p:o:F:R:r:w:h:fB:c:G:I:s:A:DiW:H:S:U:T:v")) != -1)
 	{
 		switch (c)
 		{
@@ -902,6 +1145,10 @@ int mudraw_main(int argc, char **argv)
 		case 'D': uselist = 0; break;
 		case 'i': ignore_errors = 1; break;
 
+#ifndef DISABLE_MUTHREADS
+		case 'T': num_workers = atoi(fz_optarg); break;
+#endif
+
 		case 'v': fprintf(stderr, "mudraw version %s\n", FZ_VERSION); return 1;
 		}
 	}
@@ -909,7 +1156,38 @@ int mudraw_main(int argc, char **argv)
 	if (fz_optind == argc)
 		usage();
 
-	ctx = fz_new_context((showmemory == 0 ? NULL : &alloc_ctx), NULL, FZ_STORE_DEFAULT);
+	if (num_workers < 0)
+	{
+		fprintf(stderr, "Number of threads must be >= 0\n");
+		exit(1);
+	}
+
+	if (num_workers > 0)
+	{
+		if (uselist == 0)
+		{
+			fprintf(stderr, "Cannot use multiple threads without using display list\n");
+			exit(1);
+		}
+		if (bandheight == 0)
+		{
+			fprintf(stderr, "Using multiple threads without banding is pointless\n");
+			exit(1);
+		}
+	}
+
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0)
+	{
+		int i;
+
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			mu_create_mutex(&mutexes[i]);
+		locks = &mudraw_locks;
+	}
+#endif
+
+	ctx = fz_new_context((showmemory == 0 ? NULL : &alloc_ctx), locks, FZ_STORE_DEFAULT);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
@@ -918,6 +1196,15 @@ int mudraw_main(int argc, char **argv)
 
 	fz_set_aa_level(ctx, alphabits);
 
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0)
+	{
+		mu_parallel.threads = num_workers;
+		fz_set_parallel_context(ctx, &mu_parallel);
+		start_workers(ctx);
+	}
+#endif
+
 	if (layout_css)
 	{
 		fz_buffer *buf = fz_read_file(ctx, layout_css);
@@ -1185,8 +1472,23 @@ int mudraw_main(int argc, char **argv)
 		}
 	}
 
+#ifndef DISABLE_MUTHREADS
+	if (num_workers > 0)
+		stop_workers(ctx);
+#endif
+
 	fz_drop_context(ctx);
 
+#ifndef DISABLE_MUTHREADS
+	if (locks)
+	{
+		int i;
+
+		for (i = 0; i < FZ_LOCK_MAX; i++)
+			mu_destroy_mutex(&mutexes[i]);
+	}
+#endif
+
 	if (showmemory)
 	{
 #if defined(_WIN64)
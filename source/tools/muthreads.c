@@ -0,0 +1,182 @@
+#include "muthreads.h"
+
+#ifndef DISABLE_MUTHREADS
+
+#ifdef _WIN32
+
+int mu_create_semaphore(mu_semaphore *sem)
+{
+	*sem = CreateSemaphore(NULL, 0, 1000, NULL);
+	return *sem == NULL;
+}
+
+void mu_destroy_semaphore(mu_semaphore *sem)
+{
+	CloseHandle(*sem);
+}
+
+void mu_trigger_semaphore(mu_semaphore *sem)
+{
+	ReleaseSemaphore(*sem, 1, NULL);
+}
+
+void mu_wait_semaphore(mu_semaphore *sem)
+{
+	WaitForSingleObject(*sem, INFINITE);
+}
+
+int mu_create_thread(mu_thread *th, LPTHREAD_START_ROUTINE fn, void *arg)
+{
+	*th = CreateThread(NULL, 0, fn, arg, 0, NULL);
+	return *th == NULL;
+}
+
+void mu_join_thread(mu_thread *th)
+{
+	WaitForSingleObject(*th, INFINITE);
+	CloseHandle(*th);
+}
+
+void mu_create_mutex(mu_mutex *mutex)
+{
+	InitializeCriticalSection(mutex);
+}
+
+void mu_destroy_mutex(mu_mutex *mutex)
+{
+	DeleteCriticalSection(mutex);
+}
+
+void mu_lock_mutex(mu_mutex *mutex)
+{
+	EnterCriticalSection(mutex);
+}
+
+void mu_unlock_mutex(mu_mutex *mutex)
+{
+	LeaveCriticalSection(mutex);
+}
+
+#else
+
+int mu_create_semaphore(mu_semaphore *sem)
+{
+	sem->count = 0;
+	if (pthread_mutex_init(&sem->mutex, NULL))
+		return 1;
+	if (pthread_cond_init(&sem->cond, NULL))
+	{
+		pthread_mutex_destroy(&sem->mutex);
+		return 1;
+	}
+	return 0;
+}
+
+void mu_destroy_semaphore(mu_semaphore *sem)
+{
+	pthread_cond_destroy(&sem->cond);
+	pthread_mutex_destroy(&sem->mutex);
+}
+
+void mu_trigger_semaphore(mu_semaphore *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+void mu_wait_semaphore(mu_semaphore *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	while (sem->count == 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+int mu_create_thread(mu_thread *th, void *(*fn)(void *), void *arg)
+{
+	return pthread_create(th, NULL, fn, arg) != 0;
+}
+
+void mu_join_thread(mu_thread *th)
+{
+	pthread_join(*th, NULL);
+}
+
+void mu_create_mutex(mu_mutex *mutex)
+{
+	pthread_mutex_init(mutex, NULL);
+}
+
+void mu_destroy_mutex(mu_mutex *mutex)
+{
+	pthread_mutex_destroy(mutex);
+}
+
+void mu_lock_mutex(mu_mutex *mutex)
+{
+	pthread_mutex_lock(mutex);
+}
+
+void mu_unlock_mutex(mu_mutex *mutex)
+{
+	pthread_mutex_unlock(mutex);
+}
+
+#endif
+
+typedef struct parallel_job_s
+{
+	fz_parallel_fn *fn;
+	void *arg;
+	int i;
+	mu_thread thread;
+} parallel_job_t;
+
+MU_THREAD_FUNC(parallel_thread)
+{
+	parallel_job_t *job = (parallel_job_t *)arg;
+
+	job->fn(job->arg, job->i);
+
+	MU_THREAD_RETURN;
+}
+
+static void mu_run_parallel(void *user, fz_parallel_fn *fn, void *arg, int count)
+{
+	parallel_job_t *jobs = malloc(count * sizeof(*jobs));
+	int i;
+
+	if (jobs == NULL)
+	{
+		for (i = 0; i < count; i++)
+			fn(arg, i);
+		return;
+	}
+	for (i = 1; i < count; i++)
+	{
+		jobs[i].fn = fn;
+		jobs[i].arg = arg;
+		jobs[i].i = i;
+		if (mu_create_thread(&jobs[i].thread, parallel_thread, &jobs[i]))
+		{
+			/* No thread to spare; do it ourselves. */
+			fn(arg, i);
+			jobs[i].fn = NULL;
+		}
+	}
+	fn(arg, 0);
+	for (i = 1; i < count; i++)
+		if (jobs[i].fn)
+			mu_join_thread(&jobs[i].thread);
+	free(jobs);
+}
+
+fz_parallel_context mu_parallel =
+{
+	NULL, 0, mu_run_parallel
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef MUPDF_TOOLS_MUTHREADS_H
+#define MUPDF_TOOLS_MUTHREADS_H
+
+/*
+ * MuPDF itself knows nothing about threads, so the small amount of glue
+ * the tools need to use them (mutexes for the fz_locks_context,
+ * semaphores, and threads) lives here, for both Windows and pthreads.
+ * Define DISABLE_MUTHREADS to build the tools without it.
+ */
+#ifndef DISABLE_MUTHREADS
+
+#include "mupdf/fitz.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+typedef HANDLE mu_semaphore;
+typedef HANDLE mu_thread;
+typedef CRITICAL_SECTION mu_mutex;
+
+#define MU_THREAD_FUNC(name) static DWORD WINAPI name(LPVOID arg)
+#define MU_THREAD_RETURN return 0
+
+int mu_create_thread(mu_thread *th, LPTHREAD_START_ROUTINE fn, void *arg);
+
+#else
+#include <pthread.h>
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int count;
+} mu_semaphore;
+typedef pthread_t mu_thread;
+typedef pthread_mutex_t mu_mutex;
+
+#define MU_THREAD_FUNC(name) static void *name(void *arg)
+#define MU_THREAD_RETURN return NULL
+
+int mu_create_thread(mu_thread *th, void *(*fn)(void *), void *arg);
+
+#endif
+
+int mu_create_semaphore(mu_semaphore *sem);
+void mu_destroy_semaphore(mu_semaphore *sem);
+void mu_trigger_semaphore(mu_semaphore *sem);
+void mu_wait_semaphore(mu_semaphore *sem);
+
+void mu_join_thread(mu_thread *th);
+
+void mu_create_mutex(mu_mutex *mutex);
+void mu_destroy_mutex(mu_mutex *mutex);
+void mu_lock_mutex(mu_mutex *mutex);
+void mu_unlock_mutex(mu_mutex *mutex);
+
+/*
+ * Runs the jobs the library splits out (such as scaling large images,
+ * or deflating streams when writing) on short lived threads of their
+ * own; the first runs on the calling thread. Set its thread count and
+ * install it with fz_set_parallel_context.
+ */
+extern fz_parallel_context mu_parallel;
+
+#endif
+
+#endif
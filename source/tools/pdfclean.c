@@ -11,6 +11,12 @@
 
 #include "mupdf/pdf.h"
 
+/*
+ * Deflating streams (-z) can be spread over a few threads (-T), using
+ * the thread glue in muthreads.c.
+ */
+#include "muthreads.h"
+
 static void usage(void)
 {
 	fprintf(stderr,
@@ -26,6 +32,11 @@ static void usage(void)
 		"\t-f\ttoggle decompression of font streams\n"
 		"\t-a\tascii hex encode binary streams\n"
 		"\t-z\tdeflate uncompressed streams\n"
+		"\t-Z -\tcompression level to deflate with (1-9)\n"
+		"\t-k\tkeep flate compressed streams as they are when decompressing\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-T -\tnumber of threads to deflate streams with\n"
+#endif
 		"\tpages\tcomma separated list of page numbers and ranges\n"
 		);
 	exit(1);
@@ -39,6 +50,9 @@ int pdfclean_main(int argc, char **argv)
 	int c;
 	fz_write_options opts;
 	int errors = 0;
+#ifndef DISABLE_MUTHREADS
+	int num_threads = 0;
+#endif
 	fz_context *ctx;
 
 	opts.do_incremental = 0;
@@ -50,8 +64,10 @@ int pdfclean_main(int argc, char **argv)
 	opts.continue_on_error = 1;
 	opts.errors = &errors;
 	opts.do_clean = 0;
+	opts.compression_level = 0;
+	opts.do_keep_flate = 0;
 
-	while ((c = fz_getopt(argc, argv, "adfgilp:sz")) != -1)
+	while ((c = fz_getopt(argc, argv, "adfgiklp:szT:Z:")) != -1)
 	{
 		switch (c)
 		{
@@ -63,7 +79,12 @@ int pdfclean_main(int argc, char **argv)
 		case 'l': opts.do_linear ++; break;
 		case 'a': opts.do_ascii ++; break;
 		case 'z': opts.do_deflate ++; break;
+		case 'Z': opts.compression_level = atoi(fz_optarg); break;
+		case 'k': opts.do_keep_flate ++; break;
 		case 's': opts.do_clean ++; break;
+#ifndef DISABLE_MUTHREADS
+		case 'T': num_threads = atoi(fz_optarg); break;
+#endif
 		default: usage(); break;
 		}
 	}
@@ -86,6 +107,14 @@ int pdfclean_main(int argc, char **argv)
 		exit(1);
 	}
 
+#ifndef DISABLE_MUTHREADS
+	if (num_threads > 1)
+	{
+		mu_parallel.threads = num_threads;
+		fz_set_parallel_context(ctx, &mu_parallel);
+	}
+#endif
+
 	fz_try(ctx)
 	{
 		pdf_clean_file(ctx, infile, outfile, password, &opts, &argv[fz_optind], argc - fz_optind);
@@ -6,3 +6,13 @@ rm -rf out2.pdf && build/debug/pdf-fix sample/121.decrypted_noinfo.pdf out2.pdf
 rm -rf out3.pdf && build/debug/pdf-fix sample/121.decrypted.pdf out3.pdf
 rm -rf out4.pdf && build/debug/pdf-fix sample/121.decrypted_noinfo.pdf out4.pdf
 
+# Banded and unbanded rendering must match, including for large images
+# that are only decoded in part when banding.
+for r in 72 150; do
+	rm -f out-u*.pnm out-b*.pnm
+	build/debug/mutool draw -r$r -o out-u%d.pnm sample/large-image.pdf
+	build/debug/mutool draw -r$r -B64 -o out-b%d.pnm sample/large-image.pdf
+	for p in 1 2 3 4 5 6 7 8 9 10; do
+		cmp -s out-u$p.pnm out-b$p.pnm || echo "large-image.pdf page $p differs when banded at $r dpi"
+	done
+done